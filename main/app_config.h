@@ -11,11 +11,17 @@
 #define WWW_DIR             CONFIG_WWW_DIR
 #define CAPTURES_DIR        CONFIG_CAPTURES_DIR
 #define REGPROFILES_DIR     CONFIG_REGPROFILES_DIR
+#define THUMBS_DIR          SD_MOUNT_POINT "/thumbs"
+#define STORE_DIR           SD_MOUNT_POINT "/store"
 
 #define WIFI_SSID           CONFIG_WIFI_SSID
 #define WIFI_PASS           CONFIG_WIFI_PASS
 #define WIFI_MAX_RETRY      CONFIG_WIFI_MAX_RETRY
 
+// HTTP server sockets; must stay below CONFIG_LWIP_MAX_SOCKETS (24) minus the
+// 3 httpd keeps internally and the slave/reglog client links
+#define HTTPD_MAX_SOCKETS   18
+
 // Streaming defaults
 #define STREAM_DEFAULT_FRAMESIZE FRAMESIZE_SVGA
 #define STREAM_DEFAULT_JPEG_QUALITY 12
@@ -25,3 +31,15 @@
 #define CAPTURE_DEFAULT_FRAMESIZE FRAMESIZE_UXGA
 #define CAPTURE_DEFAULT_PIXFORMAT PIXFORMAT_JPEG
 #define CAPTURE_DEFAULT_JPEG_QUALITY 10
+
+// Raw UXGA captures are taken in bands (capture_stripe.c). The stripe framesize
+// sets the band size: its pixel count must be a whole number of UXGA rows that
+// divides 1200 (SVGA: 300 rows, QVGA: 48 rows).
+#define CAPTURE_STRIPE_FRAMESIZE FRAMESIZE_SVGA
+#define CAPTURE_STRIPE_WARMUP    4   // frames for AEC/AGC to settle on the first band
+#define CAPTURE_STRIPE_SETTLE    2   // frames dropped after each window move
+
+// Bayer RAW8 captures (pixformat "bayer"): CFA phase of the top-left photosite
+// pair as read out by the sensor (capture_dng.h BAYER_*). Recorded in the DNG
+// and the sidecar; fix it here if a module's optics mirror the readout.
+#define BAYER_CFA_PATTERN 1   // BGGR
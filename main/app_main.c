@@ -1,9 +1,23 @@
 #include "app_config.h"
 #include "app_state.h"
 #include "sdmmc_mount.h"
+#include "capture_io.h"
+#include "capture_store.h"
+#include "capture_catalog.h"
+#include "retention.h"
+#include "capture_mem.h"
 #include "mdns_names.h"
 #include "cam_manager.h"
+#include "reg_overlay.h"
+#include "frame_sync.h"
+#include "sccb_sched.h"
+#include "reg_script.h"
+#include "reg_log.h"
 #include "web_server.h"
+#include "static_cache.h"
+#include "ws_stream.h"
+#include "event_bus.h"
+#include "capture_gallery.h"
 #include "wifi_sta.h"
 
 #include "esp_log.h"
@@ -18,13 +32,31 @@ void app_main(void) {
   g_app.sccb_mutex = xSemaphoreCreateMutex();
   g_app.stream_enabled = true;
 
+  reg_overlay_init();
+  frame_sync_init();
+  sccb_sched_init();
+  reg_script_init();
+  reg_log_init();
+
   if (!wifi_sta_start_and_wait()) {
     ESP_LOGE(TAG, "Wi-Fi not connected; mDNS and sync may not work");
   }
 
-  if (!sdmmc_mount_and_prepare()) {
+  bool sd_ok = sdmmc_mount_and_prepare();
+  if (!sd_ok) {
     ESP_LOGE(TAG, "SD mount failed; expected SDIO 4-bit FAT32");
   }
+  // Before the camera: its staging buffer needs 16 KiB of internal DMA RAM
+  capture_io_init();
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+  if (sd_ok && !capture_store_init()) ESP_LOGE(TAG, "segment store unavailable; captures go to files");
+#endif
+  if (sd_ok) capture_catalog_init();
+  if (sd_ok) retention_init();
+  // Also without a card (memory-only captures); before the camera takes its frame buffers
+  capture_mem_init();
+  static_cache_init();
+  static_cache_preload(sd_ok);
 
   mdns_start_with_http();
 
@@ -32,6 +64,9 @@ void app_main(void) {
     ESP_LOGE(TAG, "Camera init failed");
   }
 
+  ws_stream_init();
+  event_bus_init();
+  if (sd_ok) capture_gallery_init();
   if (!web_server_start()) {
     ESP_LOGE(TAG, "Web server failed");
   }
@@ -1,7 +1,12 @@
 #include "cam_manager.h"
 #include "app_state.h"
 #include "app_config.h"
+#include "ov2640_ctrl.h"
+#include "reg_overlay.h"
+#include "event_bus.h"
+#include "capture_mem.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -21,6 +26,20 @@ static cam_profile_t g_capture = {
   .fb_count = 1
 };
 
+static cam_capture_timing_t g_last_timing = {0};
+static int64_t g_overlay_us = 0;   // duration of the overlay apply in the last cam_init_locked()
+
+static const uint32_t k_fb_le[] = { 5000, 10000, 20000, 40000, 70000, 100000, 200000, 500000, 1000000 };
+static const uint32_t k_write_le[] = { 10000, 20000, 40000, 70000, 100000, 150000, 250000, 400000, 700000, 1000000, 2000000 };
+static const uint32_t k_reinit_le[] = { 50000, 100000, 200000, 300000, 500000, 750000, 1000000, 2000000 };
+static cam_stats_t g_stats;
+static portMUX_TYPE g_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+static int64_t g_deinit_at = 0;     // start of the deinit preceding the next init (0 = none)
+static int64_t g_fps_win_start = 0;
+static uint32_t g_fps_win_frames = 0;
+static cam_mode_t g_fps_mode = CAM_MODE_NONE;
+static bool g_bayer_on = false;      // DSP switched to RAW output since the last init
+
 static camera_config_t make_ai_thinker_cfg(const cam_profile_t *p) {
   camera_config_t c = {
     .pin_pwdn  = 32,
@@ -55,8 +74,8 @@ static camera_config_t make_ai_thinker_cfg(const cam_profile_t *p) {
 
   if (p->pixformat != PIXFORMAT_JPEG)
   {
-    c.fb_count = 1;
-    c.grab_mode = CAMERA_GRAB_WHEN_EMPTY;
+    c.fb_count = p->raw_fb_count > 1 ? p->raw_fb_count : 1;
+    c.grab_mode = c.fb_count > 1 ? CAMERA_GRAB_LATEST : CAMERA_GRAB_WHEN_EMPTY;
     c.jpeg_quality = 63; // unused, but keep valid
   }
   else
@@ -69,23 +88,80 @@ static camera_config_t make_ai_thinker_cfg(const cam_profile_t *p) {
 }
 
 static bool cam_deinit_locked(void) {
+  g_deinit_at = esp_timer_get_time();
   esp_camera_deinit();
   g_app.mode = CAM_MODE_NONE;
   return true;
 }
 
 static bool cam_init_locked(const cam_profile_t *p, cam_mode_t mode) {
+  g_bayer_on = false;   // the driver reloads the DSP tables
   camera_config_t cfg = make_ai_thinker_cfg(p);
   esp_err_t err = esp_camera_init(&cfg);
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "esp_camera_init failed: %s", esp_err_to_name(err));
     return false;
   }
+  ov2640_invalidate_bank();
+
+  int64_t t0 = esp_timer_get_time();
+  reg_overlay_apply(mode == CAM_MODE_CAPTURE ? REG_OVL_CAPTURE : REG_OVL_STREAM, p);
+  g_overlay_us = esp_timer_get_time() - t0;
+
+  if (g_deinit_at) {
+    uint32_t us = (uint32_t)(esp_timer_get_time() - g_deinit_at);
+    portENTER_CRITICAL(&g_stats_mux);
+    g_stats.reinits++;
+    metrics_hist_observe(&g_stats.reinit, us);
+    portEXIT_CRITICAL(&g_stats_mux);
+    g_deinit_at = 0;
+  }
+
   g_app.mode = mode;
   return true;
 }
 
+camera_fb_t *cam_manager_fb_get(void) {
+  int64_t t0 = esp_timer_get_time();
+  camera_fb_t *fb = esp_camera_fb_get();
+  int64_t now = esp_timer_get_time();
+  cam_mode_t mode = g_app.mode;
+
+  portENTER_CRITICAL(&g_stats_mux);
+  metrics_hist_observe(&g_stats.fb_get, (uint32_t)(now - t0));
+  if (!fb) {
+    g_stats.fb_timeouts++;
+  } else {
+    g_stats.frames[mode]++;
+    if (mode != g_fps_mode) {
+      // mode switch: only the active mode has a current rate
+      for (int m = 0; m < CAM_STATS_MODES; m++) g_stats.fps[m] = 0;
+      g_fps_mode = mode;
+      g_fps_win_start = now;
+      g_fps_win_frames = 0;
+    }
+    g_fps_win_frames++;
+    if (now - g_fps_win_start >= 1000000) {
+      g_stats.fps[mode] = (float)g_fps_win_frames * 1e6f / (float)(now - g_fps_win_start);
+      g_fps_win_start = now;
+      g_fps_win_frames = 0;
+    }
+  }
+  portEXIT_CRITICAL(&g_stats_mux);
+  return fb;
+}
+
+void cam_manager_get_stats(cam_stats_t *out) {
+  portENTER_CRITICAL(&g_stats_mux);
+  *out = g_stats;
+  portEXIT_CRITICAL(&g_stats_mux);
+}
+
 bool cam_manager_init(void) {
+  metrics_hist_init(&g_stats.fb_get, k_fb_le, sizeof(k_fb_le) / sizeof(k_fb_le[0]));
+  metrics_hist_init(&g_stats.reinit, k_reinit_le, sizeof(k_reinit_le) / sizeof(k_reinit_le[0]));
+  metrics_hist_init(&g_stats.write, k_write_le, sizeof(k_write_le) / sizeof(k_write_le[0]));
+
   xSemaphoreTake(g_app.cam_mutex, portMAX_DELAY);
   bool ok = cam_init_locked(&g_stream, CAM_MODE_STREAM);
   xSemaphoreGive(g_app.cam_mutex);
@@ -95,6 +171,20 @@ bool cam_manager_init(void) {
 
 bool cam_manager_set_stream_profile(const cam_profile_t *p) { g_stream = *p; return true; }
 bool cam_manager_set_capture_profile(const cam_profile_t *p) { g_capture = *p; return true; }
+void cam_manager_get_capture_profile(cam_profile_t *out) { *out = g_capture; }
+
+bool cam_manager_set_stream_quality(int quality) {
+  if (quality < 0 || quality > 63) return false;
+  xSemaphoreTake(g_app.cam_mutex, portMAX_DELAY);
+  g_stream.jpeg_quality = quality;
+  bool ok = true;
+  sensor_t *s = g_app.mode == CAM_MODE_STREAM ? esp_camera_sensor_get() : NULL;
+  if (s && s->set_quality) ok = s->set_quality(s, quality) == 0;
+  xSemaphoreGive(g_app.cam_mutex);
+  return ok;
+}
+
+int cam_manager_get_stream_quality(void) { return g_stream.jpeg_quality; }
 
 bool cam_manager_start_stream(void) {
   xSemaphoreTake(g_app.cam_mutex, portMAX_DELAY);
@@ -115,54 +205,157 @@ bool cam_manager_stop_stream(void) {
   return true;
 }
 
-bool cam_manager_capture_to_file(const char *filepath, char *meta_json_out, int meta_max) {
+// "/sdcard/captures/cap_00000001.jpg" -> "cap_00000001"
+static void id_from_path(const char *path, char *out, int out_max) {
+  const char *base = strrchr(path, '/');
+  snprintf(out, out_max, "%s", base ? base + 1 : path);
+  char *dot = strrchr(out, '.');
+  if (dot) *dot = 0;
+}
+
+bool cam_manager_capture_to_file(const char *filepath, const char *meta_path, char *meta_json_out, int meta_max) {
+  char id[32];
+  id_from_path(filepath, id, sizeof(id));
+  cam_capture_timing_t t = {0};
+  int64_t t_start = esp_timer_get_time();
+
   xSemaphoreTake(g_app.cam_mutex, portMAX_DELAY);
 
   g_app.stream_enabled = false;
 
+  int64_t t0 = esp_timer_get_time();
   cam_deinit_locked();
+  t.deinit_us = esp_timer_get_time() - t0;
+
+  t0 = esp_timer_get_time();
   if (!cam_init_locked(&g_capture, CAM_MODE_CAPTURE)) {
     xSemaphoreGive(g_app.cam_mutex);
+    event_bus_publish(EV_ERROR, id, 0, 0, "camera init failed");
     return false;
   }
+  t.overlay_us = g_overlay_us;
+  t.init_us = esp_timer_get_time() - t0 - g_overlay_us;
+  reg_ovl_stats_t ovl;
+  reg_overlay_get_stats(REG_OVL_CAPTURE, &ovl);
+  t.overlay_writes = ovl.last_written;
 
-  camera_fb_t *fb = esp_camera_fb_get();
+  t0 = esp_timer_get_time();
+  camera_fb_t *fb = cam_manager_fb_get();
+  t.fb_get_us = esp_timer_get_time() - t0;
   if (!fb) {
     ESP_LOGE(TAG, "fb_get failed");
     cam_deinit_locked();
     cam_init_locked(&g_stream, CAM_MODE_STREAM);
     g_app.stream_enabled = true;
     xSemaphoreGive(g_app.cam_mutex);
+    event_bus_publish(EV_ERROR, id, 0, 0, "fb_get failed");
     return false;
   }
+  event_bus_publish(EV_FRAME, id, (int32_t)fb->len, (int32_t)t.fb_get_us, NULL);
 
-  FILE *f = fopen(filepath, "wb");
-  if (!f) {
-    ESP_LOGE(TAG, "open file failed: %s", filepath);
+  // Into the PSRAM store (capture_mem.c): the SD write may come later
+  uint32_t crc = 0;
+  bool wrote = capture_mem_save(filepath, fb->buf, fb->len, &t.write_us, &crc);
+  portENTER_CRITICAL(&g_stats_mux);
+  if (wrote) metrics_hist_observe(&g_stats.write, (uint32_t)t.write_us);
+  portEXIT_CRITICAL(&g_stats_mux);
+  if (!wrote) {
     esp_camera_fb_return(fb);
     cam_deinit_locked();
     cam_init_locked(&g_stream, CAM_MODE_STREAM);
     g_app.stream_enabled = true;
     xSemaphoreGive(g_app.cam_mutex);
+    event_bus_publish(EV_ERROR, id, 0, (int32_t)t.write_us, "write failed");
     return false;
   }
+  event_bus_publish(EV_WRITE, id, (int32_t)fb->len, (int32_t)t.write_us, NULL);
 
-  fwrite(fb->buf, 1, fb->len, f);
-  fclose(f);
-
-  if (meta_json_out && meta_max > 0) {
-    snprintf(meta_json_out, meta_max,
-      "{\"len\":%u,\"w\":%u,\"h\":%u,\"format\":%d}",
-      (unsigned)fb->len, fb->width, fb->height, fb->format
-    );
-  }
-
+  unsigned len = (unsigned)fb->len, w = (unsigned)fb->width, h = (unsigned)fb->height;
+  int fmt = fb->format;
   esp_camera_fb_return(fb);
 
+  t0 = esp_timer_get_time();
   cam_deinit_locked();
   bool ok = cam_init_locked(&g_stream, CAM_MODE_STREAM);
   g_app.stream_enabled = ok;
+  t.restore_us = esp_timer_get_time() - t0;
+  t.total_us = esp_timer_get_time() - t_start;
+  g_last_timing = t;
 
   xSemaphoreGive(g_app.cam_mutex);
+
+  char meta[384];
+  snprintf(meta, sizeof(meta),
+    "{\"len\":%u,\"crc32\":\"%08x\",\"w\":%u,\"h\":%u,\"format\":%d,"
+    "\"timing_us\":{\"deinit\":%lld,\"init\":%lld,\"overlay\":%lld,\"overlay_writes\":%d,"
+    "\"fb_get\":%lld,\"write\":%lld,\"restore\":%lld,\"total\":%lld}}",
+    len, (unsigned)crc, w, h, fmt,
+    (long long)t.deinit_us, (long long)t.init_us, (long long)t.overlay_us, t.overlay_writes,
+    (long long)t.fb_get_us, (long long)t.write_us, (long long)t.restore_us, (long long)t.total_us
+  );
+  if (meta_json_out && meta_max > 0) snprintf(meta_json_out, meta_max, "%s", meta);
+  if (meta_path) capture_mem_save(meta_path, meta, strlen(meta), NULL, NULL);
   return ok;
 }
+
+bool cam_manager_run_session(const cam_profile_t *p, cam_session_fn fn, void *ctx) {
+  xSemaphoreTake(g_app.cam_mutex, portMAX_DELAY);
+  g_app.stream_enabled = false;
+
+  cam_deinit_locked();
+  bool ok = cam_init_locked(p, CAM_MODE_CAPTURE);
+  if (ok) ok = fn(ctx);
+
+  cam_deinit_locked();
+  bool restored = cam_init_locked(&g_stream, CAM_MODE_STREAM);
+  g_app.stream_enabled = restored;
+  xSemaphoreGive(g_app.cam_mutex);
+  return ok && restored;
+}
+
+void cam_manager_get_last_timing(cam_capture_timing_t *out) {
+  if (!out) return;
+  xSemaphoreTake(g_app.cam_mutex, portMAX_DELAY);
+  *out = g_last_timing;
+  xSemaphoreGive(g_app.cam_mutex);
+}
+
+// DSP bank registers for Bayer output
+#define DSP_CTRL1       0xC3   // CIP, DMY, RAW_GMA, DG, AWB, AWB_GAIN, LENC, PRE
+#define DSP_CTRL0       0xC2   // [3:0] YUV422, YUV_EN, RGB_EN, RAW_EN
+#define DSP_IMAGE_MODE  0xDA   // [4] JPEG, [3:2] 00 YUV422 / 01 RAW10 / 10 RGB565
+#define CTRL0_FMT_MASK  0x0F
+#define CTRL0_RAW_EN    0x01
+#define IMAGE_MODE_MASK 0x1C
+#define IMAGE_MODE_RAW  0x04
+
+static uint8_t g_bayer_saved[3];   // CTRL1, CTRL0, IMAGE_MODE before enabling
+
+bool ov2640_enable_bayer_raw8(bool enable, int pattern) {
+  if (pattern < 0 || pattern > 3) return false;
+  if (!enable) {
+    if (!g_bayer_on) return true;
+    const ov2640_reg_op_t ops[] = {
+      { REG_BANK_DSP, DSP_IMAGE_MODE, 0xFF, g_bayer_saved[2] },
+      { REG_BANK_DSP, DSP_CTRL0,      0xFF, g_bayer_saved[1] },
+      { REG_BANK_DSP, DSP_CTRL1,      0xFF, g_bayer_saved[0] },
+    };
+    g_bayer_on = false;
+    return ov2640_write_batch(ops, 3) == 3;
+  }
+
+  // Saved once: enabling again (e.g. after a window change) must not save RAW state
+  if (!g_bayer_on &&
+      (!ov2640_read_reg(REG_BANK_DSP, DSP_CTRL1, &g_bayer_saved[0]) ||
+       !ov2640_read_reg(REG_BANK_DSP, DSP_CTRL0, &g_bayer_saved[1]) ||
+       !ov2640_read_reg(REG_BANK_DSP, DSP_IMAGE_MODE, &g_bayer_saved[2]))) return false;
+  const ov2640_reg_op_t ops[] = {
+    { REG_BANK_DSP, DSP_CTRL1,      0xFF,            0x00 },
+    { REG_BANK_DSP, DSP_CTRL0,      CTRL0_FMT_MASK,  CTRL0_RAW_EN },
+    { REG_BANK_DSP, DSP_IMAGE_MODE, IMAGE_MODE_MASK, IMAGE_MODE_RAW },
+  };
+  if (ov2640_write_batch(ops, 3) != 3) return false;
+  if (!g_bayer_on) ESP_LOGI(TAG, "Bayer RAW8 on (pattern %d)", pattern);
+  g_bayer_on = true;
+  return true;
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
 #include "esp_camera.h"
+#include "metrics_hist.h"
 
 typedef enum {
   CAP_FMT_JPEG,
@@ -17,14 +19,66 @@ typedef struct {
   pixformat_t pixformat;
   int jpeg_quality;
   int fb_count;
+  int raw_fb_count;   // raw formats get one buffer unless this asks for more
+  bool compress;      // raw formats: rawz-coded by capture_stripe.c, ignored by the driver
+  bool stripes;       // raw UXGA: banded by capture_stripe.c instead of one full frame buffer
 } cam_profile_t;
 
+// Per-capture timing breakdown (microseconds)
+typedef struct {
+  int64_t deinit_us;
+  int64_t init_us;      // esp_camera_init() only
+  int64_t overlay_us;   // register overlay re-apply after init
+  int64_t fb_get_us;
+  int64_t write_us;
+  int64_t restore_us;   // back to stream profile (incl. its overlay)
+  int64_t total_us;
+  int overlay_writes;
+} cam_capture_timing_t;
+
+// Driver counters; frames/fps are indexed by cam_mode_t
+#define CAM_STATS_MODES 3
+
+typedef struct {
+  metrics_hist_t fb_get;        // us
+  uint32_t fb_timeouts;
+  uint32_t reinits;
+  metrics_hist_t reinit;        // deinit + init + overlay, us
+  metrics_hist_t write;         // capture_to_file frame write, us
+  uint32_t frames[CAM_STATS_MODES];
+  float fps[CAM_STATS_MODES];   // over the last ~1 s window
+} cam_stats_t;
+
 bool cam_manager_init(void);
 bool cam_manager_set_stream_profile(const cam_profile_t *p);
 bool cam_manager_set_capture_profile(const cam_profile_t *p);
+// Changes the stream JPEG quality (kept across re-inits); applied live when streaming
+bool cam_manager_set_stream_quality(int quality);
+int cam_manager_get_stream_quality(void);
+void cam_manager_get_capture_profile(cam_profile_t *out);
 
 bool cam_manager_start_stream(void);
 bool cam_manager_stop_stream(void);
 
-bool cam_manager_capture_to_file(const char *filepath, char *meta_json_out, int meta_max);
+// Captures one frame to `filepath` and, if `meta_path` is set, its JSON sidecar
+// (also copied to meta_json_out when given). Both go through capture_io, or
+// become records in the segment store when CONFIG_CAPTURE_STORE_SEGMENTS is set.
+bool cam_manager_capture_to_file(const char *filepath, const char *meta_path, char *meta_json_out, int meta_max);
+
+// Runs `fn` with the camera initialized in profile `p` (CAPTURE mode, cam mutex
+// held, stream paused), then restores the stream profile. `fn` may call
+// esp_camera_fb_get() repeatedly while the sensor keeps running.
+typedef bool (*cam_session_fn)(void *ctx);
+bool cam_manager_run_session(const cam_profile_t *p, cam_session_fn fn, void *ctx);
+void cam_manager_get_last_timing(cam_capture_timing_t *out);
+
+// esp_camera_fb_get() with latency/timeout/fps accounting; caller holds cam_mutex
+camera_fb_t *cam_manager_fb_get(void);
+void cam_manager_get_stats(cam_stats_t *out);
+// Switches the DSP output to RAW10 on the DVP bus (the 8 data lines carry the
+// top 8 bits: RAW8) with every processing stage off, so frames are the sensor
+// mosaic. DSP bypass proper (R_BYPASS) is not used: it would also skip the DSP
+// output window the driver's fixed frame sizes depend on. `pattern` is the CFA
+// phase the caller expects and is only validated here. Disable restores the
+// saved registers; a camera re-init does the same. Caller holds cam_mutex.
 bool ov2640_enable_bayer_raw8(bool enable, int pattern /*0=RGGB,1=BGGR,2=GRBG,3=GBRG*/);
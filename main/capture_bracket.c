@@ -0,0 +1,230 @@
+#include "capture_bracket.h"
+#include "app_config.h"
+#include "capture_io.h"
+#include "ov2640_ctrl.h"
+#include "frame_sync.h"
+#include "event_bus.h"
+#include "esp_camera.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "BRACKET";
+
+// OV2640 sensor bank
+#define REG_GAIN    0x00
+#define REG_REG04   0x04   // AEC[1:0]
+#define REG_AEC     0x10   // AEC[9:2]
+#define REG_COM8    0x13   // bit0 AEC enable, bit2 AGC enable
+#define REG_REG45   0x45   // AEC[15:10]
+
+typedef struct {
+  const bracket_plan_t *plan;
+  const char *id;
+  uint8_t *buf[BRACKET_MAX_STEPS];
+  bracket_entry_t ent[BRACKET_MAX_STEPS];
+  uint16_t w, h;
+  uint8_t fmt;
+  int got;
+  uint32_t crc;                 // of the .brk, summed while it is written
+  uint32_t frames;
+  int64_t t0;
+  int64_t session_us;
+} bracket_ctx_t;
+
+bool capture_bracket_plan_from_json(cJSON *root, bracket_plan_t *out) {
+  memset(out, 0, sizeof(*out));
+  out->settle = 2;
+  cJSON *st = cJSON_GetObjectItem(root, "settle");
+  if (cJSON_IsNumber(st)) out->settle = st->valueint;
+  if (out->settle < 0 || out->settle > BRACKET_MAX_SETTLE) return false;
+
+  cJSON *steps = cJSON_GetObjectItem(root, "steps");
+  if (!cJSON_IsArray(steps)) return false;
+  int n = cJSON_GetArraySize(steps);
+  if (n < 1 || n > BRACKET_MAX_STEPS) return false;
+  for (int i = 0; i < n; i++) {
+    cJSON *it = cJSON_GetArrayItem(steps, i);
+    cJSON *aec = cJSON_GetObjectItem(it, "aec");
+    cJSON *gain = cJSON_GetObjectItem(it, "gain");
+    if (!cJSON_IsNumber(aec) || aec->valueint < 1 || aec->valueint > 0xFFFF) return false;
+    if (gain && (!cJSON_IsNumber(gain) || gain->valueint < 0 || gain->valueint > 0xFF)) return false;
+    out->steps[i].aec = (uint16_t)aec->valueint;
+    out->steps[i].gain = gain ? (uint8_t)gain->valueint : 0;
+  }
+  out->n = n;
+  return true;
+}
+
+bool capture_bracket_plan_to_json(const bracket_plan_t *plan, char *out, int out_max) {
+  int n = snprintf(out, out_max, "\"settle\":%d,\"steps\":[", plan->settle);
+  for (int i = 0; i < plan->n && n < out_max; i++)
+    n += snprintf(out + n, out_max - n, "%s{\"aec\":%u,\"gain\":%u}", i ? "," : "",
+                  plan->steps[i].aec, plan->steps[i].gain);
+  if (n < out_max) n += snprintf(out + n, out_max - n, "]");
+  return n < out_max;
+}
+
+static bool apply_step(const bracket_step_t *s) {
+  const ov2640_reg_op_t ops[] = {
+    { REG_BANK_SENSOR, REG_REG45, 0x3F, (uint8_t)(s->aec >> 10) },
+    { REG_BANK_SENSOR, REG_AEC,   0xFF, (uint8_t)(s->aec >> 2) },
+    { REG_BANK_SENSOR, REG_REG04, 0x03, (uint8_t)(s->aec & 0x03) },
+    { REG_BANK_SENSOR, REG_GAIN,  0xFF, s->gain },
+  };
+  const int n = sizeof(ops) / sizeof(ops[0]);
+  return ov2640_write_batch(ops, n) == n;
+}
+
+static camera_fb_t *next_frame(bracket_ctx_t *c) {
+  camera_fb_t *fb = cam_manager_fb_get();
+  if (!fb) return NULL;
+  c->frames++;
+  frame_sync_frame_done();
+  return fb;
+}
+
+// Runs with the cam mutex held; the sensor streams continuously in between
+static bool bracket_session(void *arg) {
+  bracket_ctx_t *c = (bracket_ctx_t*)arg;
+  const bracket_plan_t *plan = c->plan;
+  c->t0 = esp_timer_get_time();
+
+  const ov2640_reg_op_t manual = { REG_BANK_SENSOR, REG_COM8, 0x05, 0x00 };
+  if (ov2640_write_batch(&manual, 1) != 1) return false;
+
+  // First frame only marks a boundary to write the first step after
+  camera_fb_t *fb = next_frame(c);
+  if (!fb) return false;
+  esp_camera_fb_return(fb);
+
+  for (int i = 0; i < plan->n; i++) {
+    if (!apply_step(&plan->steps[i])) return false;
+
+    for (int s = 0; s < plan->settle; s++) {
+      if (!(fb = next_frame(c))) return false;
+      esp_camera_fb_return(fb);
+    }
+
+    if (!(fb = next_frame(c))) return false;
+    uint8_t *copy = (uint8_t*)heap_caps_malloc(fb->len, MALLOC_CAP_SPIRAM);
+    if (!copy) {
+      ESP_LOGE(TAG, "no PSRAM for frame %d (%u bytes)", i, (unsigned)fb->len);
+      esp_camera_fb_return(fb);
+      return false;
+    }
+    memcpy(copy, fb->buf, fb->len);
+    c->buf[i] = copy;
+    c->ent[i] = (bracket_entry_t){
+      .len = (uint32_t)fb->len,
+      .aec = plan->steps[i].aec,
+      .gain = plan->steps[i].gain,
+      .frame = c->frames,
+      .t_us = esp_timer_get_time() - c->t0,
+    };
+    c->w = (uint16_t)fb->width;
+    c->h = (uint16_t)fb->height;
+    c->fmt = (uint8_t)fb->format;
+    c->got++;
+    event_bus_publish(EV_FRAME, c->id, (int32_t)fb->len, 0, NULL);
+    esp_camera_fb_return(fb);
+  }
+  c->session_us = esp_timer_get_time() - c->t0;
+  return true;
+}
+
+static void format_meta(const char *id, const bracket_ctx_t *c, int64_t cam_us, int64_t write_us,
+                        char *out, int out_max) {
+  int n = snprintf(out, out_max,
+    "{\"id\":\"%s\",\"crc32\":\"%08x\",\"count\":%d,\"w\":%u,\"h\":%u,\"format\":%d,\"settle\":%d,\"frames\":[",
+    id, (unsigned)c->crc, c->got, c->w, c->h, c->fmt, c->plan->settle);
+  for (int i = 0; i < c->got && n < out_max; i++)
+    n += snprintf(out + n, out_max - n,
+      "%s{\"aec\":%u,\"gain\":%u,\"len\":%u,\"frame\":%u,\"t_us\":%lld}", i ? "," : "",
+      c->ent[i].aec, c->ent[i].gain, (unsigned)c->ent[i].len, (unsigned)c->ent[i].frame, (long long)c->ent[i].t_us);
+  if (n < out_max)
+    snprintf(out + n, out_max - n,
+      "],\"timing_us\":{\"burst\":%lld,\"session\":%lld,\"write\":%lld}}",
+      (long long)c->session_us, (long long)cam_us, (long long)write_us);
+}
+
+// The .brk and its .json sidecar, closed and written in one capture_io pass;
+// *write_us gets the container write time
+static bool write_container(const char *id, bracket_ctx_t *c, int64_t cam_us, char *meta, int meta_max,
+                            int64_t *write_us) {
+  int64_t t0 = esp_timer_get_time();
+  char path[128], json_path[128];
+  snprintf(path, sizeof(path), "%s/%s.brk", CAPTURES_DIR, id);
+  snprintf(json_path, sizeof(json_path), "%s/%s.json", CAPTURES_DIR, id);
+
+  bracket_hdr_t h = {
+    .version = 1,
+    .count = (uint16_t)c->got,
+    .width = c->w,
+    .height = c->h,
+    .format = c->fmt,
+    .settle = (uint8_t)c->plan->settle,
+  };
+  memcpy(h.magic, BRACKET_MAGIC, sizeof(h.magic));
+  snprintf(h.id, sizeof(h.id), "%s", id);
+
+  uint32_t off = sizeof(h) + c->got * sizeof(bracket_entry_t);
+  for (int i = 0; i < c->got; i++) {
+    c->ent[i].offset = off;
+    off += c->ent[i].len;
+  }
+
+  bool prealloc;
+  FILE *f = capture_io_open(path, off, &prealloc);
+  if (!f) {
+    ESP_LOGE(TAG, "open failed: %s", path);
+    return false;
+  }
+  capture_io_part_t parts[BRACKET_MAX_STEPS + 2] = {
+    { &h, sizeof(h) },
+    { c->ent, c->got * sizeof(bracket_entry_t) },
+  };
+  for (int i = 0; i < c->got; i++) parts[2 + i] = (capture_io_part_t){ c->buf[i], c->ent[i].len };
+  c->crc = 0;
+  bool ok = capture_io_writev(f, parts, c->got + 2, 0, &c->crc);
+  *write_us = esp_timer_get_time() - t0;
+  if (ok) format_meta(id, c, cam_us, *write_us, meta, meta_max);
+  ok = capture_io_close(f, prealloc, *write_us, ok ? json_path : NULL, meta) && ok;
+  if (!ok) {
+    remove(path);
+    remove(json_path);
+  }
+  return ok;
+}
+
+bool capture_bracket_run(const char *id, const cam_profile_t *p, const bracket_plan_t *plan,
+                         char *meta_json_out, int meta_max) {
+  if (!meta_json_out || meta_max <= 0) return false;
+  bracket_ctx_t *c = (bracket_ctx_t*)calloc(1, sizeof(*c));
+  if (!c) return false;
+  c->plan = plan;
+  c->id = id;
+
+  int64_t t0 = esp_timer_get_time();
+  bool ok = cam_manager_run_session(p, bracket_session, c) && c->got == plan->n;
+  int64_t cam_us = esp_timer_get_time() - t0;
+
+  if (ok) {
+    int64_t write_us = 0;
+    ok = write_container(id, c, cam_us, meta_json_out, meta_max, &write_us);
+    // write_container() laid out the offsets: the last frame ends the file
+    const bracket_entry_t *last = &c->ent[c->got - 1];
+    if (ok) event_bus_publish(EV_WRITE, id, (int32_t)(last->offset + last->len), (int32_t)write_us, "brk");
+    else event_bus_publish(EV_ERROR, id, 0, 0, "bracket write failed");
+  } else {
+    ESP_LOGE(TAG, "%s: burst failed after %d/%d frames", id, c->got, plan->n);
+    event_bus_publish(EV_ERROR, id, c->got, 0, "bracket burst failed");
+  }
+
+  for (int i = 0; i < c->got; i++) heap_caps_free(c->buf[i]);
+  free(c);
+  return ok;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "cam_manager.h"
+#include "cJSON.h"
+
+// Exposure bracketing burst. The camera is initialized once in the capture
+// profile with AEC/AGC off; each step's exposure/gain is written right after a
+// frame is delivered, `settle` frames are dropped while the sensor latches the
+// new values, and the next frame is kept in PSRAM. All frames are saved in one
+// container (<id>.brk) with a JSON sidecar.
+#define BRACKET_MAX_STEPS   8
+#define BRACKET_MAX_SETTLE  4
+#define BRACKET_MAGIC       "BRK1"
+
+typedef struct {
+  uint16_t aec;       // exposure in lines (AEC[15:0])
+  uint8_t gain;       // raw GAIN register
+} bracket_step_t;
+
+typedef struct {
+  int n;
+  int settle;
+  bracket_step_t steps[BRACKET_MAX_STEPS];
+} bracket_plan_t;
+
+// Container layout (little endian): header, index[count], then frame data
+typedef struct __attribute__((packed)) {
+  char magic[4];
+  uint16_t version;
+  uint16_t count;
+  uint16_t width, height;
+  uint8_t format;     // pixformat_t
+  uint8_t settle;
+  uint16_t reserved;
+  char id[32];
+} bracket_hdr_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t offset;    // from start of file
+  uint32_t len;
+  uint16_t aec;
+  uint8_t gain;
+  uint8_t reserved;
+  uint32_t frame;     // frames since session start
+  int64_t t_us;       // since session start
+} bracket_entry_t;
+
+// {"steps":[{"aec":300,"gain":0},...],"settle":2}
+bool capture_bracket_plan_from_json(cJSON *root, bracket_plan_t *out);
+bool capture_bracket_plan_to_json(const bracket_plan_t *plan, char *out, int out_max);
+
+// Runs the burst into <id>.brk; the JSON sidecar goes to meta_json_out and to
+// <id>.json in the same write pass
+bool capture_bracket_run(const char *id, const cam_profile_t *p, const bracket_plan_t *plan,
+                         char *meta_json_out, int meta_max);
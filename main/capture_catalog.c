@@ -0,0 +1,523 @@
+#include "capture_catalog.h"
+#include "capture_store.h"
+#include "capture_mem.h"
+#include "app_config.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static const char *TAG = "CATALOG";
+
+#define NVS_NS       "catalog"
+#define NVS_KEY_NEXT "next_id"
+#define TMP_PATH     CATALOG_PATH ".tmp"
+#define COMPACT_SLACK 512   // dead log records tolerated beyond the live count
+
+// Main-file extensions, by catalog_rec_t.fmt; only ever append
+static const char *k_fmt[] = { "jpg", "rgb565", "yuv", "gray", "brk", "rawz", "dng" };
+#define N_FMT (int)(sizeof(k_fmt) / sizeof(k_fmt[0]))
+#define FMT_JPG 0   // the only one with thumbnails
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t rec_size;
+  uint32_t reserved[2];
+} catalog_hdr_t;
+
+static SemaphoreHandle_t s_lock = NULL;   // everything below
+static catalog_rec_t *s_recs = NULL;      // PSRAM, ascending id
+static uint32_t s_n = 0, s_cap = 0;
+static uint64_t s_bytes = 0;              // sum of s_recs[].size
+static FILE *s_log = NULL;
+static uint32_t s_log_n = 0;              // records in the log, tombstones and superseded ones included
+static uint32_t s_next = 1;               // next id to hand out
+static uint32_t s_reserved = 0;           // ids below this are covered by NVS
+static volatile bool s_ready = false;
+static volatile bool s_rebuilding = false;
+
+// Only the name capture_catalog_next_id() would give (cap_%08u): records are
+// keyed by the number and their paths rebuilt from it
+static bool parse_id(const char *s, size_t len, uint32_t *num) {
+  if (len < 12 || len > 14 || strncmp(s, "cap_", 4) != 0) return false;
+  uint64_t v = 0;
+  for (size_t i = 4; i < len; i++) {
+    if (s[i] < '0' || s[i] > '9') return false;
+    v = v * 10 + (uint64_t)(s[i] - '0');
+  }
+  char canon[16];
+  if (v > UINT32_MAX || snprintf(canon, sizeof(canon), "cap_%08u", (unsigned)v) != (int)len ||
+      strncmp(canon, s, len) != 0)
+    return false;
+  *num = (uint32_t)v;
+  return true;
+}
+
+bool capture_catalog_id_valid(const char *id) {
+  uint32_t num;
+  return id && parse_id(id, strlen(id), &num);
+}
+
+static int fmt_of(const char *ext) {
+  for (int i = 0; i < N_FMT; i++)
+    if (!strcmp(ext, k_fmt[i])) return i;
+  return -1;
+}
+
+const char *capture_catalog_ext(const catalog_rec_t *r) {
+  return r->fmt < N_FMT ? k_fmt[r->fmt] : "bin";
+}
+
+static uint32_t nvs_next(void) {
+  nvs_handle_t h;
+  uint32_t v = 0;
+  if (nvs_open(NVS_NS, NVS_READONLY, &h) != ESP_OK) return 0;
+  if (nvs_get_u32(h, NVS_KEY_NEXT, &v) != ESP_OK) v = 0;
+  nvs_close(h);
+  return v;
+}
+
+static void nvs_store_next(uint32_t v) {
+  nvs_handle_t h;
+  if (nvs_open(NVS_NS, NVS_READWRITE, &h) != ESP_OK) return;
+  if (nvs_set_u32(h, NVS_KEY_NEXT, v) == ESP_OK) nvs_commit(h);
+  nvs_close(h);
+}
+
+// Index of the first record with id >= `id`
+static uint32_t lower_bound(const catalog_rec_t *r, uint32_t n, uint32_t id) {
+  uint32_t lo = 0, hi = n;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (r[mid].id < id) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// Inserts or replaces; ids normally arrive in order, so this is an append
+static bool put_locked(const catalog_rec_t *rec) {
+  uint32_t i = s_n && s_recs[s_n - 1].id < rec->id ? s_n : lower_bound(s_recs, s_n, rec->id);
+  if (i < s_n && s_recs[i].id == rec->id) {
+    s_bytes = s_bytes - s_recs[i].size + rec->size;
+    uint8_t flags = s_recs[i].flags;
+    s_recs[i] = *rec;
+    s_recs[i].flags |= flags;
+    return true;
+  }
+  if (s_n == s_cap) {
+    if (s_cap == CATALOG_MAX) return false;
+    uint32_t cap = s_cap ? s_cap * 2 : 256;
+    catalog_rec_t *grown = (catalog_rec_t*)heap_caps_realloc(s_recs, cap * sizeof(catalog_rec_t), MALLOC_CAP_SPIRAM);
+    if (!grown) return false;
+    s_recs = grown;
+    s_cap = cap;
+  }
+  memmove(&s_recs[i + 1], &s_recs[i], (s_n - i) * sizeof(catalog_rec_t));
+  s_recs[i] = *rec;
+  s_n++;
+  s_bytes += rec->size;
+  if (rec->id >= s_next) s_next = rec->id + 1;
+  return true;
+}
+
+static void erase_locked(uint32_t i) {
+  s_bytes -= s_recs[i].size;
+  memmove(&s_recs[i], &s_recs[i + 1], (s_n - i - 1) * sizeof(catalog_rec_t));
+  s_n--;
+}
+
+static void erase_id_locked(uint32_t id) {
+  uint32_t i = lower_bound(s_recs, s_n, id);
+  if (i < s_n && s_recs[i].id == id) erase_locked(i);
+}
+
+static bool load_log(void) {
+  FILE *f = fopen(CATALOG_PATH, "rb");
+  if (!f) return false;
+  catalog_hdr_t h;
+  bool ok = fread(&h, 1, sizeof(h), f) == sizeof(h) && h.magic == CATALOG_MAGIC &&
+            h.version == 1 && h.rec_size == sizeof(catalog_rec_t);
+  catalog_rec_t r;
+  uint32_t n = 0;
+  while (ok && fread(&r, 1, sizeof(r), f) == sizeof(r)) {
+    if (r.loc == CATALOG_LOC_DELETED) erase_id_locked(r.id);
+    else put_locked(&r);
+    n++;
+  }
+  fclose(f);
+  if (!ok) return false;
+  s_log_n = n;
+
+  // A torn last record (power loss mid-append) is cut off
+  struct stat st;
+  off_t want = (off_t)(sizeof(h) + n * sizeof(r));
+  if (stat(CATALOG_PATH, &st) == 0 && st.st_size != want) truncate(CATALOG_PATH, want);
+  return true;
+}
+
+static FILE *open_log(void) {
+  FILE *f = fopen(CATALOG_PATH, "ab");
+  if (f) setvbuf(f, NULL, _IONBF, 0);
+  return f;
+}
+
+// Writes the whole catalog to a fresh log (memory-only captures are never
+// logged); caller holds s_lock
+static bool write_log_locked(void) {
+  if (s_log) fclose(s_log);
+  s_log = NULL;
+  FILE *f = fopen(TMP_PATH, "wb");
+  if (!f) return false;
+  catalog_hdr_t h = { .magic = CATALOG_MAGIC, .version = 1, .rec_size = sizeof(catalog_rec_t) };
+  bool ok = fwrite(&h, 1, sizeof(h), f) == sizeof(h);
+  uint32_t n = 0;
+  for (uint32_t i = 0; ok && i < s_n; i++) {
+    if (s_recs[i].loc == CATALOG_LOC_MEM) continue;
+    ok = fwrite(&s_recs[i], 1, sizeof(catalog_rec_t), f) == sizeof(catalog_rec_t);
+    n++;
+  }
+  ok = (fclose(f) == 0) && ok;
+  if (ok) {
+    remove(CATALOG_PATH);
+    ok = rename(TMP_PATH, CATALOG_PATH) == 0;
+  }
+  if (ok) s_log_n = n;
+  s_log = open_log();
+  return ok;
+}
+
+// Tombstones and superseded records only grow the log: rewrite it once they
+// outnumber the live records by COMPACT_SLACK
+static void compact_locked(void) {
+  if (s_rebuilding || s_log_n <= 2 * s_n + COMPACT_SLACK) return;
+  uint32_t before = s_log_n;
+  int64_t t0 = esp_timer_get_time();
+  bool ok = write_log_locked();
+  ESP_LOGI(TAG, "log compacted: %u -> %u records in %lld ms%s", (unsigned)before, (unsigned)s_log_n,
+           (long long)((esp_timer_get_time() - t0) / 1000), ok ? "" : " (write failed)");
+}
+
+// During a rebuild the new log is written from s_recs when it finishes
+static bool append_locked(const catalog_rec_t *r) {
+  if (s_rebuilding) return true;
+  if (!s_log) s_log = open_log();
+  bool ok = s_log && fwrite(r, 1, sizeof(*r), s_log) == sizeof(*r) && fsync(fileno(s_log)) == 0;
+  if (ok) s_log_n++;
+  return ok;
+}
+
+// Only the rebuild looks at the card; afterwards the thumb task reports new ones
+static uint8_t thumb_flag(uint32_t id) {
+  char path[64];
+  snprintf(path, sizeof(path), "%s/cap_%08u.jpg", THUMBS_DIR, (unsigned)id);
+  struct stat st;
+  return stat(path, &st) == 0 ? CATALOG_F_THUMB : 0;
+}
+
+static bool fill_rec(catalog_rec_t *r, uint32_t id, int fmt) {
+  char name[24], path[128];
+  snprintf(name, sizeof(name), "cap_%08u", (unsigned)id);
+  memset(r, 0, sizeof(*r));
+  r->id = id;
+  r->fmt = (uint8_t)fmt;
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+  store_idx_t e;
+  if (capture_store_find(name, k_fmt[fmt], &e)) {
+    r->loc = CATALOG_LOC_STORE;
+    r->seg = e.seg;
+    r->offset = e.offset;
+    r->size = e.len;
+    r->mtime = e.mtime;
+    return true;
+  }
+#endif
+  snprintf(path, sizeof(path), "%s/%s.%s", CAPTURES_DIR, name, k_fmt[fmt]);
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    // Not flushed from the PSRAM store yet
+    capture_mem_ref_t ref;
+    if (!capture_mem_acquire(strrchr(path, '/') + 1, &ref)) return false;
+    r->loc = CATALOG_LOC_MEM;
+    r->size = ref.len;
+    r->mtime = ref.mtime;
+    capture_mem_release(&ref);
+    return true;
+  }
+  r->loc = CATALOG_LOC_FILE;
+  r->size = (uint32_t)st.st_size;
+  r->mtime = (uint32_t)st.st_mtime;
+  return true;
+}
+
+// Builds a sorted catalog from the card; records added meanwhile (they went
+// to s_recs, which was emptied when the rebuild started) are merged in
+static void rebuild_task(void *arg) {
+  (void)arg;
+  int64_t t0 = esp_timer_get_time();
+  catalog_rec_t *found = NULL;
+  uint32_t n = 0, cap = 0;
+
+  DIR *d = opendir(CAPTURES_DIR);
+  struct dirent *de;
+  while (d && (de = readdir(d)) != NULL && n < CATALOG_MAX) {
+    const char *dot = strrchr(de->d_name, '.');
+    uint32_t id;
+    int fmt;
+    if (!dot || (fmt = fmt_of(dot + 1)) < 0 || !parse_id(de->d_name, (size_t)(dot - de->d_name), &id)) continue;
+    if (n == cap) {
+      cap = cap ? cap * 2 : 256;
+      catalog_rec_t *grown = (catalog_rec_t*)heap_caps_realloc(found, cap * sizeof(catalog_rec_t), MALLOC_CAP_SPIRAM);
+      if (!grown) break;
+      found = grown;
+    }
+    if (fill_rec(&found[n], id, fmt)) {
+      if (fmt == FMT_JPG) found[n].flags = thumb_flag(id);
+      n++;
+    }
+  }
+  if (d) closedir(d);
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  for (uint32_t i = 0; i < n; i++) {
+    // Newer entries (added during the rebuild) win over what the scan found
+    uint32_t k = lower_bound(s_recs, s_n, found[i].id);
+    if (k < s_n && s_recs[k].id == found[i].id) continue;
+    put_locked(&found[i]);
+  }
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+  for (uint32_t i = 0; i < capture_store_count(); i++) {
+    store_idx_t e;
+    uint32_t id;
+    int fmt;
+    if (!capture_store_get(i, &e) || (fmt = fmt_of(e.ext)) < 0 || !parse_id(e.name, strlen(e.name), &id)) continue;
+    catalog_rec_t r = { .id = id, .mtime = e.mtime, .size = e.len, .fmt = (uint8_t)fmt,
+                        .loc = CATALOG_LOC_STORE, .seg = e.seg, .offset = e.offset,
+                        .flags = fmt == FMT_JPG ? thumb_flag(id) : 0 };
+    put_locked(&r);
+  }
+#endif
+  bool ok = write_log_locked();
+  s_ready = true;
+  s_rebuilding = false;
+  uint32_t total = s_n;
+  xSemaphoreGive(s_lock);
+  heap_caps_free(found);
+
+  ESP_LOGI(TAG, "rebuilt: %u captures in %lld ms%s", (unsigned)total,
+           (long long)((esp_timer_get_time() - t0) / 1000), ok ? "" : " (write failed)");
+  vTaskDelete(NULL);
+}
+
+static bool start_rebuild(void) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  bool start = !s_rebuilding;
+  if (start) {
+    s_rebuilding = true;
+    s_ready = false;
+    s_n = 0;
+    s_bytes = 0;
+  }
+  xSemaphoreGive(s_lock);
+  if (start && xTaskCreate(rebuild_task, "catalog", 4096, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+    s_rebuilding = false;
+    return false;
+  }
+  return start;
+}
+
+void capture_catalog_init(void) {
+  if (s_lock) return;
+  s_lock = xSemaphoreCreateMutex();
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  bool loaded = load_log();
+  if (loaded) s_log = open_log();
+  uint32_t seeded = nvs_next();
+  if (seeded > s_next) s_next = seeded;
+  s_reserved = s_next;   // first allocation reserves a new block
+  s_ready = loaded;
+  xSemaphoreGive(s_lock);
+
+  if (loaded) {
+    ESP_LOGI(TAG, "%u captures, next id %u", (unsigned)s_n, (unsigned)s_next);
+  } else {
+    ESP_LOGW(TAG, "no catalog, rebuilding from the card");
+    start_rebuild();
+  }
+}
+
+bool capture_catalog_ready(void) {
+  return s_ready;
+}
+
+uint32_t capture_catalog_next_id(void) {
+  if (!s_lock) {
+    static uint32_t fallback = 0;   // no card: ids only need to be unique per boot
+    return ++fallback;
+  }
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  uint32_t id = s_next++;
+  if (s_next > s_reserved) {
+    s_reserved = s_next + CATALOG_ID_BLOCK;
+    nvs_store_next(s_reserved);
+  }
+  xSemaphoreGive(s_lock);
+  return id;
+}
+
+void capture_catalog_add(const char *id, const char *ext) {
+  uint32_t num;
+  int fmt = fmt_of(ext);
+  if (!s_lock || fmt < 0 || !parse_id(id, strlen(id), &num)) return;
+  catalog_rec_t r;
+  if (!fill_rec(&r, num, fmt)) return;
+  if (!r.mtime) r.mtime = (uint32_t)time(NULL);
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  // A memory record moving to the card brings its thumb flag into the log
+  uint32_t i = lower_bound(s_recs, s_n, num);
+  if (i < s_n && s_recs[i].id == num) r.flags |= s_recs[i].flags;
+  bool ok = put_locked(&r) && (r.loc == CATALOG_LOC_MEM || append_locked(&r));
+  compact_locked();
+  xSemaphoreGive(s_lock);
+  if (!ok) ESP_LOGW(TAG, "%s not recorded", id);
+}
+
+uint64_t capture_catalog_bytes(void) {
+  if (!s_lock) return 0;
+  // 64-bit: not read atomically on this core
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  uint64_t b = s_bytes;
+  xSemaphoreGive(s_lock);
+  return b;
+}
+
+bool capture_catalog_oldest(catalog_rec_t *out) {
+  if (!s_ready) return false;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  uint32_t i = 0;
+  while (i < s_n && s_recs[i].loc == CATALOG_LOC_MEM) i++;
+  bool ok = i < s_n;
+  if (ok) *out = s_recs[i];
+  xSemaphoreGive(s_lock);
+  return ok;
+}
+
+void capture_catalog_set_thumb(uint32_t id) {
+  if (!s_lock) return;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  uint32_t i = lower_bound(s_recs, s_n, id);
+  if (i < s_n && s_recs[i].id == id && !(s_recs[i].flags & CATALOG_F_THUMB)) {
+    s_recs[i].flags |= CATALOG_F_THUMB;
+    // Memory-only records are not logged; the flush logs the flag with the file
+    if (s_recs[i].loc != CATALOG_LOC_MEM) append_locked(&s_recs[i]);
+    compact_locked();
+  }
+  xSemaphoreGive(s_lock);
+}
+
+void capture_catalog_remove(uint32_t id) {
+  if (!s_lock) return;
+  catalog_rec_t t = { .id = id, .loc = CATALOG_LOC_DELETED };
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  erase_id_locked(id);
+  append_locked(&t);
+  compact_locked();
+  xSemaphoreGive(s_lock);
+}
+
+uint32_t capture_catalog_remove_segment(uint16_t seg) {
+  if (!s_lock) return 0;
+  uint32_t removed = 0;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  for (uint32_t i = s_n; i-- > 0; ) {
+    if (s_recs[i].loc != CATALOG_LOC_STORE || s_recs[i].seg != seg) continue;
+    catalog_rec_t t = { .id = s_recs[i].id, .loc = CATALOG_LOC_DELETED };
+    erase_locked(i);
+    append_locked(&t);
+    removed++;
+  }
+  compact_locked();
+  xSemaphoreGive(s_lock);
+  return removed;
+}
+
+uint32_t capture_catalog_count(void) {
+  return s_ready ? s_n : 0;
+}
+
+int capture_catalog_page(uint32_t offset, catalog_rec_t *out, int max) {
+  if (!s_ready) return 0;
+  int k = 0;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  for (uint32_t i = offset; i < s_n && k < max; i++) out[k++] = s_recs[s_n - 1 - i];
+  xSemaphoreGive(s_lock);
+  return k;
+}
+
+bool capture_catalog_next(uint32_t after, catalog_rec_t *out) {
+  if (!s_ready || after == UINT32_MAX) return false;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  uint32_t i = lower_bound(s_recs, s_n, after + 1);
+  bool found = i < s_n;
+  if (found) *out = s_recs[i];
+  xSemaphoreGive(s_lock);
+  return found;
+}
+
+bool capture_catalog_lookup(uint32_t id, catalog_rec_t *out) {
+  if (!s_ready) return false;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  uint32_t i = lower_bound(s_recs, s_n, id);
+  bool found = i < s_n && s_recs[i].id == id;
+  if (found) *out = s_recs[i];
+  xSemaphoreGive(s_lock);
+  return found;
+}
+
+// ------------------ HTTP ------------------
+
+esp_err_t capture_catalog_info_handler(httpd_req_t *req) {
+  char q[64] = "", id[24];
+  uint32_t num;
+  httpd_req_get_url_query_str(req, q, sizeof(q));
+  if (httpd_query_key_value(q, "id", id, sizeof(id)) != ESP_OK || !parse_id(id, strlen(id), &num))
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "bad id");
+  if (!s_ready) return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "catalog rebuilding");
+
+  catalog_rec_t r;
+  if (!capture_catalog_lookup(num, &r)) return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "no such capture");
+  char buf[256];
+  if (r.loc == CATALOG_LOC_STORE) {
+    snprintf(buf, sizeof(buf), "{\"id\":\"cap_%08u\",\"format\":\"%s\",\"size\":%u,\"mtime\":%u,"
+             "\"location\":\"store\",\"segment\":%u,\"offset\":%u}",
+             (unsigned)r.id, capture_catalog_ext(&r), (unsigned)r.size, (unsigned)r.mtime,
+             (unsigned)r.seg, (unsigned)r.offset);
+  } else {
+    snprintf(buf, sizeof(buf), "{\"id\":\"cap_%08u\",\"format\":\"%s\",\"size\":%u,\"mtime\":%u,"
+             "\"location\":\"%s\",\"path\":\"/captures/cap_%08u.%s\"}",
+             (unsigned)r.id, capture_catalog_ext(&r), (unsigned)r.size, (unsigned)r.mtime,
+             r.loc == CATALOG_LOC_MEM ? "memory" : "file", (unsigned)r.id, capture_catalog_ext(&r));
+  }
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, buf);
+}
+
+esp_err_t capture_catalog_reindex_handler(httpd_req_t *req) {
+  if (!s_lock) return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "no card");
+  if (!start_rebuild()) return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "rebuild already running");
+  httpd_resp_set_status(req, "202 Accepted");
+  return httpd_resp_sendstr(req, "{\"ok\":true,\"rebuilding\":true}");
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_http_server.h"
+
+// Persistent capture catalog: one fixed-size record per cap_<n> capture in
+// CATALOG_PATH (append-only log, later records for an id win), held in PSRAM
+// sorted by id, so listings page by index and lookups are a binary search
+// instead of a readdir. A missing or damaged catalog is rebuilt in the
+// background from CAPTURES_DIR (and the segment store, when enabled).
+//
+// Ids come from a counter in NVS that is reserved in blocks, so they stay
+// monotonic across reboots without an NVS write per capture.
+#define CATALOG_PATH      SD_MOUNT_POINT "/catalog.bin"
+#define CATALOG_MAGIC     0x54414343u   // "CCAT"
+#define CATALOG_MAX       65536
+#define CATALOG_ID_BLOCK  32
+
+// DELETED: tombstone in the log. MEM: only in the PSRAM store (capture_mem.h)
+// so far; such records are not logged, the flush records the file.
+enum { CATALOG_LOC_FILE = 0, CATALOG_LOC_STORE = 1, CATALOG_LOC_MEM = 2, CATALOG_LOC_DELETED = 0xFF };
+
+// catalog_rec_t.flags; kept when a capture's record is replaced
+#define CATALOG_F_THUMB   0x01          // THUMBS_DIR/cap_<n>.jpg is in place
+
+typedef struct __attribute__((packed)) {
+  uint32_t id;
+  uint32_t mtime;
+  uint32_t size;                // main file bytes
+  uint8_t  fmt;                 // index into the extension table, see capture_catalog_ext()
+  uint8_t  loc;                 // CATALOG_LOC_*
+  uint16_t seg;                 // segment (loc = store)
+  uint32_t offset;              // record offset in the segment (loc = store)
+  uint8_t  flags;               // CATALOG_F_*
+  uint8_t  reserved[3];
+} catalog_rec_t;                // 24 bytes
+
+void capture_catalog_init(void);
+bool capture_catalog_ready(void);   // false while rebuilding
+// Next capture id (cap_%08u); never handed out twice, also across reboots
+uint32_t capture_catalog_next_id(void);
+// True for ids the catalog can hold ("cap_%08u"); captures are only saved under these
+bool capture_catalog_id_valid(const char *id);
+// Records capture `id` (see capture_catalog_id_valid()) whose main file has extension `ext`
+void capture_catalog_add(const char *id, const char *ext);
+uint32_t capture_catalog_count(void);
+// Up to `max` records from `offset` (0 = newest), newest first; returns how many
+int capture_catalog_page(uint32_t offset, catalog_rec_t *out, int max);
+bool capture_catalog_lookup(uint32_t id, catalog_rec_t *out);
+// Record with the smallest id above `after`, for walks that tolerate concurrent changes
+bool capture_catalog_next(uint32_t after, catalog_rec_t *out);
+const char *capture_catalog_ext(const catalog_rec_t *r);
+// Sum of the size of all cataloged captures
+uint64_t capture_catalog_bytes(void);
+// Oldest capture on the card (MEM records are skipped)
+bool capture_catalog_oldest(catalog_rec_t *out);
+// Notes that the capture's thumbnail is in place (logged once)
+void capture_catalog_set_thumb(uint32_t id);
+// Forgets a capture (the caller deletes its data); logged as a tombstone
+void capture_catalog_remove(uint32_t id);
+// Forgets every capture stored in segment `seg`; returns how many
+uint32_t capture_catalog_remove_segment(uint16_t seg);
+
+// GET /api/captures/info?id=cap_<n>: one record; POST /api/captures/reindex: rebuild
+esp_err_t capture_catalog_info_handler(httpd_req_t *req);
+esp_err_t capture_catalog_reindex_handler(httpd_req_t *req);
@@ -0,0 +1,130 @@
+#include "capture_dng.h"
+#include <string.h>
+
+#define T_BYTE      1
+#define T_ASCII     2
+#define T_SHORT     3
+#define T_LONG      4
+#define T_RATIONAL  5
+#define T_SRATIONAL 10
+
+#define N_TAGS      23
+#define IFD_OFF     8
+#define EXTRA_OFF   (IFD_OFF + 2 + N_TAGS * 12 + 4)
+
+static const char *k_cfa_names[] = { "rggb", "bggr", "grbg", "gbrg" };
+// TIFF/EP CFAPattern colors: 0 = red, 1 = green, 2 = blue
+static const uint8_t k_cfa[4][4] = { {0,1,1,2}, {2,1,1,0}, {1,0,2,1}, {1,2,0,1} };
+
+// XYZ (D65) -> camera. Placeholder with sRGB primaries, not a calibrated
+// OV2640 profile: raw converters need a matrix to open the file at all.
+static const int32_t k_color_matrix[9] = {
+  32406, -15372, -4986,
+  -9689,  18758,   415,
+    557,  -2040, 10570,
+};
+
+typedef struct {
+  uint8_t *b;
+  int n;            // entries written
+  uint32_t extra;   // next free byte for out-of-line values
+} ifd_t;
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  put16(p, (uint16_t)v);
+  put16(p + 2, (uint16_t)(v >> 16));
+}
+
+// Entries must be added in ascending tag order
+static uint8_t *entry(ifd_t *d, uint16_t tag, uint16_t type, uint32_t count) {
+  uint8_t *e = d->b + IFD_OFF + 2 + 12 * d->n++;
+  put16(e, tag);
+  put16(e + 2, type);
+  put32(e + 4, count);
+  return e + 8;
+}
+
+static void e_short(ifd_t *d, uint16_t tag, uint16_t v) {
+  put16(entry(d, tag, T_SHORT, 1), v);
+}
+
+static void e_long(ifd_t *d, uint16_t tag, uint32_t v) {
+  put32(entry(d, tag, T_LONG, 1), v);
+}
+
+static void e_bytes(ifd_t *d, uint16_t tag, const uint8_t v[4]) {
+  memcpy(entry(d, tag, T_BYTE, 4), v, 4);
+}
+
+static void e_ascii(ifd_t *d, uint16_t tag, const char *s) {
+  uint32_t len = (uint32_t)strlen(s) + 1;
+  uint8_t *v = entry(d, tag, T_ASCII, len);
+  if (len <= 4) { memcpy(v, s, len); return; }
+  put32(v, d->extra);
+  memcpy(d->b + d->extra, s, len);
+  d->extra += (len + 1) & ~1u;   // values start on a word boundary
+}
+
+static void e_rationals(ifd_t *d, uint16_t tag, uint16_t type, const int32_t *num, uint32_t den, int n) {
+  put32(entry(d, tag, type, (uint32_t)n), d->extra);
+  for (int i = 0; i < n; i++) {
+    put32(d->b + d->extra, (uint32_t)num[i]);
+    put32(d->b + d->extra + 4, den);
+    d->extra += 8;
+  }
+}
+
+const char *capture_dng_cfa_name(int pattern) {
+  return pattern >= 0 && pattern < 4 ? k_cfa_names[pattern] : NULL;
+}
+
+bool capture_dng_header(uint8_t *out, uint16_t w, uint16_t h, int pattern, const char *model) {
+  if (!capture_dng_cfa_name(pattern)) return false;
+  memset(out, 0, CAPTURE_DNG_HDR);
+  out[0] = 'I';
+  out[1] = 'I';
+  put16(out + 2, 42);
+  put32(out + 4, IFD_OFF);
+
+  static const uint8_t version[4] = { 1, 4, 0, 0 };
+  static const uint8_t backward[4] = { 1, 1, 0, 0 };
+  static const int32_t neutral[3] = { 1, 1, 1 };
+  char unique[48];
+  strcpy(unique, "ESP32-CAM ");
+  strncat(unique, model, sizeof(unique) - strlen(unique) - 1);
+
+  ifd_t d = { .b = out, .n = 0, .extra = EXTRA_OFF };
+  e_long(&d, 254, 0);                         // NewSubfileType: main image
+  e_long(&d, 256, w);                         // ImageWidth
+  e_long(&d, 257, h);                         // ImageLength
+  e_short(&d, 258, 8);                        // BitsPerSample
+  e_short(&d, 259, 1);                        // Compression: none
+  e_short(&d, 262, 32803);                    // PhotometricInterpretation: CFA
+  e_ascii(&d, 271, "OmniVision");             // Make
+  e_ascii(&d, 272, model);                    // Model
+  e_long(&d, 273, CAPTURE_DNG_HDR);           // StripOffsets
+  e_short(&d, 274, 1);                        // Orientation
+  e_short(&d, 277, 1);                        // SamplesPerPixel
+  e_long(&d, 278, h);                         // RowsPerStrip
+  e_long(&d, 279, (uint32_t)w * h);           // StripByteCounts
+  e_short(&d, 284, 1);                        // PlanarConfiguration
+  uint8_t *dims = entry(&d, 33421, T_SHORT, 2);   // CFARepeatPatternDim: 2x2
+  put16(dims, 2);
+  put16(dims + 2, 2);
+  e_bytes(&d, 33422, k_cfa[pattern]);         // CFAPattern
+  e_bytes(&d, 50706, version);                // DNGVersion 1.4
+  e_bytes(&d, 50707, backward);               // DNGBackwardVersion 1.1
+  e_ascii(&d, 50708, unique);                 // UniqueCameraModel
+  e_long(&d, 50717, 255);                     // WhiteLevel
+  e_rationals(&d, 50721, T_SRATIONAL, k_color_matrix, 10000, 9);   // ColorMatrix1
+  e_rationals(&d, 50728, T_RATIONAL, neutral, 1, 3);               // AsShotNeutral
+  e_short(&d, 50778, 21);                     // CalibrationIlluminant1: D65
+  put16(out + IFD_OFF, (uint16_t)d.n);
+  // Next-IFD offset (0) is already zero
+  return d.n == N_TAGS && d.extra <= CAPTURE_DNG_HDR;
+}
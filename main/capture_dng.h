@@ -0,0 +1,17 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Minimal DNG (TIFF, little endian, one uncompressed CFA strip) for Bayer RAW8
+// frames. The header is padded to CAPTURE_DNG_HDR bytes and followed by the
+// packed photosites (one byte each, rows top to bottom, no row padding), so a
+// .dng is also the packed frame behind a fixed prefix and stays sector-aligned
+// for capture_io. No IDF dependencies.
+#define CAPTURE_DNG_HDR 512
+
+// CFA phase of the top-left 2x2 block, as in ov2640_enable_bayer_raw8()
+enum { BAYER_RGGB = 0, BAYER_BGGR = 1, BAYER_GRBG = 2, BAYER_GBRG = 3 };
+
+const char *capture_dng_cfa_name(int pattern);   // "rggb", ...; NULL if invalid
+// Fills out[CAPTURE_DNG_HDR]; false for an invalid pattern
+bool capture_dng_header(uint8_t *out, uint16_t w, uint16_t h, int pattern, const char *model);
@@ -0,0 +1,318 @@
+#include "capture_export.h"
+#include "app_config.h"
+#include "slave_client.h"
+#include "capture_http.h"
+#include "capture_catalog.h"
+#include "capture_mem.h"
+#include "capture_store.h"
+#include "esp_rom_crc.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static const char *TAG = "EXPORT";
+
+#define TAR_BLOCK 512
+
+typedef struct {
+  httpd_req_t *req;
+  uint32_t from, to;
+  bool slave;
+  slave_stream_t *link;   // connection of this export's own to the slave, made on first use
+  uint8_t *buf;
+  size_t cap, len;
+  uint32_t files, verified;
+  uint64_t bytes;
+  char disp[64];      // Content-Disposition; httpd keeps the pointer until the headers go out
+} export_ctx_t;
+
+// Body source: fills up to n bytes, returns count or <= 0 on error
+typedef int (*read_fn_t)(void *src, char *dst, int n);
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool s_busy = false;
+
+static bool flush(export_ctx_t *c) {
+  if (!c->len) return true;
+  bool ok = httpd_resp_send_chunk(c->req, (const char*)c->buf, (ssize_t)c->len) == ESP_OK;
+  c->bytes += c->len;
+  c->len = 0;
+  return ok;
+}
+
+static bool emit(export_ctx_t *c, const void *data, size_t n) {
+  const uint8_t *p = (const uint8_t*)data;
+  while (n > 0) {
+    size_t k = c->cap - c->len;
+    if (k > n) k = n;
+    memcpy(c->buf + c->len, p, k);
+    c->len += k;
+    p += k;
+    n -= k;
+    if (c->len == c->cap && !flush(c)) return false;
+  }
+  return true;
+}
+
+static bool emit_zeros(export_ctx_t *c, size_t n) {
+  static const uint8_t zero[TAR_BLOCK];
+  while (n > 0) {
+    size_t k = n > sizeof(zero) ? sizeof(zero) : n;
+    if (!emit(c, zero, k)) return false;
+    n -= k;
+  }
+  return true;
+}
+
+static bool tar_header(export_ctx_t *c, const char *name, uint32_t size, uint32_t mtime) {
+  uint8_t h[TAR_BLOCK];
+  memset(h, 0, sizeof(h));
+  snprintf((char*)h, 100, "%s", name);
+  memcpy(h + 100, "0000644", 8);               // mode
+  memcpy(h + 108, "0000000", 8);               // uid
+  memcpy(h + 116, "0000000", 8);               // gid
+  snprintf((char*)h + 124, 12, "%011o", (unsigned)size);
+  snprintf((char*)h + 136, 12, "%011o", (unsigned)mtime);
+  h[156] = '0';                                // regular file
+  memcpy(h + 257, "ustar", 6);
+  memcpy(h + 263, "00", 2);
+
+  // Checksum is computed with its own field read as spaces
+  memset(h + 148, ' ', 8);
+  unsigned sum = 0;
+  for (int i = 0; i < TAR_BLOCK; i++) sum += h[i];
+  snprintf((char*)h + 148, 8, "%06o", sum);    // "NNNNNN\0 "
+  return emit(c, h, sizeof(h));
+}
+
+// Reads the body straight into the tail of the staging buffer. With an
+// expected CRC the body is summed as it arrives; a mismatch fails the member
+// before its last bytes leave the buffer.
+static bool tar_member(export_ctx_t *c, const char *name, uint32_t size, uint32_t mtime,
+                       read_fn_t rd, void *src, const uint32_t *expect) {
+  if (!tar_header(c, name, size, mtime)) return false;
+  uint32_t remaining = size, crc = 0;
+  while (remaining > 0) {
+    if (c->len == c->cap && !flush(c)) return false;
+    size_t want = c->cap - c->len;
+    if (want > remaining) want = remaining;
+    int got = rd(src, (char*)c->buf + c->len, (int)want);
+    if (got <= 0) {
+      ESP_LOGW(TAG, "%s: short read, %u bytes missing", name, (unsigned)remaining);
+      return false;
+    }
+    if (expect) crc = esp_rom_crc32_le(crc, c->buf + c->len, (uint32_t)got);
+    c->len += (size_t)got;
+    remaining -= (uint32_t)got;
+  }
+  if (expect && crc != *expect) {
+    ESP_LOGE(TAG, "%s: CRC %08x, recorded %08x", name, (unsigned)crc, (unsigned)*expect);
+    return false;
+  }
+  if (expect) c->verified++;
+  c->files++;
+  return emit_zeros(c, (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK);
+}
+
+// A capture file wherever it currently lives: the PSRAM store, the card or a
+// segment store record
+typedef struct {
+  FILE *f;
+  bool in_mem;
+  capture_mem_ref_t mem;
+  bool in_store;
+  store_idx_t rec;
+  uint32_t off, size, mtime;
+} src_t;
+
+static bool src_open(src_t *s, const char *name) {
+  memset(s, 0, sizeof(*s));
+  if (capture_mem_acquire(name, &s->mem)) {
+    s->in_mem = true;
+    s->size = s->mem.len;
+    s->mtime = s->mem.mtime;
+    return true;
+  }
+  char path[128];
+  snprintf(path, sizeof(path), "%s/%s", CAPTURES_DIR, name);
+  struct stat st;
+  if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && (s->f = fopen(path, "rb")) != NULL) {
+    s->size = (uint32_t)st.st_size;
+    s->mtime = (uint32_t)st.st_mtime;
+    return true;
+  }
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+  char id[STORE_NAME_LEN + STORE_EXT_LEN];
+  snprintf(id, sizeof(id), "%s", name);
+  char *dot = strrchr(id, '.');
+  if (dot) {
+    *dot = 0;
+    if (capture_store_find(id, dot + 1, &s->rec)) {
+      s->in_store = true;
+      s->size = s->rec.len;
+      s->mtime = s->rec.mtime;
+      return true;
+    }
+  }
+#endif
+  return false;
+}
+
+static void src_close(src_t *s) {
+  if (s->in_mem) capture_mem_release(&s->mem);
+  if (s->f) fclose(s->f);
+}
+
+static int read_src(void *src, char *dst, int n) {
+  src_t *s = (src_t*)src;
+  if (s->f) return (int)fread(dst, 1, (size_t)n, s->f);
+  if (s->off >= s->size) return 0;
+  if ((uint32_t)n > s->size - s->off) n = (int)(s->size - s->off);
+  if (s->in_mem) memcpy(dst, s->mem.data + s->off, (size_t)n);
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+  else if (!capture_store_read(&s->rec, s->off, dst, (size_t)n)) return -1;
+#endif
+  s->off += (uint32_t)n;
+  return n;
+}
+
+static int read_slave(void *src, char *dst, int n) {
+  return slave_stream_read((slave_stream_t*)src, dst, n);
+}
+
+// Returns false only if the archive is broken; a missing slave copy is skipped
+static bool export_slave_copy(export_ctx_t *c, const char *name, uint32_t mtime) {
+  char path[96], entry[96];
+  snprintf(path, sizeof(path), "/captures/%s", name);
+  int64_t len = 0;
+  if (!c->link && !(c->link = slave_stream_create())) return true;
+  int code = slave_stream_begin(c->link, path, &len);
+  if (code != 200) {
+    if (code < 0) ESP_LOGW(TAG, "slave copy of %s unavailable", name);
+    return true;
+  }
+  snprintf(entry, sizeof(entry), "slave/%s", name);
+  uint32_t crc;
+  bool has_crc = slave_stream_crc(c->link, &crc);
+  bool ok = len <= UINT32_MAX && tar_member(c, entry, (uint32_t)len, mtime, read_slave, c->link, has_crc ? &crc : NULL);
+  slave_stream_end(c->link, ok);
+  return ok;
+}
+
+// Missing files are skipped; returns false only if the archive is broken
+static bool export_file(export_ctx_t *c, const char *name) {
+  src_t src;
+  if (!src_open(&src, name)) return true;
+  char entry[96];
+  snprintf(entry, sizeof(entry), "%s%s", c->slave ? "master/" : "", name);
+  uint32_t crc;
+  bool has_crc = capture_http_recorded_crc(name, &crc);
+  bool ok = tar_member(c, entry, src.size, src.mtime, read_src, &src, has_crc ? &crc : NULL);
+  src_close(&src);
+  if (ok && c->slave) ok = export_slave_copy(c, name, src.mtime);
+  return ok;
+}
+
+// Walks the catalog, not the directory: captures still only in PSRAM or in
+// the segment store are exported too
+static bool export_all(export_ctx_t *c) {
+  bool ok = true;
+  catalog_rec_t r;
+  bool have = capture_catalog_lookup(c->from, &r) || capture_catalog_next(c->from, &r);
+  while (ok && have && r.id <= c->to) {
+    char name[40];
+    snprintf(name, sizeof(name), "cap_%08u.%s", (unsigned)r.id, capture_catalog_ext(&r));
+    ok = export_file(c, name);
+    snprintf(name, sizeof(name), "cap_%08u.json", (unsigned)r.id);
+    if (ok) ok = export_file(c, name);
+    have = capture_catalog_next(r.id, &r);
+  }
+
+  // End of archive: two zero blocks
+  return ok && emit_zeros(c, 2 * TAR_BLOCK) && flush(c);
+}
+
+static void export_task(void *arg) {
+  export_ctx_t *c = (export_ctx_t*)arg;
+  httpd_req_t *req = c->req;
+
+  snprintf(c->disp, sizeof(c->disp), "attachment; filename=\"captures_%u-%u.tar\"",
+           (unsigned)c->from, (unsigned)c->to);
+  httpd_resp_set_type(req, "application/x-tar");
+  httpd_resp_set_hdr(req, "Content-Disposition", c->disp);
+
+  bool ready = capture_catalog_ready();
+  bool ok = ready && export_all(c);
+  if (!ready) httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "catalog rebuilding");
+  else if (ok) httpd_resp_send_chunk(req, NULL, 0);
+  // A truncated archive must not look complete: drop the connection instead of ending the chunks
+  else httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+  ESP_LOGI(TAG, "%s: %u files (%u CRC-checked), %llu bytes", ok ? "done" : "aborted",
+           (unsigned)c->files, (unsigned)c->verified, (unsigned long long)c->bytes);
+
+  slave_stream_destroy(c->link);
+  heap_caps_free(c->buf);
+  free(c);
+  portENTER_CRITICAL(&s_mux);
+  s_busy = false;
+  portEXIT_CRITICAL(&s_mux);
+  httpd_req_async_handler_complete(req);
+  vTaskDelete(NULL);
+}
+
+static uint32_t query_u32(const char *q, const char *key, uint32_t def) {
+  char v[16];
+  if (httpd_query_key_value(q, key, v, sizeof(v)) != ESP_OK) return def;
+  return (uint32_t)strtoul(v, NULL, 10);
+}
+
+esp_err_t capture_export_handler(httpd_req_t *req) {
+  char q[96] = "";
+  httpd_req_get_url_query_str(req, q, sizeof(q));
+
+  export_ctx_t *c = (export_ctx_t*)calloc(1, sizeof(*c));
+  if (!c) return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no mem");
+  c->from = query_u32(q, "from", 0);
+  c->to = query_u32(q, "to", UINT32_MAX);
+#if CONFIG_ROLE_MASTER
+  c->slave = query_u32(q, "slave", 0) != 0;
+#endif
+  if (c->from > c->to) {
+    free(c);
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "from > to");
+  }
+
+  c->cap = CAPTURE_EXPORT_BUF;
+  c->buf = (uint8_t*)heap_caps_malloc(c->cap, MALLOC_CAP_DMA);
+  if (!c->buf) {
+    free(c);
+    return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no mem");
+  }
+
+  bool admit = false;
+  portENTER_CRITICAL(&s_mux);
+  if (!s_busy) { s_busy = true; admit = true; }
+  portEXIT_CRITICAL(&s_mux);
+  if (!admit) {
+    heap_caps_free(c->buf);
+    free(c);
+    return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "export already running");
+  }
+
+  bool started = httpd_req_async_handler_begin(req, &c->req) == ESP_OK;
+  if (started && xTaskCreate(export_task, "capture_export", 4096, c, 5, NULL) == pdPASS) return ESP_OK;
+
+  if (started) httpd_req_async_handler_complete(c->req);
+  slave_stream_destroy(c->link);
+  heap_caps_free(c->buf);
+  free(c);
+  portENTER_CRITICAL(&s_mux);
+  s_busy = false;
+  portEXIT_CRITICAL(&s_mux);
+  return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "export failed to start");
+}
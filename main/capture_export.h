@@ -0,0 +1,14 @@
+#pragma once
+#include "esp_http_server.h"
+
+// GET /captures/export?from=&to=[&slave=1]: streams an uncompressed ustar
+// archive of the cataloged captures with from <= id <= to (main file and JSON
+// sidecar), read from the PSRAM store, the SD card or the segment store into
+// one bounded buffer (no temp files). With slave=1 (master only) each
+// file is followed by the slave's copy of the same name, fetched over the
+// persistent link; entries are then named master/<file> and slave/<file>.
+// Files with a recorded CRC32 (local sidecar, or the slave's X-Capture-CRC32)
+// are summed as they are copied; a mismatch aborts the archive.
+#define CAPTURE_EXPORT_BUF  (16 * 1024)
+
+esp_err_t capture_export_handler(httpd_req_t *req);
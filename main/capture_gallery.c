@@ -0,0 +1,252 @@
+#include "capture_gallery.h"
+#include "chunk_writer.h"
+#include "capture_catalog.h"
+#include "capture_mem.h"
+#include "capture_store.h"
+#include "jpeg_decoder.h"
+#include "img_converters.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static const char *TAG = "GALLERY";
+
+#define ID_LEN     24
+
+static QueueHandle_t s_q = NULL;
+static volatile bool s_rescan = true;   // backfill once at boot
+
+// "cap_<digits>"; *num gets the digits
+static bool parse_id(const char *s, size_t len, uint32_t *num) {
+  if (len < 5 || len >= ID_LEN || strncmp(s, "cap_", 4) != 0) return false;
+  uint32_t v = 0;
+  for (size_t i = 4; i < len; i++) {
+    if (s[i] < '0' || s[i] > '9') return false;
+    v = v * 10 + (uint32_t)(s[i] - '0');
+  }
+  *num = v;
+  return true;
+}
+
+static bool read_file(const char *path, uint8_t *buf, size_t len) {
+  FILE *f = fopen(path, "rb");
+  if (!f) return false;
+  bool ok = fread(buf, 1, len, f) == len;
+  fclose(f);
+  return ok;
+}
+
+static bool make_thumb(const char *id) {
+  uint32_t num;
+  if (!parse_id(id, strlen(id), &num)) return false;
+  char src[128], dst[128], tmp[136];
+  snprintf(src, sizeof(src), "%s/%s.jpg", CAPTURES_DIR, id);
+  snprintf(dst, sizeof(dst), "%s/%s.jpg", THUMBS_DIR, id);
+  struct stat st;
+  if (stat(dst, &st) == 0) {
+    // Made before the catalog kept the flag
+    capture_catalog_set_thumb(num);
+    return true;
+  }
+  // A deferred capture may not be on the card yet
+  char name[CAPTURE_MEM_NAME_LEN];
+  snprintf(name, sizeof(name), "%s.jpg", id);
+  capture_mem_ref_t ref;
+  bool in_mem = capture_mem_acquire(name, &ref);
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+  bool in_store = false;
+  store_idx_t rec;
+#endif
+  if (in_mem) {
+    st.st_size = ref.len;
+  } else if (stat(src, &st) != 0) {
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+    // Or only in a segment file
+    if (!capture_store_find(id, "jpg", &rec)) return false;
+    in_store = true;
+    st.st_size = rec.len;
+#else
+    return false;
+#endif
+  }
+  if (st.st_size == 0 || st.st_size > GALLERY_MAX_SRC) {
+    if (in_mem) capture_mem_release(&ref);
+    return false;
+  }
+
+  size_t len = (size_t)st.st_size;
+  uint8_t *jpg = (uint8_t*)heap_caps_malloc(len, MALLOC_CAP_SPIRAM);
+  uint8_t *rgb = NULL, *out = NULL;
+  size_t out_len = 0;
+  bool ok = jpg != NULL;
+  if (ok && in_mem) memcpy(jpg, ref.data, len);
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+  else if (ok && in_store) ok = capture_store_read(&rec, 0, jpg, len);
+#endif
+  else if (ok) ok = read_file(src, jpg, len);
+  if (in_mem) capture_mem_release(&ref);
+
+  // swap_color_bytes: fmt2jpg wants the camera's big-endian RGB565
+  esp_jpeg_image_cfg_t cfg = {
+    .indata = jpg,
+    .indata_size = (uint32_t)len,
+    .out_format = JPEG_IMAGE_FORMAT_RGB565,
+    .out_scale = JPEG_IMAGE_SCALE_1_8,
+    .flags = { .swap_color_bytes = 1 },
+  };
+  esp_jpeg_image_output_t img;
+  if (ok) ok = esp_jpeg_get_image_info(&cfg, &img) == ESP_OK && img.output_len > 0;
+  if (ok) ok = (rgb = (uint8_t*)heap_caps_malloc(img.output_len, MALLOC_CAP_SPIRAM)) != NULL;
+  if (ok) {
+    cfg.outbuf = rgb;
+    cfg.outbuf_size = (uint32_t)img.output_len;
+    ok = esp_jpeg_decode(&cfg, &img) == ESP_OK;
+  }
+  heap_caps_free(jpg);
+  if (ok) ok = fmt2jpg(rgb, img.output_len, img.width, img.height, PIXFORMAT_RGB565,
+                       GALLERY_THUMB_QUALITY, &out, &out_len);
+  heap_caps_free(rgb);
+
+  if (ok) {
+    // Write then rename: a reader never sees a partial thumbnail
+    snprintf(tmp, sizeof(tmp), "%s.tmp", dst);
+    FILE *f = fopen(tmp, "wb");
+    ok = f && fwrite(out, 1, out_len, f) == out_len;
+    if (f) fclose(f);
+    ok = ok && rename(tmp, dst) == 0;
+    if (!ok) remove(tmp);
+  }
+  free(out);
+  if (ok) capture_catalog_set_thumb(num);
+  if (ok) ESP_LOGI(TAG, "%s: %ux%u thumb, %u bytes", id, img.width, img.height, (unsigned)out_len);
+  else ESP_LOGW(TAG, "%s: no thumbnail", id);
+  return ok;
+}
+
+// Thumbnails for every cataloged JPEG capture that has none yet
+static void backfill(void) {
+  catalog_rec_t page[16];
+  char id[ID_LEN];
+  uint32_t off = 0;
+  int n;
+  while ((n = capture_catalog_page(off, page, 16)) > 0) {
+    for (int i = 0; i < n; i++) {
+      if (page[i].loc == CATALOG_LOC_MEM || strcmp(capture_catalog_ext(&page[i]), "jpg")) continue;
+      snprintf(id, sizeof(id), "cap_%08u", (unsigned)page[i].id);
+      make_thumb(id);
+      vTaskDelay(1);
+    }
+    off += (uint32_t)n;
+  }
+}
+
+static void thumb_task(void *arg) {
+  (void)arg;
+  char id[ID_LEN];
+  for (;;) {
+    if (xQueueReceive(s_q, id, pdMS_TO_TICKS(s_rescan ? 0 : 5000)) == pdTRUE) {
+      make_thumb(id);
+    } else if (s_rescan) {
+      s_rescan = false;
+      backfill();
+    }
+  }
+}
+
+void capture_gallery_init(void) {
+  if (s_q) return;
+  s_q = xQueueCreate(GALLERY_QUEUE_LEN, ID_LEN);
+  // Camera driver runs on core 0: decode/encode stays on core 1, just above idle
+  xTaskCreatePinnedToCore(thumb_task, "thumbs", 6144, NULL, tskIDLE_PRIORITY + 1, NULL, 1);
+}
+
+void capture_gallery_enqueue(const char *id) {
+  char buf[ID_LEN];
+  snprintf(buf, sizeof(buf), "%s", id);
+  if (!s_q || xQueueSend(s_q, buf, 0) != pdTRUE) s_rescan = true;
+}
+
+// ------------------ HTTP ------------------
+
+static int query_int(const char *q, const char *key, int def) {
+  char v[12];
+  if (httpd_query_key_value(q, key, v, sizeof(v)) != ESP_OK) return def;
+  return atoi(v);
+}
+
+esp_err_t capture_gallery_list_handler(httpd_req_t *req) {
+  char q[64] = "";
+  httpd_req_get_url_query_str(req, q, sizeof(q));
+  int offset = query_int(q, "offset", 0);
+  int limit = query_int(q, "limit", 20);
+  if (offset < 0 || limit < 1 || limit > GALLERY_PAGE_MAX)
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "bad offset/limit");
+  if (!capture_catalog_ready())
+    return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "catalog rebuilding");
+
+  catalog_rec_t *page = (catalog_rec_t*)malloc(GALLERY_PAGE_MAX * sizeof(catalog_rec_t));
+  if (!page) return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no mem");
+  uint32_t total = capture_catalog_count();
+  int n = capture_catalog_page((uint32_t)offset, page, limit);
+
+  httpd_resp_set_type(req, "application/json");
+  chunk_writer_t w;
+  cw_init(&w, req);
+  cw_printf(&w, "{\"total\":%u,\"offset\":%d,\"items\":[", (unsigned)total, offset);
+  for (int i = 0; i < n; i++) {
+    const catalog_rec_t *r = &page[i];
+    bool thumb = r->flags & CATALOG_F_THUMB;
+    cw_printf(&w, "%s{\"id\":\"cap_%08u\",\"files\":[\"%s\",\"json\"],\"size\":%u,\"mtime\":%u,"
+              "\"location\":\"%s\",\"thumb\":%s}",
+              i ? "," : "", (unsigned)r->id, capture_catalog_ext(r), (unsigned)r->size, (unsigned)r->mtime,
+              r->loc == CATALOG_LOC_STORE ? "store" : r->loc == CATALOG_LOC_MEM ? "memory" : "file",
+              thumb ? "true" : "false");
+  }
+  cw_puts(&w, "]}");
+  free(page);
+  return cw_finish(&w);
+}
+
+esp_err_t capture_gallery_thumb_handler(httpd_req_t *req) {
+  char q[64] = "", id[ID_LEN];
+  uint32_t num;
+  httpd_req_get_url_query_str(req, q, sizeof(q));
+  if (httpd_query_key_value(q, "id", id, sizeof(id)) != ESP_OK || !parse_id(id, strlen(id), &num))
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "bad id");
+
+  char path[128];
+  snprintf(path, sizeof(path), "%s/%s.jpg", THUMBS_DIR, id);
+  struct stat st;
+  if (stat(path, &st) != 0 || st.st_size <= 0 || st.st_size > 64 * 1024) {
+    capture_gallery_enqueue(id);
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "thumbnail pending");
+  }
+
+  // A capture never changes, so neither does its thumbnail
+  char etag[32], inm[32];
+  snprintf(etag, sizeof(etag), "\"t%x-%lx\"", (unsigned)st.st_size, (unsigned long)st.st_mtime);
+  httpd_resp_set_hdr(req, "ETag", etag);
+  httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=31536000, immutable");
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", inm, sizeof(inm)) == ESP_OK && !strcmp(inm, etag)) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, NULL, 0);
+  }
+
+  uint8_t *buf = (uint8_t*)malloc((size_t)st.st_size);
+  if (!buf) return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no mem");
+  esp_err_t r;
+  if (read_file(path, buf, (size_t)st.st_size)) {
+    httpd_resp_set_type(req, "image/jpeg");
+    r = httpd_resp_send(req, (const char*)buf, (ssize_t)st.st_size);
+  } else {
+    r = httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "read failed");
+  }
+  free(buf);
+  return r;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <stdbool.h>
+#include "esp_http_server.h"
+#include "app_config.h"
+
+// Capture gallery: thumbnails are made by a low-priority task pinned to the core
+// the camera driver does not use (1/8-scale esp_jpeg decode, re-encoded with
+// fmt2jpg) and kept in THUMBS_DIR, so browsing never touches a full-size JPEG.
+//
+// GET /api/captures?offset=&limit=   newest first from the catalog: id, files,
+//                                    size, mtime, location, thumb
+// GET /api/captures/thumb?id=<id>    cached thumbnail (immutable, ETag/304);
+//                                    404 queues it when it does not exist yet
+#define GALLERY_QUEUE_LEN     16
+#define GALLERY_MAX_SRC       (1024 * 1024)   // larger JPEGs are not thumbnailed
+#define GALLERY_THUMB_QUALITY 70              // fmt2jpg scale, higher = better
+#define GALLERY_PAGE_MAX      50
+
+void capture_gallery_init(void);
+// Non-blocking; a full queue triggers a pass over the catalog once the task is idle
+void capture_gallery_enqueue(const char *id);
+
+esp_err_t capture_gallery_list_handler(httpd_req_t *req);
+esp_err_t capture_gallery_thumb_handler(httpd_req_t *req);
@@ -0,0 +1,413 @@
+#include "capture_http.h"
+#include "capture_mem.h"
+#include "capture_store.h"
+#include "app_config.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+static const char *TAG = "DL";
+
+#define SECTOR        512
+#define URI_PREFIX    "/captures/"
+#define CRC_HEADER    "X-Capture-CRC32"
+
+typedef struct {
+  httpd_req_t *req;
+  char path[128];
+  const char *ctype;
+  uint32_t size;
+  uint32_t start, end;    // inclusive byte range
+  bool partial;
+  bool in_mem;            // served from the PSRAM store
+  capture_mem_ref_t mem;
+  bool in_store;          // served from a segment store record
+  store_idx_t rec;
+  bool has_crc;           // crc recorded at write time
+  bool verify;            // full body: sum it while sending
+  uint32_t crc, sum;
+  char etag[32];
+} dl_ctx_t;
+
+static const uint32_t k_kbps_le[] = { 64, 128, 256, 512, 768, 1024, 1536, 2048, 4096 };
+static capture_http_stats_t s_st;
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static int s_clients = 0;
+
+static const char *ctype_for(const char *name) {
+  const char *dot = strrchr(name, '.');
+  if (!dot) return "application/octet-stream";
+  if (!strcmp(dot, ".jpg")) return "image/jpeg";
+  if (!strcmp(dot, ".json")) return "application/json";
+  if (!strcmp(dot, ".dng")) return "image/x-adobe-dng";
+  return "application/octet-stream";
+}
+
+static bool valid_name(const char *s) {
+  if (!*s || *s == '.') return false;
+  for (; *s; s++) {
+    if (!isalnum((unsigned char)*s) && *s != '_' && *s != '-' && *s != '.') return false;
+  }
+  return true;
+}
+
+// "bytes=a-b", "bytes=a-", "bytes=-n". Returns 1 ok, 0 ignore header, -1 unsatisfiable.
+static int parse_range(const char *h, uint32_t size, uint32_t *start, uint32_t *end) {
+  if (strncmp(h, "bytes=", 6) != 0 || strchr(h, ',')) return 0;   // multi-range: send it all
+  const char *p = h + 6;
+  char *e;
+  if (*p == '-') {
+    unsigned long n = strtoul(p + 1, &e, 10);
+    if (e == p + 1 || *e) return 0;
+    if (n == 0 || size == 0) return -1;
+    *start = n >= size ? 0 : size - (uint32_t)n;
+    *end = size - 1;
+    return 1;
+  }
+  unsigned long a = strtoul(p, &e, 10);
+  if (e == p || *e != '-') return 0;
+  p = e + 1;
+  unsigned long b = size ? size - 1 : 0;
+  if (*p) {
+    b = strtoul(p, &e, 10);
+    if (*e || b < a) return 0;
+  }
+  if (a >= size) return -1;
+  *start = (uint32_t)a;
+  *end = b >= size ? size - 1 : (uint32_t)b;
+  return 1;
+}
+
+static bool send_all(httpd_req_t *req, const char *buf, size_t len) {
+  int timeouts = 0;
+  while (len > 0) {
+    int n = httpd_send(req, buf, len);
+    if (n < 0) {
+      // a stalled client gets a few send timeouts, then the download is dropped
+      if (n == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < 4) continue;
+      return false;
+    }
+    timeouts = 0;
+    buf += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+// Status line and headers are written directly: httpd_resp_send_chunk() would
+// switch to chunked encoding, and resumable downloads need Content-Length.
+static bool send_head(httpd_req_t *req, const dl_ctx_t *c) {
+  char h[320];
+  uint32_t len = c->size ? c->end - c->start + 1 : 0;
+  int n = snprintf(h, sizeof(h),
+    "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %u\r\nAccept-Ranges: bytes\r\nETag: %s\r\n",
+    c->partial ? "206 Partial Content" : "200 OK", c->ctype, (unsigned)len, c->etag);
+  if (c->partial)
+    n += snprintf(h + n, sizeof(h) - n, "Content-Range: bytes %u-%u/%u\r\n",
+                  (unsigned)c->start, (unsigned)c->end, (unsigned)c->size);
+  if (c->has_crc) n += snprintf(h + n, sizeof(h) - n, CRC_HEADER ": %08x\r\n", (unsigned)c->crc);
+  n += snprintf(h + n, sizeof(h) - n, "\r\n");
+  return send_all(req, h, (size_t)n);
+}
+
+// Sums a chunk about to be sent; false if it is the last one and the body
+// does not match what was written
+static bool check_chunk(dl_ctx_t *c, const uint8_t *p, uint32_t n, bool last) {
+  if (!c->verify) return true;
+  c->sum = esp_rom_crc32_le(c->sum, p, n);
+  if (!last) return true;
+  bool ok = c->sum == c->crc;
+  portENTER_CRITICAL(&s_mux);
+  if (ok) s_st.crc_checked++;
+  else s_st.crc_errors++;
+  portEXIT_CRITICAL(&s_mux);
+  if (!ok) ESP_LOGE(TAG, "%s: CRC %08x, recorded %08x", c->path, (unsigned)c->sum, (unsigned)c->crc);
+  return ok;
+}
+
+// Not on the card yet (or cached): straight from PSRAM, no staging buffer
+static bool send_mem(dl_ctx_t *c, uint32_t *sent) {
+  if (!send_head(c->req, c)) return false;
+  uint32_t len = c->size ? c->end - c->start + 1 : 0;
+  for (uint32_t off = 0; off < len; off += CAPTURE_DL_BUF) {
+    uint32_t n = len - off < CAPTURE_DL_BUF ? len - off : CAPTURE_DL_BUF;
+    const uint8_t *p = c->mem.data + c->start + off;
+    if (!check_chunk(c, p, n, off + n == len) || !send_all(c->req, (const char*)p, n)) return false;
+    *sent += n;
+  }
+  return true;
+}
+
+static bool send_file(dl_ctx_t *c, uint32_t *sent) {
+  httpd_req_t *req = c->req;
+  bool ok = false;
+  size_t cap = CAPTURE_DL_BUF;
+  uint8_t *buf = (uint8_t*)heap_caps_malloc(cap, MALLOC_CAP_DMA);
+  if (!buf) buf = (uint8_t*)heap_caps_malloc(cap = 8 * 1024, MALLOC_CAP_DMA);
+  FILE *f = buf ? fopen(c->path, "rb") : NULL;
+
+  if (f && send_head(req, c)) {
+    // Unbuffered stdio + sector-aligned offsets let FATFS read straight into buf
+    setvbuf(f, NULL, _IONBF, 0);
+    uint32_t base = c->start & ~(uint32_t)(SECTOR - 1);
+    uint32_t skip = c->start - base;
+    uint32_t remaining = c->size ? c->end - c->start + 1 : 0;
+    ok = fseek(f, (long)base, SEEK_SET) == 0;
+
+    while (ok && remaining > 0) {
+      size_t want = cap;
+      if (skip + remaining < want) want = (skip + remaining + SECTOR - 1) & ~(size_t)(SECTOR - 1);
+      size_t got = fread(buf, 1, want, f);
+      if (got <= skip) { ok = false; break; }
+      uint32_t n = (uint32_t)(got - skip);
+      if (n > remaining) n = remaining;
+      ok = check_chunk(c, buf + skip, n, n == remaining) && send_all(req, (const char*)buf + skip, n);
+      *sent += ok ? n : 0;
+      remaining -= n;
+      skip = 0;
+    }
+  }
+  if (f) fclose(f);
+  heap_caps_free(buf);
+  return ok;
+}
+
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+// Only in a segment file: read through the store, which knows the offset
+static bool send_store(dl_ctx_t *c, uint32_t *sent) {
+  uint8_t *buf = (uint8_t*)heap_caps_malloc(CAPTURE_DL_BUF, MALLOC_CAP_DMA);
+  bool ok = buf && send_head(c->req, c);
+  uint32_t len = c->size ? c->end - c->start + 1 : 0;
+  for (uint32_t off = 0; ok && off < len; off += CAPTURE_DL_BUF) {
+    uint32_t n = len - off < CAPTURE_DL_BUF ? len - off : CAPTURE_DL_BUF;
+    ok = capture_store_read(&c->rec, c->start + off, buf, n) &&
+         check_chunk(c, buf, n, off + n == len) && send_all(c->req, (const char*)buf, n);
+    *sent += ok ? n : 0;
+  }
+  heap_caps_free(buf);
+  return ok;
+}
+#endif
+
+static void free_ctx(dl_ctx_t *c) {
+  if (c->in_mem) capture_mem_release(&c->mem);
+  free(c);
+}
+
+static void dl_task(void *arg) {
+  dl_ctx_t *c = (dl_ctx_t*)arg;
+  httpd_req_t *req = c->req;
+  int64_t t0 = esp_timer_get_time();
+  uint32_t sent = 0;
+  bool ok;
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+  if (c->in_store) ok = send_store(c, &sent);
+  else
+#endif
+  ok = c->in_mem ? send_mem(c, &sent) : send_file(c, &sent);
+
+  int64_t us = esp_timer_get_time() - t0;
+  portENTER_CRITICAL(&s_mux);
+  s_st.bytes += sent;
+  s_st.send_us += (uint64_t)us;
+  if (!ok) s_st.aborted++;
+  if (ok && sent >= 64 * 1024 && us > 0)
+    metrics_hist_observe(&s_st.kbps, (uint32_t)((uint64_t)sent * 1000000 / 1024 / (uint64_t)us));
+  s_clients--;
+  portEXIT_CRITICAL(&s_mux);
+
+  if (!ok) ESP_LOGW(TAG, "%s: aborted after %u bytes", c->path, (unsigned)sent);
+  // Close the socket on failure: the promised Content-Length was not delivered
+  if (!ok) httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+  httpd_req_async_handler_complete(req);
+  free_ctx(c);
+  vTaskDelete(NULL);
+}
+
+// "cap_00000001.jpg" as a segment store record
+static bool find_store_rec(const char *name, store_idx_t *out) {
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+  char id[STORE_NAME_LEN + STORE_EXT_LEN];
+  snprintf(id, sizeof(id), "%s", name);
+  char *dot = strrchr(id, '.');
+  if (!dot) return false;
+  *dot = 0;
+  return capture_store_find(id, dot + 1, out);
+#else
+  (void)name;
+  (void)out;
+  return false;
+#endif
+}
+
+esp_err_t capture_http_handler(httpd_req_t *req) {
+  if (!s_st.kbps.le) {
+    portENTER_CRITICAL(&s_mux);
+    if (!s_st.kbps.le) metrics_hist_init(&s_st.kbps, k_kbps_le, sizeof(k_kbps_le) / sizeof(k_kbps_le[0]));
+    portEXIT_CRITICAL(&s_mux);
+  }
+
+  char name[64];
+  snprintf(name, sizeof(name), "%s", req->uri + strlen(URI_PREFIX));
+  name[strcspn(name, "?#")] = 0;
+  if (!valid_name(name)) return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "not found");
+
+  dl_ctx_t *c = (dl_ctx_t*)calloc(1, sizeof(*c));
+  if (!c) return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no mem");
+  snprintf(c->path, sizeof(c->path), "%s/%s", CAPTURES_DIR, name);
+
+  struct stat st;
+  c->in_mem = capture_mem_acquire(name, &c->mem);
+  if (c->in_mem) {
+    c->size = c->mem.len;
+    st.st_mtime = c->mem.mtime;
+    c->crc = c->mem.crc;
+    c->has_crc = true;
+  } else if (stat(c->path, &st) == 0 && S_ISREG(st.st_mode)) {
+    c->size = (uint32_t)st.st_size;
+    c->has_crc = capture_http_recorded_crc(name, &c->crc);
+  } else if (find_store_rec(name, &c->rec)) {
+    c->in_store = true;
+    c->size = c->rec.len;
+    st.st_mtime = c->rec.mtime;
+    c->crc = c->rec.crc32;
+    c->has_crc = c->rec.crc32 != 0;
+  } else {
+    free(c);
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "not found");
+  }
+  c->ctype = ctype_for(name);
+  c->start = 0;
+  c->end = c->size ? c->size - 1 : 0;
+  snprintf(c->etag, sizeof(c->etag), "\"%x-%lx\"", (unsigned)c->size, (unsigned long)st.st_mtime);
+
+  portENTER_CRITICAL(&s_mux);
+  s_st.requests++;
+  portEXIT_CRITICAL(&s_mux);
+
+  char range[64], if_range[40];
+  bool use_range = httpd_req_get_hdr_value_str(req, "Range", range, sizeof(range)) == ESP_OK;
+  // If-Range with a stale validator: the file changed, send all of it
+  if (use_range && httpd_req_get_hdr_value_str(req, "If-Range", if_range, sizeof(if_range)) == ESP_OK)
+    use_range = !strcmp(if_range, c->etag);
+  if (use_range) {
+    int r = parse_range(range, c->size, &c->start, &c->end);
+    if (r < 0) {
+      char h[160];
+      int n = snprintf(h, sizeof(h),
+        "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%u\r\nContent-Length: 0\r\n\r\n",
+        (unsigned)c->size);
+      free_ctx(c);
+      portENTER_CRITICAL(&s_mux);
+      s_st.not_satisfiable++;
+      portEXIT_CRITICAL(&s_mux);
+      return send_all(req, h, (size_t)n) ? ESP_OK : ESP_FAIL;
+    }
+    if (r > 0) {
+      c->partial = true;
+      portENTER_CRITICAL(&s_mux);
+      s_st.ranges++;
+      portEXIT_CRITICAL(&s_mux);
+    }
+  }
+
+  c->verify = c->has_crc && !c->partial && c->size > 0;
+
+  if (req->method == HTTP_HEAD) {
+    bool ok = send_head(req, c);
+    free_ctx(c);
+    return ok ? ESP_OK : ESP_FAIL;
+  }
+
+  bool admit = false;
+  portENTER_CRITICAL(&s_mux);
+  if (s_clients < CAPTURE_DL_MAX_CLIENTS) { s_clients++; admit = true; }
+  portEXIT_CRITICAL(&s_mux);
+  if (!admit) {
+    free_ctx(c);
+    return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "too many downloads");
+  }
+
+  if (httpd_req_async_handler_begin(req, &c->req) != ESP_OK) {
+    free_ctx(c);
+    portENTER_CRITICAL(&s_mux);
+    s_clients--;
+    portEXIT_CRITICAL(&s_mux);
+    return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "async failed");
+  }
+  if (xTaskCreate(dl_task, "capture_dl", 4096, c, 5, NULL) != pdPASS) {
+    httpd_req_async_handler_complete(c->req);
+    free_ctx(c);
+    portENTER_CRITICAL(&s_mux);
+    s_clients--;
+    portEXIT_CRITICAL(&s_mux);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+// "crc32":"0123abcd" near the top of a sidecar
+static bool crc_from_json(const char *s, uint32_t *crc) {
+  const char *p = strstr(s, "\"crc32\":\"");
+  if (!p) return false;
+  p += 9;
+  char *e;
+  unsigned long v = strtoul(p, &e, 16);
+  if (e != p + 8 || *e != '"') return false;
+  *crc = (uint32_t)v;
+  return true;
+}
+
+bool capture_http_recorded_crc(const char *name, uint32_t *crc) {
+  capture_mem_ref_t ref;
+  if (capture_mem_acquire(name, &ref)) {
+    *crc = ref.crc;
+    capture_mem_release(&ref);
+    return true;
+  }
+  char id[64];
+  snprintf(id, sizeof(id), "%s", name);
+  char *dot = strrchr(id, '.');
+  // A sidecar has no sidecar of its own
+  if (!dot || !strcmp(dot, ".json")) return false;
+  *dot = 0;
+  store_idx_t e;
+  if (find_store_rec(name, &e) && e.crc32) {
+    *crc = e.crc32;
+    return true;
+  }
+
+  // The key is near the start of every sidecar, so the head of the file is enough
+  char json[72], buf[160];
+  size_t n = 0;
+  snprintf(json, sizeof(json), "%s.json", id);
+  if (capture_mem_acquire(json, &ref)) {
+    n = ref.len < sizeof(buf) - 1 ? ref.len : sizeof(buf) - 1;
+    memcpy(buf, ref.data, n);
+    capture_mem_release(&ref);
+  } else {
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s", CAPTURES_DIR, json);
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+  }
+  buf[n] = 0;
+  return crc_from_json(buf, crc);
+}
+
+void capture_http_get_stats(capture_http_stats_t *out) {
+  portENTER_CRITICAL(&s_mux);
+  *out = s_st;
+  portEXIT_CRITICAL(&s_mux);
+  if (!out->kbps.le) metrics_hist_init(&out->kbps, k_kbps_le, sizeof(k_kbps_le) / sizeof(k_kbps_le[0]));
+}
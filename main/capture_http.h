@@ -0,0 +1,34 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_http_server.h"
+#include "metrics_hist.h"
+
+// GET/HEAD /captures/<name>: serves files from CAPTURES_DIR with a fixed
+// Content-Length, single-range Range/If-Range support (206/416) and a strong
+// ETag, so large downloads can be resumed. Bodies are sent from a sector-aligned
+// DMA buffer by a worker task, detached from the httpd task. Files held in the
+// PSRAM store (capture_mem.h) are sent from there, whether or not they have
+// reached the card yet; records only in the segment store (capture_store.h)
+// are read from their segment.
+//
+// When the CRC32 recorded at write time is known it is sent as
+// X-Capture-CRC32, and a full-body response is summed as it goes out: on a
+// mismatch the last chunk is withheld and the connection closed, so the client
+// sees a short body instead of a corrupt file.
+#define CAPTURE_DL_BUF          (32 * 1024)
+#define CAPTURE_DL_MAX_CLIENTS  2
+
+typedef struct {
+  uint32_t requests, ranges, not_satisfiable, aborted;
+  uint32_t crc_checked, crc_errors;   // full bodies verified against the recorded CRC
+  uint64_t bytes;
+  uint64_t send_us;             // time spent reading + sending bodies
+  metrics_hist_t kbps;          // per-response throughput, KiB/s
+} capture_http_stats_t;
+
+esp_err_t capture_http_handler(httpd_req_t *req);
+// CRC32 recorded for capture file `name` ("cap_00000001.jpg"): from the PSRAM
+// store, the segment store index or the "crc32" field of its sidecar
+bool capture_http_recorded_crc(const char *name, uint32_t *crc);
+void capture_http_get_stats(capture_http_stats_t *out);
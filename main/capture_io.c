@@ -0,0 +1,174 @@
+#include "capture_io.h"
+#include "app_config.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_vfs_fat.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "CAPIO";
+
+static SemaphoreHandle_t s_lock = NULL;   // guards s_buf
+static uint8_t *s_buf = NULL;
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static capture_io_stats_t s_st;
+
+void capture_io_init(void) {
+  if (s_lock) return;
+  s_lock = xSemaphoreCreateMutex();
+  // Allocated once: a 16 KiB internal block is easy to get at boot, not after
+  // the heap has fragmented
+  s_buf = (uint8_t*)heap_caps_malloc(CAPTURE_IO_CHUNK, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+  if (!s_buf) ESP_LOGW(TAG, "no DMA staging buffer, capture writes go through stdio");
+}
+
+static const uint8_t k_zero[512] = { 0 };
+
+// Copies parts back to back into s_buf and writes it whenever full; caller holds s_lock
+static bool writev_staged(FILE *f, const capture_io_part_t *parts, int n, size_t pad, uint32_t *crc) {
+  size_t fill = 0;
+  for (int i = 0; i <= n; i++) {
+    const uint8_t *src = i < n ? (const uint8_t*)parts[i].data : k_zero;
+    size_t len = i < n ? parts[i].len : pad;
+    while (len > 0) {
+      size_t k = CAPTURE_IO_CHUNK - fill < len ? CAPTURE_IO_CHUNK - fill : len;
+      memcpy(s_buf + fill, src, k);
+      // Summed from internal RAM, not from PSRAM a second time
+      if (crc && i < n) *crc = esp_rom_crc32_le(*crc, s_buf + fill, (uint32_t)k);
+      fill += k;
+      len -= k;
+      if (i < n) src += k;
+      if (fill == CAPTURE_IO_CHUNK) {
+        if (fwrite(s_buf, 1, fill, f) != fill) return false;
+        fill = 0;
+      }
+    }
+  }
+  return fill == 0 || fwrite(s_buf, 1, fill, f) == fill;
+}
+
+static bool writev_direct(FILE *f, const capture_io_part_t *parts, int n, size_t pad, uint32_t *crc) {
+  for (int i = 0; i < n; i++) {
+    if (fwrite(parts[i].data, 1, parts[i].len, f) != parts[i].len) return false;
+    if (crc) *crc = esp_rom_crc32_le(*crc, (const uint8_t*)parts[i].data, (uint32_t)parts[i].len);
+  }
+  return pad == 0 || fwrite(k_zero, 1, pad, f) == pad;
+}
+
+static void lock(void) {
+  if (s_lock) xSemaphoreTake(s_lock, portMAX_DELAY);
+}
+
+static void unlock(void) {
+  if (s_lock) xSemaphoreGive(s_lock);
+}
+
+// Caller holds s_lock
+static bool writev_locked(FILE *f, const capture_io_part_t *parts, int n, size_t align, uint32_t *crc) {
+  size_t total = 0;
+  for (int i = 0; i < n; i++) total += parts[i].len;
+  size_t pad = align > 1 && total % align ? align - total % align : 0;
+  if (pad > sizeof(k_zero)) return false;
+
+  bool ok = s_buf ? writev_staged(f, parts, n, pad, crc) : writev_direct(f, parts, n, pad, crc);
+  portENTER_CRITICAL(&s_mux);
+  if (ok) s_st.bytes += total;
+  portEXIT_CRITICAL(&s_mux);
+  return ok;
+}
+
+static void note_files(bool ok, uint32_t files, uint32_t preallocated, int64_t us) {
+  portENTER_CRITICAL(&s_mux);
+  if (ok) {
+    s_st.files += files;
+    s_st.preallocated += preallocated;
+    s_st.write_us += (uint64_t)us;
+  } else {
+    s_st.failures++;
+  }
+  portEXIT_CRITICAL(&s_mux);
+}
+
+bool capture_io_writev(FILE *f, const capture_io_part_t *parts, int n, size_t align, uint32_t *crc) {
+  lock();
+  bool ok = writev_locked(f, parts, n, align, crc);
+  unlock();
+  return ok;
+}
+
+FILE *capture_io_open(const char *path, size_t len, bool *prealloc) {
+  // Contiguous clusters reserved in one FAT update; "r+" keeps them
+  remove(path);
+  *prealloc = len > 0 && esp_vfs_fat_create_contiguous_file(SD_MOUNT_POINT, path, len, true) == ESP_OK;
+  FILE *f = fopen(path, *prealloc ? "r+b" : "wb");
+  if (f) setvbuf(f, NULL, _IONBF, 0);
+  return f;
+}
+
+bool capture_io_close(FILE *f, bool prealloc, int64_t us, const char *sidecar, const char *meta) {
+  int64_t t0 = esp_timer_get_time();
+  uint32_t files = 1, preallocated = prealloc ? 1 : 0;
+  lock();
+  bool ok = fclose(f) == 0;
+  if (ok && sidecar) {
+    bool side_prealloc;
+    size_t len = strlen(meta);
+    FILE *g = capture_io_open(sidecar, len, &side_prealloc);
+    ok = g != NULL;
+    if (ok) {
+      capture_io_part_t part = { meta, len };
+      ok = writev_locked(g, &part, 1, 0, NULL);
+      ok = (fclose(g) == 0) && ok;
+    }
+    files++;
+    if (side_prealloc) preallocated++;
+    if (!ok) ESP_LOGE(TAG, "sidecar write failed: %s", sidecar);
+  }
+  unlock();
+  note_files(ok, files, preallocated, us + esp_timer_get_time() - t0);
+  return ok;
+}
+
+void capture_io_note(bool ok, bool prealloc, int64_t us) {
+  note_files(ok, 1, prealloc ? 1 : 0, us);
+}
+
+bool capture_io_write(const char *path, const void *data, size_t len, int64_t *us, uint32_t *crc) {
+  int64_t t0 = esp_timer_get_time();
+  if (crc) *crc = 0;
+
+  bool prealloc;
+  FILE *f = capture_io_open(path, len, &prealloc);
+  bool ok = f != NULL;
+  if (ok) {
+    capture_io_part_t part = { data, len };
+    ok = capture_io_writev(f, &part, 1, 0, crc);
+    ok = (fclose(f) == 0) && ok;
+  }
+
+  int64_t dt = esp_timer_get_time() - t0;
+  if (us) *us = dt;
+  if (!ok) ESP_LOGE(TAG, "write failed: %s (%u bytes)", path, (unsigned)len);
+  note_files(ok, 1, prealloc ? 1 : 0, dt);
+  return ok;
+}
+
+void capture_io_copy(void *dst, const void *src, size_t len, uint32_t *crc) {
+  uint8_t *d = (uint8_t*)dst;
+  const uint8_t *s = (const uint8_t*)src;
+  for (size_t off = 0; off < len; off += CAPTURE_IO_CHUNK) {
+    size_t k = len - off < CAPTURE_IO_CHUNK ? len - off : CAPTURE_IO_CHUNK;
+    memcpy(d + off, s + off, k);
+    if (crc) *crc = esp_rom_crc32_le(*crc, d + off, (uint32_t)k);
+  }
+}
+
+void capture_io_get_stats(capture_io_stats_t *out) {
+  portENTER_CRITICAL(&s_mux);
+  *out = s_st;
+  portEXIT_CRITICAL(&s_mux);
+}
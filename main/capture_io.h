@@ -0,0 +1,51 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Capture file writes. Frames live in PSRAM, which the SDMMC DMA cannot read,
+// so an unstaged fwrite() is bounced to the card one 512-byte sector at a time.
+// Here data is copied through a DMA-capable staging buffer one FAT allocation
+// unit at a time and written unbuffered, so every write is a whole-cluster
+// multi-sector transfer. Files are allocated up front (contiguous when the card
+// allows) so no FAT chain is extended while the frame is written.
+#define CAPTURE_IO_CHUNK (16 * 1024)   // = allocation_unit_size in sdmmc_mount.c
+
+typedef struct {
+  uint32_t files, failures;
+  uint32_t preallocated;        // files that got a contiguous allocation
+  uint64_t bytes;
+  uint64_t write_us;            // open + allocate + write + close
+} capture_io_stats_t;
+
+typedef struct {
+  const void *data;
+  size_t len;
+} capture_io_part_t;
+
+void capture_io_init(void);
+// Writes the parts back to back at f's current position, zero-padded to a
+// multiple of `align` (<= 512; 0 = none). f should be unbuffered (_IONBF).
+// If crc is non-NULL it is carried on over the parts (not the padding): each
+// chunk is summed right after it is copied into the staging buffer, so the
+// CRC costs no pass of its own. Start from 0; same value as zlib's crc32().
+bool capture_io_writev(FILE *f, const capture_io_part_t *parts, int n, size_t align, uint32_t *crc);
+// Replaces path with a file of len bytes allocated up front, opened unbuffered
+// for capture_io_writev(); *prealloc tells whether the allocation succeeded
+FILE *capture_io_open(const char *path, size_t len, bool *prealloc);
+// Closes f, written with capture_io_open() + capture_io_writev() in us so far,
+// and counts it in the stats. If sidecar is non-NULL the JSON in meta is
+// written to it in the same pass: the staging buffer is held from the close
+// through the sidecar, so no other capture write gets in between.
+bool capture_io_close(FILE *f, bool prealloc, int64_t us, const char *sidecar, const char *meta);
+// Counts a write made through capture_io_writev() into a file the caller
+// keeps open (a capture_store.c record) in the stats
+void capture_io_note(bool ok, bool prealloc, int64_t us);
+// Writes len bytes to path (replacing it); *us gets the elapsed time and *crc
+// the CRC32 of the data, each if non-NULL
+bool capture_io_write(const char *path, const void *data, size_t len, int64_t *us, uint32_t *crc);
+// memcpy() in CAPTURE_IO_CHUNK pieces, carrying *crc on over each piece while
+// it is still in cache
+void capture_io_copy(void *dst, const void *src, size_t len, uint32_t *crc);
+void capture_io_get_stats(capture_io_stats_t *out);
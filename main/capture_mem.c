@@ -0,0 +1,479 @@
+#include "capture_mem.h"
+#include "capture_catalog.h"
+#include "capture_io.h"
+#include "capture_store.h"
+#include "app_state.h"
+#include "app_config.h"
+#include "cJSON.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *TAG = "CAPMEM";
+
+#define NVS_NS    "capture_mem"
+#define SLOT(i)   ((s_first + (i)) % CAPTURE_MEM_MAX_ENTRIES)
+
+#if CONFIG_CAPTURE_MEM_MEMORY_ONLY
+#define DEFAULT_MODE CAPTURE_MEM_MEMORY
+#elif CONFIG_CAPTURE_MEM_DEFERRED
+#define DEFAULT_MODE CAPTURE_MEM_DEFERRED
+#else
+#define DEFAULT_MODE CAPTURE_MEM_IMMEDIATE
+#endif
+
+// FILLING is reserved and being copied into outside the lock: not served yet.
+// PENDING and WRITING hold data the card does not have yet and are never
+// evicted; a copy or write in progress also holds a reference, so the entry
+// stays put if it is discarded meanwhile
+enum { E_FILLING, E_PENDING, E_WRITING, E_CLEAN, E_MEMORY, E_DISCARDED };
+
+typedef struct {
+  char name[CAPTURE_MEM_NAME_LEN];
+  uint32_t off, len;            // data in the ring
+  uint32_t mtime;
+  uint32_t crc;                 // CRC32 of the data, summed while it was copied in
+  int64_t t_put;
+  uint8_t state;
+  uint8_t refs;                 // readers between acquire and release
+} entry_t;
+
+static const char *k_mode_names[] = { "immediate", "deferred", "memory" };
+
+static SemaphoreHandle_t s_lock = NULL;   // everything below
+static uint8_t *s_ring = NULL;
+static uint32_t s_size = 0;
+static uint32_t s_head = 0;               // end of the newest entry's data
+static entry_t s_e[CAPTURE_MEM_MAX_ENTRIES];
+static int s_first = 0, s_count = 0;      // oldest entry, entries held (FIFO)
+static int64_t s_last_put = 0;
+static TaskHandle_t s_task = NULL;
+static capture_mem_stats_t s_st = { .mode = DEFAULT_MODE };
+
+static void load_mode(void) {
+  nvs_handle_t h;
+  uint8_t v;
+  if (nvs_open(NVS_NS, NVS_READONLY, &h) != ESP_OK) return;
+  if (nvs_get_u8(h, "mode", &v) == ESP_OK && v <= CAPTURE_MEM_MEMORY) s_st.mode = (capture_mem_mode_t)v;
+  nvs_close(h);
+}
+
+static void store_mode(capture_mem_mode_t m) {
+  nvs_handle_t h;
+  if (nvs_open(NVS_NS, NVS_READWRITE, &h) != ESP_OK) return;
+  if (nvs_set_u8(h, "mode", (uint8_t)m) == ESP_OK) nvs_commit(h);
+  nvs_close(h);
+}
+
+// "cap_00000001.json" -> "cap_00000001" and "json"
+static void split_name(const char *name, char *id, int id_max, char *ext, int ext_max) {
+  snprintf(id, id_max, "%s", name);
+  char *dot = strrchr(id, '.');
+  if (dot) *dot = 0;
+  snprintf(ext, ext_max, "%s", dot ? dot + 1 : "bin");
+}
+
+// Appends to the segment store when it is mounted, else (or while its index
+// is full) writes a file of its own; crc is that of the data (the store
+// records it)
+static bool write_card(const char *name, const void *data, size_t len, uint32_t crc, int64_t *us) {
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+  if (capture_store_enabled()) {
+    char id[STORE_NAME_LEN], ext[STORE_EXT_LEN];
+    split_name(name, id, sizeof(id), ext, sizeof(ext));
+    if (capture_store_append(id, ext, data, len, crc, us)) return true;
+    if (!capture_store_full()) return false;
+    ESP_LOGW(TAG, "%s: store index full, writing a file", name);
+  }
+#endif
+  (void)crc;
+  char path[128];
+  snprintf(path, sizeof(path), "%s/%s", CAPTURES_DIR, name);
+  return capture_io_write(path, data, len, us, NULL);
+}
+
+// write_card() for data that bypasses the ring: the file path sums it while
+// staging, only the store needs a pass of its own for its record trailer
+static bool write_direct(const char *name, const void *data, size_t len, uint32_t *crc, int64_t *us) {
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+  if (capture_store_enabled() && !capture_store_full()) {
+    *crc = esp_rom_crc32_le(0, (const uint8_t*)data, (uint32_t)len);
+    return write_card(name, data, len, *crc, us);
+  }
+#endif
+  char path[128];
+  snprintf(path, sizeof(path), "%s/%s", CAPTURES_DIR, name);
+  return capture_io_write(path, data, len, us, crc);
+}
+
+// Where `len` bytes of data can go without evicting anything. Data occupies
+// [oldest.off, s_head), wrapping at the end of the ring; a full ring has
+// s_head == oldest.off.
+static bool fits_locked(uint32_t len, uint32_t *off) {
+  if (!s_count) {
+    s_head = 0;
+    *off = 0;
+    return len <= s_size;
+  }
+  if (s_count == CAPTURE_MEM_MAX_ENTRIES) return false;
+  uint32_t tail = s_e[s_first].off;
+  if (s_head > tail) {
+    if (len <= s_size - s_head) { *off = s_head; return true; }
+    if (len <= tail) { *off = 0; return true; }
+    return false;
+  }
+  if (s_head + len <= tail && s_head != tail) { *off = s_head; return true; }
+  return false;
+}
+
+// Evicts from the oldest end until len fits; a memory-only capture evicted
+// before it was ever written is noted in lost[] for the catalog
+static bool reserve_locked(uint32_t len, uint32_t *off, uint32_t *lost, int *n_lost) {
+  while (!fits_locked(len, off)) {
+    entry_t *e = &s_e[s_first];
+    if (!s_count || e->state == E_FILLING || e->state == E_PENDING || e->state == E_WRITING || e->refs) return false;
+    if (e->state == E_MEMORY) {
+      s_st.lost++;
+      unsigned id;
+      char ext[8];
+      if (sscanf(e->name, "cap_%u.%7s", &id, ext) == 2 && strcmp(ext, "json")) lost[(*n_lost)++] = id;
+    }
+    e->state = E_DISCARDED;
+    s_first = (s_first + 1) % CAPTURE_MEM_MAX_ENTRIES;
+    s_count--;
+    s_st.evicted++;
+  }
+  return true;
+}
+
+static int find_locked(const char *name) {
+  for (int i = s_count - 1; i >= 0; i--) {
+    entry_t *e = &s_e[SLOT(i)];
+    if (e->state != E_DISCARDED && e->state != E_FILLING && !strcmp(e->name, name)) return SLOT(i);
+  }
+  return -1;
+}
+
+// Also hides an entry still being copied in, so it is never published
+static void discard_locked(const char *name) {
+  for (int i = 0; i < s_count; i++) {
+    entry_t *e = &s_e[SLOT(i)];
+    if (e->state != E_DISCARDED && !strcmp(e->name, name)) e->state = E_DISCARDED;
+  }
+}
+
+static void note_written_locked(entry_t *e, int64_t us, bool ok) {
+  if (!ok) {
+    s_st.flush_failures++;
+    return;
+  }
+  int64_t lag = esp_timer_get_time() - e->t_put;
+  s_st.flushed++;
+  s_st.flush_bytes += e->len;
+  s_st.flush_us += (uint64_t)us;
+  s_st.last_lag_us = lag;
+  if (lag > s_st.max_lag_us) s_st.max_lag_us = lag;
+}
+
+bool capture_mem_save(const char *path, const void *data, size_t len, int64_t *us, uint32_t *crc) {
+  uint32_t sum = 0;
+  if (!crc) crc = &sum;
+  const char *base = strrchr(path, '/');
+  const char *name = base ? base + 1 : path;
+  if (!s_ring || strlen(name) >= CAPTURE_MEM_NAME_LEN || len == 0 || len > s_size) {
+    if (s_lock) {
+      xSemaphoreTake(s_lock, portMAX_DELAY);
+      s_st.bypassed++;
+      xSemaphoreGive(s_lock);
+    }
+    return write_direct(name, data, len, crc, us);
+  }
+
+  int64_t t0 = esp_timer_get_time();
+  uint32_t lost[CAPTURE_MEM_MAX_ENTRIES];
+  int n_lost = 0, slot = -1;
+  uint32_t off = 0;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  capture_mem_mode_t mode = s_st.mode;
+  // A capture saved again under the same name replaces the older entry
+  discard_locked(name);
+  if (reserve_locked(((uint32_t)len + 3) & ~3u, &off, lost, &n_lost)) {
+    // Claim the space, copy without the lock, publish below
+    slot = SLOT(s_count);
+    entry_t *e = &s_e[slot];
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    e->off = off;
+    e->len = (uint32_t)len;
+    e->crc = 0;
+    e->state = E_FILLING;
+    e->refs = 1;
+    s_head = off + (((uint32_t)len + 3) & ~3u);
+    s_count++;
+    s_st.puts++;
+  } else {
+    s_st.bypassed++;
+  }
+  s_last_put = esp_timer_get_time();
+  xSemaphoreGive(s_lock);
+
+  if (slot >= 0) {
+    uint32_t sum_data = 0;
+    capture_io_copy(s_ring + off, data, len, &sum_data);
+    *crc = sum_data;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    entry_t *e = &s_e[slot];
+    e->crc = sum_data;
+    e->mtime = (uint32_t)time(NULL);
+    e->t_put = esp_timer_get_time();
+    // Discarded while copying (saved again meanwhile): stays hidden
+    if (e->state == E_FILLING)
+      e->state = mode == CAPTURE_MEM_MEMORY ? E_MEMORY : mode == CAPTURE_MEM_DEFERRED ? E_PENDING : E_WRITING;
+    if (mode != CAPTURE_MEM_IMMEDIATE) e->refs--;   // else held by the write below
+    xSemaphoreGive(s_lock);
+  }
+
+  for (int i = 0; i < n_lost; i++) {
+    char id[24];
+    snprintf(id, sizeof(id), "cap_%08u", (unsigned)lost[i]);
+    capture_catalog_remove(lost[i]);
+    ESP_LOGW(TAG, "%s dropped from memory, never written", id);
+  }
+
+  if (slot < 0) {
+    // Oldest entry still waiting for the card: this one cannot wait behind it
+    return write_direct(name, data, len, crc, us);
+  }
+
+  bool ok = true;
+  if (mode == CAPTURE_MEM_IMMEDIATE) {
+    int64_t wus = 0;
+    ok = write_card(name, s_ring + off, len, *crc, &wus);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    note_written_locked(&s_e[slot], wus, ok);
+    // Not on the card: the caller sees the failure, nothing is served
+    if (s_e[slot].state == E_WRITING) s_e[slot].state = ok ? E_CLEAN : E_DISCARDED;
+    s_e[slot].refs--;
+    xSemaphoreGive(s_lock);
+  } else if (mode == CAPTURE_MEM_DEFERRED && s_task) {
+    xTaskNotifyGive(s_task);
+  }
+  if (us) *us = esp_timer_get_time() - t0;
+  return ok;
+}
+
+bool capture_mem_acquire(const char *name, capture_mem_ref_t *out) {
+  if (!s_ring) return false;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  int k = find_locked(name);
+  // Out of references: the caller falls back to the card like on a miss
+  bool ok = k >= 0 && s_e[k].refs < UINT8_MAX;
+  if (ok) {
+    s_e[k].refs++;
+    out->data = s_ring + s_e[k].off;
+    out->len = s_e[k].len;
+    out->mtime = s_e[k].mtime;
+    out->crc = s_e[k].crc;
+    out->slot = k;
+  }
+  xSemaphoreGive(s_lock);
+  return ok;
+}
+
+void capture_mem_release(const capture_mem_ref_t *ref) {
+  if (!s_ring || ref->slot < 0) return;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  if (s_e[ref->slot].refs) s_e[ref->slot].refs--;
+  xSemaphoreGive(s_lock);
+}
+
+void capture_mem_discard(const char *name) {
+  if (!s_ring) return;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  discard_locked(name);
+  xSemaphoreGive(s_lock);
+}
+
+// The SD card is left to the capture paths while a camera session runs and
+// for a moment after each capture, so bursts are not slowed down by flushes
+static bool card_idle(void) {
+  if (g_app.cam_mutex && xSemaphoreGetMutexHolder(g_app.cam_mutex) != NULL) return false;
+  return esp_timer_get_time() - s_last_put >= (int64_t)CAPTURE_MEM_IDLE_MS * 1000;
+}
+
+static bool any_pending(void) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  bool any = false;
+  for (int i = 0; i < s_count && !any; i++) any = s_e[SLOT(i)].state == E_PENDING;
+  xSemaphoreGive(s_lock);
+  return any;
+}
+
+// Writes the oldest pending entry; false if there was none or the write failed
+static bool flush_oldest(void) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  int k = -1;
+  for (int i = 0; i < s_count && k < 0; i++)
+    if (s_e[SLOT(i)].state == E_PENDING) k = SLOT(i);
+  if (k >= 0) {
+    s_e[k].state = E_WRITING;
+    s_e[k].refs++;
+  }
+  xSemaphoreGive(s_lock);
+  if (k < 0) return false;
+
+  // The reference keeps the entry from being evicted or reused while unlocked
+  entry_t *e = &s_e[k];
+  int64_t us = 0;
+  bool ok = write_card(e->name, s_ring + e->off, e->len, e->crc, &us);
+
+  char id[CAPTURE_MEM_NAME_LEN], ext[8];
+  split_name(e->name, id, sizeof(id), ext, sizeof(ext));
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  note_written_locked(e, us, ok);
+  // Replaced by a newer capture meanwhile: keep it hidden
+  if (e->state == E_WRITING) e->state = ok ? E_CLEAN : E_PENDING;
+  e->refs--;
+  xSemaphoreGive(s_lock);
+
+  if (!ok) ESP_LOGW(TAG, "%s: flush failed, retrying", id);
+  // The catalog record moves from memory to the card
+  else capture_catalog_add(id, ext);
+  return ok;
+}
+
+static void flush_task(void *arg) {
+  (void)arg;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CAPTURE_MEM_POLL_MS));
+    while (any_pending()) {
+      if (!card_idle()) {
+        vTaskDelay(pdMS_TO_TICKS(CAPTURE_MEM_IDLE_MS));
+        continue;
+      }
+      // A failed write is retried on the next poll
+      if (!flush_oldest()) break;
+    }
+  }
+}
+
+// Ring size that still leaves CAPTURE_MEM_FB_RESERVE contiguous for a raw
+// frame; 0 on boards where it does not (4 MB PSRAM)
+static uint32_t ring_budget(void) {
+  uint32_t want = (uint32_t)CONFIG_CAPTURE_MEM_KB * 1024;
+  uint32_t block = (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+  uint32_t room = block > CAPTURE_MEM_FB_RESERVE ? (block - CAPTURE_MEM_FB_RESERVE) & ~4095u : 0;
+  uint32_t size = want < room ? want : room;
+  return size >= CAPTURE_MEM_MIN_KB * 1024 ? size : 0;
+}
+
+void capture_mem_init(void) {
+  if (s_lock || CONFIG_CAPTURE_MEM_KB <= 0) return;
+  load_mode();
+  s_size = ring_budget();
+  if (!s_size) {
+    ESP_LOGW(TAG, "PSRAM kept for raw frame buffers (%u KiB free in one block), captures go straight to the card",
+             (unsigned)(heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM) / 1024));
+    return;
+  }
+  s_ring = (uint8_t*)heap_caps_malloc(s_size, MALLOC_CAP_SPIRAM);
+  // Placed so that it split the free block: a raw frame would no longer fit
+  if (s_ring && heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM) < CAPTURE_MEM_FB_RESERVE) {
+    heap_caps_free(s_ring);
+    s_ring = NULL;
+  }
+  if (!s_ring) {
+    ESP_LOGE(TAG, "no PSRAM for a %u KiB store, captures go straight to the card", (unsigned)(s_size / 1024));
+    s_size = 0;
+    return;
+  }
+  s_lock = xSemaphoreCreateMutex();
+  s_st.capacity = s_size;
+  xTaskCreatePinnedToCore(flush_task, "capture_mem", 4096, NULL, tskIDLE_PRIORITY + 1, &s_task, 1);
+  ESP_LOGI(TAG, "%u KiB in PSRAM (%u configured), durability %s", (unsigned)(s_size / 1024),
+           (unsigned)CONFIG_CAPTURE_MEM_KB, k_mode_names[s_st.mode]);
+}
+
+void capture_mem_set_mode(capture_mem_mode_t m) {
+  if (s_lock) xSemaphoreTake(s_lock, portMAX_DELAY);
+  s_st.mode = m;
+  if (s_lock) xSemaphoreGive(s_lock);
+  store_mode(m);
+  if (s_task) xTaskNotifyGive(s_task);
+}
+
+void capture_mem_get_stats(capture_mem_stats_t *out) {
+  if (!s_lock) {
+    *out = s_st;
+    return;
+  }
+  int64_t now = esp_timer_get_time();
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  *out = s_st;
+  out->entries = 0;
+  out->used = 0;
+  out->pending = out->pending_bytes = 0;
+  out->oldest_pending_us = 0;
+  for (int i = 0; i < s_count; i++) {
+    const entry_t *e = &s_e[SLOT(i)];
+    out->used += (e->len + 3) & ~3u;
+    if (e->state == E_DISCARDED) continue;
+    out->entries++;
+    if (e->state != E_PENDING && e->state != E_WRITING) continue;
+    if (!out->pending) out->oldest_pending_us = now - e->t_put;
+    out->pending++;
+    out->pending_bytes += e->len;
+  }
+  xSemaphoreGive(s_lock);
+}
+
+// ------------------ HTTP ------------------
+
+static esp_err_t send_state(httpd_req_t *req) {
+  capture_mem_stats_t st;
+  capture_mem_get_stats(&st);
+  char buf[512];
+  snprintf(buf, sizeof(buf),
+    "{\"durability\":\"%s\",\"capacity\":%u,\"used\":%u,\"entries\":%u,\"pending\":%u,\"pending_bytes\":%u,"
+    "\"oldest_pending_ms\":%lld,\"last_lag_ms\":%lld,\"max_lag_ms\":%lld,\"puts\":%u,\"flushed\":%u,"
+    "\"flush_kbps\":%u,\"evicted\":%u,\"lost\":%u,\"bypassed\":%u,\"flush_failures\":%u}",
+    k_mode_names[st.mode], (unsigned)st.capacity, (unsigned)st.used, (unsigned)st.entries,
+    (unsigned)st.pending, (unsigned)st.pending_bytes, (long long)(st.oldest_pending_us / 1000),
+    (long long)(st.last_lag_us / 1000), (long long)(st.max_lag_us / 1000), (unsigned)st.puts,
+    (unsigned)st.flushed,
+    st.flush_us ? (unsigned)(st.flush_bytes * 1000000 / 1024 / st.flush_us) : 0,
+    (unsigned)st.evicted, (unsigned)st.lost, (unsigned)st.bypassed, (unsigned)st.flush_failures);
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, buf);
+}
+
+esp_err_t capture_mem_get_handler(httpd_req_t *req) {
+  return send_state(req);
+}
+
+esp_err_t capture_mem_set_handler(httpd_req_t *req) {
+  char body[96];
+  int n = httpd_req_recv(req, body, sizeof(body) - 1);
+  if (n <= 0) return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "no body");
+  body[n] = 0;
+  cJSON *root = cJSON_Parse(body);
+  if (!root) return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "bad json");
+
+  cJSON *v = cJSON_GetObjectItem(root, "durability");
+  int mode = -1;
+  for (int i = 0; i <= CAPTURE_MEM_MEMORY && cJSON_IsString(v); i++)
+    if (!strcmp(v->valuestring, k_mode_names[i])) mode = i;
+  cJSON_Delete(root);
+  if (mode < 0) return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "durability: immediate, deferred or memory");
+
+  capture_mem_set_mode((capture_mem_mode_t)mode);
+  return send_state(req);
+}
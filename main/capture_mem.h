@@ -0,0 +1,77 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_http_server.h"
+
+// PSRAM capture store. Single-frame captures and their sidecars are copied
+// into a ring in PSRAM (allocated once at boot, so it does not fragment the
+// heap the camera re-allocates its frame buffers from, and only from what a
+// full raw frame leaves over) and are served from
+// there by /captures/<name> as soon as the capture returns. When they reach
+// the card depends on the durability mode:
+//
+//   immediate  written before the capture returns; the copy stays as a read cache
+//   deferred   written by a background task once the card is idle: no camera
+//              session running and no capture for CAPTURE_MEM_IDLE_MS
+//   memory     never written; dropped oldest first when space is needed and
+//              lost on reset
+//
+// Entries already on the card and memory-only entries are evicted oldest
+// first. A capture that does not fit because the oldest entry is still waiting
+// for the card is written straight to the card instead. Banded raw captures
+// and brackets do not go through here: they are written as they are taken.
+//
+// GET /api/mem: occupancy, flush lag and counters; POST /api/mem
+// {"durability":"immediate|deferred|memory"} (kept in NVS).
+#define CAPTURE_MEM_MAX_ENTRIES 64
+#define CAPTURE_MEM_NAME_LEN    40
+#define CAPTURE_MEM_IDLE_MS     300
+#define CAPTURE_MEM_POLL_MS     1000
+// PSRAM the ring must leave in one block for the camera: a non-banded raw UXGA
+// frame (RGB565) plus some slack for the driver. The ring shrinks to what is
+// left above this, and is not allocated if that is under CAPTURE_MEM_MIN_KB.
+#define CAPTURE_MEM_FB_RESERVE  (1600 * 1200 * 2 + 128 * 1024)
+#define CAPTURE_MEM_MIN_KB      256
+
+typedef enum { CAPTURE_MEM_IMMEDIATE = 0, CAPTURE_MEM_DEFERRED = 1, CAPTURE_MEM_MEMORY = 2 } capture_mem_mode_t;
+
+typedef struct {
+  const uint8_t *data;
+  uint32_t len;
+  uint32_t mtime;
+  uint32_t crc;                 // CRC32 of data
+  int slot;                     // for capture_mem_release()
+} capture_mem_ref_t;
+
+typedef struct {
+  capture_mem_mode_t mode;
+  uint32_t capacity, used;      // ring bytes
+  uint32_t entries;
+  uint32_t pending, pending_bytes;   // not on the card yet (memory-only entries excluded)
+  uint32_t puts, flushed, evicted, lost;   // lost: memory-only entries evicted
+  uint32_t bypassed;            // written straight to the card: store off, full or entry too large
+  uint32_t flush_failures;
+  int64_t oldest_pending_us;    // age of the oldest pending entry, 0 if none
+  int64_t last_lag_us, max_lag_us;   // capture -> on the card
+  uint64_t flush_bytes, flush_us;
+} capture_mem_stats_t;
+
+// Allocates the ring (CONFIG_CAPTURE_MEM_KB, less if PSRAM would not keep
+// CAPTURE_MEM_FB_RESERVE free) and starts the flush task
+void capture_mem_init(void);
+// Saves len bytes as `path` (a file in CAPTURES_DIR) according to the current
+// mode; without the store, or if it is full, the data goes to the card (the
+// segment store when mounted) right away. *us gets the time the caller spent
+// and *crc the CRC32 of the data, summed as it is copied or written.
+bool capture_mem_save(const char *path, const void *data, size_t len, int64_t *us, uint32_t *crc);
+// Pins the entry for file `name` ("cap_00000001.jpg") until capture_mem_release()
+bool capture_mem_acquire(const char *name, capture_mem_ref_t *out);
+void capture_mem_release(const capture_mem_ref_t *ref);
+// Forgets the entry for file `name` (it was deleted from the card)
+void capture_mem_discard(const char *name);
+void capture_mem_set_mode(capture_mem_mode_t m);
+void capture_mem_get_stats(capture_mem_stats_t *out);
+
+esp_err_t capture_mem_get_handler(httpd_req_t *req);
+esp_err_t capture_mem_set_handler(httpd_req_t *req);
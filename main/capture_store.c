@@ -0,0 +1,549 @@
+#include "capture_store.h"
+#include "capture_io.h"
+#include "capture_gallery.h"
+#include "app_config.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_vfs_fat.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+
+static const char *TAG = "STORE";
+
+#define SEG_BYTES   ((uint32_t)CONFIG_CAPTURE_SEGMENT_MB * 1024 * 1024)
+#define INDEX_PATH  STORE_DIR "/index.bin"
+#define COPY_BUF    (16 * 1024)
+#define HASH_SLOTS  (2 * STORE_MAX_RECORDS)   // power of two, at most half full
+
+static SemaphoreHandle_t s_lock = NULL;   // everything below
+static store_idx_t *s_idx = NULL;         // PSRAM, STORE_MAX_RECORDS entries
+static uint32_t s_n = 0;                  // seq is consecutive along s_idx
+static uint32_t *s_hash = NULL;           // PSRAM; seq + 1 of the newest record per name.ext, 0 = free
+static FILE *s_seg = NULL;                // write segment, unbuffered
+static FILE *s_index = NULL;
+static uint16_t s_segno = 0;
+static uint32_t s_off = 0;
+static uint32_t s_seq = 0;                // last committed
+static capture_store_stats_t s_st;
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool s_export_busy = false;
+
+static void seg_path(char *out, size_t n, uint16_t seg) {
+  snprintf(out, n, "%s/seg_%05u.dat", STORE_DIR, (unsigned)seg);
+}
+
+static uint32_t rec_size(uint32_t len) {
+  uint32_t n = (uint32_t)(sizeof(store_rec_hdr_t) + sizeof(store_rec_tail_t)) + len;
+  return (n + STORE_ALIGN - 1) & ~(uint32_t)(STORE_ALIGN - 1);
+}
+
+// Opens a segment for writing, creating (preallocated) when missing and `create`
+static FILE *open_segment(uint16_t seg, bool create) {
+  char p[64];
+  seg_path(p, sizeof(p), seg);
+  struct stat st;
+  if (stat(p, &st) != 0) {
+    if (!create) return NULL;
+    if (esp_vfs_fat_create_contiguous_file(SD_MOUNT_POINT, p, SEG_BYTES, true) != ESP_OK) {
+      ESP_LOGW(TAG, "%s: no contiguous space, growing on demand", p);
+      FILE *f = fopen(p, "wb");
+      if (!f) return NULL;
+      fclose(f);
+    }
+  }
+  FILE *f = fopen(p, "r+b");
+  if (f) setvbuf(f, NULL, _IONBF, 0);
+  return f;
+}
+
+// True if a committed record with sequence `seq` starts at `off`
+static bool check_record(FILE *f, uint16_t seg, uint32_t off, uint32_t seq, store_rec_hdr_t *h, uint32_t *crc) {
+  if (off > SEG_BYTES - rec_size(0)) return false;
+  if (fseek(f, (long)off, SEEK_SET) != 0 || fread(h, 1, sizeof(*h), f) != sizeof(*h)) return false;
+  if (h->magic != STORE_REC_MAGIC || h->version != 1 || h->seg != seg || h->seq != seq) return false;
+  if (h->len > SEG_BYTES - off - rec_size(0)) return false;
+
+  store_rec_tail_t t;
+  if (fseek(f, (long)(off + sizeof(*h) + h->len), SEEK_SET) != 0 || fread(&t, 1, sizeof(t), f) != sizeof(t)) return false;
+  h->name[STORE_NAME_LEN - 1] = 0;
+  h->ext[STORE_EXT_LEN - 1] = 0;
+  *crc = t.crc32;
+  return t.magic == STORE_TAIL_MAGIC && t.seq == seq && t.len == h->len;
+}
+
+static void entry_from(store_idx_t *e, const store_rec_hdr_t *h, uint32_t off, uint32_t crc) {
+  memset(e, 0, sizeof(*e));
+  memcpy(e->name, h->name, STORE_NAME_LEN);
+  memcpy(e->ext, h->ext, STORE_EXT_LEN);
+  e->seq = h->seq;
+  e->seg = h->seg;
+  e->offset = off;
+  e->len = h->len;
+  e->mtime = (uint32_t)h->mtime;
+  e->crc32 = crc;
+}
+
+// FNV-1a over "name.ext"
+static uint32_t key_hash(const char *name, const char *ext) {
+  uint32_t h = 2166136261u;
+  for (const char *p = name; *p; p++) h = (h ^ (uint8_t)*p) * 16777619u;
+  h = (h ^ '.') * 16777619u;
+  for (const char *p = ext; *p; p++) h = (h ^ (uint8_t)*p) * 16777619u;
+  return h;
+}
+
+static store_idx_t *by_seq_locked(uint32_t seq) {
+  if (!s_n || seq < s_idx[0].seq || seq - s_idx[0].seq >= s_n) return NULL;
+  return &s_idx[seq - s_idx[0].seq];
+}
+
+// Slot holding name.ext, or the free slot where it would go
+static uint32_t hash_slot_locked(const char *name, const char *ext) {
+  uint32_t h = key_hash(name, ext) & (HASH_SLOTS - 1);
+  for (;; h = (h + 1) & (HASH_SLOTS - 1)) {
+    if (!s_hash[h]) return h;
+    const store_idx_t *o = by_seq_locked(s_hash[h] - 1);
+    if (o && !strcmp(o->name, name) && !strcmp(o->ext, ext)) return h;
+  }
+}
+
+// e must already be in s_idx; a newer record of the same name replaces the older
+static void hash_put_locked(const store_idx_t *e) {
+  if (s_hash) s_hash[hash_slot_locked(e->name, e->ext)] = e->seq + 1;
+}
+
+static void hash_rebuild_locked(void) {
+  if (!s_hash) return;
+  memset(s_hash, 0, HASH_SLOTS * sizeof(uint32_t));
+  for (uint32_t i = 0; i < s_n; i++) hash_put_locked(&s_idx[i]);
+}
+
+// Kept in memory even when the index write fails: the next boot re-finds the
+// record by scanning from the last entry that did make it. Callers check for
+// room first (appends are refused while the index is full).
+static bool index_append(const store_idx_t *e) {
+  if (s_n >= STORE_MAX_RECORDS) {
+    ESP_LOGE(TAG, "index full, seq %u not indexed", (unsigned)e->seq);
+    return false;
+  }
+  s_idx[s_n++] = *e;
+  hash_put_locked(e);
+  if (!s_index || fwrite(e, 1, sizeof(*e), s_index) != sizeof(*e) ||
+      fflush(s_index) != 0 || fsync(fileno(s_index)) != 0)
+    ESP_LOGW(TAG, "index write failed (seq %u)", (unsigned)e->seq);
+  return true;
+}
+
+// Entries must be consecutive in seq and point inside a segment; anything after
+// the first bad one is dropped and rebuilt by the tail scan
+static void load_index(void) {
+  FILE *f = fopen(INDEX_PATH, "rb");
+  if (!f) return;
+  store_idx_t e;
+  while (s_n < STORE_MAX_RECORDS && fread(&e, 1, sizeof(e), f) == sizeof(e)) {
+    const store_idx_t *prev = s_n ? &s_idx[s_n - 1] : NULL;
+    if (prev && (e.seq != prev->seq + 1 || e.seg < prev->seg)) break;
+    if (e.offset % STORE_ALIGN || e.offset > SEG_BYTES - rec_size(e.len)) break;
+    e.name[STORE_NAME_LEN - 1] = 0;
+    e.ext[STORE_EXT_LEN - 1] = 0;
+    s_idx[s_n++] = e;
+  }
+  fclose(f);
+
+  struct stat st;
+  if (stat(INDEX_PATH, &st) == 0 && (uint32_t)st.st_size != s_n * sizeof(store_idx_t)) {
+    ESP_LOGW(TAG, "index: keeping %u entries, truncating %ld bytes", (unsigned)s_n, (long)st.st_size);
+    truncate(INDEX_PATH, (off_t)(s_n * sizeof(store_idx_t)));
+  }
+}
+
+// Walks records past the last indexed one (also into the next segment, which
+// may have been started just before a power loss) and indexes them. With the
+// index full the rest stay unindexed; the next append overwrites them.
+static void recover_tail(void) {
+  store_rec_hdr_t h;
+  uint32_t crc;
+  for (;;) {
+    if (check_record(s_seg, s_segno, s_off, s_seq + 1, &h, &crc)) {
+      store_idx_t e;
+      entry_from(&e, &h, s_off, crc);
+      if (!index_append(&e)) break;
+      s_st.recovered++;
+      s_seq = h.seq;
+      s_off += rec_size(h.len);
+      continue;
+    }
+    FILE *next = open_segment((uint16_t)(s_segno + 1), false);
+    if (!next) break;
+    if (!check_record(next, (uint16_t)(s_segno + 1), 0, s_seq + 1, &h, &crc)) {
+      fclose(next);
+      break;
+    }
+    fclose(s_seg);
+    s_seg = next;
+    s_segno++;
+    s_off = 0;
+  }
+}
+
+bool capture_store_init(void) {
+  if (s_lock) return s_seg != NULL;
+  s_lock = xSemaphoreCreateMutex();
+  s_idx = (store_idx_t*)heap_caps_malloc(STORE_MAX_RECORDS * sizeof(store_idx_t), MALLOC_CAP_SPIRAM);
+  if (!s_idx) {
+    ESP_LOGE(TAG, "no PSRAM for the index");
+    return false;
+  }
+
+  s_hash = (uint32_t*)heap_caps_calloc(HASH_SLOTS, sizeof(uint32_t), MALLOC_CAP_SPIRAM);
+  if (!s_hash) ESP_LOGW(TAG, "no PSRAM for the name lookup, scanning the index instead");
+
+  int64_t t0 = esp_timer_get_time();
+  load_index();
+  hash_rebuild_locked();
+  if (s_n) {
+    const store_idx_t *last = &s_idx[s_n - 1];
+    s_segno = last->seg;
+    s_off = last->offset + rec_size(last->len);
+    s_seq = last->seq;
+  }
+  s_index = fopen(INDEX_PATH, "ab");
+  s_seg = open_segment(s_segno, true);
+  if (!s_seg || !s_index) {
+    ESP_LOGE(TAG, "cannot open segment %u / index", (unsigned)s_segno);
+    return false;
+  }
+  recover_tail();
+
+  s_st.records = s_n;
+  s_st.segment = s_segno;
+  s_st.write_off = s_off;
+  ESP_LOGI(TAG, "%u records, segment %u @ %u, %u recovered (%lld ms)", (unsigned)s_n, (unsigned)s_segno,
+           (unsigned)s_off, (unsigned)s_st.recovered, (long long)((esp_timer_get_time() - t0) / 1000));
+  return true;
+}
+
+bool capture_store_enabled(void) {
+  return s_seg != NULL;
+}
+
+bool capture_store_full(void) {
+  if (!s_lock) return false;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  bool full = s_n >= STORE_MAX_RECORDS;
+  xSemaphoreGive(s_lock);
+  return full;
+}
+
+bool capture_store_append(const char *name, const char *ext, const void *data, size_t len, uint32_t crc, int64_t *us) {
+  int64_t t0 = esp_timer_get_time();
+  if (!s_seg || rec_size((uint32_t)len) > SEG_BYTES) return false;
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  // Never written without its index entry: the caller writes a plain file
+  // until retention drops a segment
+  if (s_n >= STORE_MAX_RECORDS) {
+    s_st.full++;
+    xSemaphoreGive(s_lock);
+    if (us) *us = esp_timer_get_time() - t0;
+    return false;
+  }
+  bool ok = true;
+  if (s_off + rec_size((uint32_t)len) > SEG_BYTES) {
+    FILE *next = open_segment((uint16_t)(s_segno + 1), true);
+    if (next) {
+      fclose(s_seg);
+      s_seg = next;
+      s_segno++;
+      s_off = 0;
+    } else {
+      ok = false;
+    }
+  }
+
+  store_rec_hdr_t h = {
+    .magic = STORE_REC_MAGIC,
+    .version = 1,
+    .seg = s_segno,
+    .seq = s_seq + 1,
+    .len = (uint32_t)len,
+    .mtime = (int64_t)time(NULL),
+  };
+  snprintf(h.name, sizeof(h.name), "%s", name);
+  snprintf(h.ext, sizeof(h.ext), "%s", ext);
+  store_rec_tail_t t = { .magic = STORE_TAIL_MAGIC, .seq = h.seq, .len = h.len, .crc32 = crc };
+  capture_io_part_t parts[] = { { &h, sizeof(h) }, { data, len }, { &t, sizeof(t) } };
+
+  // A failed write leaves s_off where it was: the next record overwrites it
+  ok = ok && fseek(s_seg, (long)s_off, SEEK_SET) == 0 &&
+       capture_io_writev(s_seg, parts, 3, STORE_ALIGN, NULL) && fsync(fileno(s_seg)) == 0;
+  if (ok) {
+    store_idx_t e;
+    entry_from(&e, &h, s_off, crc);
+    index_append(&e);
+    s_seq = h.seq;
+    s_off += rec_size(h.len);
+    s_st.records = s_n;
+    s_st.bytes += len;
+  } else {
+    s_st.failures++;
+    ESP_LOGE(TAG, "append %s.%s (%u bytes) failed", name, ext, (unsigned)len);
+  }
+  s_st.segment = s_segno;
+  s_st.write_off = s_off;
+  xSemaphoreGive(s_lock);
+
+  int64_t dt = esp_timer_get_time() - t0;
+  capture_io_note(ok, false, dt);
+  if (us) *us = dt;
+  return ok;
+}
+
+bool capture_store_find(const char *name, const char *ext, store_idx_t *out) {
+  if (!s_idx) return false;
+  bool found = false;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  if (s_hash) {
+    uint32_t seq = s_hash[hash_slot_locked(name, ext)];
+    const store_idx_t *e = seq ? by_seq_locked(seq - 1) : NULL;
+    if (e) *out = *e;
+    found = e != NULL;
+  }
+  for (uint32_t i = s_n; !s_hash && i-- > 0 && !found; ) {
+    if (strcmp(s_idx[i].name, name) || strcmp(s_idx[i].ext, ext)) continue;
+    *out = s_idx[i];
+    found = true;
+  }
+  xSemaphoreGive(s_lock);
+  return found;
+}
+
+uint32_t capture_store_count(void) {
+  return s_n;
+}
+
+bool capture_store_get(uint32_t i, store_idx_t *out) {
+  if (!s_lock) return false;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  bool ok = i < s_n;
+  if (ok) *out = s_idx[i];
+  xSemaphoreGive(s_lock);
+  return ok;
+}
+
+// Own FILE per call: committed records never change, so readers skip the lock
+bool capture_store_read(const store_idx_t *e, uint32_t off, void *buf, size_t n) {
+  if (off > e->len || n > e->len - off) return false;
+  char p[64];
+  seg_path(p, sizeof(p), e->seg);
+  FILE *f = fopen(p, "rb");
+  if (!f) return false;
+  bool ok = fseek(f, (long)(e->offset + sizeof(store_rec_hdr_t) + off), SEEK_SET) == 0 &&
+            fread(buf, 1, n, f) == n;
+  fclose(f);
+  return ok;
+}
+
+// The payload is summed as it passes through buf; a mismatch leaves no file
+static bool copy_out(const store_idx_t *e, const char *path, uint8_t *buf) {
+  char tmp[136];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *f = fopen(tmp, "wb");
+  if (!f) return false;
+  setvbuf(f, NULL, _IONBF, 0);
+  bool ok = true;
+  uint32_t crc = 0;
+  for (uint32_t off = 0; ok && off < e->len; off += COPY_BUF) {
+    size_t n = e->len - off < COPY_BUF ? e->len - off : COPY_BUF;
+    ok = capture_store_read(e, off, buf, n) && fwrite(buf, 1, n, f) == n;
+    crc = esp_rom_crc32_le(crc, buf, (uint32_t)n);
+  }
+  if (ok && e->crc32 && crc != e->crc32) {
+    ESP_LOGE(TAG, "%s.%s: CRC %08x, recorded %08x", e->name, e->ext, (unsigned)crc, (unsigned)e->crc32);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_st.crc_errors++;
+    xSemaphoreGive(s_lock);
+    ok = false;
+  }
+  ok = (fclose(f) == 0) && ok;
+  if (ok) {
+    remove(path);
+    ok = rename(tmp, path) == 0;
+  }
+  if (!ok) remove(tmp);
+  return ok;
+}
+
+int capture_store_export(const char *name) {
+  if (!s_idx) return -1;
+  uint8_t *buf = (uint8_t*)heap_caps_malloc(COPY_BUF, MALLOC_CAP_DMA);
+  if (!buf) buf = (uint8_t*)malloc(COPY_BUF);
+  if (!buf) return -1;
+
+  // Walked by seq, one entry copied out under the lock at a time: retention
+  // may drop the oldest segment meanwhile and shift the index down
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  uint32_t seq = s_n ? s_idx[0].seq : 0, last = s_seq;
+  xSemaphoreGive(s_lock);
+
+  int written = 0;
+  for (; seq <= last; seq++) {
+    store_idx_t e;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_n && seq < s_idx[0].seq) seq = s_idx[0].seq;
+    const store_idx_t *p = by_seq_locked(seq);
+    if (p) e = *p;
+    xSemaphoreGive(s_lock);
+    if (!p) break;
+
+    if (name && strcmp(e.name, name)) continue;
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s.%s", CAPTURES_DIR, e.name, e.ext);
+    struct stat st;
+    if (!name && stat(path, &st) == 0) continue;
+    if (!copy_out(&e, path, buf)) {
+      // Its segment was dropped while it was being copied
+      xSemaphoreTake(s_lock, portMAX_DELAY);
+      bool gone = !by_seq_locked(e.seq);
+      xSemaphoreGive(s_lock);
+      if (gone) continue;
+      ESP_LOGE(TAG, "export %s failed", path);
+      written = -1;
+      break;
+    }
+    written++;
+    if (!strcmp(e.ext, "jpg")) capture_gallery_enqueue(e.name);
+    if (!name) vTaskDelay(1);
+  }
+  heap_caps_free(buf);
+  return written;
+}
+
+// The index is rewritten without the segment's entries (a prefix, as segments
+// only grow); seq stays consecutive, so load_index() accepts the result
+bool capture_store_drop_oldest(uint16_t *seg, uint64_t *bytes) {
+  if (!s_seg) return false;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  bool ok = s_n > 0 && s_idx[0].seg != s_segno;
+  uint32_t k = 0;
+  uint64_t freed = 0;
+  if (ok) {
+    *seg = s_idx[0].seg;
+    while (k < s_n && s_idx[k].seg == *seg) freed += s_idx[k++].len;
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", INDEX_PATH);
+    FILE *f = fopen(tmp, "wb");
+    ok = f && fwrite(&s_idx[k], sizeof(store_idx_t), s_n - k, f) == s_n - k;
+    if (f) ok = (fclose(f) == 0) && ok;
+    if (ok) {
+      fclose(s_index);
+      remove(INDEX_PATH);
+      ok = rename(tmp, INDEX_PATH) == 0;
+      s_index = fopen(INDEX_PATH, "ab");
+    } else {
+      remove(tmp);
+    }
+  }
+  if (ok) {
+    memmove(s_idx, &s_idx[k], (s_n - k) * sizeof(store_idx_t));
+    s_n -= k;
+    hash_rebuild_locked();
+    s_st.records = s_n;
+    char p[64];
+    seg_path(p, sizeof(p), *seg);
+    remove(p);
+    *bytes = freed;
+    ESP_LOGI(TAG, "dropped segment %u (%u records)", (unsigned)*seg, (unsigned)k);
+  }
+  xSemaphoreGive(s_lock);
+  return ok;
+}
+
+void capture_store_get_stats(capture_store_stats_t *out) {
+  if (!s_lock) {
+    memset(out, 0, sizeof(*out));
+    return;
+  }
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  *out = s_st;
+  xSemaphoreGive(s_lock);
+}
+
+// ------------------ HTTP ------------------
+
+esp_err_t capture_store_info_handler(httpd_req_t *req) {
+  capture_store_stats_t st;
+  capture_store_get_stats(&st);
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+    "{\"enabled\":%s,\"records\":%u,\"max_records\":%u,\"full\":%u,\"recovered\":%u,\"failures\":%u,"
+    "\"crc_errors\":%u,\"segment\":%u,\"write_off\":%u,\"segment_bytes\":%u,\"bytes\":%llu}",
+    capture_store_enabled() ? "true" : "false", (unsigned)st.records, (unsigned)STORE_MAX_RECORDS,
+    (unsigned)st.full, (unsigned)st.recovered, (unsigned)st.failures, (unsigned)st.crc_errors, (unsigned)st.segment, (unsigned)st.write_off, (unsigned)SEG_BYTES,
+    (unsigned long long)st.bytes);
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, buf);
+}
+
+static void export_all_task(void *arg) {
+  (void)arg;
+  int n = capture_store_export(NULL);
+  ESP_LOGI(TAG, "export: %d files written", n);
+  portENTER_CRITICAL(&s_mux);
+  s_export_busy = false;
+  portEXIT_CRITICAL(&s_mux);
+  vTaskDelete(NULL);
+}
+
+static bool valid_name(const char *s) {
+  if (!*s) return false;
+  for (; *s; s++)
+    if (!((*s >= '0' && *s <= '9') || (*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || *s == '_' || *s == '-'))
+      return false;
+  return true;
+}
+
+esp_err_t capture_store_export_handler(httpd_req_t *req) {
+  if (!capture_store_enabled()) return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "store not mounted");
+  char q[64] = "", id[STORE_NAME_LEN];
+  httpd_req_get_url_query_str(req, q, sizeof(q));
+  httpd_resp_set_type(req, "application/json");
+
+  if (httpd_query_key_value(q, "id", id, sizeof(id)) == ESP_OK) {
+    if (!valid_name(id)) return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "bad id");
+    int n = capture_store_export(id);
+    if (n < 0) return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "export failed");
+    if (n == 0) return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "no such capture");
+    char buf[48];
+    snprintf(buf, sizeof(buf), "{\"ok\":true,\"files\":%d}", n);
+    return httpd_resp_sendstr(req, buf);
+  }
+
+  bool admit = false;
+  portENTER_CRITICAL(&s_mux);
+  if (!s_export_busy) { s_export_busy = true; admit = true; }
+  portEXIT_CRITICAL(&s_mux);
+  if (!admit) return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "export already running");
+  if (xTaskCreate(export_all_task, "store_export", 4096, NULL, 2, NULL) != pdPASS) {
+    portENTER_CRITICAL(&s_mux);
+    s_export_busy = false;
+    portEXIT_CRITICAL(&s_mux);
+    return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no task");
+  }
+  httpd_resp_set_status(req, "202 Accepted");
+  return httpd_resp_sendstr(req, "{\"ok\":true,\"started\":true}");
+}
+
+#endif // CONFIG_CAPTURE_STORE_SEGMENTS
@@ -0,0 +1,92 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_http_server.h"
+
+// Append-only capture container (CONFIG_CAPTURE_STORE_SEGMENTS). Files are
+// appended as records to preallocated segment files STORE_DIR/seg_NNNNN.dat:
+//
+//   store_rec_hdr_t | payload | store_rec_tail_t | zero pad to 512
+//
+// Every committed record also gets a 64-byte entry in STORE_DIR/index.bin,
+// which is loaded into PSRAM at boot for lookups by name. A record whose index
+// entry never made it to the card (power loss between the two writes) is found
+// again by scanning the tail of the last segment: records carry a store-wide
+// sequence number and a trailer, so stale card contents past the end never
+// validate. Trailer and index entry also carry the payload's CRC32, which is
+// checked when a record is exported (0 in records from older firmware).
+#define STORE_REC_MAGIC   0x31524353u   // "SCR1"
+#define STORE_TAIL_MAGIC  0x444E4553u   // "SEND"
+#define STORE_ALIGN       512
+#define STORE_MAX_RECORDS 16384
+#define STORE_NAME_LEN    32
+#define STORE_EXT_LEN     8
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t seg;
+  uint32_t seq;
+  uint32_t len;                 // payload bytes
+  int64_t  mtime;               // time(NULL) at append
+  char name[STORE_NAME_LEN];    // e.g. "cap_00000001"
+  char ext[STORE_EXT_LEN];      // e.g. "jpg", "json"
+} store_rec_hdr_t;              // 64 bytes
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t len;
+  uint32_t crc32;               // of the payload
+} store_rec_tail_t;
+
+typedef struct __attribute__((packed)) {
+  char name[STORE_NAME_LEN];
+  char ext[STORE_EXT_LEN];
+  uint32_t seq;
+  uint16_t seg;
+  uint16_t reserved;
+  uint32_t offset;              // of the record header within the segment
+  uint32_t len;                 // payload bytes
+  uint32_t mtime;
+  uint32_t crc32;               // of the payload; 0 = not recorded
+} store_idx_t;                  // 64 bytes
+
+typedef struct {
+  uint32_t records, recovered, failures;
+  uint32_t crc_errors;          // exports refused because the payload no longer matched
+  uint32_t full;                // appends refused with the index full (written as files)
+  uint16_t segment;             // current write segment
+  uint32_t write_off;
+  uint64_t bytes;
+} capture_store_stats_t;
+
+// Loads the index and recovers records past its end; false without a card
+bool capture_store_init(void);
+bool capture_store_enabled(void);
+// True while the index holds STORE_MAX_RECORDS entries; appends are refused
+// until capture_store_drop_oldest() makes room
+bool capture_store_full(void);
+// Appends one record whose payload has CRC32 `crc` (the trailer precedes any
+// chance to sum it on the way out); *us gets the elapsed time if non-NULL
+bool capture_store_append(const char *name, const char *ext, const void *data, size_t len, uint32_t crc, int64_t *us);
+// Newest record with this name/ext (hashed, no index scan)
+bool capture_store_find(const char *name, const char *ext, store_idx_t *out);
+uint32_t capture_store_count(void);
+// i-th record, oldest first
+bool capture_store_get(uint32_t i, store_idx_t *out);
+// Reads n payload bytes at `off` of a record
+bool capture_store_read(const store_idx_t *e, uint32_t off, void *buf, size_t n);
+// Writes records as CAPTURES_DIR/<name>.<ext>; name NULL = every record whose
+// file does not exist yet. Returns the number of files written, -1 on error.
+int capture_store_export(const char *name);
+void capture_store_get_stats(capture_store_stats_t *out);
+// Deletes the oldest segment and its index entries, unless it is the one being
+// written; *seg gets its number
+bool capture_store_drop_oldest(uint16_t *seg, uint64_t *bytes);
+
+// GET /api/store: counters; POST /api/store/export[?id=<name>]: export one
+// capture's records, or (no id) all missing ones in the background
+esp_err_t capture_store_info_handler(httpd_req_t *req);
+esp_err_t capture_store_export_handler(httpd_req_t *req);
@@ -0,0 +1,362 @@
+#include "capture_stripe.h"
+#include "app_config.h"
+#include "capture_io.h"
+#include "rawz_core.h"
+#include "capture_dng.h"
+#include "ov2640_ctrl.h"
+#include "frame_sync.h"
+#include "event_bus.h"
+#include "esp_camera.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *TAG = "STRIPE";
+
+#define REG_COM8       0x13   // sensor bank: bit0 AEC enable, bit2 AGC enable
+#define OV2640_UXGA    0      // set_res_raw() startX selects the sensor mode in the OV2640 driver
+
+typedef struct {
+  const char *id;
+  const char *path;
+  uint16_t w, h, rows;
+  int n;
+  framesize_t fs;               // what the camera is initialized at
+  size_t stripe_len;            // bytes per band as the driver must deliver them
+  bool bayer;
+  rawz_state_t *rz;             // NULL: bands are written as they are
+  uint8_t *zbuf;                // one coded block behind its u32 length
+  uint8_t prefix[CAPTURE_DNG_HDR];   // rawz or DNG header written before the first band
+  size_t prefix_len;
+  size_t file_len;              // bytes written so far
+  uint32_t crc;                 // and their CRC32
+  int64_t encode_us;
+  QueueHandle_t q;              // camera_fb_t*; NULL stops the writer
+  SemaphoreHandle_t done;
+  FILE *f;
+  bool prealloc;
+  volatile bool write_failed;
+  int written;
+  int64_t write_us;             // writer busy time
+  uint32_t frames;
+  uint32_t psram_free_min, psram_block_min;
+  int64_t t0, first_us, last_us, session_us;
+} stripe_ctx_t;
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static capture_stripe_stats_t s_st;
+
+// PIXFORMAT_RAW stands for Bayer RAW8 in a cam_profile_t
+static int rawz_fmt(pixformat_t pf) {
+  switch (pf) {
+    case PIXFORMAT_RGB565:    return RAWZ_FMT_RGB565;
+    case PIXFORMAT_YUV422:    return RAWZ_FMT_YUV422;
+    case PIXFORMAT_GRAYSCALE: return RAWZ_FMT_GRAY;
+    case PIXFORMAT_RAW:       return RAWZ_FMT_BAYER8;
+    default:                  return -1;
+  }
+}
+
+// What the driver is told: Bayer bytes arrive one per pixel clock, so they are
+// carried as RGB565 frames of half as many pixels
+static pixformat_t driver_format(pixformat_t pf) {
+  return pf == PIXFORMAT_RAW ? PIXFORMAT_RGB565 : pf;
+}
+
+// Band geometry for a raw profile: UXGA is split into bands that fill one
+// CAPTURE_STRIPE_FRAMESIZE driver frame, anything else is one band at its own
+// size. Bayer frames exist only as UXGA bands.
+static bool geometry(const cam_profile_t *p, stripe_ctx_t *c) {
+  int fmt = rawz_fmt(p->pixformat);
+  if (fmt < 0 || p->framesize >= FRAMESIZE_INVALID) return false;
+  c->bayer = fmt == RAWZ_FMT_BAYER8;
+  c->w = resolution[p->framesize].width;
+  c->h = resolution[p->framesize].height;
+  c->rows = c->h;
+  c->fs = p->framesize;
+  int out_bpp = rawz_bytes_per_pixel((uint8_t)fmt);
+  c->stripe_len = (size_t)c->w * c->rows * out_bpp;
+  if (p->framesize != FRAMESIZE_UXGA) return !c->bayer;
+
+  int drv_bpp = driver_format(p->pixformat) == PIXFORMAT_GRAYSCALE ? 1 : 2;
+  uint32_t fb_bytes = (uint32_t)resolution[CAPTURE_STRIPE_FRAMESIZE].width *
+                      resolution[CAPTURE_STRIPE_FRAMESIZE].height * drv_bpp;
+  if (fb_bytes % ((uint32_t)c->w * out_bpp)) return false;
+  c->rows = (uint16_t)(fb_bytes / ((uint32_t)c->w * out_bpp));
+  c->fs = CAPTURE_STRIPE_FRAMESIZE;
+  c->stripe_len = fb_bytes;
+  // Coded blocks must not straddle bands
+  return c->rows > 0 && c->rows < c->h && c->h % c->rows == 0 && c->rows % RAWZ_BLOCK_ROWS == 0;
+}
+
+bool capture_stripe_applies(const cam_profile_t *p) {
+  stripe_ctx_t c;
+  // Bands shear moving subjects, so plain raw UXGA is banded only on request
+  return geometry(p, &c) && (c.bayer || p->compress || (c.rows < c.h && p->stripes));
+}
+
+static bool put_block(stripe_ctx_t *c, const uint8_t *rows, int n) {
+  int64_t t0 = esp_timer_get_time();
+  uint32_t len = (uint32_t)rawz_encode(c->rz, rows, n, c->zbuf + 4);
+  c->encode_us += esp_timer_get_time() - t0;
+  memcpy(c->zbuf, &len, 4);
+  capture_io_part_t part = { c->zbuf, len + 4 };
+  c->file_len += len + 4;
+  return capture_io_writev(c->f, &part, 1, 0, &c->crc);
+}
+
+static bool put_band(stripe_ctx_t *c, const camera_fb_t *fb) {
+  if (!c->rz) {
+    capture_io_part_t part = { fb->buf, fb->len };
+    c->file_len += fb->len;
+    return capture_io_writev(c->f, &part, 1, 0, &c->crc);
+  }
+  for (int y = 0; y < c->rows; y += RAWZ_BLOCK_ROWS) {
+    int n = c->rows - y < RAWZ_BLOCK_ROWS ? c->rows - y : RAWZ_BLOCK_ROWS;
+    if (!put_block(c, fb->buf + (size_t)y * c->rz->row_bytes, n)) return false;
+  }
+  return true;
+}
+
+static bool open_file(stripe_ctx_t *c) {
+  // A coded file is allocated at the raw size and truncated when closed
+  c->f = capture_io_open(c->path, c->prefix_len + c->stripe_len * c->n, &c->prealloc);
+  if (!c->f || !c->prefix_len) return c->f != NULL;
+  capture_io_part_t part = { c->prefix, c->prefix_len };
+  c->file_len = c->prefix_len;
+  return capture_io_writev(c->f, &part, 1, 0, &c->crc);
+}
+
+static void writer_task(void *arg) {
+  stripe_ctx_t *c = (stripe_ctx_t*)arg;
+  camera_fb_t *fb;
+  while (xQueueReceive(c->q, &fb, portMAX_DELAY) == pdTRUE && fb) {
+    int64_t t0 = esp_timer_get_time();
+    if (!c->write_failed) {
+      if ((c->f || open_file(c)) && put_band(c, fb)) c->written++;
+      else c->write_failed = true;
+    }
+    // Frees the buffer for the driver while the next band is being framed
+    esp_camera_fb_return(fb);
+    c->write_us += esp_timer_get_time() - t0;
+  }
+  xSemaphoreGive(c->done);
+  vTaskDelete(NULL);
+}
+
+static bool move_window(const stripe_ctx_t *c, int k) {
+  sensor_t *s = esp_camera_sensor_get();
+  if (!s || !s->set_res_raw) return false;
+  // Window of `rows` full-width lines at row k*rows, output 1:1
+  int err = s->set_res_raw(s, OV2640_UXGA, 0, 0, 0, 0, k * c->rows, c->w, c->rows, c->w, c->rows, false, false);
+  ov2640_invalidate_bank();
+  // The mode table rewrites part of the sensor bank: keep exposure frozen
+  const ov2640_reg_op_t manual = { REG_BANK_SENSOR, REG_COM8, 0x05, 0x00 };
+  if (err != 0 || (k > 0 && ov2640_write_batch(&manual, 1) != 1)) return false;
+  // Window offsets are multiples of 2 rows, so the CFA phase is the same in every band
+  return !c->bayer || ov2640_enable_bayer_raw8(true, BAYER_CFA_PATTERN);
+}
+
+static camera_fb_t *next_frame(stripe_ctx_t *c) {
+  camera_fb_t *fb = cam_manager_fb_get();
+  if (!fb) return NULL;
+  c->frames++;
+  frame_sync_frame_done();
+  return fb;
+}
+
+// The frame in flight and the one queued still show the old window
+static bool drop_frames(stripe_ctx_t *c, int n) {
+  for (int i = 0; i < n; i++) {
+    camera_fb_t *fb = next_frame(c);
+    if (!fb) return false;
+    esp_camera_fb_return(fb);
+  }
+  return true;
+}
+
+static void sample_mem(stripe_ctx_t *c) {
+  uint32_t free_b = (uint32_t)heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+  uint32_t block = (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+  if (free_b < c->psram_free_min) c->psram_free_min = free_b;
+  if (block < c->psram_block_min) c->psram_block_min = block;
+}
+
+// Runs with the cam mutex held; the writer task only returns buffers
+static bool stripe_session(void *arg) {
+  stripe_ctx_t *c = (stripe_ctx_t*)arg;
+  c->t0 = esp_timer_get_time();
+  sample_mem(c);
+
+  // AEC/AGC settle on the first band in UXGA timing, then stay frozen. A
+  // single band is taken like any other capture: first frame after init.
+  const ov2640_reg_op_t manual = { REG_BANK_SENSOR, REG_COM8, 0x05, 0x00 };
+  if (c->n > 1 &&
+      (!move_window(c, 0) || !drop_frames(c, CAPTURE_STRIPE_WARMUP) || ov2640_write_batch(&manual, 1) != 1)) {
+    ESP_LOGE(TAG, "%s: sensor window setup failed", c->id);
+    return false;
+  }
+
+  c->q = xQueueCreate(1, sizeof(camera_fb_t*));
+  c->done = xSemaphoreCreateBinary();
+  // The camera task runs on core 0
+  if (!c->q || !c->done || xTaskCreatePinnedToCore(writer_task, "stripe_wr", 4096, c, 4, NULL, 1) != pdPASS) {
+    if (c->q) vQueueDelete(c->q);
+    if (c->done) vSemaphoreDelete(c->done);
+    return false;
+  }
+
+  bool ok = true;
+  for (int k = 0; ok && k < c->n && !c->write_failed; k++) {
+    if (k > 0) ok = move_window(c, k) && drop_frames(c, CAPTURE_STRIPE_SETTLE);
+    camera_fb_t *fb = ok ? next_frame(c) : NULL;
+    if (!fb) { ok = false; break; }
+    if (fb->len != c->stripe_len) {
+      ESP_LOGE(TAG, "%s: band %d is %u bytes, expected %u", c->id, k, (unsigned)fb->len, (unsigned)c->stripe_len);
+      esp_camera_fb_return(fb);
+      ok = false;
+      break;
+    }
+    sample_mem(c);
+    int64_t now = esp_timer_get_time() - c->t0;
+    if (k == 0) c->first_us = now;
+    c->last_us = now;
+    event_bus_publish(EV_FRAME, c->id, (int32_t)fb->len, 0, "stripe");
+    // Blocks while the writer still has the previous band queued
+    xQueueSend(c->q, &fb, portMAX_DELAY);
+  }
+
+  camera_fb_t *end = NULL;
+  xQueueSend(c->q, &end, portMAX_DELAY);
+  xSemaphoreTake(c->done, portMAX_DELAY);
+  vQueueDelete(c->q);
+  vSemaphoreDelete(c->done);
+  c->session_us = esp_timer_get_time() - c->t0;
+  return ok && !c->write_failed && c->written == c->n;
+}
+
+bool capture_stripe_run(const char *id, const cam_profile_t *p, const char *bin_path,
+                        const char *json_path, char *meta_json_out, int meta_max) {
+  stripe_ctx_t *c = (stripe_ctx_t*)calloc(1, sizeof(*c));
+  if (!c) return false;
+  if (!geometry(p, c)) { free(c); return false; }
+  c->id = id;
+  c->path = bin_path;
+  c->n = c->h / c->rows;
+  c->psram_free_min = c->psram_block_min = UINT32_MAX;
+  if (p->compress) {
+    // Coder state and block buffer in internal RAM when it fits: the coder reads them per byte
+    c->rz = (rawz_state_t*)heap_caps_malloc(sizeof(rawz_state_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!c->rz) c->rz = (rawz_state_t*)heap_caps_malloc(sizeof(rawz_state_t), MALLOC_CAP_SPIRAM);
+    bool ok = c->rz && rawz_init(c->rz, (uint8_t)rawz_fmt(p->pixformat), c->w);
+    if (ok) {
+      size_t zlen = 4 + rawz_bound(c->rz, RAWZ_BLOCK_ROWS);
+      c->zbuf = (uint8_t*)heap_caps_malloc(zlen, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+      if (!c->zbuf) c->zbuf = (uint8_t*)heap_caps_malloc(zlen, MALLOC_CAP_SPIRAM);
+      ok = c->zbuf != NULL;
+    }
+    if (!ok) {
+      ESP_LOGE(TAG, "%s: no memory for the coder", id);
+      heap_caps_free(c->rz);
+      free(c);
+      return false;
+    }
+    rawz_hdr_t h;
+    rawz_hdr_init(&h, c->rz->fmt, c->w, c->h);
+    memcpy(c->prefix, &h, sizeof(h));
+    c->prefix_len = sizeof(h);
+  } else if (c->bayer) {
+    capture_dng_header(c->prefix, c->w, c->h, BAYER_CFA_PATTERN, "OV2640");
+    c->prefix_len = CAPTURE_DNG_HDR;
+  }
+
+  // Driver buffers sized for one band
+  cam_profile_t sp = {
+    .framesize = c->fs,
+    .pixformat = driver_format(p->pixformat),
+    .jpeg_quality = p->jpeg_quality,
+    .fb_count = 1,
+    .raw_fb_count = c->n > 1 ? 2 : 1,
+  };
+  int64_t t0 = esp_timer_get_time();
+  bool ok = cam_manager_run_session(&sp, stripe_session, c) && c->f;
+  if (ok && c->rz) ok = ftruncate(fileno(c->f), (off_t)c->file_len) == 0;
+  int64_t total_us = esp_timer_get_time() - t0;
+
+  // The sidecar is formatted before the file is closed so both go out in one
+  // capture_io pass
+  size_t len = c->stripe_len * c->n;
+  char meta[768];
+  if (ok) {
+    char codec[160] = "";
+    if (c->rz)
+      snprintf(codec, sizeof(codec),
+        ",\"codec\":{\"name\":\"rawz\",\"raw\":%u,\"coded\":%u,\"ratio\":%.3f,\"encode_us\":%lld,\"encode_kbps\":%u}",
+        (unsigned)len, (unsigned)c->file_len, c->file_len ? (double)len / (double)c->file_len : 0.0,
+        (long long)c->encode_us,
+        c->encode_us > 0 ? (unsigned)((uint64_t)len * 1000000 / 1024 / (uint64_t)c->encode_us) : 0);
+    char bayer[96] = "";
+    if (c->bayer) {
+      sensor_t *s = esp_camera_sensor_get();
+      // CFA of the stored rows as the sensor was set; mirror/flip are not folded in
+      snprintf(bayer, sizeof(bayer), ",\"bayer\":{\"cfa\":\"%s\",\"hmirror\":%d,\"vflip\":%d,\"offset\":%u}",
+               capture_dng_cfa_name(BAYER_CFA_PATTERN), s ? s->status.hmirror : 0, s ? s->status.vflip : 0,
+               c->rz ? 0u : (unsigned)CAPTURE_DNG_HDR);
+    }
+    snprintf(meta, sizeof(meta),
+      "{\"len\":%u,\"crc32\":\"%08x\",\"w\":%u,\"h\":%u,\"format\":%d,\"stripes\":%d,\"stripe_rows\":%u,\"preallocated\":%s,"
+      "\"mem\":{\"fb_bytes\":%u,\"frame_bytes\":%u,\"psram_free_min\":%u,\"psram_largest_free_min\":%u},"
+      "\"timing_us\":{\"first_stripe\":%lld,\"span\":%lld,\"write\":%lld,\"session\":%lld,\"total\":%lld}%s%s}",
+      (unsigned)c->file_len, (unsigned)c->crc, c->w, c->h, (int)p->pixformat, c->n, c->rows, c->prealloc ? "true" : "false",
+      (unsigned)(sp.raw_fb_count * c->stripe_len), (unsigned)len, (unsigned)c->psram_free_min, (unsigned)c->psram_block_min,
+      (long long)c->first_us, (long long)(c->last_us - c->first_us), (long long)c->write_us,
+      (long long)c->session_us, (long long)total_us, codec, bayer);
+  }
+  if (c->f) ok = capture_io_close(c->f, c->prealloc, c->write_us, ok ? json_path : NULL, meta) && ok;
+
+  if (ok) {
+    event_bus_publish(EV_WRITE, id, (int32_t)c->file_len, (int32_t)c->write_us, c->rz ? "rawz" : "stripes");
+    if (meta_json_out && meta_max > 0) snprintf(meta_json_out, meta_max, "%s", meta);
+    ESP_LOGI(TAG, "%s: %d bands of %u bytes, %u KiB in frame buffers, %u bytes on card, %lld ms", id, c->n,
+             (unsigned)c->stripe_len, (unsigned)(sp.raw_fb_count * c->stripe_len / 1024), (unsigned)c->file_len,
+             (long long)(total_us / 1000));
+  } else {
+    ESP_LOGE(TAG, "%s: failed after %d/%d bands", id, c->written, c->n);
+    event_bus_publish(EV_ERROR, id, c->written, 0, "stripe capture failed");
+    remove(bin_path);
+    if (json_path) remove(json_path);
+  }
+
+  portENTER_CRITICAL(&s_mux);
+  if (ok) s_st.captures++;
+  else s_st.failures++;
+  s_st.stripes += (uint32_t)c->written;
+  s_st.last_fb_bytes = (uint32_t)(sp.raw_fb_count * c->stripe_len);
+  if (c->psram_free_min != UINT32_MAX) s_st.last_psram_free_min = c->psram_free_min;
+  s_st.last_us = c->session_us;
+  if (ok && c->rz) {
+    s_st.rawz_in += len;
+    s_st.rawz_out += c->file_len;
+    s_st.rawz_us += (uint64_t)c->encode_us;
+  }
+  portEXIT_CRITICAL(&s_mux);
+
+  heap_caps_free(c->zbuf);
+  heap_caps_free(c->rz);
+  free(c);
+  return ok;
+}
+
+void capture_stripe_get_stats(capture_stripe_stats_t *out) {
+  portENTER_CRITICAL(&s_mux);
+  *out = s_st;
+  portEXIT_CRITICAL(&s_mux);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "cam_manager.h"
+
+// Full-resolution raw capture without a full-frame buffer. The driver only
+// hands out whole frames, so the sensor output is windowed instead: the camera
+// is initialized at CAPTURE_STRIPE_FRAMESIZE with two frame buffers, and each
+// frame it delivers is a band of full-width UXGA rows holding exactly as many
+// pixels (1600 x 300 for SVGA). A writer task streams each band to one
+// preallocated file while the driver fills the other buffer and the sensor
+// window moves down. AEC/AGC are frozen once the first band has settled so all
+// bands share one exposure; bands are still a frame period apart in time.
+//
+// With cam_profile_t.compress the writer (pinned to core 1, away from the
+// camera task) rawz-codes each band in RAWZ_BLOCK_ROWS blocks before writing
+// it; smaller raw frames then go through the same pipeline as a single band.
+//
+// Bayer RAW8 (PIXFORMAT_RAW in a profile, UXGA only) uses the same bands: the
+// driver runs as RGB565, whose two bytes per pixel carry two photosites, so an
+// SVGA buffer holds 1600 x 600 of them. The file is a DNG (capture_dng.h), or
+// rawz with RAWZ_FMT_BAYER8 when compressed.
+typedef struct {
+  uint32_t captures, failures;
+  uint32_t stripes;             // bands written, all captures
+  uint32_t last_fb_bytes;       // frame buffers held by the last capture
+  uint32_t last_psram_free_min; // lowest free PSRAM seen during it
+  int64_t last_us;              // session time of the last capture
+  uint64_t rawz_in, rawz_out;   // bytes before/after coding, all captures
+  uint64_t rawz_us;             // time spent coding
+} capture_stripe_stats_t;
+
+// True for Bayer profiles, compressed raw profiles and raw UXGA profiles with
+// `stripes` set, which then go through capture_stripe_run(); other raw UXGA
+// captures stay single frames. False for a Bayer profile at any other size: it
+// cannot be captured.
+bool capture_stripe_applies(const cam_profile_t *p);
+
+// Captures one frame of profile `p` band by band into bin_path and writes the
+// JSON sidecar (also copied to meta_json_out when given)
+bool capture_stripe_run(const char *id, const cam_profile_t *p, const char *bin_path,
+                        const char *json_path, char *meta_json_out, int meta_max);
+
+void capture_stripe_get_stats(capture_stripe_stats_t *out);
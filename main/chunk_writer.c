@@ -0,0 +1,71 @@
+#include "chunk_writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void cw_init(chunk_writer_t *w, httpd_req_t *req) {
+  w->req = req;
+  w->len = 0;
+  w->err = ESP_OK;
+  w->total = 0;
+}
+
+esp_err_t cw_flush(chunk_writer_t *w) {
+  if (w->err != ESP_OK || w->len == 0) return w->err;
+  w->err = httpd_resp_send_chunk(w->req, w->buf, w->len);
+  w->total += (size_t)w->len;
+  w->len = 0;
+  return w->err;
+}
+
+void cw_write(chunk_writer_t *w, const char *data, size_t n) {
+  while (n > 0 && w->err == ESP_OK) {
+    size_t room = CW_BUF_SIZE - (size_t)w->len;
+    size_t k = n < room ? n : room;
+    memcpy(w->buf + w->len, data, k);
+    w->len += (int)k;
+    data += k;
+    n -= k;
+    if (w->len == CW_BUF_SIZE) cw_flush(w);
+  }
+}
+
+void cw_puts(chunk_writer_t *w, const char *s) {
+  cw_write(w, s, strlen(s));
+}
+
+void cw_uint(chunk_writer_t *w, unsigned v) {
+  char tmp[10];
+  int i = sizeof(tmp);
+  do { tmp[--i] = (char)('0' + v % 10); v /= 10; } while (v);
+  cw_write(w, tmp + i, sizeof(tmp) - (size_t)i);
+}
+
+void cw_printf(chunk_writer_t *w, const char *fmt, ...) {
+  if (w->err != ESP_OK) return;
+  char tmp[128];
+  va_list ap, ap2;
+  va_start(ap, fmt);
+  va_copy(ap2, ap);
+  int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+  va_end(ap);
+  if (n >= 0 && n < (int)sizeof(tmp)) {
+    cw_write(w, tmp, (size_t)n);
+  } else if (n >= 0) {
+    // Longer than the stack buffer: format once more into one that fits
+    char *big = (char*)malloc((size_t)n + 1);
+    if (big && vsnprintf(big, (size_t)n + 1, fmt, ap2) == n) cw_write(w, big, (size_t)n);
+    else w->err = ESP_ERR_NO_MEM;
+    free(big);
+  } else {
+    w->err = ESP_FAIL;
+  }
+  va_end(ap2);
+}
+
+esp_err_t cw_finish(chunk_writer_t *w) {
+  cw_flush(w);
+  if (w->err != ESP_OK) return w->err;
+  w->err = httpd_resp_send_chunk(w->req, NULL, 0);
+  return w->err;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <stdarg.h>
+#include <stddef.h>
+#include "esp_http_server.h"
+
+// Buffered writer over httpd_resp_send_chunk(): output is staged in a fixed
+// buffer (lives wherever the writer does, normally the handler stack) and sent
+// as one chunk when full, so large responses need no heap.
+#define CW_BUF_SIZE 512
+
+typedef struct {
+  httpd_req_t *req;
+  int len;
+  esp_err_t err;        // first send error; later writes become no-ops
+  size_t total;         // bytes handed to httpd so far
+  char buf[CW_BUF_SIZE];
+} chunk_writer_t;
+
+void cw_init(chunk_writer_t *w, httpd_req_t *req);
+void cw_write(chunk_writer_t *w, const char *data, size_t n);
+void cw_puts(chunk_writer_t *w, const char *s);
+void cw_uint(chunk_writer_t *w, unsigned v);
+// Output over 128 bytes is formatted into a heap buffer; if that fails (or
+// formatting does) the writer stops as on a send error rather than truncate
+void cw_printf(chunk_writer_t *w, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+esp_err_t cw_flush(chunk_writer_t *w);
+esp_err_t cw_finish(chunk_writer_t *w);   // flush + terminating zero-length chunk
@@ -0,0 +1,295 @@
+#include "event_bus.h"
+#include "app_config.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "cJSON.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if CONFIG_ROLE_MASTER
+#include "esp_http_client.h"
+#endif
+
+static const char *TAG = "EVENTS";
+
+#define SRC_MASTER 0
+#define SRC_SLAVE  1
+#if CONFIG_ROLE_MASTER
+#define LOCAL_SRC  SRC_MASTER
+#else
+#define LOCAL_SRC  SRC_SLAVE
+#endif
+#define POLL_MS    20
+#define PING_US    (15 * 1000000LL)
+
+typedef struct {
+  int64_t t_us;
+  int32_t v, dur_us;
+  uint8_t type, src;
+  char id[24];
+  char msg[32];
+} ev_t;
+
+// seq = event number + 1 once the slot is fully written, 0 while it is being written
+typedef struct {
+  atomic_uint seq;
+  ev_t ev;
+} ev_slot_t;
+
+static const char *k_names[EV_TYPE_COUNT] = { "arm", "trigger", "frame", "write", "error", "slave" };
+static ev_slot_t s_ring[EVENT_BUS_SLOTS];
+static atomic_uint s_head;
+static atomic_int s_clients;
+
+// Strings end up inside JSON: keep them to plain characters
+static void copy_clean(char *dst, size_t max, const char *src) {
+  size_t i = 0;
+  for (; src && src[i] && i + 1 < max; i++) {
+    char ch = src[i];
+    dst[i] = (ch < 0x20 || ch == '"' || ch == '\\') ? '_' : ch;
+  }
+  dst[i] = 0;
+}
+
+static void publish_ev(const ev_t *e) {
+  unsigned n = atomic_fetch_add_explicit(&s_head, 1, memory_order_relaxed);
+  ev_slot_t *s = &s_ring[n & (EVENT_BUS_SLOTS - 1)];
+  atomic_store_explicit(&s->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  s->ev = *e;
+  atomic_store_explicit(&s->seq, n + 1, memory_order_release);
+}
+
+void event_bus_publish(ev_type_t type, const char *id, int32_t v, int32_t dur_us, const char *msg) {
+  ev_t e = {
+    .t_us = esp_timer_get_time(),
+    .v = v,
+    .dur_us = dur_us,
+    .type = (uint8_t)type,
+    .src = LOCAL_SRC,
+  };
+  copy_clean(e.id, sizeof(e.id), id);
+  copy_clean(e.msg, sizeof(e.msg), msg);
+  publish_ev(&e);
+}
+
+// 1: *out is event *cursor (cursor advanced); 0: nothing new yet;
+// -1: events were overwritten before they were read, *lost says how many
+static int read_next(unsigned *cursor, ev_t *out, unsigned *lost) {
+  unsigned head = atomic_load_explicit(&s_head, memory_order_relaxed);
+  if (head == *cursor) return 0;
+  if (head - *cursor > EVENT_BUS_SLOTS) {
+    *lost = head - EVENT_BUS_SLOTS - *cursor;
+    *cursor = head - EVENT_BUS_SLOTS;
+    return -1;
+  }
+
+  ev_slot_t *s = &s_ring[*cursor & (EVENT_BUS_SLOTS - 1)];
+  unsigned want = *cursor + 1;
+  unsigned s1 = atomic_load_explicit(&s->seq, memory_order_acquire);
+  if (s1 != want) {
+    if (s1 == 0 || (int)(s1 - want) < 0) return 0;   // publisher still writing it
+    *lost = 1;
+    (*cursor)++;
+    return -1;
+  }
+  *out = s->ev;
+  atomic_thread_fence(memory_order_acquire);
+  if (atomic_load_explicit(&s->seq, memory_order_relaxed) != s1) {
+    *lost = 1;      // overwritten while copying
+    (*cursor)++;
+    return -1;
+  }
+  (*cursor)++;
+  return 1;
+}
+
+// ------------------ SSE subscribers ------------------
+
+typedef struct {
+  httpd_req_t *req;
+  unsigned cursor;
+} sub_ctx_t;
+
+static bool sse_send(httpd_req_t *req, const char *buf, int n) {
+  return httpd_resp_send_chunk(req, buf, n) == ESP_OK;
+}
+
+static void sub_task(void *arg) {
+  sub_ctx_t *c = (sub_ctx_t*)arg;
+  httpd_req_t *req = c->req;
+  char buf[256];
+  int n;
+
+  httpd_resp_set_type(req, "text/event-stream");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+  n = snprintf(buf, sizeof(buf), "retry: 2000\n\n");
+  bool ok = sse_send(req, buf, n);
+  int64_t last_send = esp_timer_get_time();
+
+  while (ok) {
+    ev_t e;
+    unsigned lost = 0;
+    unsigned seq = c->cursor;
+    int r = read_next(&c->cursor, &e, &lost);
+    if (r > 0) {
+      n = snprintf(buf, sizeof(buf),
+        "id: %u\nevent: %s\ndata: {\"t_us\":%lld,\"src\":\"%s\",\"id\":\"%s\",\"v\":%ld,\"dur_us\":%ld,\"msg\":\"%s\"}\n\n",
+        seq, k_names[e.type], (long long)e.t_us, e.src == SRC_SLAVE ? "slave" : "master",
+        e.id, (long)e.v, (long)e.dur_us, e.msg);
+    } else if (r < 0) {
+      n = snprintf(buf, sizeof(buf), "event: gap\ndata: {\"lost\":%u}\n\n", lost);
+    } else if (esp_timer_get_time() - last_send > PING_US) {
+      n = snprintf(buf, sizeof(buf), ": ping\n\n");   // finds dead clients
+    } else {
+      vTaskDelay(pdMS_TO_TICKS(POLL_MS));
+      continue;
+    }
+    ok = sse_send(req, buf, n);
+    last_send = esp_timer_get_time();
+  }
+
+  httpd_resp_send_chunk(req, NULL, 0);
+  httpd_req_async_handler_complete(req);
+  free(c);
+  atomic_fetch_sub(&s_clients, 1);
+  ESP_LOGI(TAG, "subscriber closed");
+  vTaskDelete(NULL);
+}
+
+esp_err_t event_bus_sse_handler(httpd_req_t *req) {
+  sub_ctx_t *c = (sub_ctx_t*)calloc(1, sizeof(*c));
+  if (!c) return httpd_resp_send_err(req, 500, "no mem");
+
+  // Resume after Last-Event-ID; read_next() reports a gap if it already left the ring
+  char last[16];
+  c->cursor = atomic_load(&s_head);
+  if (httpd_req_get_hdr_value_str(req, "Last-Event-ID", last, sizeof(last)) == ESP_OK) {
+    unsigned next = (unsigned)strtoul(last, NULL, 10) + 1;
+    if ((int)(c->cursor - next) >= 0) c->cursor = next;
+  }
+
+  if (atomic_fetch_add(&s_clients, 1) >= EVENT_BUS_MAX_CLIENTS) {
+    atomic_fetch_sub(&s_clients, 1);
+    free(c);
+    return httpd_resp_send_err(req, 500, "too many subscribers");
+  }
+
+  if (httpd_req_async_handler_begin(req, &c->req) != ESP_OK) {
+    free(c);
+    atomic_fetch_sub(&s_clients, 1);
+    return httpd_resp_send_err(req, 500, "async failed");
+  }
+
+  if (xTaskCreate(sub_task, "events_sse", 4096, c, 4, NULL) != pdPASS) {
+    httpd_req_async_handler_complete(c->req);
+    free(c);
+    atomic_fetch_sub(&s_clients, 1);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+// ------------------ master: relay of the slave's events ------------------
+
+#if CONFIG_ROLE_MASTER
+#define RELAY_BUF 768
+
+static unsigned s_relay_last = 0;     // last slave event id seen (+1), 0 = none
+static int type_from_name(const char *name) {
+  for (int i = 0; i < EV_TYPE_COUNT; i++)
+    if (!strcmp(k_names[i], name)) return i;
+  return -1;
+}
+
+static void relay_dispatch(const char *event, const char *data) {
+  int type = type_from_name(event);
+  if (type < 0 || type == EV_SLAVE) return;
+  cJSON *j = cJSON_Parse(data);
+  if (!j) return;
+  cJSON *t = cJSON_GetObjectItem(j, "t_us");
+  cJSON *id = cJSON_GetObjectItem(j, "id");
+  cJSON *v = cJSON_GetObjectItem(j, "v");
+  cJSON *d = cJSON_GetObjectItem(j, "dur_us");
+  cJSON *msg = cJSON_GetObjectItem(j, "msg");
+  ev_t e = {
+    .t_us = cJSON_IsNumber(t) ? (int64_t)t->valuedouble : 0,   // slave clock
+    .v = cJSON_IsNumber(v) ? v->valueint : 0,
+    .dur_us = cJSON_IsNumber(d) ? d->valueint : 0,
+    .type = (uint8_t)type,
+    .src = SRC_SLAVE,
+  };
+  copy_clean(e.id, sizeof(e.id), cJSON_IsString(id) ? id->valuestring : NULL);
+  copy_clean(e.msg, sizeof(e.msg), cJSON_IsString(msg) ? msg->valuestring : NULL);
+  cJSON_Delete(j);
+  publish_ev(&e);
+}
+
+// Returns when the stream ends or the last local subscriber left
+static void relay_read(esp_http_client_handle_t c, char *buf) {
+  int len = 0;
+  char event[16] = "";
+  while (atomic_load(&s_clients) > 0) {
+    int n = esp_http_client_read(c, buf + len, RELAY_BUF - 1 - len);
+    if (n <= 0) return;
+    len += n;
+    buf[len] = 0;
+
+    char *line = buf, *nl;
+    while ((nl = strchr(line, '\n')) != NULL) {
+      *nl = 0;
+      if (!strncmp(line, "id: ", 4)) s_relay_last = (unsigned)strtoul(line + 4, NULL, 10) + 1;
+      else if (!strncmp(line, "event: ", 7)) snprintf(event, sizeof(event), "%s", line + 7);
+      else if (!strncmp(line, "data: ", 6)) relay_dispatch(event, line + 6);
+      else if (!*line) event[0] = 0;
+      line = nl + 1;
+    }
+    len -= (int)(line - buf);
+    memmove(buf, line, (size_t)len);
+    if (len >= RELAY_BUF - 1) len = 0;   // line too long for us: drop it
+  }
+}
+
+static void relay_task(void *arg) {
+  (void)arg;
+  char url[128], last[16];
+  snprintf(url, sizeof(url), "http://%s.local/api/events", SLAVE_MDNS_HOST);
+  char *buf = (char*)malloc(RELAY_BUF);
+
+  for (;;) {
+    if (!buf || atomic_load(&s_clients) == 0) {
+      vTaskDelay(pdMS_TO_TICKS(1000));
+      continue;
+    }
+    // Longer than the slave's ping interval, so an idle stream does not time out
+    esp_http_client_config_t cfg = { .url = url, .timeout_ms = 20000 };
+    esp_http_client_handle_t c = esp_http_client_init(&cfg);
+    if (c && s_relay_last) {
+      snprintf(last, sizeof(last), "%u", s_relay_last - 1);
+      esp_http_client_set_header(c, "Last-Event-ID", last);
+    }
+    bool up = c && esp_http_client_open(c, 0) == ESP_OK &&
+              esp_http_client_fetch_headers(c) >= 0 && esp_http_client_get_status_code(c) == 200;
+    if (up) {
+      event_bus_publish(EV_SLAVE, NULL, 0, 0, "relay_up");
+      relay_read(c, buf);
+      event_bus_publish(EV_SLAVE, NULL, 0, 0, "relay_down");
+    }
+    if (c) {
+      esp_http_client_close(c);
+      esp_http_client_cleanup(c);
+    }
+    vTaskDelay(pdMS_TO_TICKS(up ? 500 : 5000));
+  }
+}
+#endif
+
+void event_bus_init(void) {
+#if CONFIG_ROLE_MASTER
+  xTaskCreate(relay_task, "events_relay", 4096, NULL, 3, NULL);
+#endif
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+#include "esp_http_server.h"
+
+// Capture lifecycle events, fanned out to GET /api/events (Server-Sent Events).
+// Publishing is lock-free and never waits: events go into a fixed ring and each
+// subscriber reads at its own pace; one that falls a full ring behind gets a
+// "gap" event instead of stalling the capture path. Reconnecting clients resume
+// from Last-Event-ID while the events are still in the ring.
+// On the master, the slave's events are relayed into the ring with "src":"slave"
+// while at least one client is subscribed.
+#define EVENT_BUS_SLOTS        64     // power of two
+#define EVENT_BUS_MAX_CLIENTS  3
+
+typedef enum {
+  EV_ARM,        // capture armed (id)
+  EV_TRIGGER,    // trigger edge sent/seen
+  EV_FRAME,      // frame acquired: v = bytes
+  EV_WRITE,      // file written: v = bytes, dur_us = write time
+  EV_ERROR,      // msg says what failed
+  EV_SLAVE,      // master's view of the slave: msg = armed|arm_failed|relay_up|relay_down
+  EV_TYPE_COUNT
+} ev_type_t;
+
+void event_bus_init(void);
+void event_bus_publish(ev_type_t type, const char *id, int32_t v, int32_t dur_us, const char *msg);
+esp_err_t event_bus_sse_handler(httpd_req_t *req);
@@ -0,0 +1,64 @@
+#include "frame_sync.h"
+#include "wait_queue.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+static wait_queue_t s_wq;
+static bool s_ready = false;
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile uint32_t s_count = 0;
+static volatile int64_t s_last_us = 0;
+static frame_sync_hook_t s_hook = NULL;
+static void *s_hook_ctx = NULL;
+
+void frame_sync_init(void) {
+  if (s_ready) return;
+  wait_queue_init(&s_wq);
+  s_ready = true;
+}
+
+void frame_sync_set_hook(frame_sync_hook_t fn, void *ctx) {
+  s_hook_ctx = ctx;
+  s_hook = fn;
+}
+
+void frame_sync_frame_done(void) {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&s_mux);
+  uint32_t frame = ++s_count;
+  s_last_us = now;
+  portEXIT_CRITICAL(&s_mux);
+  if (s_hook) s_hook(frame, s_hook_ctx);
+  if (s_ready) wait_queue_wake_all(&s_wq);
+}
+
+uint32_t frame_sync_count(void) {
+  return s_count;
+}
+
+int64_t frame_sync_last_us(void) {
+  portENTER_CRITICAL(&s_mux);
+  int64_t t = s_last_us;
+  portEXIT_CRITICAL(&s_mux);
+  return t;
+}
+
+bool frame_sync_wait(uint32_t after, TickType_t timeout, uint32_t *frame, int64_t *ts_us) {
+  if (!s_ready) return false;
+  TickType_t start = xTaskGetTickCount();
+  // Registered before the first check: a frame ending in between still wakes us
+  int slot = wait_queue_enter(&s_wq);
+  bool got = true;
+  while (s_count == after) {
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= timeout) { got = false; break; }
+    wait_queue_wait(&s_wq, slot, timeout - waited);
+  }
+  wait_queue_leave(&s_wq, slot);
+  if (!got) return false;
+  portENTER_CRITICAL(&s_mux);
+  if (frame) *frame = s_count;
+  if (ts_us) *ts_us = s_last_us;
+  portEXIT_CRITICAL(&s_mux);
+  return true;
+}
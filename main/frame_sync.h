@@ -0,0 +1,21 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+// Frame boundary clock. Frame producers call frame_sync_frame_done() as soon as
+// a frame buffer is handed over by the camera driver (end of active video, i.e.
+// start of vertical blanking); waiters are woken together on every frame.
+void frame_sync_init(void);
+void frame_sync_frame_done(void);
+
+// Optional hook run inside frame_sync_frame_done() before waiters are woken
+// (used to commit queued register writes in vertical blanking). Must not block.
+typedef void (*frame_sync_hook_t)(uint32_t frame, void *ctx);
+void frame_sync_set_hook(frame_sync_hook_t fn, void *ctx);
+
+uint32_t frame_sync_count(void);
+int64_t  frame_sync_last_us(void);
+
+// Blocks until a frame newer than `after` completes. Returns false on timeout.
+bool frame_sync_wait(uint32_t after, TickType_t timeout, uint32_t *frame, int64_t *ts_us);
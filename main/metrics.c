@@ -0,0 +1,216 @@
+#include "metrics.h"
+#include "ov2640_ctrl.h"
+#include "cam_manager.h"
+#include "static_cache.h"
+#include "capture_http.h"
+#include "ws_stream.h"
+#include "capture_io.h"
+#include "capture_stripe.h"
+#include "capture_store.h"
+#include "retention.h"
+#include "capture_mem.h"
+#include <stdio.h>
+#include <string.h>
+
+void metrics_type(chunk_writer_t *w, const char *name, const char *type, const char *help) {
+  cw_printf(w, "# HELP %s %s\n", name, help);
+  cw_printf(w, "# TYPE %s %s\n", name, type);
+}
+
+void metrics_value(chunk_writer_t *w, const char *name, const char *labels, double v) {
+  if (labels) cw_printf(w, "%s{%s} %.6g\n", name, labels, v);
+  else cw_printf(w, "%s %.6g\n", name, v);
+}
+
+void metrics_hist(chunk_writer_t *w, const char *name, const char *help, const metrics_hist_t *h) {
+  metrics_type(w, name, "histogram", help);
+  uint32_t acc = 0;
+  for (int i = 0; i < h->n; i++) {
+    acc += h->bucket[i];
+    cw_printf(w, "%s_bucket{le=\"%u\"} %u\n", name, (unsigned)h->le[i], (unsigned)acc);
+  }
+  cw_printf(w, "%s_bucket{le=\"+Inf\"} %u\n", name, (unsigned)h->count);
+  cw_printf(w, "%s_sum %llu\n%s_count %u\n", name, (unsigned long long)h->sum, name, (unsigned)h->count);
+}
+
+static void counter(chunk_writer_t *w, const char *name, const char *help, double v) {
+  metrics_type(w, name, "counter", help);
+  metrics_value(w, name, NULL, v);
+}
+
+static void write_sccb(chunk_writer_t *w) {
+  ov2640_stats_t st;
+  ov2640_get_stats(&st);
+  counter(w, "sccb_reads_total", "SCCB register reads", st.reads);
+  counter(w, "sccb_writes_total", "SCCB register writes (incl. bank selects)", st.writes);
+  counter(w, "sccb_failures_total", "Failed SCCB transactions", st.failures);
+  counter(w, "sccb_bank_switches_total", "Bank select writes issued", st.bank_switches);
+  counter(w, "sccb_bank_switches_avoided_total", "Bank selects skipped thanks to the bank cache", st.bank_avoided);
+  metrics_hist(w, "sccb_op_duration_us", "SCCB transaction latency", &st.latency);
+}
+
+static void write_camera(chunk_writer_t *w) {
+  static const char *modes[] = { "none", "stream", "capture" };
+  cam_stats_t st;
+  cam_manager_get_stats(&st);
+  char lbl[24];
+
+  metrics_hist(w, "cam_fb_get_duration_us", "esp_camera_fb_get() latency", &st.fb_get);
+  counter(w, "cam_fb_get_timeouts_total", "esp_camera_fb_get() returned no frame", st.fb_timeouts);
+  counter(w, "cam_reinit_total", "Camera driver re-initializations", st.reinits);
+  metrics_hist(w, "cam_reinit_duration_us", "Camera deinit + init + overlay duration", &st.reinit);
+  metrics_hist(w, "cam_capture_write_duration_us", "Capture frame file write (open to close)", &st.write);
+  metrics_type(w, "cam_capture_write_quantile_us", "gauge", "Capture write latency quantiles estimated from the histogram");
+  metrics_value(w, "cam_capture_write_quantile_us", "q=\"0.5\"", metrics_hist_quantile(&st.write, 0.5f));
+  metrics_value(w, "cam_capture_write_quantile_us", "q=\"0.99\"", metrics_hist_quantile(&st.write, 0.99f));
+
+  metrics_type(w, "cam_frames_total", "counter", "Frames delivered per camera mode");
+  for (int m = 0; m < CAM_STATS_MODES; m++) {
+    snprintf(lbl, sizeof(lbl), "mode=\"%s\"", modes[m]);
+    metrics_value(w, "cam_frames_total", lbl, st.frames[m]);
+  }
+  metrics_type(w, "cam_fps", "gauge", "Frame rate over the last window, per camera mode");
+  for (int m = 0; m < CAM_STATS_MODES; m++) {
+    snprintf(lbl, sizeof(lbl), "mode=\"%s\"", modes[m]);
+    metrics_value(w, "cam_fps", lbl, st.fps[m]);
+  }
+}
+
+static void write_www(chunk_writer_t *w) {
+  static_cache_stats_t st;
+  static_cache_get_stats(&st);
+  counter(w, "www_cache_hits_total", "Static asset requests served from PSRAM", st.hits);
+  counter(w, "www_cache_misses_total", "Static asset requests that had to load the file", st.misses);
+  counter(w, "www_not_modified_total", "304 responses to If-None-Match", st.not_modified);
+  counter(w, "www_gzip_served_total", "Pre-compressed variants served", st.gzip_served);
+  counter(w, "www_not_acceptable_total", "406 responses: only a gzip copy, not accepted by the client", st.not_acceptable);
+  counter(w, "www_sd_reads_total", "Asset files read from SD into the cache", st.sd_reads);
+  counter(w, "www_uncached_total", "Asset responses streamed from SD (over cache budget)", st.uncached);
+  metrics_type(w, "www_cache_bytes", "gauge", "PSRAM used by cached assets");
+  metrics_value(w, "www_cache_bytes", NULL, st.bytes);
+}
+
+static void write_downloads(chunk_writer_t *w) {
+  capture_http_stats_t st;
+  capture_http_get_stats(&st);
+  counter(w, "capture_dl_requests_total", "GET/HEAD requests for /captures/*", st.requests);
+  counter(w, "capture_dl_range_total", "Requests answered with 206 Partial Content", st.ranges);
+  counter(w, "capture_dl_not_satisfiable_total", "Requests answered with 416", st.not_satisfiable);
+  counter(w, "capture_dl_aborted_total", "Downloads that failed before the last byte", st.aborted);
+  counter(w, "capture_dl_crc_checked_total", "Full downloads that matched the CRC32 recorded at write time", st.crc_checked);
+  counter(w, "capture_dl_crc_errors_total", "Downloads cut short because the body did not match its CRC32", st.crc_errors);
+  counter(w, "capture_dl_bytes_total", "Capture body bytes sent", (double)st.bytes);
+  counter(w, "capture_dl_seconds_total", "Time spent reading and sending capture bodies", (double)st.send_us / 1e6);
+  metrics_hist(w, "capture_dl_throughput_kibps", "Per-download throughput (bodies >= 64 KiB)", &st.kbps);
+}
+
+static void write_capture_io(chunk_writer_t *w) {
+  capture_io_stats_t st;
+  capture_io_get_stats(&st);
+  counter(w, "capture_io_files_total", "Capture and sidecar files (and store records) written", st.files);
+  counter(w, "capture_io_failures_total", "Capture file writes that failed", st.failures);
+  counter(w, "capture_io_preallocated_total", "Files written into a contiguous preallocation", st.preallocated);
+  counter(w, "capture_io_bytes_total", "Capture bytes written", (double)st.bytes);
+  counter(w, "capture_io_seconds_total", "Time spent writing capture files", (double)st.write_us / 1e6);
+}
+
+static void write_stripes(chunk_writer_t *w) {
+  capture_stripe_stats_t st;
+  capture_stripe_get_stats(&st);
+  counter(w, "capture_stripe_captures_total", "Raw UXGA captures streamed in bands", st.captures);
+  counter(w, "capture_stripe_failures_total", "Banded captures that failed", st.failures);
+  counter(w, "capture_stripe_bands_total", "Bands written to the card", st.stripes);
+  metrics_type(w, "capture_stripe_fb_bytes", "gauge", "Frame buffer memory held by the last banded capture");
+  metrics_value(w, "capture_stripe_fb_bytes", NULL, st.last_fb_bytes);
+  metrics_type(w, "capture_stripe_psram_free_min_bytes", "gauge", "Lowest free PSRAM during the last banded capture");
+  metrics_value(w, "capture_stripe_psram_free_min_bytes", NULL, st.last_psram_free_min);
+  metrics_type(w, "capture_stripe_last_seconds", "gauge", "Camera session time of the last banded capture");
+  metrics_value(w, "capture_stripe_last_seconds", NULL, (double)st.last_us / 1e6);
+  counter(w, "capture_rawz_in_bytes_total", "Raw bytes fed to the rawz coder", (double)st.rawz_in);
+  counter(w, "capture_rawz_out_bytes_total", "Coded rawz bytes written", (double)st.rawz_out);
+  counter(w, "capture_rawz_seconds_total", "Time spent rawz coding", (double)st.rawz_us / 1e6);
+}
+
+static void write_retention(chunk_writer_t *w) {
+  retention_stats_t st;
+  retention_get_stats(&st);
+  metrics_type(w, "sd_free_bytes", "gauge", "Free space on the SD card");
+  metrics_value(w, "sd_free_bytes", NULL, (double)st.free_bytes);
+  metrics_type(w, "capture_bytes", "gauge", "Size of all cataloged captures");
+  metrics_value(w, "capture_bytes", NULL, (double)st.capture_bytes);
+  counter(w, "retention_deleted_total", "Captures deleted by retention", st.deleted);
+  counter(w, "retention_segments_dropped_total", "Store segments deleted by retention", st.segments_dropped);
+  counter(w, "retention_deleted_bytes_total", "Capture bytes deleted by retention", (double)st.deleted_bytes);
+  counter(w, "retention_rejected_total", "Captures rejected at admission for lack of space", st.rejected);
+}
+
+static void write_mem(chunk_writer_t *w) {
+  capture_mem_stats_t st;
+  capture_mem_get_stats(&st);
+  metrics_type(w, "capture_mem_used_bytes", "gauge", "PSRAM capture store bytes in use");
+  metrics_value(w, "capture_mem_used_bytes", NULL, st.used);
+  metrics_type(w, "capture_mem_capacity_bytes", "gauge", "PSRAM capture store size");
+  metrics_value(w, "capture_mem_capacity_bytes", NULL, st.capacity);
+  metrics_type(w, "capture_mem_entries", "gauge", "Files held in the PSRAM capture store");
+  metrics_value(w, "capture_mem_entries", NULL, st.entries);
+  metrics_type(w, "capture_mem_pending", "gauge", "Files waiting to be flushed to the card");
+  metrics_value(w, "capture_mem_pending", NULL, st.pending);
+  metrics_type(w, "capture_mem_pending_bytes", "gauge", "Bytes waiting to be flushed to the card");
+  metrics_value(w, "capture_mem_pending_bytes", NULL, st.pending_bytes);
+  metrics_type(w, "capture_mem_flush_lag_seconds", "gauge", "Age of the oldest file not yet on the card");
+  metrics_value(w, "capture_mem_flush_lag_seconds", NULL, (double)st.oldest_pending_us / 1e6);
+  metrics_type(w, "capture_mem_last_lag_seconds", "gauge", "Capture to card time of the last flushed file");
+  metrics_value(w, "capture_mem_last_lag_seconds", NULL, (double)st.last_lag_us / 1e6);
+  counter(w, "capture_mem_puts_total", "Files saved into the PSRAM store", st.puts);
+  counter(w, "capture_mem_flushed_total", "Files written from the PSRAM store to the card", st.flushed);
+  counter(w, "capture_mem_evicted_total", "Files evicted from the PSRAM store", st.evicted);
+  counter(w, "capture_mem_lost_total", "Memory-only files evicted without ever being written", st.lost);
+  counter(w, "capture_mem_bypassed_total", "Files written straight to the card (store off or full)", st.bypassed);
+  counter(w, "capture_mem_flush_failures_total", "Failed card writes from the PSRAM store", st.flush_failures);
+}
+
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+static void write_store(chunk_writer_t *w) {
+  capture_store_stats_t st;
+  capture_store_get_stats(&st);
+  metrics_type(w, "capture_store_records", "gauge", "Records in the segment store index");
+  metrics_value(w, "capture_store_records", NULL, st.records);
+  counter(w, "capture_store_recovered_total", "Records re-indexed by the tail scan at boot", st.recovered);
+  counter(w, "capture_store_failures_total", "Failed record appends", st.failures);
+  counter(w, "capture_store_full_total", "Appends refused with the index full (written as files)", st.full);
+  counter(w, "capture_store_crc_errors_total", "Exports refused because a record no longer matched its CRC32", st.crc_errors);
+  counter(w, "capture_store_bytes_total", "Payload bytes appended since boot", (double)st.bytes);
+  metrics_type(w, "capture_store_segment", "gauge", "Current write segment number");
+  metrics_value(w, "capture_store_segment", NULL, st.segment);
+}
+#endif
+
+static void write_ws(chunk_writer_t *w) {
+  ws_stream_stats_t st;
+  ws_stream_get_stats(&st);
+  metrics_type(w, "ws_stream_clients", "gauge", "Connected /ws/stream clients");
+  metrics_value(w, "ws_stream_clients", NULL, st.clients);
+  counter(w, "ws_stream_frames_sent_total", "Frames delivered to WebSocket clients", st.sent);
+  counter(w, "ws_stream_frames_skipped_total", "Frames skipped because the client was still draining", st.skipped);
+  counter(w, "ws_stream_send_errors_total", "Failed WebSocket sends (client dropped)", st.send_errors);
+  counter(w, "ws_stream_bytes_total", "WebSocket frame bytes sent, headers included", (double)st.bytes);
+}
+
+esp_err_t metrics_handler(httpd_req_t *req) {
+  chunk_writer_t w;
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+  cw_init(&w, req);
+  write_sccb(&w);
+  write_camera(&w);
+  write_www(&w);
+  write_downloads(&w);
+  write_capture_io(&w);
+  write_stripes(&w);
+  write_retention(&w);
+  write_mem(&w);
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+  write_store(&w);
+#endif
+  write_ws(&w);
+  return cw_finish(&w);
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <stdint.h>
+#include "metrics_hist.h"
+#include "esp_http_server.h"
+#include "chunk_writer.h"
+
+// Prometheus text exposition helpers; `labels` is e.g. "mode=\"stream\"" or NULL
+void metrics_type(chunk_writer_t *w, const char *name, const char *type, const char *help);
+void metrics_value(chunk_writer_t *w, const char *name, const char *labels, double v);
+void metrics_hist(chunk_writer_t *w, const char *name, const char *help, const metrics_hist_t *h);
+
+// GET /metrics
+esp_err_t metrics_handler(httpd_req_t *req);
@@ -0,0 +1,32 @@
+#include "metrics_hist.h"
+#include <string.h>
+
+void metrics_hist_init(metrics_hist_t *h, const uint32_t *le, int n) {
+  memset(h, 0, sizeof(*h));
+  h->le = le;
+  h->n = (uint8_t)(n > METRICS_HIST_MAX ? METRICS_HIST_MAX : n);
+}
+
+void metrics_hist_observe(metrics_hist_t *h, uint32_t v) {
+  int i = 0;
+  while (i < h->n && v > h->le[i]) i++;
+  h->bucket[i]++;
+  h->count++;
+  h->sum += v;
+}
+
+uint32_t metrics_hist_quantile(const metrics_hist_t *h, float q) {
+  if (!h->count || !h->n) return 0;
+  float rank = q * (float)h->count;
+  uint32_t acc = 0;
+  for (int i = 0; i < h->n; i++) {
+    if (h->bucket[i] && (float)(acc + h->bucket[i]) >= rank) {
+      uint32_t lo = i ? h->le[i - 1] : 0;
+      float frac = (rank - (float)acc) / (float)h->bucket[i];
+      if (frac < 0) frac = 0;
+      return lo + (uint32_t)(frac * (float)(h->le[i] - lo));
+    }
+    acc += h->bucket[i];
+  }
+  return h->le[h->n - 1];
+}
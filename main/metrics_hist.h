@@ -0,0 +1,21 @@
+#pragma once
+#include <stdint.h>
+
+// Fixed-bucket histogram. `le` holds ascending upper bounds; bucket[n] counts
+// values above the last bound (+Inf). Buckets are stored non-cumulative and
+// accumulated when rendered. Callers provide their own locking.
+#define METRICS_HIST_MAX 12
+
+typedef struct {
+  const uint32_t *le;
+  uint8_t n;
+  uint32_t bucket[METRICS_HIST_MAX + 1];
+  uint32_t count;
+  uint64_t sum;
+} metrics_hist_t;
+
+void metrics_hist_init(metrics_hist_t *h, const uint32_t *le, int n);
+void metrics_hist_observe(metrics_hist_t *h, uint32_t v);
+// Estimated q-quantile (0..1), interpolated linearly inside the bucket that
+// holds it; values in the +Inf bucket report the last bound. 0 when empty.
+uint32_t metrics_hist_quantile(const metrics_hist_t *h, float q);
@@ -1,39 +1,77 @@
 #include "ov2640_ctrl.h"
 #include "app_state.h"
 #include "esp_camera.h"
+#include "esp_timer.h"
 
 #define REG_BANK_SELECT 0xFF
 
 static uint8_t g_bank = 0xFF;
 
+// SCCB transaction latency buckets (us); a register op at 100 kHz is ~200-400 us
+static const uint32_t k_lat_le[] = { 100, 200, 300, 500, 750, 1000, 2000, 5000, 10000 };
+static ov2640_stats_t g_stats;   // guarded by sccb_mutex
+
 static inline sensor_t* cam_sensor(void) {
   return esp_camera_sensor_get();
 }
 
+void ov2640_invalidate_bank(void) {
+  g_bank = 0xFF;
+}
+
+// Caller holds sccb_mutex
+static void account_locked(bool read, int r, int64_t t0) {
+  if (!g_stats.latency.le) metrics_hist_init(&g_stats.latency, k_lat_le, sizeof(k_lat_le) / sizeof(k_lat_le[0]));
+  if (read) g_stats.reads++;
+  else g_stats.writes++;
+  if (read ? r < 0 : r != 0) g_stats.failures++;
+  metrics_hist_observe(&g_stats.latency, (uint32_t)(esp_timer_get_time() - t0));
+}
+
+static int set_reg_locked(sensor_t *s, uint8_t addr, uint8_t mask, uint8_t val) {
+  int64_t t0 = esp_timer_get_time();
+  int r = s->set_reg(s, 0 /*bank ignored for set_reg*/, addr, mask, val);
+  account_locked(false, r, t0);
+  return r;
+}
+
+static int get_reg_locked(sensor_t *s, uint8_t addr) {
+  int64_t t0 = esp_timer_get_time();
+  int r = s->get_reg(s, 0, addr);
+  account_locked(true, r, t0);
+  return r;
+}
+
+// Caller holds sccb_mutex
+static bool set_bank_locked(sensor_t *s, ov2640_bank_t bank) {
+  if (g_bank == (uint8_t)bank) {
+    g_stats.bank_avoided++;
+    return true;
+  }
+  // bank is selected by writing 0xFF (mask=0xFF)
+  g_stats.bank_switches++;
+  if (set_reg_locked(s, REG_BANK_SELECT, 0xFF, (uint8_t)bank) != 0) return false;
+  g_bank = (uint8_t)bank;
+  return true;
+}
+
 bool ov2640_set_bank(ov2640_bank_t bank) {
-  if (g_bank == (uint8_t)bank) return true;
   sensor_t *s = cam_sensor();
   if (!s) return false;
 
   xSemaphoreTake(g_app.sccb_mutex, portMAX_DELAY);
-  // bank is selected by writing 0xFF (mask=0xFF)
-  int r = s->set_reg(s, 0 /*bank ignored for set_reg*/, REG_BANK_SELECT, 0xFF, (uint8_t)bank);
+  bool ok = set_bank_locked(s, bank);
   xSemaphoreGive(g_app.sccb_mutex);
-
-  if (r != 0) return false;
-  g_bank = (uint8_t)bank;
-  return true;
+  return ok;
 }
 
 bool ov2640_read_reg(ov2640_bank_t bank, uint8_t addr, uint8_t *val) {
   if (!val) return false;
-  if (!ov2640_set_bank(bank)) return false;
-
   sensor_t *s = cam_sensor();
   if (!s) return false;
 
   xSemaphoreTake(g_app.sccb_mutex, portMAX_DELAY);
-  int r = s->get_reg(s, 0, addr);
+  int r = set_bank_locked(s, bank) ? get_reg_locked(s, addr) : -1;
   xSemaphoreGive(g_app.sccb_mutex);
 
   if (r < 0) return false;
@@ -42,27 +80,39 @@ bool ov2640_read_reg(ov2640_bank_t bank, uint8_t addr, uint8_t *val) {
 }
 
 bool ov2640_write_reg(ov2640_bank_t bank, uint8_t addr, uint8_t value) {
-  if (!ov2640_set_bank(bank)) return false;
+  return ov2640_modify_reg(bank, addr, 0xFF, value);
+}
 
+bool ov2640_modify_reg(ov2640_bank_t bank, uint8_t addr, uint8_t mask, uint8_t value) {
   sensor_t *s = cam_sensor();
   if (!s) return false;
 
   xSemaphoreTake(g_app.sccb_mutex, portMAX_DELAY);
-  int r = s->set_reg(s, 0, addr, 0xFF, value);
+  int r = set_bank_locked(s, bank) ? set_reg_locked(s, addr, mask, value) : -1;
   xSemaphoreGive(g_app.sccb_mutex);
 
   return r == 0;
 }
 
-bool ov2640_modify_reg(ov2640_bank_t bank, uint8_t addr, uint8_t mask, uint8_t value) {
-  if (!ov2640_set_bank(bank)) return false;
-
+int ov2640_write_batch(const ov2640_reg_op_t *ops, int n) {
   sensor_t *s = cam_sensor();
-  if (!s) return false;
+  if (!s || !ops) return 0;
 
+  int done = 0;
   xSemaphoreTake(g_app.sccb_mutex, portMAX_DELAY);
-  int r = s->set_reg(s, 0, addr, mask, value);
+  for (; done < n; done++) {
+    const ov2640_reg_op_t *op = &ops[done];
+    if (op->bank > 1 || op->addr == REG_BANK_SELECT) break;
+    if (!set_bank_locked(s, (ov2640_bank_t)op->bank)) break;
+    if (set_reg_locked(s, op->addr, op->mask, op->val) != 0) break;
+  }
   xSemaphoreGive(g_app.sccb_mutex);
+  return done;
+}
 
-  return r == 0;
+void ov2640_get_stats(ov2640_stats_t *out) {
+  xSemaphoreTake(g_app.sccb_mutex, portMAX_DELAY);
+  *out = g_stats;
+  xSemaphoreGive(g_app.sccb_mutex);
+  if (!out->latency.le) metrics_hist_init(&out->latency, k_lat_le, sizeof(k_lat_le) / sizeof(k_lat_le[0]));
 }
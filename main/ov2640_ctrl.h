@@ -1,10 +1,30 @@
 #pragma once
 #include <stdbool.h>
 #include <stdint.h>
+#include "metrics_hist.h"
 
 typedef enum { REG_BANK_DSP = 0x00, REG_BANK_SENSOR = 0x01 } ov2640_bank_t;
 
+// One register write; mask 0xFF = full write
+typedef struct {
+  uint8_t bank, addr, mask, val;
+} ov2640_reg_op_t;
+
 bool ov2640_set_bank(ov2640_bank_t bank);
+void ov2640_invalidate_bank(void);   // call after esp_camera_init(): driver leaves bank unknown
 bool ov2640_read_reg(ov2640_bank_t bank, uint8_t addr, uint8_t *val);
 bool ov2640_write_reg(ov2640_bank_t bank, uint8_t addr, uint8_t val);
 bool ov2640_modify_reg(ov2640_bank_t bank, uint8_t addr, uint8_t mask, uint8_t val);
+
+// Writes ops in order under a single SCCB lock (no other access can interleave).
+// Returns the number of ops written; stops at the first failure.
+int ov2640_write_batch(const ov2640_reg_op_t *ops, int n);
+
+typedef struct {
+  uint32_t reads, writes, failures;
+  uint32_t bank_switches;   // bank select writes issued
+  uint32_t bank_avoided;    // bank selects skipped because g_bank already matched
+  metrics_hist_t latency;   // per transaction, us
+} ov2640_stats_t;
+
+void ov2640_get_stats(ov2640_stats_t *out);
@@ -0,0 +1,209 @@
+#include "rawz_core.h"
+#include <string.h>
+
+#define OP_RUN    0x00
+#define OP_PAIR   0x40
+#define OP_SMALL  0x80
+#define OP_LIT    0xC0
+#define OP_MASK   0xC0
+#define OP_MAX    64
+
+int rawz_bytes_per_pixel(uint8_t fmt) {
+  switch (fmt) {
+    case RAWZ_FMT_RGB565:
+    case RAWZ_FMT_YUV422: return 2;
+    case RAWZ_FMT_GRAY:
+    case RAWZ_FMT_BAYER8: return 1;
+    default:              return 0;
+  }
+}
+
+bool rawz_init(rawz_state_t *s, uint8_t fmt, uint16_t width) {
+  int bpp = rawz_bytes_per_pixel(fmt);
+  if (!bpp || !width || (size_t)width * bpp > RAWZ_MAX_ROW) return false;
+  s->fmt = fmt;
+  s->row_bytes = (uint16_t)(width * bpp);
+  s->up = fmt == RAWZ_FMT_BAYER8 ? 2 : 1;
+  s->rows_done = 0;
+  return true;
+}
+
+void rawz_hdr_init(rawz_hdr_t *h, uint8_t fmt, uint16_t width, uint16_t height) {
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, RAWZ_MAGIC, sizeof(h->magic));
+  h->version = RAWZ_VERSION;
+  h->format = fmt;
+  h->width = width;
+  h->height = height;
+  h->block_rows = RAWZ_BLOCK_ROWS;
+  h->blocks = (uint16_t)((height + RAWZ_BLOCK_ROWS - 1) / RAWZ_BLOCK_ROWS);
+  h->raw_len = (uint32_t)width * height * rawz_bytes_per_pixel(fmt);
+}
+
+size_t rawz_bound(const rawz_state_t *s, int n) {
+  // Worst case alternates one-byte literals with one-byte ops: 3 bytes per 2
+  // residuals, plus the filter byte
+  return (size_t)n * (2 + s->row_bytes + s->row_bytes / 2);
+}
+
+static inline int left_of(const rawz_state_t *s, int i) {
+  switch (s->fmt) {
+    case RAWZ_FMT_YUV422: return (i & 1) ? 4 : 2;   // YUYV: U/V repeat every 4 bytes
+    case RAWZ_FMT_GRAY:   return 1;
+    default:              return 2;                 // RGB565 word, or same CFA color
+  }
+}
+
+static inline bool have_up(const rawz_state_t *s) {
+  return s->rows_done >= s->up;
+}
+
+static inline const uint8_t *up_row(const rawz_state_t *s) {
+  return s->prev[(s->rows_done - s->up) & 1];
+}
+
+static void push_row(rawz_state_t *s, const uint8_t *row) {
+  memcpy(s->prev[s->rows_done & 1], row, s->row_bytes);
+  s->rows_done++;
+}
+
+// Predicted sample at byte i of a row, given the row decoded so far
+static inline uint16_t pred16(const rawz_state_t *s, const uint8_t *row, int filter, int i) {
+  if (filter == RAWZ_FILTER_UP) return (uint16_t)(up_row(s)[i] << 8 | up_row(s)[i + 1]);
+  return i >= 2 ? (uint16_t)(row[i - 2] << 8 | row[i - 1]) : 0;
+}
+
+static inline uint8_t pred8(const rawz_state_t *s, const uint8_t *row, int filter, int i) {
+  if (filter == RAWZ_FILTER_UP) return up_row(s)[i];
+  int l = left_of(s, i);
+  return i >= l ? row[i - l] : 0;
+}
+
+// Residuals of `row` under `filter` into s->res (when fill) and their magnitude sum
+static uint32_t residuals(rawz_state_t *s, const uint8_t *row, int filter, bool fill) {
+  uint32_t cost = 0;
+  if (s->fmt == RAWZ_FMT_RGB565) {
+    for (int i = 0; i < s->row_bytes; i += 2) {
+      uint16_t r = (uint16_t)((row[i] << 8 | row[i + 1]) - pred16(s, row, filter, i));
+      int16_t v = (int16_t)r;
+      cost += (uint32_t)(v < 0 ? -v : v);
+      if (fill) { s->res[i] = (uint8_t)(r >> 8); s->res[i + 1] = (uint8_t)r; }
+    }
+  } else {
+    for (int i = 0; i < s->row_bytes; i++) {
+      int8_t v = (int8_t)(row[i] - pred8(s, row, filter, i));
+      cost += (uint32_t)(v < 0 ? -v : v);
+      if (fill) s->res[i] = (uint8_t)v;
+    }
+  }
+  return cost;
+}
+
+static inline bool in_range(uint8_t r, int lo, int hi) {
+  int v = (int8_t)r;
+  return v >= lo && v <= hi;
+}
+
+static size_t emit_row(const rawz_state_t *s, uint8_t *out) {
+  const uint8_t *r = s->res;
+  const int n = s->row_bytes;
+  size_t o = 0;
+  int i = 0;
+  while (i < n) {
+    if (r[i] == 0) {
+      int k = 1;
+      while (i + k < n && k < OP_MAX && r[i + k] == 0) k++;
+      out[o++] = (uint8_t)(OP_RUN | (k - 1));
+      i += k;
+    } else if (i + 1 < n && in_range(r[i], -4, 3) && in_range(r[i + 1], -4, 3)) {
+      out[o++] = (uint8_t)(OP_PAIR | (((int8_t)r[i] + 4) << 3) | ((int8_t)r[i + 1] + 4));
+      i += 2;
+    } else if (in_range(r[i], -32, 31)) {
+      out[o++] = (uint8_t)(OP_SMALL | ((int8_t)r[i] + 32));
+      i++;
+    } else {
+      int k = 1;
+      while (i + k < n && k < OP_MAX && r[i + k] != 0 && !in_range(r[i + k], -32, 31)) k++;
+      out[o++] = (uint8_t)(OP_LIT | (k - 1));
+      memcpy(out + o, r + i, (size_t)k);
+      o += (size_t)k;
+      i += k;
+    }
+  }
+  return o;
+}
+
+size_t rawz_encode(rawz_state_t *s, const uint8_t *rows, int n, uint8_t *out) {
+  size_t o = 0;
+  for (int y = 0; y < n; y++) {
+    const uint8_t *row = rows + (size_t)y * s->row_bytes;
+    int filter = RAWZ_FILTER_SUB;
+    if (have_up(s) && residuals(s, row, RAWZ_FILTER_UP, false) < residuals(s, row, RAWZ_FILTER_SUB, false))
+      filter = RAWZ_FILTER_UP;
+    residuals(s, row, filter, true);
+    out[o++] = (uint8_t)filter;
+    o += emit_row(s, out + o);
+    push_row(s, row);
+  }
+  return o;
+}
+
+// Residual bytes of one row from the op stream; returns bytes consumed or 0
+static size_t read_row(rawz_state_t *s, const uint8_t *in, size_t len) {
+  uint8_t *r = s->res;
+  const int n = s->row_bytes;
+  size_t o = 0;
+  int i = 0;
+  while (i < n) {
+    if (o >= len) return 0;
+    uint8_t op = in[o++];
+    int arg = op & ~OP_MASK;
+    switch (op & OP_MASK) {
+      case OP_RUN:
+        if (i + arg + 1 > n) return 0;
+        memset(r + i, 0, (size_t)arg + 1);
+        i += arg + 1;
+        break;
+      case OP_PAIR:
+        if (i + 2 > n) return 0;
+        r[i++] = (uint8_t)((arg >> 3) - 4);
+        r[i++] = (uint8_t)((arg & 7) - 4);
+        break;
+      case OP_SMALL:
+        r[i++] = (uint8_t)(arg - 32);
+        break;
+      default:
+        if (i + arg + 1 > n || o + arg + 1 > len) return 0;
+        memcpy(r + i, in + o, (size_t)arg + 1);
+        o += (size_t)arg + 1;
+        i += arg + 1;
+        break;
+    }
+  }
+  return o;
+}
+
+bool rawz_decode(rawz_state_t *s, const uint8_t *in, size_t len, uint8_t *rows, int n) {
+  size_t o = 0;
+  for (int y = 0; y < n; y++) {
+    uint8_t *row = rows + (size_t)y * s->row_bytes;
+    if (o >= len) return false;
+    int filter = in[o++];
+    if (filter != RAWZ_FILTER_SUB && (filter != RAWZ_FILTER_UP || !have_up(s))) return false;
+    size_t k = read_row(s, in + o, len - o);
+    if (!k) return false;
+    o += k;
+    // Left prediction reads the bytes reconstructed just before
+    if (s->fmt == RAWZ_FMT_RGB565) {
+      for (int i = 0; i < s->row_bytes; i += 2) {
+        uint16_t v = (uint16_t)((s->res[i] << 8 | s->res[i + 1]) + pred16(s, row, filter, i));
+        row[i] = (uint8_t)(v >> 8);
+        row[i + 1] = (uint8_t)v;
+      }
+    } else {
+      for (int i = 0; i < s->row_bytes; i++) row[i] = (uint8_t)(s->res[i] + pred8(s, row, filter, i));
+    }
+    push_row(s, row);
+  }
+  return o == len;
+}
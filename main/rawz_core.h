@@ -0,0 +1,63 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lossless codec for raw captures, free of ESP-IDF dependencies so the host
+// decoder (tools/rawz_decode.c) builds the same source.
+//
+// Each row starts with a filter byte: SUB predicts every sample from the same
+// channel to its left, UP from the row above; the encoder picks the one with
+// the smaller residual sum. RGB565 is predicted as big-endian 16-bit words,
+// YUV422 per channel (Y two bytes back, U/V four), gray per byte, Bayer from
+// the same CFA color (two bytes back, two rows up). Residual bytes are coded
+// with four byte-aligned ops, never crossing a row:
+//
+//   00nnnnnn            n+1 zero residuals (1..64)
+//   01aaabbb            two residuals in -4..3 (stored +4)
+//   10vvvvvv            one residual in -32..31 (stored +32)
+//   11nnnnnn <n+1 B>    n+1 literal residuals (1..64)
+//
+// Prediction runs across calls: rows must be encoded and decoded in order.
+//
+// File layout (.rawz, little endian): rawz_hdr_t, then `blocks` blocks of
+// block_rows rows (the last may be shorter), each a u32 length and the coded
+// bytes.
+#define RAWZ_MAGIC        "RAWZ"
+#define RAWZ_VERSION      1
+#define RAWZ_MAX_ROW      3200    // bytes: UXGA RGB565
+#define RAWZ_BLOCK_ROWS   4
+
+enum { RAWZ_FMT_RGB565 = 0, RAWZ_FMT_YUV422 = 1, RAWZ_FMT_GRAY = 2, RAWZ_FMT_BAYER8 = 3 };
+enum { RAWZ_FILTER_SUB = 0, RAWZ_FILTER_UP = 1 };
+
+typedef struct __attribute__((packed)) {
+  char magic[4];
+  uint16_t version;
+  uint8_t format;       // RAWZ_FMT_*
+  uint8_t reserved0;
+  uint16_t width, height;
+  uint16_t block_rows;
+  uint16_t blocks;
+  uint32_t raw_len;     // decoded size, = width * height * bytes per pixel
+  uint8_t reserved[12];
+} rawz_hdr_t;
+
+typedef struct {
+  uint8_t fmt;
+  uint16_t row_bytes;
+  uint8_t up;                   // rows between a sample and its UP predictor
+  uint32_t rows_done;
+  uint8_t prev[2][RAWZ_MAX_ROW];   // last two rows, by rows_done parity
+  uint8_t res[RAWZ_MAX_ROW];
+} rawz_state_t;
+
+int rawz_bytes_per_pixel(uint8_t fmt);
+bool rawz_init(rawz_state_t *s, uint8_t fmt, uint16_t width);
+void rawz_hdr_init(rawz_hdr_t *h, uint8_t fmt, uint16_t width, uint16_t height);
+// Worst-case coded size of n rows
+size_t rawz_bound(const rawz_state_t *s, int n);
+// Encodes n rows into out (at least rawz_bound() bytes); returns bytes written
+size_t rawz_encode(rawz_state_t *s, const uint8_t *rows, int n, uint8_t *out);
+// Decodes n rows from exactly `len` coded bytes; false on malformed input
+bool rawz_decode(rawz_state_t *s, const uint8_t *in, size_t len, uint8_t *rows, int n);
@@ -0,0 +1,362 @@
+#include "reg_log.h"
+#include "reg_cache.h"
+#include "reg_overlay.h"
+#include "sccb_sched.h"
+#include "slave_client.h"
+#include "wait_queue.h"
+#include "app_config.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_heap_caps.h"
+#include "cJSON.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "REGLOG";
+
+
+static SemaphoreHandle_t s_lock = NULL;
+
+// Shadow: merged result of every replicated mutation (val under mask)
+static reg_cache_t s_shadow;
+static uint8_t s_shadow_mask[2][256];
+
+static void shadow_reset_locked(void) {
+  reg_cache_init(&s_shadow);
+  memset(s_shadow_mask, 0, sizeof(s_shadow_mask));
+}
+
+static void shadow_merge_locked(const reg_log_op_t *op) {
+  uint8_t v = op->val;
+  if (s_shadow.dirty[op->bank][op->addr]) {
+    v = (uint8_t)((s_shadow.val[op->bank][op->addr] & ~op->mask) | (op->val & op->mask));
+    s_shadow_mask[op->bank][op->addr] |= op->mask;
+  } else {
+    s_shadow_mask[op->bank][op->addr] = op->mask;
+  }
+  reg_cache_set(&s_shadow, (ov2640_bank_t)op->bank, op->addr, v);
+}
+
+// FNV-1a over (bank, addr, mask, val & mask) of every shadowed register
+static uint32_t shadow_hash_locked(void) {
+  uint32_t h = 2166136261u;
+  for (int b = 0; b < 2; b++) {
+    for (int a = 0; a < 256; a++) {
+      if (!s_shadow.dirty[b][a]) continue;
+      uint8_t m = s_shadow_mask[b][a];
+      uint8_t bytes[4] = { (uint8_t)b, (uint8_t)a, m, (uint8_t)(s_shadow.val[b][a] & m) };
+      for (int i = 0; i < 4; i++) { h ^= bytes[i]; h *= 16777619u; }
+    }
+  }
+  return h;
+}
+
+uint32_t reg_log_shadow_hash(void) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  uint32_t h = shadow_hash_locked();
+  xSemaphoreGive(s_lock);
+  return h;
+}
+
+#if CONFIG_ROLE_MASTER
+typedef struct {
+  reg_log_op_t op;
+  int64_t t_us;     // append time, for mirroring latency
+} log_ent_t;
+
+static log_ent_t *s_ring = NULL;
+static uint32_t s_epoch = 0;
+static uint32_t s_head = 0;       // last appended seq (first seq is 1)
+static uint32_t s_acked = 0;      // last seq the slave applied
+static bool s_need_resync = false;
+static TaskHandle_t s_repl_task = NULL;
+static wait_queue_t s_ack_wq;     // reg_log_wait_acked() callers, woken after every ack
+
+static struct {
+  uint32_t batches, errors, resyncs;
+  uint32_t slave_hash, hash_seq;
+  bool diverged;
+  int64_t lat_last, lat_max, lat_sum;
+  uint32_t lat_n;
+} s_st;
+
+uint32_t reg_log_append(ov2640_bank_t bank, uint8_t addr, uint8_t mask, uint8_t val) {
+  reg_log_op_t op = { (uint8_t)bank, addr, mask, val };
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  uint32_t seq = ++s_head;
+  log_ent_t *e = &s_ring[seq % REG_LOG_RING];
+  e->op = op;
+  e->t_us = esp_timer_get_time();
+  shadow_merge_locked(&op);
+  xSemaphoreGive(s_lock);
+  return seq;
+}
+
+void reg_log_kick(void) {
+  if (s_repl_task) xTaskNotifyGive(s_repl_task);
+}
+
+bool reg_log_wait_acked(uint32_t seq, TickType_t timeout, int64_t *latency_us) {
+  TickType_t start = xTaskGetTickCount();
+  // Registered before the first check, so an ack landing in between wakes us
+  int slot = wait_queue_enter(&s_ack_wq);
+  bool acked = true;
+  while (s_acked < seq) {
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= timeout) { acked = false; break; }
+    wait_queue_wait(&s_ack_wq, slot, timeout - waited);
+  }
+  wait_queue_leave(&s_ack_wq, slot);
+  if (acked && latency_us) *latency_us = s_st.lat_last;
+  return acked;
+}
+
+// Fills buf with the next batch; returns its byte length
+static int build_batch_locked(uint8_t *buf) {
+  reg_log_batch_hdr_t *h = (reg_log_batch_hdr_t*)buf;
+  reg_log_op_t *ops = (reg_log_op_t*)(buf + sizeof(*h));
+  h->epoch = s_epoch;
+  h->flags = 0;
+  h->count = 0;
+
+  if (s_head - s_acked > REG_LOG_RING) s_need_resync = true;   // entries already overwritten
+
+  if (s_need_resync) {
+    h->flags = REG_LOG_FLAG_RESYNC;
+    h->base = s_head;
+    for (int b = 0; b < 2; b++) {
+      for (int a = 0; a < 256; a++) {
+        if (!s_shadow.dirty[b][a]) continue;
+        ops[h->count++] = (reg_log_op_t){ (uint8_t)b, (uint8_t)a, s_shadow_mask[b][a], s_shadow.val[b][a] };
+      }
+    }
+  } else {
+    h->base = s_acked + 1;
+    uint32_t n = s_head - s_acked;
+    if (n > REG_LOG_BATCH_MAX) n = REG_LOG_BATCH_MAX;
+    for (uint32_t i = 0; i < n; i++) ops[i] = s_ring[(h->base + i) % REG_LOG_RING].op;
+    h->count = (uint16_t)n;   // 0 = status probe
+  }
+  return (int)(sizeof(*h) + h->count * sizeof(reg_log_op_t));
+}
+
+static void handle_ack_locked(const reg_log_batch_hdr_t *sent, uint32_t applied, uint32_t hash) {
+  int64_t now = esp_timer_get_time();
+
+  if (sent->flags & REG_LOG_FLAG_RESYNC) {
+    if (applied == sent->base) {
+      s_need_resync = false;
+      s_st.resyncs++;
+      s_acked = applied;
+    }
+  } else if (applied > s_head) {
+    s_need_resync = true;
+  } else if (applied < s_acked) {
+    // slave lost state (reboot): re-send from its position, or resync if gone from the ring
+    s_acked = applied;
+  } else {
+    for (uint32_t seq = s_acked + 1; seq <= applied; seq++) {
+      int64_t lat = now - s_ring[seq % REG_LOG_RING].t_us;
+      s_st.lat_last = lat;
+      if (lat > s_st.lat_max) s_st.lat_max = lat;
+      s_st.lat_sum += lat;
+      s_st.lat_n++;
+    }
+    s_acked = applied;
+  }
+
+  if (s_acked == s_head) {
+    s_st.slave_hash = hash;
+    s_st.hash_seq = s_acked;
+    bool div = hash != shadow_hash_locked();
+    if (div && !s_st.diverged) ESP_LOGW(TAG, "slave shadow diverged at seq %u, resyncing", (unsigned)s_acked);
+    s_st.diverged = div;
+    if (div) s_need_resync = true;
+  }
+}
+
+static void repl_task(void *arg) {
+  (void)arg;
+  uint8_t *buf;
+  // Once for the task's life; nothing can be replicated without it
+  while (!(buf = (uint8_t*)malloc(sizeof(reg_log_batch_hdr_t) + 512 * sizeof(reg_log_op_t)))) {
+    ESP_LOGE(TAG, "no memory for the batch buffer, retrying");
+    vTaskDelay(pdMS_TO_TICKS(1000));
+  }
+  char resp[128];
+
+  while (1) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool pending = s_acked < s_head || s_need_resync;
+    xSemaphoreGive(s_lock);
+
+    // Idle: probe every 5 s so slave reboots/divergence are noticed
+    if (!pending) ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(5000));
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int len = build_batch_locked(buf);
+    xSemaphoreGive(s_lock);
+    reg_log_batch_hdr_t sent = *(reg_log_batch_hdr_t*)buf;
+
+    int code = slave_link_post(SLAVE_LINK_REPL, "/api/reglog/apply", "application/octet-stream", (const char*)buf, len, resp, sizeof(resp));
+    cJSON *root = code == 200 ? cJSON_Parse(resp) : NULL;
+    cJSON *ap = root ? cJSON_GetObjectItem(root, "applied") : NULL;
+    cJSON *hs = root ? cJSON_GetObjectItem(root, "hash") : NULL;
+    if (!cJSON_IsNumber(ap) || !cJSON_IsString(hs)) {
+      cJSON_Delete(root);
+      xSemaphoreTake(s_lock, portMAX_DELAY);
+      s_st.errors++;
+      xSemaphoreGive(s_lock);
+      vTaskDelay(pdMS_TO_TICKS(500));
+      continue;
+    }
+    uint32_t applied = (uint32_t)ap->valuedouble;
+    uint32_t hash = (uint32_t)strtoul(hs->valuestring, NULL, 16);
+    cJSON_Delete(root);
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint32_t acked_before = s_acked;
+    s_st.batches++;
+    handle_ack_locked(&sent, applied, hash);
+    bool stalled = sent.count && s_acked == acked_before;
+    xSemaphoreGive(s_lock);
+
+    wait_queue_wake_all(&s_ack_wq);
+
+    // Slave could not apply (e.g. camera re-init in progress): back off before retrying
+    if (stalled) vTaskDelay(pdMS_TO_TICKS(200));
+  }
+}
+
+bool reg_log_status_json(char *out, int out_max) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  snprintf(out, out_max,
+    "{\"role\":\"master\",\"epoch\":%u,\"head\":%u,\"acked\":%u,\"pending\":%u,"
+    "\"hash\":\"%08x\",\"slave_hash\":\"%08x\",\"hash_seq\":%u,\"diverged\":%s,"
+    "\"batches\":%u,\"errors\":%u,\"resyncs\":%u,"
+    "\"lat_last_us\":%lld,\"lat_avg_us\":%lld,\"lat_max_us\":%lld}",
+    (unsigned)s_epoch, (unsigned)s_head, (unsigned)s_acked, (unsigned)(s_head - s_acked),
+    (unsigned)shadow_hash_locked(), (unsigned)s_st.slave_hash, (unsigned)s_st.hash_seq,
+    s_st.diverged ? "true" : "false",
+    (unsigned)s_st.batches, (unsigned)s_st.errors, (unsigned)s_st.resyncs,
+    (long long)s_st.lat_last, (long long)(s_st.lat_n ? s_st.lat_sum / s_st.lat_n : 0), (long long)s_st.lat_max);
+  xSemaphoreGive(s_lock);
+  return true;
+}
+
+esp_err_t reg_log_apply_handler(httpd_req_t *req) {
+  return httpd_resp_send_err(req, 404, "master has no apply endpoint");
+}
+
+void reg_log_init(void) {
+  s_lock = xSemaphoreCreateMutex();
+  wait_queue_init(&s_ack_wq);
+  shadow_reset_locked();
+  s_ring = (log_ent_t*)heap_caps_calloc(REG_LOG_RING, sizeof(log_ent_t), MALLOC_CAP_SPIRAM);
+  s_epoch = esp_random();
+  xTaskCreatePinnedToCore(repl_task, "reg_repl", 4096, NULL, 4, &s_repl_task, 0);
+}
+
+#else  // SLAVE
+
+static uint32_t s_epoch = 0;
+static uint32_t s_applied = 0;
+
+uint32_t reg_log_append(ov2640_bank_t bank, uint8_t addr, uint8_t mask, uint8_t val) {
+  (void)bank; (void)addr; (void)mask; (void)val;
+  return 0;
+}
+void reg_log_kick(void) {}
+bool reg_log_wait_acked(uint32_t seq, TickType_t timeout, int64_t *latency_us) {
+  (void)seq; (void)timeout; (void)latency_us;
+  return false;
+}
+
+bool reg_log_status_json(char *out, int out_max) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  snprintf(out, out_max, "{\"role\":\"slave\",\"epoch\":%u,\"applied\":%u,\"hash\":\"%08x\"}",
+    (unsigned)s_epoch, (unsigned)s_applied, (unsigned)shadow_hash_locked());
+  xSemaphoreGive(s_lock);
+  return true;
+}
+
+// One scheduled batch, committed at the next frame boundary; returns ops written
+static int apply_ops(const reg_log_op_t *ops, int n) {
+  if (n <= 0) return 0;
+  sccb_sched_result_t sr;
+  sccb_sched_apply(ops, n, pdMS_TO_TICKS(500), &sr);
+  for (int i = 0; i < sr.written; i++)
+    reg_overlay_record(REG_OVL_CURRENT, (ov2640_bank_t)ops[i].bank, ops[i].addr, ops[i].mask, ops[i].val);
+  return sr.written;
+}
+
+esp_err_t reg_log_apply_handler(httpd_req_t *req) {
+  const int max_len = sizeof(reg_log_batch_hdr_t) + 512 * sizeof(reg_log_op_t);
+  int len = (int)req->content_len;
+  if (len < (int)sizeof(reg_log_batch_hdr_t) || len > max_len) return httpd_resp_send_err(req, 400, "bad length");
+
+  uint8_t *buf = (uint8_t*)malloc(len);
+  if (!buf) return httpd_resp_send_err(req, 500, "no mem");
+  int got = 0;
+  while (got < len) {
+    int n = httpd_req_recv(req, (char*)buf + got, len - got);
+    if (n <= 0) { free(buf); return httpd_resp_send_err(req, 400, "recv failed"); }
+    got += n;
+  }
+
+  reg_log_batch_hdr_t h;
+  memcpy(&h, buf, sizeof(h));
+  reg_log_op_t *ops = (reg_log_op_t*)(buf + sizeof(h));
+  if (sizeof(h) + h.count * sizeof(reg_log_op_t) != (size_t)len) { free(buf); return httpd_resp_send_err(req, 400, "bad count"); }
+
+  int written = 0;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  if (h.epoch != s_epoch) {
+    // master rebooted: its sequence restarted
+    s_epoch = h.epoch;
+    s_applied = 0;
+    shadow_reset_locked();
+  }
+
+  if (h.flags & REG_LOG_FLAG_RESYNC) {
+    shadow_reset_locked();
+    int n = 0;
+    for (int i = 0; i < h.count; i++) {
+      if (ops[i].bank > 1) continue;
+      shadow_merge_locked(&ops[i]);
+      ops[n++] = ops[i];
+    }
+    written = apply_ops(ops, n);
+    // On a failed write the shadow is kept but applied is not advanced: master resyncs again
+    if (written == n) s_applied = h.base;
+  } else if (h.base <= s_applied + 1) {
+    // apply in order, skipping entries already applied from a re-sent batch
+    uint32_t first = s_applied + 1 - h.base;
+    int n = 0;
+    while (first + n < h.count && ops[first + n].bank <= 1) n++;
+    written = apply_ops(ops + first, n);
+    for (int i = 0; i < written; i++) shadow_merge_locked(&ops[first + i]);
+    s_applied += written;
+  }
+  uint32_t applied = s_applied;
+  uint32_t hash = shadow_hash_locked();
+  xSemaphoreGive(s_lock);
+  free(buf);
+
+  if (written) reg_overlay_save_later();
+
+  char out[64];
+  snprintf(out, sizeof(out), "{\"applied\":%u,\"hash\":\"%08x\"}", (unsigned)applied, (unsigned)hash);
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, out);
+}
+
+void reg_log_init(void) {
+  s_lock = xSemaphoreCreateMutex();
+  shadow_reset_locked();
+}
+#endif
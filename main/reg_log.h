@@ -0,0 +1,37 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_http_server.h"
+#include "ov2640_ctrl.h"
+
+// Replicated register log. The MASTER applies register mutations locally,
+// appends them to a sequence-numbered log and a replicator task streams
+// batches to the SLAVE over the persistent link. The SLAVE applies batches in
+// order and acks the last applied sequence together with a hash of its
+// register shadow (the merged state of all replicated writes); the MASTER
+// compares it against its own shadow to detect divergence.
+#define REG_LOG_RING        1024   // master log entries kept for re-send
+#define REG_LOG_BATCH_MAX   64
+#define REG_LOG_FLAG_RESYNC 0x0001 // batch carries the full shadow, not log entries
+
+typedef struct __attribute__((packed)) {
+  uint32_t epoch;     // master boot id; slave resets its state when it changes
+  uint32_t base;      // seq of first entry (RESYNC: seq the snapshot is current at)
+  uint16_t count;
+  uint16_t flags;
+} reg_log_batch_hdr_t;
+
+typedef ov2640_reg_op_t reg_log_op_t;   // 4 bytes on the wire
+
+void reg_log_init(void);
+
+// MASTER: append an already-applied local mutation; returns its seq
+uint32_t reg_log_append(ov2640_bank_t bank, uint8_t addr, uint8_t mask, uint8_t val);
+void reg_log_kick(void);
+bool reg_log_wait_acked(uint32_t seq, TickType_t timeout, int64_t *latency_us);
+
+uint32_t reg_log_shadow_hash(void);
+bool reg_log_status_json(char *out, int out_max);
+
+esp_err_t reg_log_apply_handler(httpd_req_t *req);   // SLAVE: POST /api/reglog/apply
@@ -0,0 +1,268 @@
+#include "reg_overlay.h"
+#include "reg_cache.h"
+#include "app_state.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "OVL";
+
+#define REG_BANK_SELECT 0xFF
+#define NVS_NS "reg_ovl"
+
+typedef struct {
+  reg_cache_t ovl;            // val = overlay value, dirty = entry present
+  uint8_t mask[2][256];
+  reg_cache_t defaults;       // val = driver default for def_profile, dirty = known
+  cam_profile_t def_profile;
+  reg_ovl_stats_t stats;
+} ovl_slot_t;
+
+// Packed NVS record: one per overlaid register
+typedef struct __attribute__((packed)) {
+  uint8_t bank, addr, mask, val;
+} ovl_rec_t;
+
+static ovl_slot_t s_slots[REG_OVL_SLOTS];
+static bool s_dirty[REG_OVL_SLOTS];          // differs from what NVS holds
+static SemaphoreHandle_t s_lock = NULL;
+static esp_timer_handle_t s_save_timer = NULL;
+static TaskHandle_t s_save_task = NULL;
+static const char *s_keys[REG_OVL_SLOTS] = { "stream", "capture" };
+
+// Programmed by the driver from framesize/pixformat/quality
+static bool is_mode_reg(int bank, uint8_t a) {
+  if (bank == REG_BANK_DSP) {
+    switch (a) {
+      case 0x05:                                  // R_BYPASS
+      case 0x44:                                  // QS
+      case 0x50: case 0x51: case 0x52: case 0x53: // CTRLI, HSIZE, VSIZE, XOFFL
+      case 0x54: case 0x55: case 0x56: case 0x57: // YOFFL, VHYX, DPRP, TEST
+      case 0x5A: case 0x5B: case 0x5C:            // ZMOW, ZMOH, ZMHH
+      case 0x86: case 0x87:                       // CTRL2, CTRL3
+      case 0xC0: case 0xC1:                       // HSIZE8, VSIZE8
+      case 0xD3:                                  // R_DVP_SP (PCLK divider)
+      case 0xD7: case 0xDA: case 0xE0: case 0xE1: // output format, IMAGE_MODE, RESET
+        return true;
+    }
+    return false;
+  }
+  switch (a) {
+    case 0x03:                                    // COM1 (vertical window LSBs)
+    case 0x11:                                    // CLKRC
+    case 0x12:                                    // COM7 (resolution)
+    case 0x17: case 0x18: case 0x19: case 0x1A:   // HREFST, HREFEND, VSTRT, VEND
+    case 0x32:                                    // REG32 (horizontal window LSBs)
+    case 0x35: case 0x37: case 0x3D:              // per-resolution timing
+    case 0x4F: case 0x50:                         // BD50, BD60 (banding per line time)
+    case 0x5A: case 0x6D:                         // per-resolution timing
+      return true;
+  }
+  return false;
+}
+
+static void slot_reset(ovl_slot_t *s) {
+  reg_cache_init(&s->ovl);
+  memset(s->mask, 0, sizeof(s->mask));
+  reg_cache_init(&s->defaults);
+  s->def_profile.framesize = FRAMESIZE_INVALID;
+  memset(&s->stats, 0, sizeof(s->stats));
+}
+
+// True if the entry changed
+static bool slot_record(ovl_slot_t *s, int bank, uint8_t addr, uint8_t mask, uint8_t val) {
+  if (s->ovl.dirty[bank][addr] && (s->mask[bank][addr] & mask) == mask &&
+      ((s->ovl.val[bank][addr] ^ val) & mask) == 0) return false;
+  if (s->ovl.dirty[bank][addr]) {
+    // merge masked writes into the existing entry
+    uint8_t merged = (uint8_t)((s->ovl.val[bank][addr] & ~mask) | (val & mask));
+    s->mask[bank][addr] |= mask;
+    val = merged;
+  } else {
+    s->mask[bank][addr] = mask;
+    s->stats.entries++;
+  }
+  reg_cache_set(&s->ovl, (ov2640_bank_t)bank, addr, val);
+  return true;
+}
+
+static void slot_load(reg_ovl_slot_t slot) {
+  nvs_handle_t h;
+  if (nvs_open(NVS_NS, NVS_READONLY, &h) != ESP_OK) return;
+
+  size_t len = 0;
+  if (nvs_get_blob(h, s_keys[slot], NULL, &len) == ESP_OK && len > 0 && len % sizeof(ovl_rec_t) == 0) {
+    ovl_rec_t *recs = (ovl_rec_t*)malloc(len);
+    if (recs && nvs_get_blob(h, s_keys[slot], recs, &len) == ESP_OK) {
+      for (size_t i = 0; i < len / sizeof(ovl_rec_t); i++) {
+        if (recs[i].bank > 1) continue;
+        // Older firmware recorded window/format registers too: drop them
+        if (is_mode_reg(recs[i].bank, recs[i].addr)) { s_dirty[slot] = true; continue; }
+        slot_record(&s_slots[slot], recs[i].bank, recs[i].addr, recs[i].mask, recs[i].val);
+      }
+    }
+    free(recs);
+  }
+  nvs_close(h);
+  ESP_LOGI(TAG, "%s overlay: %d regs", s_keys[slot], s_slots[slot].stats.entries);
+}
+
+// The NVS write can stall on a flash erase: done here, not on the esp_timer
+// task every other timer callback shares
+static void save_task(void *arg) {
+  (void)arg;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    reg_overlay_save();
+  }
+}
+
+static void save_timer_cb(void *arg) {
+  (void)arg;
+  xTaskNotifyGive(s_save_task);
+}
+
+void reg_overlay_init(void) {
+  if (!s_lock) s_lock = xSemaphoreCreateMutex();
+  if (!s_save_task) xTaskCreate(save_task, "ovl_save", 4096, NULL, tskIDLE_PRIORITY + 1, &s_save_task);
+  if (!s_save_timer && s_save_task) {
+    const esp_timer_create_args_t args = { .callback = save_timer_cb, .name = "ovl_save" };
+    esp_timer_create(&args, &s_save_timer);
+  }
+  for (int i = 0; i < REG_OVL_SLOTS; i++) {
+    slot_reset(&s_slots[i]);
+    slot_load((reg_ovl_slot_t)i);
+  }
+}
+
+int reg_overlay_slot_from_str(const char *s) {
+  if (!s || !strcmp(s, "current")) return REG_OVL_CURRENT;
+  if (!strcmp(s, "all")) return REG_OVL_ALL;
+  if (!strcmp(s, "stream")) return REG_OVL_STREAM;
+  if (!strcmp(s, "capture")) return REG_OVL_CAPTURE;
+  return REG_OVL_NONE;
+}
+
+void reg_overlay_record(int slot, ov2640_bank_t bank, uint8_t addr, uint8_t mask, uint8_t val) {
+  if (slot == REG_OVL_NONE || addr == REG_BANK_SELECT || (int)bank > 1 || mask == 0) return;
+  if (is_mode_reg(bank, addr)) return;
+  if (slot == REG_OVL_CURRENT) slot = g_app.mode == CAM_MODE_CAPTURE ? REG_OVL_CAPTURE : REG_OVL_STREAM;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  for (int i = 0; i < REG_OVL_SLOTS; i++) {
+    if ((slot == REG_OVL_ALL || slot == i) && slot_record(&s_slots[i], bank, addr, mask, val)) s_dirty[i] = true;
+  }
+  xSemaphoreGive(s_lock);
+}
+
+void reg_overlay_clear(int slot) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  for (int i = 0; i < REG_OVL_SLOTS; i++) {
+    if (slot != REG_OVL_ALL && slot != i) continue;
+    s_dirty[i] = s_dirty[i] || s_slots[i].stats.entries > 0;
+    slot_reset(&s_slots[i]);
+  }
+  xSemaphoreGive(s_lock);
+}
+
+bool reg_overlay_save(void) {
+  nvs_handle_t h;
+  if (nvs_open(NVS_NS, NVS_READWRITE, &h) != ESP_OK) return false;
+
+  ovl_rec_t *recs = (ovl_rec_t*)malloc(512 * sizeof(ovl_rec_t));
+  if (!recs) { nvs_close(h); return false; }
+
+  bool ok = true;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  for (int i = 0; i < REG_OVL_SLOTS && ok; i++) {
+    if (!s_dirty[i]) continue;
+    ovl_slot_t *s = &s_slots[i];
+    size_t n = 0;
+    for (int b = 0; b < 2; b++) {
+      for (int a = 0; a < 256; a++) {
+        if (!s->ovl.dirty[b][a]) continue;
+        recs[n++] = (ovl_rec_t){ (uint8_t)b, (uint8_t)a, s->mask[b][a], s->ovl.val[b][a] };
+      }
+    }
+    esp_err_t err = n ? nvs_set_blob(h, s_keys[i], recs, n * sizeof(ovl_rec_t))
+                      : nvs_erase_key(h, s_keys[i]);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) ok = false;
+  }
+  if (ok) ok = nvs_commit(h) == ESP_OK;
+  if (ok) memset(s_dirty, 0, sizeof(s_dirty));
+  xSemaphoreGive(s_lock);
+
+  free(recs);
+  nvs_close(h);
+  if (!ok) ESP_LOGE(TAG, "overlay save failed");
+  return ok;
+}
+
+void reg_overlay_save_later(void) {
+  if (!s_save_timer) {
+    reg_overlay_save();
+    return;
+  }
+  // Restarted by every write: the save follows the last one of a burst
+  esp_timer_stop(s_save_timer);
+  esp_timer_start_once(s_save_timer, (uint64_t)REG_OVL_SAVE_DELAY_MS * 1000);
+}
+
+bool reg_overlay_apply(reg_ovl_slot_t slot, const cam_profile_t *p) {
+  if (slot >= REG_OVL_SLOTS || !p || !s_lock) return false;
+  int64_t t0 = esp_timer_get_time();
+  int written = 0, reads = 0;
+  bool ok = true;
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  ovl_slot_t *s = &s_slots[slot];
+
+  // Driver defaults depend on the init tables for framesize/pixformat/quality
+  if (s->def_profile.framesize != p->framesize || s->def_profile.pixformat != p->pixformat ||
+      s->def_profile.jpeg_quality != p->jpeg_quality) {
+    reg_cache_init(&s->defaults);
+    s->def_profile = *p;
+  }
+
+  // Bank-major order keeps bank switches to one per bank
+  for (int b = 0; b < 2; b++) {
+    for (int a = 0; a < 256; a++) {
+      if (!s->ovl.dirty[b][a]) continue;
+
+      if (!s->defaults.dirty[b][a]) {
+        uint8_t d = 0;
+        if (!ov2640_read_reg((ov2640_bank_t)b, (uint8_t)a, &d)) { ok = false; continue; }
+        reg_cache_set(&s->defaults, (ov2640_bank_t)b, (uint8_t)a, d);
+        reads++;
+      }
+
+      uint8_t m = s->mask[b][a];
+      uint8_t v = s->ovl.val[b][a];
+      if ((s->defaults.val[b][a] & m) == (v & m)) continue;
+
+      if (!ov2640_modify_reg((ov2640_bank_t)b, (uint8_t)a, m, v)) { ok = false; continue; }
+      written++;
+    }
+  }
+
+  s->stats.last_written = written;
+  s->stats.last_read = reads;
+  s->stats.last_us = esp_timer_get_time() - t0;
+  xSemaphoreGive(s_lock);
+
+  if (!ok) ESP_LOGW(TAG, "%s overlay apply incomplete", s_keys[slot]);
+  return ok;
+}
+
+void reg_overlay_get_stats(reg_ovl_slot_t slot, reg_ovl_stats_t *out) {
+  if (!out) return;
+  memset(out, 0, sizeof(*out));
+  if (slot >= REG_OVL_SLOTS || !s_lock) return;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  *out = s_slots[slot].stats;
+  xSemaphoreGive(s_lock);
+}
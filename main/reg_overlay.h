@@ -0,0 +1,44 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "cam_manager.h"
+#include "ov2640_ctrl.h"
+
+// Register overlay: writes made through the register APIs/presets are recorded
+// per camera profile and re-applied after every esp_camera_init(), so a capture
+// reinit does not drop the tuning done on the stream. Unscoped writes go to the
+// slot of the mode the camera is in. Window, scaler, clock and output format
+// registers are never recorded: the driver programs them per framesize and
+// pixformat, and replaying the stream's values would break a UXGA/raw capture.
+typedef enum {
+  REG_OVL_STREAM = 0,
+  REG_OVL_CAPTURE,
+  REG_OVL_SLOTS
+} reg_ovl_slot_t;
+
+#define REG_OVL_ALL      (-1)
+#define REG_OVL_NONE     (-2)
+#define REG_OVL_CURRENT  (-3)   // slot of the current camera mode
+
+#define REG_OVL_SAVE_DELAY_MS  2000
+
+typedef struct {
+  int entries;        // registers held in the overlay
+  int last_written;   // registers that differed from driver defaults on last apply
+  int last_read;      // default snapshots taken (SCCB reads) on last apply
+  int64_t last_us;    // duration of last apply
+} reg_ovl_stats_t;
+
+void reg_overlay_init(void);                     // loads persisted overlay from NVS
+int  reg_overlay_slot_from_str(const char *s);   // "current" (NULL)/"all"/"stream"/"capture"/"none"
+
+void reg_overlay_record(int slot, ov2640_bank_t bank, uint8_t addr, uint8_t mask, uint8_t val);
+void reg_overlay_clear(int slot);
+bool reg_overlay_save(void);                     // writes changed slots to NVS now
+// Saves once no write has come in for REG_OVL_SAVE_DELAY_MS, so a burst of
+// register POSTs costs one NVS write
+void reg_overlay_save_later(void);
+
+// Called with cam_mutex held, right after esp_camera_init().
+bool reg_overlay_apply(reg_ovl_slot_t slot, const cam_profile_t *p);
+void reg_overlay_get_stats(reg_ovl_slot_t slot, reg_ovl_stats_t *out);
@@ -1,6 +1,9 @@
 #include "reg_profiles.h"
 #include "app_config.h"
 #include "ov2640_ctrl.h"
+#include "reg_overlay.h"
+#include "reg_log.h"
+#include "sccb_sched.h"
 #include "esp_log.h"
 #include "cJSON.h"
 #include <stdio.h>
@@ -78,20 +81,22 @@ bool presets_save_current(const char *name) {
   return true;
 }
 
-static bool apply_bank_array(cJSON *arr, ov2640_bank_t bank) {
-  if (!cJSON_IsArray(arr)) return false;
-  int n = cJSON_GetArraySize(arr);
-  for (int i = 0; i < n; i++) {
+#define PRESET_MAX_OPS 512
+
+static void collect_bank_array(cJSON *arr, ov2640_bank_t bank, ov2640_reg_op_t *ops, int *n) {
+  if (!cJSON_IsArray(arr)) return;
+  int cnt = cJSON_GetArraySize(arr);
+  for (int i = 0; i < cnt && *n < PRESET_MAX_OPS; i++) {
     cJSON *obj = cJSON_GetArrayItem(arr, i);
     cJSON *a = cJSON_GetObjectItem(obj, "addr");
     cJSON *v = cJSON_GetObjectItem(obj, "val");
     if (!cJSON_IsNumber(a) || !cJSON_IsNumber(v)) continue;
-    if (!ov2640_write_reg(bank, (uint8_t)a->valueint, (uint8_t)v->valueint)) return false;
+    if (a->valueint == 0xFF) continue;   // bank select: owned by ov2640_set_bank()
+    ops[(*n)++] = (ov2640_reg_op_t){ (uint8_t)bank, (uint8_t)a->valueint, 0xFF, (uint8_t)v->valueint };
   }
-  return true;
 }
 
-bool presets_load_and_apply(const char *name) {
+bool presets_load_and_apply(const char *name, uint32_t *log_seq) {
   char path[256];
   preset_path(path, sizeof(path), name);
 
@@ -116,7 +121,23 @@ bool presets_load_and_apply(const char *name) {
   cJSON *dsp = cJSON_GetObjectItem(root, "dsp");
   cJSON *sen = cJSON_GetObjectItem(root, "sensor");
 
-  bool ok = apply_bank_array(dsp, REG_BANK_DSP) && apply_bank_array(sen, REG_BANK_SENSOR);
+  if (!cJSON_IsArray(dsp) || !cJSON_IsArray(sen)) { cJSON_Delete(root); return false; }
+
+  ov2640_reg_op_t *ops = (ov2640_reg_op_t*)malloc(PRESET_MAX_OPS * sizeof(ov2640_reg_op_t));
+  if (!ops) { cJSON_Delete(root); return false; }
+  int n = 0;
+  collect_bank_array(dsp, REG_BANK_DSP, ops, &n);
+  collect_bank_array(sen, REG_BANK_SENSOR, ops, &n);
   cJSON_Delete(root);
+
+  // The whole preset lands between frames, never half-applied inside one
+  sccb_sched_result_t sr;
+  bool ok = sccb_sched_apply(ops, n, pdMS_TO_TICKS(2000), &sr);
+  for (int i = 0; i < sr.written; i++) {
+    reg_overlay_record(REG_OVL_CURRENT, (ov2640_bank_t)ops[i].bank, ops[i].addr, 0xFF, ops[i].val);
+    if (log_seq) *log_seq = reg_log_append((ov2640_bank_t)ops[i].bank, ops[i].addr, 0xFF, ops[i].val);
+  }
+  free(ops);
+  reg_overlay_save_later();
   return ok;
 }
@@ -1,6 +1,9 @@
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
 
 bool presets_list_json(char *out, int out_max);
 bool presets_save_current(const char *name);
-bool presets_load_and_apply(const char *name);
+// log_seq != NULL: also append every write to the replicated register log and
+// return the last seq (MASTER mirroring)
+bool presets_load_and_apply(const char *name, uint32_t *log_seq);
@@ -0,0 +1,594 @@
+#include "reg_script.h"
+#include "app_config.h"
+#include "ov2640_ctrl.h"
+#include "sccb_sched.h"
+#include "frame_sync.h"
+#include "reg_overlay.h"
+#include "cam_manager.h"
+#include "app_state.h"
+#include "capture_catalog.h"
+#include "capture_gallery.h"
+#include "capture_stripe.h"
+#include "retention.h"
+#include "chunk_writer.h"
+#include "slave_client.h"
+#include "trigger_gpio.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+static const char *TAG = "SCRIPT";
+
+#define SCRIPT_TEXT_MAX   4096
+#define RESULT_JSON_MAX   6144
+#define FRAME_TIMEOUT_MS  500
+#define FRAMES_IDLE_US    250000    // no frame for this long: nobody is pulling the stream
+#define ARM_EXPIRY_US     5000000
+#define POLL_WAIT_MS      3000
+#define MAX_POLLERS       2
+
+static SemaphoreHandle_t s_busy = NULL;   // one script at a time
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool s_running = false;            // an HTTP run owns the worker, under s_mux
+
+// ------------------ compiler ------------------
+
+static bool parse_num(char **p, long lo, long hi, long *out) {
+  while (**p == ' ' || **p == '\t') (*p)++;
+  if (!**p) return false;
+  char *end;
+  long v = strtol(*p, &end, 0);
+  if (end == *p || v < lo || v > hi) return false;
+  *p = end;
+  *out = v;
+  return true;
+}
+
+static bool compile_step(char *line, reg_script_op_t *op) {
+  char *p = line;
+  while (*p == ' ' || *p == '\t') p++;
+  char k = (char)tolower((unsigned char)*p++);
+  long b = 0, a = 0, m = 0xFF, v = 0;
+  memset(op, 0, sizeof(*op));
+
+  switch (k) {
+    case 'w':
+    case 'm':
+      // 0xFF is the bank select register, owned by ov2640_ctrl
+      if (!parse_num(&p, 0, 1, &b) || !parse_num(&p, 0, 0xFE, &a)) return false;
+      if (k == 'm' && !parse_num(&p, 0, 0xFF, &m)) return false;
+      if (!parse_num(&p, 0, 0xFF, &v)) return false;
+      op->kind = k == 'w' ? RS_WRITE : RS_MODIFY;
+      op->bank = (uint8_t)b; op->addr = (uint8_t)a; op->mask = (uint8_t)m; op->val = (uint8_t)v;
+      break;
+    case 'r':
+      if (!parse_num(&p, 0, 1, &b) || !parse_num(&p, 0, 0xFE, &a)) return false;
+      op->kind = RS_READ;
+      op->bank = (uint8_t)b; op->addr = (uint8_t)a;
+      break;
+    case 'f':
+      if (!parse_num(&p, 1, REG_SCRIPT_MAX_FRAMES, &v)) return false;
+      op->kind = RS_WAIT_FRAMES;
+      op->arg = (uint16_t)v;
+      break;
+    case 'd':
+      if (!parse_num(&p, 0, REG_SCRIPT_MAX_DELAY, &v)) return false;
+      op->kind = RS_DELAY_MS;
+      op->arg = (uint16_t)v;
+      break;
+    case 'c':
+      op->kind = RS_CAPTURE;
+      break;
+    default:
+      return false;
+  }
+  while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+  return *p == 0;
+}
+
+bool reg_script_compile(const char *text, reg_script_t *out, int *err_line) {
+  out->n = 0;
+  int line_no = 0;
+  const char *s = text;
+  char line[96];
+
+  while (*s) {
+    const char *e = s;
+    while (*e && *e != '\n' && *e != ';') e++;
+    line_no++;
+    int len = (int)(e - s);
+    if (len >= (int)sizeof(line)) { if (err_line) *err_line = line_no; return false; }
+    memcpy(line, s, len);
+    line[len] = 0;
+    s = *e ? e + 1 : e;
+
+    char *hash = strchr(line, '#');
+    if (hash) *hash = 0;
+    char *p = line;
+    while (isspace((unsigned char)*p)) p++;
+    if (!*p) continue;
+
+    if (out->n >= REG_SCRIPT_MAX_OPS || !compile_step(p, &out->ops[out->n])) {
+      if (err_line) *err_line = line_no;
+      return false;
+    }
+    out->n++;
+  }
+  return out->n > 0;
+}
+
+// ------------------ runner ------------------
+
+static bool is_write(const reg_script_op_t *op) {
+  return op->kind == RS_WRITE || op->kind == RS_MODIFY;
+}
+
+// Same names as the capture API: compressed raw is .rawz, Bayer a DNG
+static const char *ext_for(const cam_profile_t *p) {
+  bool raw = p->pixformat != PIXFORMAT_JPEG;
+  if (raw && p->compress) return "rawz";
+  switch (p->pixformat) {
+    case PIXFORMAT_RAW: return "dng";
+    case PIXFORMAT_RGB565: return "rgb565";
+    case PIXFORMAT_YUV422: return "yuv";
+    case PIXFORMAT_GRAYSCALE: return "gray";
+    default: return "jpg";
+  }
+}
+
+// A cataloged cap_ capture, through the same stripe/Bayer/rawz paths and
+// retention check as POST /api/capture; returns its catalog id, 0 on failure
+static uint32_t run_capture(void) {
+  cam_profile_t p;
+  cam_manager_get_capture_profile(&p);
+  char why[160];
+  if (!retention_admit(retention_estimate(&p), why, sizeof(why))) {
+    ESP_LOGW(TAG, "capture refused: %s", why);
+    return 0;
+  }
+
+  uint32_t num = capture_catalog_next_id();
+  const char *ext = ext_for(&p);
+  char id[24], bin_path[128], json_path[128];
+  snprintf(id, sizeof(id), "cap_%08u", (unsigned)num);
+  snprintf(bin_path, sizeof(bin_path), "%s/%s.%s", CAPTURES_DIR, id, ext);
+  snprintf(json_path, sizeof(json_path), "%s/%s.json", CAPTURES_DIR, id);
+
+  bool ok = capture_stripe_applies(&p) ? capture_stripe_run(id, &p, bin_path, json_path, NULL, 0)
+                                       : cam_manager_capture_to_file(bin_path, json_path, NULL, 0);
+  if (!ok) return 0;
+  capture_catalog_add(id, ext);
+  if (!strcmp(ext, "jpg")) capture_gallery_enqueue(id);
+  return num;
+}
+
+// Next frame boundary after `after`. Rides the stream's clock while a client
+// pulls frames; otherwise (normal on the slave) fetches the frame itself.
+static bool next_frame(uint32_t after, uint32_t *frame) {
+  int64_t last = frame_sync_last_us();
+  bool flowing = last != 0 && esp_timer_get_time() - last < FRAMES_IDLE_US;
+  if (flowing && frame_sync_wait(after, pdMS_TO_TICKS(FRAME_TIMEOUT_MS), frame, NULL)) return true;
+
+  if (!g_app.stream_enabled) return false;
+  if (xSemaphoreTake(g_app.cam_mutex, pdMS_TO_TICKS(FRAME_TIMEOUT_MS)) != pdTRUE) return false;
+  camera_fb_t *fb = cam_manager_fb_get();
+  xSemaphoreGive(g_app.cam_mutex);
+  if (!fb) return false;
+  frame_sync_frame_done();
+  esp_camera_fb_return(fb);
+  *frame = frame_sync_count();
+  return true;
+}
+
+bool reg_script_run(const reg_script_t *s, uint32_t run, reg_script_result_t *res) {
+  res->run = run;
+  res->ok = true;
+  res->err_op = -1;
+  res->n = 0;
+  bool wrote = false;
+  int64_t t0 = esp_timer_get_time();
+
+  for (int i = 0; i < s->n && res->ok; ) {
+    const reg_script_op_t *op = &s->ops[i];
+    reg_script_res_t *r = &res->res[res->n++];
+    r->op = (uint16_t)i;
+    r->frame = 0;
+    bool ok = true;
+    int next = i + 1;
+
+    switch (op->kind) {
+      case RS_WRITE:
+      case RS_MODIFY: {
+        ov2640_reg_op_t batch[REG_SCRIPT_MAX_OPS];
+        int k = 0;
+        for (; i + k < s->n && is_write(&s->ops[i + k]); k++) {
+          const reg_script_op_t *w = &s->ops[i + k];
+          batch[k] = (ov2640_reg_op_t){ w->bank, w->addr, w->kind == RS_WRITE ? 0xFF : w->mask, w->val };
+        }
+        sccb_sched_result_t sr;
+        ok = sccb_sched_apply(batch, k, pdMS_TO_TICKS(FRAME_TIMEOUT_MS), &sr);
+        for (int j = 0; j < sr.written; j++)
+          reg_overlay_record(REG_OVL_CURRENT, (ov2640_bank_t)batch[j].bank, batch[j].addr, batch[j].mask, batch[j].val);
+        wrote |= sr.written > 0;
+        r->val = sr.written;
+        r->frame = sr.frame;
+        next = i + k;
+        break;
+      }
+      case RS_READ: {
+        uint8_t v = 0;
+        ok = ov2640_read_reg((ov2640_bank_t)op->bank, op->addr, &v);
+        r->val = v;
+        r->frame = frame_sync_count();
+        break;
+      }
+      case RS_WAIT_FRAMES: {
+        int waited = 0;
+        uint32_t f = frame_sync_count();
+        while (waited < op->arg && next_frame(f, &f)) waited++;
+        ok = waited == op->arg;
+        r->val = waited;
+        r->frame = f;
+        break;
+      }
+      case RS_DELAY_MS:
+        vTaskDelay(pdMS_TO_TICKS(op->arg));
+        r->val = op->arg;
+        r->frame = frame_sync_count();
+        break;
+      case RS_CAPTURE: {
+        uint32_t id = run_capture();
+        ok = id != 0;
+        r->val = (int32_t)id;
+        r->frame = frame_sync_count();
+        break;
+      }
+    }
+
+    r->t_us = esp_timer_get_time() - t0;
+    if (!ok) {
+      res->ok = false;
+      res->err_op = i;
+    }
+    i = next;
+  }
+
+  res->total_us = esp_timer_get_time() - t0;
+  if (wrote) reg_overlay_save_later();
+  if (!res->ok) ESP_LOGW(TAG, "run %08x stopped at step %d", (unsigned)run, res->err_op);
+  return res->ok;
+}
+
+// ------------------ HTTP ------------------
+
+static void result_json(chunk_writer_t *w, const reg_script_result_t *r) {
+  cw_printf(w, "{\"run\":\"%08x\",\"ok\":%s,\"err_op\":%d,\"us\":%lld,\"res\":[",
+            (unsigned)r->run, r->ok ? "true" : "false", r->err_op, (long long)r->total_us);
+  for (int i = 0; i < r->n; i++) {
+    const reg_script_res_t *x = &r->res[i];
+    cw_printf(w, "%s[%u,%ld,%u,%lld]", i ? "," : "", x->op, (long)x->val, (unsigned)x->frame, (long long)x->t_us);
+  }
+  cw_puts(w, "]}");
+}
+
+static char *recv_text(httpd_req_t *req) {
+  int len = (int)req->content_len;
+  if (len <= 0 || len > SCRIPT_TEXT_MAX) return NULL;
+  char *buf = (char*)malloc(len + 1);
+  if (!buf) return NULL;
+  int got = 0;
+  while (got < len) {
+    int n = httpd_req_recv(req, buf + got, len - got);
+    if (n <= 0) { free(buf); return NULL; }
+    got += n;
+  }
+  buf[len] = 0;
+  return buf;
+}
+
+static bool query_u32(httpd_req_t *req, const char *key, uint32_t *out) {
+  char q[96], v[16];
+  if (httpd_req_get_url_query_str(req, q, sizeof(q)) != ESP_OK) return false;
+  if (httpd_query_key_value(q, key, v, sizeof(v)) != ESP_OK) return false;
+  *out = (uint32_t)strtoul(v, NULL, 16);
+  return true;
+}
+
+#if CONFIG_ROLE_MASTER
+static uint32_t s_run_seq = 0;
+
+// Polls the slave until its copy of the run finished; `out` gets its result JSON
+static bool fetch_slave_result(uint32_t run, int64_t budget_us, char *out, int out_max) {
+  char path[64];
+  snprintf(path, sizeof(path), "/api/registers/script/result?run=%08x", (unsigned)run);
+  int64_t deadline = esp_timer_get_time() + budget_us;
+  do {
+    int code = slave_link_post(SLAVE_LINK_SCRIPT, path, "text/plain", NULL, 0, out, out_max);
+    if (code == 200 && strncmp(out, "{\"pending\"", 10) != 0) return true;
+    if (code != 200) vTaskDelay(pdMS_TO_TICKS(100));
+  } while (esp_timer_get_time() < deadline);
+  return false;
+}
+#endif
+
+#if CONFIG_ROLE_SLAVE
+static reg_script_t *s_armed = NULL;
+static uint32_t s_armed_run = 0;
+static int64_t s_armed_at = 0;
+static reg_script_result_t *s_last = NULL;
+static bool s_last_done = false;
+static SemaphoreHandle_t s_state = NULL;   // guards the armed/last pointers
+static int s_pollers = 0;                  // result long-polls in flight, under s_mux
+
+typedef struct {
+  httpd_req_t *req;
+  uint32_t run;
+} poll_ctx_t;
+
+bool reg_script_run_armed(void) {
+  xSemaphoreTake(s_state, portMAX_DELAY);
+  reg_script_t *s = s_armed;
+  uint32_t run = s_armed_run;
+  bool fresh = s && esp_timer_get_time() - s_armed_at < ARM_EXPIRY_US;
+  s_armed = NULL;
+  xSemaphoreGive(s_state);
+  if (!s) return false;
+  if (!fresh) {
+    ESP_LOGW(TAG, "armed run %08x expired", (unsigned)run);
+    free(s);
+    return false;
+  }
+
+  reg_script_result_t *res = (reg_script_result_t*)calloc(1, sizeof(*res));
+  if (res) {
+    xSemaphoreTake(s_busy, portMAX_DELAY);
+    reg_script_run(s, run, res);
+    xSemaphoreGive(s_busy);
+  }
+  free(s);
+
+  xSemaphoreTake(s_state, portMAX_DELAY);
+  free(s_last);
+  s_last = res;
+  s_last_done = res != NULL;
+  xSemaphoreGive(s_state);
+  return true;
+}
+
+static esp_err_t arm_script(httpd_req_t *req, reg_script_t *s, uint32_t run) {
+  xSemaphoreTake(s_state, portMAX_DELAY);
+  free(s_armed);
+  s_armed = s;
+  s_armed_run = run;
+  s_armed_at = esp_timer_get_time();
+  if (s_last && s_last->run != run) s_last_done = false;
+  xSemaphoreGive(s_state);
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, "{\"ok\":true,\"armed\":true}");
+}
+
+// Answers as soon as the run finished, or "pending" after POLL_WAIT_MS
+static void poll_task(void *arg) {
+  poll_ctx_t *c = (poll_ctx_t*)arg;
+  httpd_req_t *req = c->req;
+  bool sent = false;
+
+  for (int64_t until = esp_timer_get_time() + POLL_WAIT_MS * 1000LL; !sent; ) {
+    xSemaphoreTake(s_state, portMAX_DELAY);
+    if (s_last_done && s_last && s_last->run == c->run) {
+      chunk_writer_t w;
+      httpd_resp_set_type(req, "application/json");
+      cw_init(&w, req);
+      result_json(&w, s_last);
+      xSemaphoreGive(s_state);
+      cw_finish(&w);
+      sent = true;
+      break;
+    }
+    xSemaphoreGive(s_state);
+    if (esp_timer_get_time() >= until) break;
+    vTaskDelay(pdMS_TO_TICKS(100));
+  }
+  if (!sent) {
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, "{\"pending\":true}");
+  }
+
+  httpd_req_async_handler_complete(req);
+  free(c);
+  portENTER_CRITICAL(&s_mux);
+  s_pollers--;
+  portEXIT_CRITICAL(&s_mux);
+  vTaskDelete(NULL);
+}
+
+esp_err_t reg_script_result_handler(httpd_req_t *req) {
+  uint32_t run;
+  if (!query_u32(req, "run", &run)) return httpd_resp_send_err(req, 400, "run missing");
+
+  // Long-poll briefly so the master does not spin on the link; the wait runs
+  // in its own task, never in the httpd task
+  bool admit = false;
+  portENTER_CRITICAL(&s_mux);
+  if (s_pollers < MAX_POLLERS) { s_pollers++; admit = true; }
+  portEXIT_CRITICAL(&s_mux);
+  if (!admit) {
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, "{\"pending\":true}");
+  }
+
+  poll_ctx_t *c = (poll_ctx_t*)calloc(1, sizeof(*c));
+  if (!c || httpd_req_async_handler_begin(req, &c->req) != ESP_OK) {
+    free(c);
+    portENTER_CRITICAL(&s_mux);
+    s_pollers--;
+    portEXIT_CRITICAL(&s_mux);
+    return httpd_resp_send_err(req, 500, "async failed");
+  }
+  c->run = run;
+  if (xTaskCreate(poll_task, "script_poll", 4096, c, 4, NULL) != pdPASS) {
+    httpd_req_async_handler_complete(c->req);
+    free(c);
+    portENTER_CRITICAL(&s_mux);
+    s_pollers--;
+    portEXIT_CRITICAL(&s_mux);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+#else
+bool reg_script_run_armed(void) { return false; }
+
+esp_err_t reg_script_result_handler(httpd_req_t *req) {
+  return httpd_resp_send_err(req, 404, "slave only");
+}
+#endif
+
+typedef struct {
+  httpd_req_t *req;
+  reg_script_t *s;
+  char *text;                 // kept for the slave copy of a synced run
+  uint32_t sync;
+  reg_script_result_t *res;
+  char *slave_json;
+} run_ctx_t;
+
+static void free_run_ctx(run_ctx_t *c) {
+  free(c->s);
+  free(c->text);
+  free(c->res);
+  free(c->slave_json);
+  free(c);
+}
+
+// Runs the script (and its synced slave copy) outside the httpd task: frame
+// and delay steps plus the slave long-poll can take seconds
+static void run_task(void *arg) {
+  run_ctx_t *c = (run_ctx_t*)arg;
+  httpd_req_t *req = c->req;
+  uint32_t run = esp_random();
+  bool slave_ok = false, armed = true;
+
+#if CONFIG_ROLE_MASTER
+  run = (run & 0xFFFF0000u) | (++s_run_seq & 0xFFFF);
+  if (c->sync) {
+    // Slave compiles and arms, then both start on the same trigger edge
+    char path[64];
+    snprintf(path, sizeof(path), "/api/registers/script?run=%08x", (unsigned)run);
+    armed = slave_link_post(SLAVE_LINK_SCRIPT, path, "text/plain", c->text, (int)strlen(c->text), c->slave_json, RESULT_JSON_MAX) == 200;
+    if (armed) trigger_master_pulse_us(30);
+  }
+#endif
+
+  if (armed) {
+    xSemaphoreTake(s_busy, portMAX_DELAY);
+    reg_script_run(c->s, run, c->res);
+    xSemaphoreGive(s_busy);
+#if CONFIG_ROLE_MASTER
+    if (c->sync) slave_ok = fetch_slave_result(run, c->res->total_us + 10000000, c->slave_json, RESULT_JSON_MAX);
+#endif
+
+    chunk_writer_t w;
+    httpd_resp_set_type(req, "application/json");
+    cw_init(&w, req);
+    if (c->sync) {
+      cw_puts(&w, "{\"master\":");
+      result_json(&w, c->res);
+      cw_puts(&w, ",\"slave\":");
+      cw_puts(&w, slave_ok ? c->slave_json : "null");
+      cw_puts(&w, "}");
+    } else {
+      result_json(&w, c->res);
+    }
+    cw_finish(&w);
+  } else {
+    httpd_resp_send_err(req, 500, "slave arm failed");
+  }
+
+  httpd_req_async_handler_complete(req);
+  free_run_ctx(c);
+  portENTER_CRITICAL(&s_mux);
+  s_running = false;
+  portEXIT_CRITICAL(&s_mux);
+  vTaskDelete(NULL);
+}
+
+esp_err_t reg_script_handler(httpd_req_t *req) {
+  char *text = recv_text(req);
+  if (!text) return httpd_resp_send_err(req, 400, "script missing or too long");
+
+  reg_script_t *s = (reg_script_t*)malloc(sizeof(*s));
+  if (!s) { free(text); return httpd_resp_send_err(req, 500, "no mem"); }
+  int err_line = 0;
+  bool compiled = reg_script_compile(text, s, &err_line);
+
+  if (!compiled) {
+    free(text);
+    free(s);
+    char msg[48];
+    snprintf(msg, sizeof(msg), "syntax error at step %d", err_line);
+    return httpd_resp_send_err(req, 400, msg);
+  }
+
+#if CONFIG_ROLE_SLAVE
+  uint32_t arm_run;
+  if (query_u32(req, "run", &arm_run)) {
+    free(text);
+    return arm_script(req, s, arm_run);   // takes ownership of s
+  }
+#endif
+
+  run_ctx_t *c = (run_ctx_t*)calloc(1, sizeof(*c));
+  if (!c) { free(text); free(s); return httpd_resp_send_err(req, 500, "no mem"); }
+  c->s = s;
+  c->text = text;
+#if CONFIG_ROLE_MASTER
+  query_u32(req, "sync", &c->sync);
+#endif
+  c->res = (reg_script_result_t*)calloc(1, sizeof(*c->res));
+  if (c->sync) c->slave_json = (char*)malloc(RESULT_JSON_MAX);
+  if (!c->res || (c->sync && !c->slave_json)) {
+    free_run_ctx(c);
+    return httpd_resp_send_err(req, 500, "no mem");
+  }
+
+  bool admit = false;
+  portENTER_CRITICAL(&s_mux);
+  if (!s_running) { s_running = true; admit = true; }
+  portEXIT_CRITICAL(&s_mux);
+  if (!admit) {
+    free_run_ctx(c);
+    return httpd_resp_send_err(req, 500, "script busy");
+  }
+
+  if (httpd_req_async_handler_begin(req, &c->req) != ESP_OK) {
+    free_run_ctx(c);
+    portENTER_CRITICAL(&s_mux);
+    s_running = false;
+    portEXIT_CRITICAL(&s_mux);
+    return httpd_resp_send_err(req, 500, "async failed");
+  }
+  if (xTaskCreate(run_task, "reg_script", 6144, c, 4, NULL) != pdPASS) {
+    httpd_req_async_handler_complete(c->req);
+    free_run_ctx(c);
+    portENTER_CRITICAL(&s_mux);
+    s_running = false;
+    portEXIT_CRITICAL(&s_mux);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+void reg_script_init(void) {
+  s_busy = xSemaphoreCreateMutex();
+#if CONFIG_ROLE_SLAVE
+  s_state = xSemaphoreCreateMutex();
+#endif
+}
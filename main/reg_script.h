@@ -0,0 +1,73 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_http_server.h"
+
+// On-device register scripts. A text script is compiled into an op array and
+// run in one go, so a tuning sequence costs one HTTP round trip. One step per
+// line (or separated by ';'), '#' starts a comment:
+//
+//   w <bank> <addr> <val>          write
+//   m <bank> <addr> <mask> <val>   masked modify
+//   r <bank> <addr>                read
+//   f <n>                          wait for n frame boundaries (fetches frames
+//                                  itself when no stream client pulls them)
+//   d <ms>                         delay
+//   c                              capture with the current capture profile, as
+//                                  a cataloged cap_<id> like POST /api/capture
+//
+// Consecutive w/m steps form one frame-aligned batch (sccb_sched).
+#define REG_SCRIPT_MAX_OPS     128
+#define REG_SCRIPT_MAX_FRAMES  300
+#define REG_SCRIPT_MAX_DELAY   10000
+
+typedef enum {
+  RS_WRITE = 0,
+  RS_MODIFY,
+  RS_READ,
+  RS_WAIT_FRAMES,
+  RS_DELAY_MS,
+  RS_CAPTURE
+} reg_script_kind_t;
+
+typedef struct {
+  uint8_t kind;
+  uint8_t bank, addr, mask, val;
+  uint16_t arg;       // frames / ms
+} reg_script_op_t;
+
+typedef struct {
+  int n;
+  reg_script_op_t ops[REG_SCRIPT_MAX_OPS];
+} reg_script_t;
+
+// Per-step result. `val`: read value, ops written (batch), frames waited, capture
+// catalog id (0 = failed).
+typedef struct {
+  uint16_t op;
+  int32_t val;
+  uint32_t frame;
+  int64_t t_us;       // since script start
+} reg_script_res_t;
+
+typedef struct {
+  uint32_t run;
+  bool ok;
+  int err_op;         // first failed step, -1 if none
+  int n;
+  int64_t total_us;
+  reg_script_res_t res[REG_SCRIPT_MAX_OPS];
+} reg_script_result_t;
+
+// Returns false and the failing line (1-based) on a syntax error
+bool reg_script_compile(const char *text, reg_script_t *out, int *err_line);
+bool reg_script_run(const reg_script_t *s, uint32_t run, reg_script_result_t *res);
+
+void reg_script_init(void);
+// SLAVE: runs a script armed by the master, from the trigger task; false if none armed
+bool reg_script_run_armed(void);
+
+// Both compile/parse in the httpd task and hand the request to a worker task
+// (async handler) for the run or the result long-poll
+esp_err_t reg_script_handler(httpd_req_t *req);          // POST /api/registers/script[?sync=1]
+esp_err_t reg_script_result_handler(httpd_req_t *req);   // POST /api/registers/script/result?run=N (slave)
@@ -0,0 +1,220 @@
+#include "reg_watch.h"
+#include "ov2640_ctrl.h"
+#include "frame_sync.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+static const char *TAG = "WATCH";
+
+typedef struct {
+  httpd_req_t *req;
+  int n;
+  int hz;
+  uint8_t bank[REG_WATCH_MAX_REGS];
+  uint8_t addr[REG_WATCH_MAX_REGS];
+  uint8_t val[REG_WATCH_MAX_REGS];
+} watch_ctx_t;
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static int s_clients = 0;
+
+static void url_decode_inplace(char *s) {
+  char *o = s;
+  while (*s) {
+    if (s[0] == '%' && isxdigit((unsigned char)s[1]) && isxdigit((unsigned char)s[2])) {
+      char hex[3] = { s[1], s[2], 0 };
+      *o++ = (char)strtol(hex, NULL, 16);
+      s += 3;
+    } else {
+      *o++ = (*s == '+') ? ' ' : *s;
+      s++;
+    }
+  }
+  *o = 0;
+}
+
+// "1:0x10,1:0x04,0:0x44"
+static bool parse_regs(char *s, watch_ctx_t *c) {
+  c->n = 0;
+  char *save = NULL;
+  for (char *tok = strtok_r(s, ", ;", &save); tok; tok = strtok_r(NULL, ", ;", &save)) {
+    char *colon = strchr(tok, ':');
+    if (!colon || c->n >= REG_WATCH_MAX_REGS) return false;
+    *colon = 0;
+    long b = strtol(tok, NULL, 0);
+    long a = strtol(colon + 1, NULL, 0);
+    if (b < 0 || b > 1 || a < 0 || a > 0xFE) return false;
+    c->bank[c->n] = (uint8_t)b;
+    c->addr[c->n] = (uint8_t)a;
+    c->n++;
+  }
+  return c->n > 0;
+}
+
+static bool sample(watch_ctx_t *c, uint8_t *out, int64_t *sccb_us) {
+  int64_t t0 = esp_timer_get_time();
+  bool ok = true;
+  for (int i = 0; i < c->n && ok; i++) {
+    ok = ov2640_read_reg((ov2640_bank_t)c->bank[i], c->addr[i], &out[i]);
+  }
+  *sccb_us = esp_timer_get_time() - t0;
+  return ok;
+}
+
+static bool sse_send(httpd_req_t *req, const char *buf, int n) {
+  if (n <= 0) return true;
+  return httpd_resp_send_chunk(req, buf, n) == ESP_OK;
+}
+
+static void watch_task(void *arg) {
+  watch_ctx_t *c = (watch_ctx_t*)arg;
+  httpd_req_t *req = c->req;
+  char buf[512];
+  int n;
+
+  httpd_resp_set_type(req, "text/event-stream");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+  const int64_t period_us = 1000000 / c->hz;
+  int ms = (int)(period_us / 1000);
+  // Wait at most one sample period for a frame boundary, then sample unaligned
+  const TickType_t frame_timeout = pdMS_TO_TICKS(ms < 20 ? 20 : (ms > 200 ? 200 : ms));
+
+  int64_t sccb_us = 0;
+  if (!sample(c, c->val, &sccb_us)) {
+    n = snprintf(buf, sizeof(buf), "event: error\ndata: {\"err\":\"read failed\"}\n\n");
+    sse_send(req, buf, n);
+    goto done;
+  }
+
+  n = snprintf(buf, sizeof(buf), "event: snapshot\ndata: {\"hz\":%d,\"f\":%u,\"regs\":[", c->hz, (unsigned)frame_sync_count());
+  for (int i = 0; i < c->n; i++)
+    n += snprintf(buf + n, sizeof(buf) - n, "%s[%u,%u]", i ? "," : "", c->bank[i], c->addr[i]);
+  n += snprintf(buf + n, sizeof(buf) - n, "],\"v\":[");
+  for (int i = 0; i < c->n; i++)
+    n += snprintf(buf + n, sizeof(buf) - n, "%s%u", i ? "," : "", c->val[i]);
+  n += snprintf(buf + n, sizeof(buf) - n, "]}\n\n");
+  if (!sse_send(req, buf, n)) goto done;
+
+  int64_t t_prev = esp_timer_get_time();
+  int64_t next_due = t_prev + period_us;
+  int64_t stats_start = t_prev;
+  uint32_t samples = 0, aligned_cnt = 0, failed = 0, skipped = 0;
+  int64_t jit_sum = 0, jit_max = 0, sccb_sum = 0;
+
+  while (1) {
+    int64_t now = esp_timer_get_time();
+    if (next_due - now > 1000) vTaskDelay(pdMS_TO_TICKS((next_due - now) / 1000));
+
+    uint32_t frame = 0;
+    int64_t frame_us = 0;
+    bool aligned = frame_sync_wait(frame_sync_count(), frame_timeout, &frame, &frame_us);
+
+    int64_t t_s = esp_timer_get_time();
+    int64_t jitter = t_s - next_due;
+
+    uint8_t cur[REG_WATCH_MAX_REGS];
+    bool ok = sample(c, cur, &sccb_us);
+    samples++;
+    if (aligned) aligned_cnt++;
+    jit_sum += jitter < 0 ? -jitter : jitter;
+    if (jitter > jit_max) jit_max = jitter;
+    sccb_sum += sccb_us;
+
+    if (!ok) {
+      failed++;
+    } else {
+      // Delta event: [index, signed change] pairs for registers that moved
+      int changed = 0;
+      n = snprintf(buf, sizeof(buf), "event: delta\ndata: {\"f\":%u,\"dt\":%lld,\"jit\":%lld,\"sccb\":%lld,\"al\":%d,\"d\":[",
+                   (unsigned)frame, (long long)(t_s - t_prev), (long long)jitter, (long long)sccb_us, aligned ? 1 : 0);
+      for (int i = 0; i < c->n; i++) {
+        if (cur[i] == c->val[i]) continue;
+        n += snprintf(buf + n, sizeof(buf) - n, "%s%d,%d", changed ? "," : "", i, (int)cur[i] - (int)c->val[i]);
+        c->val[i] = cur[i];
+        changed++;
+      }
+      n += snprintf(buf + n, sizeof(buf) - n, "]}\n\n");
+      if (changed) {
+        if (!sse_send(req, buf, n)) break;
+        t_prev = t_s;
+      }
+    }
+
+    if (t_s - stats_start >= 1000000) {
+      n = snprintf(buf, sizeof(buf),
+        "event: stats\ndata: {\"n\":%u,\"aligned\":%u,\"failed\":%u,\"skipped\":%u,"
+        "\"jit_avg\":%lld,\"jit_max\":%lld,\"sccb_us\":%lld,\"window_us\":%lld}\n\n",
+        (unsigned)samples, (unsigned)aligned_cnt, (unsigned)failed, (unsigned)skipped,
+        (long long)(samples ? jit_sum / samples : 0), (long long)jit_max,
+        (long long)sccb_sum, (long long)(t_s - stats_start));
+      if (!sse_send(req, buf, n)) break;
+      stats_start = t_s;
+      samples = aligned_cnt = failed = skipped = 0;
+      jit_sum = jit_max = sccb_sum = 0;
+    }
+
+    next_due += period_us;
+    if (t_s - next_due > period_us) {
+      // Fell behind (frame rate below hz, or slow client): resync the schedule
+      skipped += (uint32_t)((t_s - next_due) / period_us);
+      next_due = t_s + period_us;
+    }
+  }
+
+done:
+  httpd_resp_send_chunk(req, NULL, 0);
+  httpd_req_async_handler_complete(req);
+  free(c);
+  portENTER_CRITICAL(&s_mux);
+  s_clients--;
+  portEXIT_CRITICAL(&s_mux);
+  ESP_LOGI(TAG, "watch client closed");
+  vTaskDelete(NULL);
+}
+
+esp_err_t reg_watch_handler(httpd_req_t *req) {
+  char q[256], regs_s[200], hz_s[8];
+  if (httpd_req_get_url_query_str(req, q, sizeof(q)) != ESP_OK) return httpd_resp_send_err(req, 400, "no query");
+  if (httpd_query_key_value(q, "regs", regs_s, sizeof(regs_s)) != ESP_OK) return httpd_resp_send_err(req, 400, "regs missing");
+
+  watch_ctx_t *c = (watch_ctx_t*)calloc(1, sizeof(*c));
+  if (!c) return httpd_resp_send_err(req, 500, "no mem");
+
+  url_decode_inplace(regs_s);
+  if (!parse_regs(regs_s, c)) { free(c); return httpd_resp_send_err(req, 400, "bad regs"); }
+
+  c->hz = 10;
+  if (httpd_query_key_value(q, "hz", hz_s, sizeof(hz_s)) == ESP_OK) c->hz = atoi(hz_s);
+  if (c->hz < 1 || c->hz > 50) { free(c); return httpd_resp_send_err(req, 400, "hz must be 1..50"); }
+
+  bool admit = false;
+  portENTER_CRITICAL(&s_mux);
+  if (s_clients < REG_WATCH_MAX_CLIENTS) { s_clients++; admit = true; }
+  portEXIT_CRITICAL(&s_mux);
+  if (!admit) { free(c); return httpd_resp_send_err(req, 500, "too many watchers"); }
+
+  if (httpd_req_async_handler_begin(req, &c->req) != ESP_OK) {
+    free(c);
+    portENTER_CRITICAL(&s_mux);
+    s_clients--;
+    portEXIT_CRITICAL(&s_mux);
+    return httpd_resp_send_err(req, 500, "async failed");
+  }
+
+  if (xTaskCreate(watch_task, "reg_watch", 4096, c, 4, NULL) != pdPASS) {
+    httpd_req_async_handler_complete(c->req);
+    free(c);
+    portENTER_CRITICAL(&s_mux);
+    s_clients--;
+    portEXIT_CRITICAL(&s_mux);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
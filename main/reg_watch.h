@@ -0,0 +1,10 @@
+#pragma once
+#include "esp_http_server.h"
+
+// GET /api/registers/watch?regs=<bank>:<addr>,...&hz=<1..50>
+// Server-Sent Events stream of register values sampled at frame boundaries.
+// The request is detached from the httpd task and served by its own worker.
+#define REG_WATCH_MAX_REGS     16
+#define REG_WATCH_MAX_CLIENTS  2
+
+esp_err_t reg_watch_handler(httpd_req_t *req);
@@ -0,0 +1,230 @@
+#include "retention.h"
+#include "capture_catalog.h"
+#include "capture_store.h"
+#include "capture_mem.h"
+#include "app_config.h"
+#include "cJSON.h"
+#include "esp_log.h"
+#include "esp_vfs_fat.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "RETENTION";
+
+#define NVS_NS  "retention"
+#define MB      (1024ull * 1024ull)
+
+static TaskHandle_t s_task = NULL;
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static retention_stats_t s_st = {
+  .limits = { CONFIG_RETENTION_MIN_FREE_MB, CONFIG_RETENTION_TARGET_FREE_MB, CONFIG_RETENTION_QUOTA_MB },
+};
+
+static void load_limits(retention_limits_t *l) {
+  nvs_handle_t h;
+  if (nvs_open(NVS_NS, NVS_READONLY, &h) != ESP_OK) return;
+  nvs_get_u32(h, "min_free", &l->min_free_mb);
+  nvs_get_u32(h, "target_free", &l->target_free_mb);
+  nvs_get_u32(h, "quota", &l->quota_mb);
+  nvs_close(h);
+}
+
+static void store_limits(const retention_limits_t *l) {
+  nvs_handle_t h;
+  if (nvs_open(NVS_NS, NVS_READWRITE, &h) != ESP_OK) return;
+  nvs_set_u32(h, "min_free", l->min_free_mb);
+  nvs_set_u32(h, "target_free", l->target_free_mb);
+  nvs_set_u32(h, "quota", l->quota_mb);
+  nvs_commit(h);
+  nvs_close(h);
+}
+
+// FatFs keeps the free cluster count once it has been counted, so this is
+// cheap after the first call (made by the task at boot)
+static bool read_space(uint64_t *total, uint64_t *free_b) {
+  return esp_vfs_fat_info(SD_MOUNT_POINT, total, free_b) == ESP_OK;
+}
+
+static void get_limits(retention_limits_t *l) {
+  portENTER_CRITICAL(&s_mux);
+  *l = s_st.limits;
+  portEXIT_CRITICAL(&s_mux);
+}
+
+static void note_deleted(uint64_t bytes, bool segment) {
+  portENTER_CRITICAL(&s_mux);
+  if (segment) s_st.segments_dropped++;
+  else s_st.deleted++;
+  s_st.deleted_bytes += bytes;
+  portEXIT_CRITICAL(&s_mux);
+}
+
+static void delete_capture(const catalog_rec_t *r) {
+  char path[128];
+  const char *ext = capture_catalog_ext(r);
+  snprintf(path, sizeof(path), "%s/cap_%08u.%s", CAPTURES_DIR, (unsigned)r->id, ext);
+  remove(path);
+  capture_mem_discard(strrchr(path, '/') + 1);
+  snprintf(path, sizeof(path), "%s/cap_%08u.json", CAPTURES_DIR, (unsigned)r->id);
+  remove(path);
+  capture_mem_discard(strrchr(path, '/') + 1);
+  snprintf(path, sizeof(path), "%s/cap_%08u.jpg", THUMBS_DIR, (unsigned)r->id);
+  remove(path);
+  capture_catalog_remove(r->id);
+  note_deleted(r->size, false);
+}
+
+// Deletes oldest-first until free space and quota are both satisfied
+static void enforce(void) {
+  retention_limits_t l;
+  get_limits(&l);
+  uint64_t total = 0, free_b = 0;
+  if (!read_space(&total, &free_b)) return;
+
+  bool triggered = free_b < l.min_free_mb * MB;
+  bool low = triggered;
+  bool over = l.quota_mb && capture_catalog_bytes() > l.quota_mb * MB;
+  int n = 0;
+  while ((low || over) && n < RETENTION_MAX_PER_PASS && capture_catalog_ready()) {
+    catalog_rec_t r;
+    if (!capture_catalog_oldest(&r)) break;
+    if (r.loc == CATALOG_LOC_STORE) {
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+      // Segment records cannot be removed one by one: the oldest segment goes as a whole
+      uint16_t seg;
+      uint64_t bytes = 0;
+      if (!capture_store_drop_oldest(&seg, &bytes)) break;
+      n += (int)capture_catalog_remove_segment(seg);
+      note_deleted(bytes, true);
+#else
+      capture_catalog_remove(r.id);
+#endif
+    } else {
+      delete_capture(&r);
+      n++;
+    }
+    if (!read_space(&total, &free_b)) break;
+    // Once triggered by the low-water mark, keep going up to the target
+    low = triggered && free_b < l.target_free_mb * MB;
+    over = l.quota_mb && capture_catalog_bytes() > l.quota_mb * MB;
+    vTaskDelay(1);
+  }
+  if (n) ESP_LOGI(TAG, "deleted %d captures, %llu MiB free", n, (unsigned long long)(free_b / MB));
+  if (low) ESP_LOGW(TAG, "still below target (%llu MiB free), nothing left to delete", (unsigned long long)(free_b / MB));
+
+  portENTER_CRITICAL(&s_mux);
+  s_st.total_bytes = total;
+  s_st.free_bytes = free_b;
+  s_st.passes++;
+  portEXIT_CRITICAL(&s_mux);
+}
+
+static void retention_task(void *arg) {
+  (void)arg;
+  for (;;) {
+    enforce();
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(RETENTION_POLL_MS));
+  }
+}
+
+void retention_init(void) {
+  if (s_task) return;
+  load_limits(&s_st.limits);
+  xTaskCreatePinnedToCore(retention_task, "retention", 4096, NULL, tskIDLE_PRIORITY + 1, &s_task, 1);
+}
+
+void retention_kick(void) {
+  if (s_task) xTaskNotifyGive(s_task);
+}
+
+size_t retention_estimate(const cam_profile_t *p) {
+  if (p->framesize >= FRAMESIZE_INVALID) return 0;
+  size_t px = (size_t)resolution[p->framesize].width * resolution[p->framesize].height;
+  switch (p->pixformat) {
+    case PIXFORMAT_RGB565:
+    case PIXFORMAT_YUV422:    return px * 2;
+    case PIXFORMAT_GRAYSCALE:
+    case PIXFORMAT_RAW:       return px;   // Bayer RAW8
+    default:                  return px / 2;   // JPEG: well above what the sensor produces at any quality
+  }
+}
+
+bool retention_admit(size_t need, char *why, int why_max) {
+  if (!s_task) return true;   // no card: the capture fails on its own
+  retention_limits_t l;
+  get_limits(&l);
+  uint64_t total = 0, free_b = 0;
+  if (!read_space(&total, &free_b)) {
+    snprintf(why, why_max, "SD card not readable");
+  } else if (free_b >= need + l.min_free_mb * MB) {
+    portENTER_CRITICAL(&s_mux);
+    s_st.free_bytes = free_b;
+    portEXIT_CRITICAL(&s_mux);
+    return true;
+  } else {
+    snprintf(why, why_max, "SD card full: %llu MiB free, capture needs up to %u KiB above the %u MiB reserve",
+             (unsigned long long)(free_b / MB), (unsigned)(need / 1024), (unsigned)l.min_free_mb);
+  }
+  portENTER_CRITICAL(&s_mux);
+  s_st.rejected++;
+  portEXIT_CRITICAL(&s_mux);
+  retention_kick();
+  return false;
+}
+
+void retention_get_stats(retention_stats_t *out) {
+  portENTER_CRITICAL(&s_mux);
+  *out = s_st;
+  portEXIT_CRITICAL(&s_mux);
+  out->capture_bytes = capture_catalog_bytes();
+}
+
+// ------------------ HTTP ------------------
+
+static esp_err_t send_state(httpd_req_t *req) {
+  retention_stats_t st;
+  retention_get_stats(&st);
+  char buf[384];
+  snprintf(buf, sizeof(buf),
+    "{\"min_free_mb\":%u,\"target_free_mb\":%u,\"quota_mb\":%u,\"total_mb\":%llu,\"free_mb\":%llu,"
+    "\"capture_mb\":%llu,\"deleted\":%u,\"segments_dropped\":%u,\"deleted_mb\":%llu,\"rejected\":%u}",
+    (unsigned)st.limits.min_free_mb, (unsigned)st.limits.target_free_mb, (unsigned)st.limits.quota_mb,
+    (unsigned long long)(st.total_bytes / MB), (unsigned long long)(st.free_bytes / MB),
+    (unsigned long long)(st.capture_bytes / MB), (unsigned)st.deleted, (unsigned)st.segments_dropped,
+    (unsigned long long)(st.deleted_bytes / MB), (unsigned)st.rejected);
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, buf);
+}
+
+esp_err_t retention_get_handler(httpd_req_t *req) {
+  return send_state(req);
+}
+
+esp_err_t retention_set_handler(httpd_req_t *req) {
+  char body[160];
+  int n = httpd_req_recv(req, body, sizeof(body) - 1);
+  if (n <= 0) return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "no body");
+  body[n] = 0;
+  cJSON *root = cJSON_Parse(body);
+  if (!root) return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "bad json");
+
+  retention_limits_t l;
+  get_limits(&l);
+  cJSON *v;
+  if (cJSON_IsNumber(v = cJSON_GetObjectItem(root, "min_free_mb"))) l.min_free_mb = (uint32_t)v->valuedouble;
+  if (cJSON_IsNumber(v = cJSON_GetObjectItem(root, "target_free_mb"))) l.target_free_mb = (uint32_t)v->valuedouble;
+  if (cJSON_IsNumber(v = cJSON_GetObjectItem(root, "quota_mb"))) l.quota_mb = (uint32_t)v->valuedouble;
+  cJSON_Delete(root);
+  if (l.target_free_mb < l.min_free_mb)
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "target_free_mb must be >= min_free_mb");
+
+  portENTER_CRITICAL(&s_mux);
+  s_st.limits = l;
+  portEXIT_CRITICAL(&s_mux);
+  store_limits(&l);
+  retention_kick();
+  return send_state(req);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_http_server.h"
+#include "cam_manager.h"
+
+// Retention manager: a low-priority task watches free space on the card and
+// deletes the oldest cataloged captures (files, sidecar, thumbnail; whole
+// segments for the segment store) while free space is below the low-water mark
+// or the captures exceed their quota, until the target is reached again.
+//
+// Captures are admitted up front: retention_admit() rejects a capture whose
+// worst-case size would push the card below the low-water mark, before the
+// camera is re-initialized or the slave is armed.
+//
+// Limits default to Kconfig and can be changed at runtime (kept in NVS):
+// GET /api/retention: limits and state; POST /api/retention {"min_free_mb",
+// "target_free_mb","quota_mb"} (quota 0 = none).
+#define RETENTION_POLL_MS      30000
+#define RETENTION_MAX_PER_PASS 256
+
+typedef struct {
+  uint32_t min_free_mb;         // low-water mark: admission limit, cleanup trigger
+  uint32_t target_free_mb;      // cleanup stops once free space is back above this
+  uint32_t quota_mb;            // cataloged capture bytes, 0 = no quota
+} retention_limits_t;
+
+typedef struct {
+  retention_limits_t limits;
+  uint64_t total_bytes, free_bytes, capture_bytes;
+  uint32_t deleted, segments_dropped, rejected, passes;
+  uint64_t deleted_bytes;
+} retention_stats_t;
+
+void retention_init(void);
+// Worst-case bytes of one frame in profile `p`
+size_t retention_estimate(const cam_profile_t *p);
+// True if `need` bytes fit above the low-water mark; otherwise wakes the
+// cleanup task and fills `why`
+bool retention_admit(size_t need, char *why, int why_max);
+void retention_kick(void);
+void retention_get_stats(retention_stats_t *out);
+
+esp_err_t retention_get_handler(httpd_req_t *req);
+esp_err_t retention_set_handler(httpd_req_t *req);
@@ -0,0 +1,181 @@
+#include "sccb_sched.h"
+#include "sccb_sched_core.h"
+#include "frame_sync.h"
+#include "wait_queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "SCHED";
+
+#define FRAME_OPS_BUDGET    32        // ~10 ms of SCCB at 100 kHz
+#define FRAMES_IDLE_US      250000    // no frame for this long: stream is not running
+#define COMMIT_TASK_PRIO    11        // above every frame producer, so it runs right after the boundary
+
+static sccb_sched_core_t s_core;
+static SemaphoreHandle_t s_lock = NULL;
+static wait_queue_t s_wq;            // sccb_sched_apply() callers, woken after each boundary
+static TaskHandle_t s_task = NULL;
+
+static struct {
+  uint32_t aligned, immediate, timeouts;
+  int64_t wait_max_us, wait_sum_us;
+  uint32_t wait_n;
+} s_st;
+
+static int write_fn(const ov2640_reg_op_t *ops, int n, void *ctx) {
+  (void)ctx;
+  return ov2640_write_batch(ops, n);
+}
+
+// frame_sync hook, in the frame producer's context: must not block, so it
+// only wakes the commit task
+static void on_frame(uint32_t frame, void *ctx) {
+  (void)ctx;
+  if (s_task) xTaskNotify(s_task, frame, eSetValueWithOverwrite);
+}
+
+// Does the SCCB I/O (which may wait for sccb_mutex) outside the producer
+static void commit_task(void *arg) {
+  (void)arg;
+  for (;;) {
+    uint32_t frame;
+    xTaskNotifyWait(0, 0, &frame, portMAX_DELAY);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    // Woken late (another frame ended meanwhile): report the frame it really hit
+    uint32_t now = frame_sync_count();
+    int n = sccb_core_pending(&s_core) ? sccb_core_commit(&s_core, now > frame ? now : frame, write_fn, NULL) : 0;
+    xSemaphoreGive(s_lock);
+    if (n) wait_queue_wake_all(&s_wq);
+  }
+}
+
+static bool frames_flowing(void) {
+  int64_t last = frame_sync_last_us();
+  return last != 0 && esp_timer_get_time() - last < FRAMES_IDLE_US;
+}
+
+void sccb_sched_init(void) {
+  s_lock = xSemaphoreCreateMutex();
+  wait_queue_init(&s_wq);
+  sccb_core_init(&s_core, FRAME_OPS_BUDGET);
+  xTaskCreate(commit_task, "sccb_sched", 3072, NULL, COMMIT_TASK_PRIO, &s_task);
+  frame_sync_set_hook(on_frame, NULL);
+}
+
+bool sccb_sched_apply(const ov2640_reg_op_t *ops, int n, TickType_t timeout, sccb_sched_result_t *res) {
+  sccb_sched_result_t r = {0};
+  int64_t t0 = esp_timer_get_time();
+  TickType_t start = xTaskGetTickCount();
+  bool ok = true;
+
+  if (!frames_flowing()) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    r.written = ov2640_write_batch(ops, n);
+    r.frame = r.first_frame = frame_sync_count() + 1;
+    r.parts = 1;
+    r.part[0].frame = r.frame;
+    r.part[0].written = r.written;
+    s_st.immediate++;
+    xSemaphoreGive(s_lock);
+    ok = r.written == n;
+    if (res) *res = r;
+    return ok;
+  }
+
+  // Split into parts of at most FRAME_OPS_BUDGET ops, one per boundary; more
+  // parts than the queue holds could never be submitted
+  if (n > SCCB_SCHED_MAX_REQ) {
+    ESP_LOGW(TAG, "%d ops exceed the queue (max %d)", n, SCCB_SCHED_MAX_REQ);
+    if (res) *res = r;
+    return false;
+  }
+  // Registered before the first look at the queue or the result, so a
+  // boundary committing in between still wakes us
+  int slot = wait_queue_enter(&s_wq);
+  uint32_t id = 0;
+  while (!id) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    id = sccb_core_submit(&s_core, ops, n);
+    xSemaphoreGive(s_lock);
+    if (id) break;
+    // queue full: wait for the next boundary to drain it
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= timeout) break;
+    wait_queue_wait(&s_wq, slot, timeout - waited);
+  }
+  if (!id) {
+    wait_queue_leave(&s_wq, slot);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_st.timeouts++;
+    xSemaphoreGive(s_lock);
+    ESP_LOGW(TAG, "queue stayed full; nothing written");
+    if (res) *res = r;
+    return false;
+  }
+
+  // On timeout commit whatever is queued right now
+  bool timed_out = false;
+  for (;;) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool done = sccb_core_result(&s_core, id, NULL), flushed = false;
+    if (!done && timed_out) {
+      while (sccb_core_pending(&s_core)) sccb_core_commit(&s_core, frame_sync_count(), write_fn, NULL);
+      done = flushed = true;
+    }
+    xSemaphoreGive(s_lock);
+    // Other callers' requests went out with ours
+    if (flushed) wait_queue_wake_all(&s_wq);
+    if (done) break;
+
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= timeout) { timed_out = true; continue; }
+    wait_queue_wait(&s_wq, slot, timeout - waited);
+  }
+  wait_queue_leave(&s_wq, slot);
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  sccb_result_t cr;
+  if (sccb_core_result(&s_core, id, &cr)) {
+    r.written = cr.written;
+    r.frame = cr.frame;
+    r.first_frame = cr.part[0].frame;
+    r.parts = cr.parts;
+    for (int i = 0; i < cr.parts; i++) {
+      r.part[i].frame = cr.part[i].frame;
+      r.part[i].written = cr.part[i].written;
+    }
+    ok = cr.ok;
+  } else {
+    ok = false;
+  }
+  r.aligned = !timed_out;
+  r.wait_us = esp_timer_get_time() - t0;
+  if (timed_out) s_st.timeouts++;
+  else s_st.aligned++;
+  if (r.wait_us > s_st.wait_max_us) s_st.wait_max_us = r.wait_us;
+  s_st.wait_sum_us += r.wait_us;
+  s_st.wait_n++;
+  xSemaphoreGive(s_lock);
+
+  if (timed_out) ESP_LOGW(TAG, "no frame boundary within timeout; wrote unaligned");
+  if (res) *res = r;
+  return ok && r.written == n;
+}
+
+bool sccb_sched_stats_json(char *out, int out_max) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  snprintf(out, out_max,
+    "{\"aligned\":%u,\"immediate\":%u,\"timeouts\":%u,\"committed\":%u,\"failed\":%u,"
+    "\"boundaries\":%u,\"pending\":%d,\"wait_avg_us\":%lld,\"wait_max_us\":%lld,\"frame\":%u}",
+    (unsigned)s_st.aligned, (unsigned)s_st.immediate, (unsigned)s_st.timeouts,
+    (unsigned)s_core.committed, (unsigned)s_core.failed, (unsigned)s_core.boundaries,
+    sccb_core_pending(&s_core),
+    (long long)(s_st.wait_n ? s_st.wait_sum_us / s_st.wait_n : 0), (long long)s_st.wait_max_us,
+    (unsigned)frame_sync_count());
+  xSemaphoreGive(s_lock);
+  return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "ov2640_ctrl.h"
+#include "sccb_sched_core.h"
+
+// Frame-aligned SCCB writes. While the stream delivers frames, requests are
+// queued and a commit task that frame_sync's hook wakes writes them at frame
+// boundaries (the hook itself never blocks). A boundary writes at most
+// FRAME_OPS_BUDGET ops: a request within it lands whole at one boundary under
+// one SCCB lock; a larger one is split into parts at consecutive boundaries,
+// one lock per part, and each part's frame is reported. Requests over
+// SCCB_SCHED_MAX_REQ ops are refused. With no frames flowing, or if no
+// boundary arrives within the timeout, the remainder is written immediately
+// (aligned = false).
+typedef struct {
+  uint32_t frame;       // first frame started after the whole request took effect
+  uint32_t first_frame; // same, for its first part
+  int written;
+  bool aligned;
+  int64_t wait_us;
+  int parts;
+  struct {
+    uint32_t frame;
+    int written;
+  } part[SCCB_SCHED_MAX_PARTS];
+} sccb_sched_result_t;
+
+void sccb_sched_init(void);
+bool sccb_sched_apply(const ov2640_reg_op_t *ops, int n, TickType_t timeout, sccb_sched_result_t *res);
+bool sccb_sched_stats_json(char *out, int out_max);
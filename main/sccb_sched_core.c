@@ -0,0 +1,90 @@
+#include "sccb_sched_core.h"
+#include <string.h>
+
+void sccb_core_init(sccb_sched_core_t *c, int ops_budget) {
+  memset(c, 0, sizeof(*c));
+  c->next_id = 1;
+  c->ops_budget = ops_budget > 0 && ops_budget < SCCB_SCHED_PART_OPS ? ops_budget : SCCB_SCHED_PART_OPS;
+}
+
+uint32_t sccb_core_submit(sccb_sched_core_t *c, const ov2640_reg_op_t *ops, int n) {
+  if (!ops || n <= 0) return 0;
+  int need = (n + c->ops_budget - 1) / c->ops_budget;
+  if (need > SCCB_SCHED_MAX_PARTS || c->count + need > SCCB_SCHED_QUEUE) return 0;
+
+  uint32_t id = c->next_id++;
+  if (c->next_id == 0) c->next_id = 1;
+  sccb_result_t *r = &c->res[id % SCCB_SCHED_RESULTS];
+  memset(r, 0, sizeof(*r));
+  r->id = id;
+  r->parts = (uint8_t)need;
+  r->ok = true;
+
+  for (int i = 0, off = 0; i < need; i++, off += c->ops_budget) {
+    int k = n - off > c->ops_budget ? c->ops_budget : n - off;
+    sccb_part_t *p = &c->q[(c->head + c->count) % SCCB_SCHED_QUEUE];
+    p->id = id;
+    p->index = (uint8_t)i;
+    p->n = (uint8_t)k;
+    memcpy(p->ops, ops + off, (size_t)k * sizeof(*ops));
+    c->count++;
+  }
+  return id;
+}
+
+static void pop(sccb_sched_core_t *c) {
+  c->head = (c->head + 1) % SCCB_SCHED_QUEUE;
+  c->count--;
+}
+
+// A result slot reused by a newer request: the part's outcome is not recorded
+static sccb_result_t *result_for(sccb_sched_core_t *c, uint32_t id) {
+  sccb_result_t *r = &c->res[id % SCCB_SCHED_RESULTS];
+  return r->id == id ? r : NULL;
+}
+
+static void finish_part(sccb_sched_core_t *c, sccb_result_t *r) {
+  if (!r || ++r->done < r->parts) return;
+  if (r->ok) c->committed++;
+  else c->failed++;
+}
+
+int sccb_core_commit(sccb_sched_core_t *c, uint32_t frame, sccb_write_fn write, void *ctx) {
+  int parts = 0, ops = 0;
+  while (c->count > 0) {
+    sccb_part_t *p = &c->q[c->head];
+    sccb_result_t *r = result_for(c, p->id);
+    // After a failed part the rest of its request is dropped, not written
+    if (r && !r->ok) {
+      finish_part(c, r);
+      pop(c);
+      continue;
+    }
+    if (ops + p->n > c->ops_budget) break;
+
+    int w = write(p->ops, p->n, ctx);
+    ops += p->n;
+    parts++;
+    if (r) {
+      r->part[p->index] = (sccb_part_res_t){ frame + 1, (uint16_t)w };
+      r->written += w;
+      r->frame = frame + 1;
+      r->ok = w == p->n;
+    }
+    finish_part(c, r);
+    pop(c);
+  }
+  if (parts) c->boundaries++;
+  return parts;
+}
+
+bool sccb_core_result(const sccb_sched_core_t *c, uint32_t id, sccb_result_t *out) {
+  const sccb_result_t *r = &c->res[id % SCCB_SCHED_RESULTS];
+  if (r->id != id || r->done < r->parts) return false;
+  if (out) *out = *r;
+  return true;
+}
+
+int sccb_core_pending(const sccb_sched_core_t *c) {
+  return c->count;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "ov2640_ctrl.h"
+
+// Frame-aligned register write queue, free of ESP-IDF/FreeRTOS dependencies so
+// it can be driven on the host by a simulated frame clock:
+//
+//   sccb_core_init(&c, budget);
+//   id = sccb_core_submit(&c, ops, n);
+//   sccb_core_commit(&c, frame_no, fake_writer, &sim);  // once per simulated frame end
+//   sccb_core_result(&c, id, &res);                      // res.frame = first frame with all new regs
+//
+// A boundary writes at most `ops_budget` ops (<= SCCB_SCHED_PART_OPS), which
+// bounds the SCCB time spent inside vertical blanking. A request of up to that
+// many ops is written whole at one boundary, in one writer call (one SCCB
+// lock). A larger one (up to SCCB_SCHED_MAX_REQ, e.g. a 512-register preset)
+// is cut into parts of `ops_budget` ops that land at consecutive boundaries;
+// each part's frame and count are reported. Small requests share a boundary
+// while the budget lasts; order is always submission order.
+// tools/sccb_sched_sim.c drives it on the host.
+#define SCCB_SCHED_PART_OPS  32                   // largest boundary budget
+#define SCCB_SCHED_QUEUE     16                   // queued parts
+#define SCCB_SCHED_MAX_REQ   (SCCB_SCHED_PART_OPS * SCCB_SCHED_QUEUE)
+#define SCCB_SCHED_MAX_PARTS SCCB_SCHED_QUEUE
+#define SCCB_SCHED_RESULTS   16
+
+typedef int (*sccb_write_fn)(const ov2640_reg_op_t *ops, int n, void *ctx);   // returns ops written
+
+typedef struct {
+  uint32_t id;        // of the request; shared by all its parts
+  uint8_t index;      // part number within the request
+  uint8_t n;
+  ov2640_reg_op_t ops[SCCB_SCHED_PART_OPS];
+} sccb_part_t;
+
+typedef struct {
+  uint32_t frame;     // first frame started after this part took effect
+  uint16_t written;
+} sccb_part_res_t;
+
+typedef struct {
+  uint32_t id;
+  uint8_t parts, done;          // parts in the request / committed or dropped so far
+  uint32_t frame;               // first frame with the whole request in effect
+  int written;                  // leading ops of the request that were written
+  bool ok;
+  sccb_part_res_t part[SCCB_SCHED_MAX_PARTS];
+} sccb_result_t;
+
+typedef struct {
+  sccb_part_t q[SCCB_SCHED_QUEUE];
+  int head, count;
+  uint32_t next_id;
+  int ops_budget;
+  sccb_result_t res[SCCB_SCHED_RESULTS];
+  uint32_t committed, failed, boundaries;
+} sccb_sched_core_t;
+
+void sccb_core_init(sccb_sched_core_t *c, int ops_budget);
+// Queues a request of n ops; 0 if the queue lacks room for all of its parts
+// right now (or n is outside 1..SCCB_SCHED_MAX_REQ, which never fits)
+uint32_t sccb_core_submit(sccb_sched_core_t *c, const ov2640_reg_op_t *ops, int n);
+// Returns the number of parts written at this boundary
+int  sccb_core_commit(sccb_sched_core_t *c, uint32_t frame, sccb_write_fn write, void *ctx);
+// True once every part of request `id` was committed (or dropped after a failure)
+bool sccb_core_result(const sccb_sched_core_t *c, uint32_t id, sccb_result_t *out);
+int  sccb_core_pending(const sccb_sched_core_t *c);   // queued parts
@@ -0,0 +1,145 @@
+#include "sd_bench.h"
+#include "app_config.h"
+#include "sdmmc_mount.h"
+#include "chunk_writer.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *TAG = "SDBENCH";
+
+#define BENCH_FILE SD_MOUNT_POINT "/.sdbench"
+
+static const size_t k_chunks[] = { 512, 4096, 16384, 32768, 65536 };
+
+typedef struct {
+  httpd_req_t *req;
+  uint32_t size;
+} bench_ctx_t;
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool s_busy = false;
+
+static uint32_t kbps(uint32_t bytes, int64_t us) {
+  return us > 0 ? (uint32_t)((uint64_t)bytes * 1000000 / 1024 / (uint64_t)us) : 0;
+}
+
+// Unbuffered stdio: each fwrite/fread of `chunk` bytes reaches FATFS as one call
+static bool run_write(uint8_t *buf, size_t chunk, uint32_t size, int64_t *us) {
+  FILE *f = fopen(BENCH_FILE, "wb");
+  if (!f) return false;
+  setvbuf(f, NULL, _IONBF, 0);
+  int64_t t0 = esp_timer_get_time();
+  bool ok = true;
+  for (uint32_t off = 0; ok && off < size; off += chunk) ok = fwrite(buf, 1, chunk, f) == chunk;
+  ok = ok && fsync(fileno(f)) == 0;
+  fclose(f);
+  *us = esp_timer_get_time() - t0;
+  return ok;
+}
+
+static bool run_read(uint8_t *buf, size_t chunk, uint32_t size, int64_t *us) {
+  FILE *f = fopen(BENCH_FILE, "rb");
+  if (!f) return false;
+  setvbuf(f, NULL, _IONBF, 0);
+  int64_t t0 = esp_timer_get_time();
+  bool ok = true;
+  for (uint32_t off = 0; ok && off < size; off += chunk) ok = fread(buf, 1, chunk, f) == chunk;
+  fclose(f);
+  *us = esp_timer_get_time() - t0;
+  return ok;
+}
+
+static void bench_task(void *arg) {
+  bench_ctx_t *c = (bench_ctx_t*)arg;
+  httpd_req_t *req = c->req;
+
+  // Largest DMA-capable buffer we can get; bigger chunk sizes are skipped
+  size_t cap = k_chunks[sizeof(k_chunks) / sizeof(k_chunks[0]) - 1];
+  uint8_t *buf = NULL;
+  while (cap >= 4096 && !(buf = (uint8_t*)heap_caps_malloc(cap, MALLOC_CAP_DMA))) cap /= 2;
+  if (buf) memset(buf, 0xA5, cap);
+
+  sd_info_t info;
+  sdmmc_get_info(&info);
+
+  httpd_resp_set_type(req, "application/json");
+  chunk_writer_t w;
+  cw_init(&w, req);
+  cw_printf(&w, "{\"freq_khz\":%d,\"max_freq_khz\":%d,\"card\":\"%s\",\"size_kb\":%u,\"results\":[",
+            info.real_freq_khz, info.max_freq_khz, info.name, (unsigned)(c->size / 1024));
+
+  bool ok = buf != NULL;
+  int done = 0;
+  for (size_t i = 0; ok && i < sizeof(k_chunks) / sizeof(k_chunks[0]); i++) {
+    size_t chunk = k_chunks[i];
+    if (chunk > cap) break;
+    int64_t wus = 0, rus = 0;
+    ok = run_write(buf, chunk, c->size, &wus) && run_read(buf, chunk, c->size, &rus);
+    if (!ok) break;
+    cw_printf(&w, "%s{\"chunk\":%u,\"write_kbps\":%u,\"read_kbps\":%u,\"write_us\":%lld,\"read_us\":%lld}",
+              done++ ? "," : "", (unsigned)chunk, (unsigned)kbps(c->size, wus), (unsigned)kbps(c->size, rus),
+              (long long)wus, (long long)rus);
+    cw_flush(&w);   // show progress while the next size runs
+    ESP_LOGI(TAG, "chunk %u: write %u KiB/s, read %u KiB/s", (unsigned)chunk,
+             (unsigned)kbps(c->size, wus), (unsigned)kbps(c->size, rus));
+  }
+  remove(BENCH_FILE);
+  heap_caps_free(buf);
+
+  cw_printf(&w, "],\"ok\":%s}", ok ? "true" : "false");
+  cw_finish(&w);
+
+  httpd_req_async_handler_complete(req);
+  free(c);
+  portENTER_CRITICAL(&s_mux);
+  s_busy = false;
+  portEXIT_CRITICAL(&s_mux);
+  vTaskDelete(NULL);
+}
+
+esp_err_t sd_bench_handler(httpd_req_t *req) {
+  char q[48] = "", v[12];
+  uint32_t kb = SD_BENCH_DEFAULT_KB;
+  if (httpd_req_get_url_query_str(req, q, sizeof(q)) == ESP_OK &&
+      httpd_query_key_value(q, "size_kb", v, sizeof(v)) == ESP_OK) kb = (uint32_t)strtoul(v, NULL, 10);
+  if (kb < 256 || kb > SD_BENCH_MAX_KB) return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "size_kb must be 256..8192");
+
+  bench_ctx_t *c = (bench_ctx_t*)calloc(1, sizeof(*c));
+  if (!c) return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no mem");
+  c->size = kb * 1024;
+
+  bool admit = false;
+  portENTER_CRITICAL(&s_mux);
+  if (!s_busy) { s_busy = true; admit = true; }
+  portEXIT_CRITICAL(&s_mux);
+  if (!admit) { free(c); return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "benchmark already running"); }
+
+  if (httpd_req_async_handler_begin(req, &c->req) != ESP_OK) {
+    free(c);
+    portENTER_CRITICAL(&s_mux);
+    s_busy = false;
+    portEXIT_CRITICAL(&s_mux);
+    return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "async failed");
+  }
+  if (xTaskCreate(bench_task, "sd_bench", 4096, c, 4, NULL) != pdPASS) {
+    httpd_req_async_handler_complete(c->req);
+    free(c);
+    portENTER_CRITICAL(&s_mux);
+    s_busy = false;
+    portEXIT_CRITICAL(&s_mux);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+esp_err_t sd_reprobe_handler(httpd_req_t *req) {
+  sdmmc_forget_freq();
+  return httpd_resp_sendstr(req, "{\"ok\":true,\"note\":\"bus clock is probed again on next boot\"}");
+}
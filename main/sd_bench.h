@@ -0,0 +1,12 @@
+#pragma once
+#include "esp_http_server.h"
+
+// GET /api/sd/bench?size_kb=<256..8192>: sequential write (incl. fsync) and read
+// throughput of a scratch file at several chunk sizes, streamed as JSON while it
+// runs. Served by a worker task; one run at a time.
+// POST /api/sd/reprobe: forget the stored bus clock, so the next boot probes again.
+#define SD_BENCH_DEFAULT_KB 1024
+#define SD_BENCH_MAX_KB     8192
+
+esp_err_t sd_bench_handler(httpd_req_t *req);
+esp_err_t sd_reprobe_handler(httpd_req_t *req);
@@ -1,25 +1,39 @@
 #include "sdmmc_mount.h"
 #include "app_config.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "nvs.h"
 
 #include "driver/sdmmc_host.h"
 #include "sdmmc_cmd.h"
 #include "esp_vfs_fat.h"
 
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
 
 static const char *TAG = "SDMMC";
 
+#define NVS_NS        "sd"
+#define NVS_KEY_FREQ  "freq_khz"
+#define PROBE_FILE    SD_MOUNT_POINT "/.sdprobe"
+#define PROBE_BYTES   (128 * 1024)
+#define PROBE_CHUNK   (16 * 1024)
+
+static sdmmc_card_t *s_card = NULL;
+static sd_info_t s_info;
+
 static void mkdir_if_missing(const char *p) {
   struct stat st;
   if (stat(p, &st) == 0 && S_ISDIR(st.st_mode)) return;
   mkdir(p, 0775);
 }
 
-bool sdmmc_mount_and_prepare(void) {
+static bool mount_at(int freq_khz) {
   sdmmc_host_t host = SDMMC_HOST_DEFAULT();
-  host.max_freq_khz = 20000; // start safe; raise later if stable
+  host.max_freq_khz = freq_khz;
 
   sdmmc_slot_config_t slot = SDMMC_SLOT_CONFIG_DEFAULT();
   slot.width = 4;
@@ -30,17 +44,127 @@ bool sdmmc_mount_and_prepare(void) {
     .allocation_unit_size = 16 * 1024
   };
 
-  sdmmc_card_t *card = NULL;
-  esp_err_t err = esp_vfs_fat_sdmmc_mount(SD_MOUNT_POINT, &host, &slot, &mcfg, &card);
+  esp_err_t err = esp_vfs_fat_sdmmc_mount(SD_MOUNT_POINT, &host, &slot, &mcfg, &s_card);
   if (err != ESP_OK) {
-    ESP_LOGE(TAG, "Mount failed: %s", esp_err_to_name(err));
+    ESP_LOGE(TAG, "Mount at %d kHz failed: %s", freq_khz, esp_err_to_name(err));
+    s_card = NULL;
     return false;
   }
+  return true;
+}
+
+static void unmount(void) {
+  if (s_card) esp_vfs_fat_sdcard_unmount(SD_MOUNT_POINT, s_card);
+  s_card = NULL;
+}
+
+static uint32_t xorshift(uint32_t *s) {
+  *s ^= *s << 13;
+  *s ^= *s >> 17;
+  *s ^= *s << 5;
+  return *s;
+}
+
+static void fill_pattern(uint32_t *buf, size_t words, uint32_t *seed) {
+  for (size_t i = 0; i < words; i++) buf[i] = xorshift(seed);
+}
+
+// Read-after-write of a pseudo-random file; bus errors at a too-high clock show
+// up as CRC/timeout failures or as corrupted data
+static bool verify_bus(void) {
+  uint32_t *buf = (uint32_t*)heap_caps_malloc(PROBE_CHUNK, MALLOC_CAP_DMA);
+  uint32_t *chk = (uint32_t*)heap_caps_malloc(PROBE_CHUNK, MALLOC_CAP_DMA);
+  bool ok = buf && chk;
+
+  uint32_t seed = 0x9E3779B9u;
+  FILE *f = ok ? fopen(PROBE_FILE, "wb") : NULL;
+  ok = f != NULL;
+  for (size_t off = 0; ok && off < PROBE_BYTES; off += PROBE_CHUNK) {
+    fill_pattern(buf, PROBE_CHUNK / 4, &seed);
+    ok = fwrite(buf, 1, PROBE_CHUNK, f) == PROBE_CHUNK;
+  }
+  if (f) {
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    fclose(f);
+  }
+
+  seed = 0x9E3779B9u;
+  f = ok ? fopen(PROBE_FILE, "rb") : NULL;
+  ok = ok && f != NULL;
+  for (size_t off = 0; ok && off < PROBE_BYTES; off += PROBE_CHUNK) {
+    fill_pattern(buf, PROBE_CHUNK / 4, &seed);
+    ok = fread(chk, 1, PROBE_CHUNK, f) == PROBE_CHUNK && memcmp(buf, chk, PROBE_CHUNK) == 0;
+  }
+  if (f) fclose(f);
+  remove(PROBE_FILE);
+
+  heap_caps_free(buf);
+  heap_caps_free(chk);
+  return ok;
+}
+
+static uint32_t nvs_freq(void) {
+  nvs_handle_t h;
+  uint32_t v = 0;
+  if (nvs_open(NVS_NS, NVS_READONLY, &h) != ESP_OK) return 0;
+  if (nvs_get_u32(h, NVS_KEY_FREQ, &v) != ESP_OK) v = 0;
+  nvs_close(h);
+  return v;
+}
+
+static void nvs_store_freq(uint32_t khz) {
+  nvs_handle_t h;
+  if (nvs_open(NVS_NS, NVS_READWRITE, &h) != ESP_OK) return;
+  if (nvs_set_u32(h, NVS_KEY_FREQ, khz) == ESP_OK) nvs_commit(h);
+  nvs_close(h);
+}
+
+// Mounts at freq_khz and checks the bus; leaves the card unmounted on failure
+static bool try_freq(int freq_khz) {
+  if (!mount_at(freq_khz)) return false;
+  if (verify_bus()) return true;
+  ESP_LOGW(TAG, "read-after-write check failed at %d kHz", freq_khz);
+  unmount();
+  return false;
+}
+
+bool sdmmc_mount_and_prepare(void) {
+  // Start from what worked last time; otherwise probe high speed first
+  uint32_t saved = nvs_freq();
+  int first = saved ? (int)saved : SDMMC_FREQ_HIGHSPEED;
+
+  bool ok = try_freq(first);
+  s_info.probed = !ok || !saved;
+  if (!ok && first != SDMMC_FREQ_DEFAULT) ok = try_freq(SDMMC_FREQ_DEFAULT);
+  if (!ok) return false;
+
+  s_info.max_freq_khz = s_card->max_freq_khz;
+  s_info.real_freq_khz = s_card->real_freq_khz;
+  s_info.capacity_mb = (uint32_t)((uint64_t)s_card->csd.capacity * s_card->csd.sector_size / (1024 * 1024));
+  snprintf(s_info.name, sizeof(s_info.name), "%s", s_card->cid.name);
+  // Remember the requested clock that passed; a card without HS support runs it at 20 MHz anyway
+  if (saved != (uint32_t)s_card->max_freq_khz) nvs_store_freq((uint32_t)s_card->max_freq_khz);
 
   mkdir_if_missing(WWW_DIR);
   mkdir_if_missing(CAPTURES_DIR);
   mkdir_if_missing(REGPROFILES_DIR);
+  mkdir_if_missing(THUMBS_DIR);
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+  mkdir_if_missing(STORE_DIR);
+#endif
 
-  ESP_LOGI(TAG, "Mounted SD at %s", SD_MOUNT_POINT);
+  ESP_LOGI(TAG, "Mounted SD at %s, %d kHz (%s)", SD_MOUNT_POINT, s_info.real_freq_khz,
+           s_info.probed ? "probed" : "from NVS");
   return true;
 }
+
+void sdmmc_get_info(sd_info_t *out) {
+  *out = s_info;
+}
+
+void sdmmc_forget_freq(void) {
+  nvs_handle_t h;
+  if (nvs_open(NVS_NS, NVS_READWRITE, &h) != ESP_OK) return;
+  if (nvs_erase_key(h, NVS_KEY_FREQ) == ESP_OK) nvs_commit(h);
+  nvs_close(h);
+}
@@ -1,3 +1,20 @@
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
+
+// Mounts the card at the bus clock stored in NVS, or probes 40 MHz first and
+// falls back to 20 MHz when a read-after-write check fails. The clock that
+// passed is stored for the next boot.
 bool sdmmc_mount_and_prepare(void);
+
+typedef struct {
+  int max_freq_khz;     // requested clock that passed the check
+  int real_freq_khz;    // what the card actually runs at
+  bool probed;          // false: the NVS setting was used as-is
+  uint32_t capacity_mb;
+  char name[8];
+} sd_info_t;
+
+void sdmmc_get_info(sd_info_t *out);
+// Drops the stored clock; the next boot probes again
+void sdmmc_forget_freq(void);
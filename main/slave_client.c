@@ -2,8 +2,12 @@
 #include "app_config.h"
 #include "esp_http_client.h"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #if CONFIG_ROLE_MASTER
 static const char *TAG="SLV";
@@ -56,7 +60,152 @@ bool slave_http_get(const char *path, char *out, int out_max) {
   esp_http_client_cleanup(c);
   return true;
 }
+// One keep-alive client per link, each serialized by its own lock, so a
+// long request on one never delays another
+typedef struct {
+  esp_http_client_handle_t c;
+  SemaphoreHandle_t lock;
+} link_t;
+
+static link_t s_links[SLAVE_LINK_COUNT];
+static portMUX_TYPE s_link_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void link_drop(link_t *l) {
+  if (!l->c) return;
+  esp_http_client_close(l->c);
+  esp_http_client_cleanup(l->c);
+  l->c = NULL;
+}
+
+// Takes the link's lock and points its (possibly new) client at path
+static link_t *link_acquire(slave_link_id_t id, const char *path) {
+  link_t *l = &s_links[id];
+  if (!l->lock) {
+    taskENTER_CRITICAL(&s_link_mux);
+    if (!l->lock) l->lock = xSemaphoreCreateMutex();
+    taskEXIT_CRITICAL(&s_link_mux);
+  }
+
+  char url[256];
+  make_url(url, sizeof(url), path);
+
+  xSemaphoreTake(l->lock, portMAX_DELAY);
+  if (!l->c) {
+    esp_http_client_config_t cfg = { .url = url, .timeout_ms = 4000, .keep_alive_enable = true };
+    l->c = esp_http_client_init(&cfg);
+  } else {
+    esp_http_client_set_url(l->c, url);
+  }
+  return l;
+}
+
+int slave_link_post(slave_link_id_t id, const char *path, const char *ctype, const char *body, int len, char *out, int out_max) {
+  link_t *l = link_acquire(id, path);
+  esp_http_client_set_method(l->c, HTTP_METHOD_POST);
+  esp_http_client_set_header(l->c, "Content-Type", ctype);
+
+  int code = -1;
+  esp_err_t err = esp_http_client_open(l->c, len);
+  if (err == ESP_OK && (len == 0 || esp_http_client_write(l->c, body, len) == len) &&
+      esp_http_client_fetch_headers(l->c) >= 0) {
+    code = esp_http_client_get_status_code(l->c);
+    int n = out && out_max > 0 ? esp_http_client_read_response(l->c, out, out_max - 1) : 0;
+    if (out && out_max > 0) out[n < 0 ? 0 : n] = 0;
+  }
+  if (code < 0) {
+    ESP_LOGW(TAG, "link POST %s failed: %s", path, esp_err_to_name(err));
+    link_drop(l);   // reconnect on next call
+  }
+  xSemaphoreGive(l->lock);
+  return code;
+}
+
+struct slave_stream {
+  esp_http_client_handle_t c;
+  bool has_crc;                 // X-Capture-CRC32 of the current body
+  uint32_t crc;
+};
+
+// Runs inside fetch_headers()
+static esp_err_t stream_event(esp_http_client_event_t *evt) {
+  slave_stream_t *st = (slave_stream_t*)evt->user_data;
+  if (evt->event_id == HTTP_EVENT_ON_HEADER && !strcasecmp(evt->header_key, "X-Capture-CRC32")) {
+    char *e;
+    unsigned long v = strtoul(evt->header_value, &e, 16);
+    st->has_crc = e != evt->header_value && *e == 0;
+    st->crc = (uint32_t)v;
+  }
+  return ESP_OK;
+}
+
+static void stream_drop(slave_stream_t *st) {
+  if (!st->c) return;
+  esp_http_client_close(st->c);
+  esp_http_client_cleanup(st->c);
+  st->c = NULL;
+}
+
+slave_stream_t *slave_stream_create(void) {
+  return (slave_stream_t*)calloc(1, sizeof(slave_stream_t));
+}
+
+int slave_stream_begin(slave_stream_t *st, const char *path, int64_t *content_len) {
+  char url[256];
+  make_url(url, sizeof(url), path);
+  if (!st->c) {
+    esp_http_client_config_t cfg = { .url = url, .timeout_ms = 4000, .keep_alive_enable = true,
+                                     .event_handler = stream_event, .user_data = st };
+    st->c = esp_http_client_init(&cfg);
+    if (!st->c) return -1;
+  } else {
+    esp_http_client_set_url(st->c, url);
+  }
+  esp_http_client_set_method(st->c, HTTP_METHOD_GET);
+  st->has_crc = false;
+
+  int code = -1;
+  int64_t len = -1;
+  esp_err_t err = esp_http_client_open(st->c, 0);
+  if (err == ESP_OK && (len = esp_http_client_fetch_headers(st->c)) >= 0)
+    code = esp_http_client_get_status_code(st->c);
+  if (code == 200 && len >= 0) {
+    *content_len = len;
+    return code;
+  }
+  if (code < 0) ESP_LOGW(TAG, "stream GET %s failed: %s", path, esp_err_to_name(err));
+  // Unread error bodies would desync the next request; reconnect instead
+  stream_drop(st);
+  return code;
+}
+
+int slave_stream_read(slave_stream_t *st, char *buf, int n) {
+  return st->c ? esp_http_client_read(st->c, buf, n) : -1;
+}
+
+bool slave_stream_crc(slave_stream_t *st, uint32_t *crc) {
+  if (st->has_crc) *crc = st->crc;
+  return st->has_crc;
+}
+
+void slave_stream_end(slave_stream_t *st, bool complete) {
+  if (!complete) stream_drop(st);
+}
+
+void slave_stream_destroy(slave_stream_t *st) {
+  if (!st) return;
+  stream_drop(st);
+  free(st);
+}
 #else
 bool slave_http_post_json(const char *path, const char *json_body){ (void)path;(void)json_body; return false; }
 bool slave_http_get(const char *path, char *out, int out_max){ (void)path;(void)out;(void)out_max; return false; }
+int slave_link_post(slave_link_id_t id, const char *path, const char *ctype, const char *body, int len, char *out, int out_max){
+  (void)id;(void)path;(void)ctype;(void)body;(void)len;(void)out;(void)out_max; return -1;
+}
+slave_stream_t *slave_stream_create(void){ return NULL; }
+int slave_stream_begin(slave_stream_t *st, const char *path, int64_t *content_len){ (void)st;(void)path;(void)content_len; return -1; }
+int slave_stream_read(slave_stream_t *st, char *buf, int n){ (void)st;(void)buf;(void)n; return -1; }
+bool slave_stream_crc(slave_stream_t *st, uint32_t *crc){ (void)st;(void)crc; return false; }
+void slave_stream_end(slave_stream_t *st, bool complete){ (void)st;(void)complete; }
+void slave_stream_destroy(slave_stream_t *st){ (void)st; }
 #endif
@@ -1,5 +1,32 @@
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
 
 bool slave_http_post_json(const char *path, const char *json_body);
 bool slave_http_get(const char *path, char *out, int out_max);
+
+// Persistent keep-alive connections to the slave, one socket per link, each
+// serialized on its own: register replication never queues behind a script
+// long-poll (up to 3 s).
+typedef enum {
+  SLAVE_LINK_REPL,      // register log batches (reg_log.c)
+  SLAVE_LINK_SCRIPT,    // script arm and result long-poll (reg_script.c)
+  SLAVE_LINK_COUNT
+} slave_link_id_t;
+
+// Returns HTTP status (or -1 on transport error); response body copied to out.
+int slave_link_post(slave_link_id_t id, const char *path, const char *ctype, const char *body, int len, char *out, int out_max);
+
+// Streaming GETs (export proxy) on a keep-alive connection owned by the
+// caller, so a long transfer holds no shared link. On 200 *content_len is set
+// and the body is read with slave_stream_read() before slave_stream_end();
+// any other status ends the request before returning. One request at a time
+// per stream; slave_stream_destroy() closes the connection.
+typedef struct slave_stream slave_stream_t;
+slave_stream_t *slave_stream_create(void);
+int slave_stream_begin(slave_stream_t *st, const char *path, int64_t *content_len);
+int slave_stream_read(slave_stream_t *st, char *buf, int n);
+// CRC32 the slave recorded for the body being streamed (its X-Capture-CRC32)
+bool slave_stream_crc(slave_stream_t *st, uint32_t *crc);
+void slave_stream_end(slave_stream_t *st, bool complete);   // !complete: drop the connection
+void slave_stream_destroy(slave_stream_t *st);
@@ -0,0 +1,302 @@
+#include "static_cache.h"
+#include "app_config.h"
+#include "www_embedded.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static const char *TAG = "WWW";
+
+// PSRAM copy of a file; one reference for the cache, one per response in flight
+typedef struct {
+  uint32_t refs;        // under s_lock
+  uint8_t data[];
+} blob_t;
+
+typedef struct {
+  const uint8_t *data;  // PSRAM copy or flash; NULL = variant absent
+  uint32_t len;
+  blob_t *blob;         // NULL: points into the embedded image
+  char etag[24];
+} variant_t;
+
+typedef struct {
+  char name[48];
+  bool present;       // false: cached "not found"
+  const char *ctype;
+  variant_t plain, gz;
+} entry_t;
+
+static entry_t s_ent[STATIC_CACHE_MAX_ENTRIES];
+static int s_n = 0;
+static uint32_t s_bytes = 0;
+static static_cache_stats_t s_st;
+static SemaphoreHandle_t s_lock = NULL;
+static bool s_sd = false;   // WWW_DIR on the SD card is usable
+
+static bool has_suffix(const char *s, const char *suf) {
+  size_t n = strlen(s), k = strlen(suf);
+  return n >= k && !strcmp(s + n - k, suf);
+}
+
+static const char *ctype_for(const char *name) {
+  if (has_suffix(name, ".html") || has_suffix(name, ".htm")) return "text/html";
+  if (has_suffix(name, ".js")) return "application/javascript";
+  if (has_suffix(name, ".css")) return "text/css";
+  if (has_suffix(name, ".json")) return "application/json";
+  if (has_suffix(name, ".svg")) return "image/svg+xml";
+  if (has_suffix(name, ".png")) return "image/png";
+  if (has_suffix(name, ".ico")) return "image/x-icon";
+  return "text/plain";
+}
+
+static uint32_t fnv1a(const uint8_t *p, uint32_t n) {
+  uint32_t h = 2166136261u;
+  for (uint32_t i = 0; i < n; i++) { h ^= p[i]; h *= 16777619u; }
+  return h;
+}
+
+// Returns false if the file is missing; *too_big if it exists but is not cacheable
+static bool load_variant(const char *path, variant_t *v, bool *too_big) {
+  struct stat st;
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+  if (st.st_size > STATIC_CACHE_MAX_FILE || s_bytes + (uint32_t)st.st_size > STATIC_CACHE_BUDGET) {
+    *too_big = true;
+    return true;
+  }
+
+  uint32_t len = (uint32_t)st.st_size;
+  blob_t *b = (blob_t*)heap_caps_malloc(sizeof(blob_t) + (len ? len : 1), MALLOC_CAP_SPIRAM);
+  if (!b) { *too_big = true; return true; }
+
+  FILE *f = fopen(path, "rb");
+  bool ok = f && fread(b->data, 1, len, f) == len;
+  if (f) fclose(f);
+  s_st.sd_reads++;
+  if (!ok) { heap_caps_free(b); return false; }
+
+  b->refs = 1;
+  v->blob = b;
+  v->data = b->data;
+  v->len = len;
+  snprintf(v->etag, sizeof(v->etag), "\"%08x-%x\"", (unsigned)fnv1a(b->data, len), (unsigned)len);
+  s_bytes += len;
+  return true;
+}
+
+// Caller holds s_lock
+static void blob_put_locked(blob_t *b) {
+  if (b && --b->refs == 0) heap_caps_free(b);
+}
+
+static void free_variant(variant_t *v) {
+  blob_put_locked(v->blob);
+  v->blob = NULL;
+  v->data = NULL;
+}
+
+// Build-time gzip'd copy from flash; no file I/O and no PSRAM
+static bool embedded_variant(const char *name, variant_t *v) {
+  for (int i = 0; i < g_www_embedded_count; i++) {
+    const www_embedded_t *w = &g_www_embedded[i];
+    if (strcmp(w->name, name)) continue;
+    v->data = w->gz_start;
+    v->len = (uint32_t)(w->gz_end - w->gz_start);
+    v->blob = NULL;
+    snprintf(v->etag, sizeof(v->etag), "\"%08x-%x\"", (unsigned)fnv1a(v->data, v->len), (unsigned)v->len);
+    return true;
+  }
+  return false;
+}
+
+// Caller holds s_lock. Returns NULL if the file exists but cannot be cached.
+static entry_t *load_locked(const char *name) {
+  if (s_n >= STATIC_CACHE_MAX_ENTRIES) return NULL;
+  entry_t *e = &s_ent[s_n];
+  memset(e, 0, sizeof(*e));
+  snprintf(e->name, sizeof(e->name), "%s", name);
+  e->ctype = ctype_for(name);
+
+  char path[128];
+  bool too_big = false, plain = false, gz = false;
+  if (s_sd) {
+    snprintf(path, sizeof(path), "%s/%s", WWW_DIR, name);
+    plain = load_variant(path, &e->plain, &too_big);
+    snprintf(path, sizeof(path), "%s/%s.gz", WWW_DIR, name);
+    gz = load_variant(path, &e->gz, &too_big);
+  }
+
+  if (too_big) {
+    s_bytes -= e->plain.len + e->gz.len;
+    free_variant(&e->plain);
+    free_variant(&e->gz);
+    return NULL;
+  }
+  // Anything on the SD card overrides the built-in copy
+  if (!plain && !gz) gz = embedded_variant(name, &e->gz);
+  e->present = plain || gz;
+  if (!e->present && s_n >= STATIC_CACHE_MAX_ENTRIES / 2) {
+    // keep 404 probes from using up the slots; report "missing" without caching it
+    static entry_t missing;
+    return &missing;
+  }
+  s_n++;
+  s_st.entries = s_n;
+  s_st.bytes = s_bytes;
+  return e;
+}
+
+static entry_t *find_locked(const char *name) {
+  for (int i = 0; i < s_n; i++)
+    if (!strcmp(s_ent[i].name, name)) return &s_ent[i];
+  return NULL;
+}
+
+void static_cache_init(void) {
+  if (!s_lock) s_lock = xSemaphoreCreateMutex();
+}
+
+void static_cache_clear(void) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  for (int i = 0; i < s_n; i++) {
+    free_variant(&s_ent[i].plain);
+    free_variant(&s_ent[i].gz);
+  }
+  s_n = 0;
+  s_bytes = 0;
+  s_st.entries = 0;
+  s_st.bytes = 0;
+  xSemaphoreGive(s_lock);
+}
+
+void static_cache_preload(bool sd_available) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  s_sd = sd_available;
+  DIR *d = s_sd ? opendir(WWW_DIR) : NULL;
+  if (d) {
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+      if (de->d_name[0] == '.' || has_suffix(de->d_name, ".gz")) continue;
+      if (strlen(de->d_name) >= sizeof(s_ent[0].name) || find_locked(de->d_name)) continue;
+      load_locked(de->d_name);
+    }
+    closedir(d);
+  } else {
+    ESP_LOGW(TAG, "%s not readable; serving the built-in UI", WWW_DIR);
+  }
+  // Built-in assets not present on the card
+  for (int i = 0; i < g_www_embedded_count; i++) {
+    if (!find_locked(g_www_embedded[i].name)) load_locked(g_www_embedded[i].name);
+  }
+  int n = s_n;
+  uint32_t bytes = s_bytes;
+  xSemaphoreGive(s_lock);
+  ESP_LOGI(TAG, "cached %d assets, %u bytes in PSRAM", n, (unsigned)bytes);
+}
+
+void static_cache_reload(void) {
+  static_cache_clear();
+  static_cache_preload(s_sd);
+}
+
+// Fallback for files that do not fit the cache
+static esp_err_t stream_file(httpd_req_t *req, const char *path, const char *ctype) {
+  FILE *f = fopen(path, "rb");
+  if (!f) return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "file not found");
+  httpd_resp_set_type(req, ctype);
+
+  char buf[1024];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    if (httpd_resp_send_chunk(req, buf, (ssize_t)n) != ESP_OK) break;
+  }
+  fclose(f);
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static bool client_has(httpd_req_t *req, const char *hdr, const char *needle) {
+  char v[96];
+  if (httpd_req_get_hdr_value_str(req, hdr, v, sizeof(v)) != ESP_OK) return false;
+  return strstr(v, needle) != NULL;
+}
+
+esp_err_t static_cache_serve(httpd_req_t *req, const char *name) {
+  if (!name[0] || strstr(name, "..") || strlen(name) >= sizeof(s_ent[0].name))
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "file not found");
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  entry_t *e = find_locked(name);
+  if (e) s_st.hits++;
+  else {
+    s_st.misses++;
+    e = load_locked(name);
+  }
+
+  if (!e) {
+    s_st.uncached++;
+    xSemaphoreGive(s_lock);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s", WWW_DIR, name);
+    return stream_file(req, path, ctype_for(name));
+  }
+  if (!e->present) {
+    xSemaphoreGive(s_lock);
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "file not found");
+  }
+
+  // Pin the variant and send without the lock: a slow client must not hold up
+  // other requests, and a concurrent clear only drops the cache's reference
+  bool accepts_gz = client_has(req, "Accept-Encoding", "gzip");
+  // Only a gzip copy (embedded, or .gz alone on the card) and the client did
+  // not ask for gzip: refuse rather than send an encoding it cannot read
+  if (e->gz.data && !e->plain.data && !accepts_gz) {
+    s_st.not_acceptable++;
+    xSemaphoreGive(s_lock);
+    httpd_resp_set_status(req, "406 Not Acceptable");
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    httpd_resp_set_type(req, "text/plain");
+    return httpd_resp_sendstr(req, "only a gzip copy is available; send Accept-Encoding: gzip");
+  }
+  bool use_gz = e->gz.data && accepts_gz;
+  variant_t v = use_gz ? e->gz : e->plain;
+  bool vary = e->gz.data != NULL;
+  const char *ctype = e->ctype;
+  bool not_modified = client_has(req, "If-None-Match", v.etag);
+  if (not_modified) s_st.not_modified++;
+  else if (use_gz) s_st.gzip_served++;
+  if (v.blob) v.blob->refs++;
+  xSemaphoreGive(s_lock);
+
+  httpd_resp_set_hdr(req, "ETag", v.etag);
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  if (vary) httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+
+  esp_err_t r;
+  if (not_modified) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    r = httpd_resp_send(req, NULL, 0);
+  } else {
+    if (use_gz) httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    httpd_resp_set_type(req, ctype);
+    r = httpd_resp_send(req, (const char*)v.data, (ssize_t)v.len);
+  }
+
+  if (v.blob) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    blob_put_locked(v.blob);
+    xSemaphoreGive(s_lock);
+  }
+  return r;
+}
+
+void static_cache_get_stats(static_cache_stats_t *out) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  *out = s_st;
+  xSemaphoreGive(s_lock);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_http_server.h"
+
+// PSRAM cache for the web UI under WWW_DIR. Files are loaded once (at boot by
+// static_cache_preload() or on first request) together with a pre-compressed
+// "<name>.gz" variant when present, and then served from memory with a strong
+// ETag; matching If-None-Match gets a 304. Missing files are cached too, so
+// steady-state UI traffic does not touch the SD card. Files not on the card
+// fall back to the gzip'd copies built into the firmware (www_embedded.h),
+// which are served straight from flash.
+#define STATIC_CACHE_MAX_ENTRIES  24
+#define STATIC_CACHE_MAX_FILE     (512 * 1024)
+#define STATIC_CACHE_BUDGET       (1536 * 1024)
+
+typedef struct {
+  uint32_t hits, misses, not_modified, gzip_served;
+  uint32_t not_acceptable;      // 406: only a gzip copy, client without Accept-Encoding: gzip
+  uint32_t sd_reads, uncached;   // files read from SD; responses streamed because over budget
+  uint32_t entries, bytes;
+} static_cache_stats_t;
+
+void static_cache_init(void);
+void static_cache_preload(bool sd_available);
+void static_cache_clear(void);
+void static_cache_reload(void);   // clear + preload, e.g. after files changed on the card
+
+// `name` is relative to WWW_DIR, e.g. "index.html"
+esp_err_t static_cache_serve(httpd_req_t *req, const char *name);
+void static_cache_get_stats(static_cache_stats_t *out);
@@ -0,0 +1,52 @@
+#include "wait_queue.h"
+#include "freertos/task.h"
+#include <string.h>
+
+bool wait_queue_init(wait_queue_t *q) {
+  memset(q, 0, sizeof(*q));
+  portMUX_INITIALIZE(&q->mux);
+  for (int i = 0; i < WAIT_QUEUE_SLOTS; i++) {
+    q->sem[i] = xSemaphoreCreateBinary();
+    // A slot without a semaphore stays taken: its waiters poll
+    if (!q->sem[i]) q->used |= 1u << i;
+  }
+  return q->used == 0;
+}
+
+int wait_queue_enter(wait_queue_t *q) {
+  int slot = -1;
+  portENTER_CRITICAL(&q->mux);
+  for (int i = 0; i < WAIT_QUEUE_SLOTS && slot < 0; i++) {
+    if (q->used & (1u << i)) continue;
+    q->used |= 1u << i;
+    slot = i;
+  }
+  portEXIT_CRITICAL(&q->mux);
+  // Drop a give meant for the slot's previous holder
+  if (slot >= 0) xSemaphoreTake(q->sem[slot], 0);
+  return slot;
+}
+
+bool wait_queue_wait(wait_queue_t *q, int slot, TickType_t timeout) {
+  if (slot >= 0) return xSemaphoreTake(q->sem[slot], timeout) == pdTRUE;
+  TickType_t poll = pdMS_TO_TICKS(WAIT_QUEUE_POLL_MS);
+  if (poll == 0) poll = 1;
+  if (timeout == 0) return false;
+  vTaskDelay(timeout < poll ? timeout : poll);
+  return true;
+}
+
+void wait_queue_leave(wait_queue_t *q, int slot) {
+  if (slot < 0) return;
+  portENTER_CRITICAL(&q->mux);
+  q->used &= ~(1u << slot);
+  portEXIT_CRITICAL(&q->mux);
+}
+
+void wait_queue_wake_all(wait_queue_t *q) {
+  portENTER_CRITICAL(&q->mux);
+  uint32_t used = q->used;
+  portEXIT_CRITICAL(&q->mux);
+  for (int i = 0; i < WAIT_QUEUE_SLOTS; i++)
+    if (used & (1u << i)) xSemaphoreGive(q->sem[i]);
+}
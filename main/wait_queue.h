@@ -0,0 +1,35 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// Broadcast wake-up for tasks waiting on a condition another task changes
+// (a frame counter, an acked sequence number). Each waiter holds a slot with
+// its own binary semaphore from before it first checks the condition, so a
+// wake-up that lands between the check and the block is kept, not lost the
+// way an event-group set+clear pulse is:
+//
+//   int slot = wait_queue_enter(&q);
+//   while (!condition) if (!wait_queue_wait(&q, slot, remaining)) break;
+//   wait_queue_leave(&q, slot);
+//
+// The changer updates the condition first, then calls wait_queue_wake_all().
+// Wake-ups can be spurious; waiters re-check. With every slot taken a waiter
+// polls every WAIT_QUEUE_POLL_MS instead.
+#define WAIT_QUEUE_SLOTS    8
+#define WAIT_QUEUE_POLL_MS  10
+
+typedef struct {
+  portMUX_TYPE mux;
+  uint32_t used;                          // slot bitmap
+  SemaphoreHandle_t sem[WAIT_QUEUE_SLOTS];
+} wait_queue_t;
+
+// False if some semaphores could not be created (those slots poll)
+bool wait_queue_init(wait_queue_t *q);
+int  wait_queue_enter(wait_queue_t *q);   // slot, or -1 (polls)
+// False once `timeout` passed without a wake-up
+bool wait_queue_wait(wait_queue_t *q, int slot, TickType_t timeout);
+void wait_queue_leave(wait_queue_t *q, int slot);
+void wait_queue_wake_all(wait_queue_t *q);   // task context, does not block
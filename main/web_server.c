@@ -6,9 +6,32 @@
 #include "ov2640_ctrl.h"
 #include "slave_client.h"
 #include "reg_profiles.h"
+#include "reg_overlay.h"
+#include "chunk_writer.h"
+#include "frame_sync.h"
+#include "reg_watch.h"
+#include "reg_log.h"
+#include "sccb_sched.h"
+#include "reg_script.h"
+#include "capture_bracket.h"
+#include "metrics.h"
+#include "static_cache.h"
+#include "capture_http.h"
+#include "capture_export.h"
+#include "ws_stream.h"
+#include "event_bus.h"
+#include "capture_gallery.h"
+#include "sd_bench.h"
+#include "capture_store.h"
+#include "capture_catalog.h"
+#include "retention.h"
+#include "capture_stripe.h"
+#include "capture_mem.h"
 
 #include "esp_http_server.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "cJSON.h"
 
 #include <stdio.h>
@@ -24,79 +47,64 @@ static char g_armed_id[64] = {0};
 static char g_armed_pf[16] = {0};
 static char g_armed_fs[16] = {0};
 static char g_armed_ext[8] = {0};
+static cam_profile_t g_armed_profile;
 static volatile bool g_is_armed = false;
+static bracket_plan_t g_bracket_plan;
+static cam_profile_t g_bracket_profile;
+static volatile bool g_bracket_armed = false;
+static volatile bool g_bracket_running = false;   // burst in progress: plan/profile/id in use
+static portMUX_TYPE g_bracket_mux = portMUX_INITIALIZER_UNLOCKED;
 #endif
 
-static esp_err_t send_file(httpd_req_t *req, const char *path, const char *ctype) {
-  FILE *f = fopen(path, "rb");
-  if (!f) return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "file not found");
-  httpd_resp_set_type(req, ctype);
-
-  char buf[1024];
-  size_t n;
-  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
-    if (httpd_resp_send_chunk(req, buf, (ssize_t)n) != ESP_OK) break;
-  }
-  fclose(f);
-  httpd_resp_send_chunk(req, NULL, 0);
-  return ESP_OK;
-}
-
-static const char* guess_ctype(const char *uri) {
-  if (strstr(uri, ".js")) return "application/javascript";
-  if (strstr(uri, ".css")) return "text/css";
-  if (strstr(uri, ".json")) return "application/json";
-  if (strstr(uri, ".html")) return "text/html";
-  return "text/plain";
-}
-
 static esp_err_t h_root(httpd_req_t *req) {
-  char path[256];
-  snprintf(path, sizeof(path), "%s/index.html", WWW_DIR);
-  return send_file(req, path, "text/html");
+  return static_cache_serve(req, "index.html");
 }
 
 static esp_err_t h_registers_page(httpd_req_t *req) {
-  char path[256];
-  snprintf(path, sizeof(path), "%s/registers.html", WWW_DIR);
-  return send_file(req, path, "text/html");
+  return static_cache_serve(req, "registers.html");
 }
 
 static esp_err_t h_www_any(httpd_req_t *req) {
-  // URI like /www/app.js -> SD path: <WWW_DIR>/app.js
+  // URI like /www/app.js?v=2 -> <WWW_DIR>/app.js
   const char *uri = req->uri;
   if (strncmp(uri, "/www/", 5) != 0) return httpd_resp_send_err(req, 404, "bad");
-  char path[256];
-  snprintf(path, sizeof(path), "%s/%s", WWW_DIR, uri + 5);
-  return send_file(req, path, guess_ctype(uri));
+  char name[64];
+  snprintf(name, sizeof(name), "%s", uri + 5);
+  name[strcspn(name, "?#")] = 0;
+  return static_cache_serve(req, name);
 }
 
+static esp_err_t api_www_reload(httpd_req_t *req) {
+  static_cache_reload();
+  return httpd_resp_sendstr(req, "{\"ok\":true}");
+}
+
+#define STREAM_FRAME_TIMEOUT_MS 2000
+
 static esp_err_t h_stream(httpd_req_t *req) {
   static const char *boundary = "123456789000000000000987654321";
   char hdr[128];
 
   httpd_resp_set_type(req, "multipart/x-mixed-replace;boundary=123456789000000000000987654321");
 
+  // Frames come from the shared producer (ws_stream.c), never from the driver
+  // directly, so WebSocket and multipart viewers see the same frames
+  ws_stream_mjpeg_open();
+  uint32_t seq = 0;
   while (g_app.stream_enabled) {
-    xSemaphoreTake(g_app.cam_mutex, portMAX_DELAY);
-    camera_fb_t *fb = esp_camera_fb_get();
-    xSemaphoreGive(g_app.cam_mutex);
-
-    if (!fb) break;
-    if (fb->format != PIXFORMAT_JPEG) {
-      esp_camera_fb_return(fb);
-      continue;
-    }
+    ws_frame_ref_t f;
+    if (!ws_stream_mjpeg_next(&seq, pdMS_TO_TICKS(STREAM_FRAME_TIMEOUT_MS), &f)) break;
 
     int hlen = snprintf(hdr, sizeof(hdr),
       "\r\n--%s\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n",
-      boundary, (unsigned)fb->len);
+      boundary, (unsigned)f.len);
 
-    if (httpd_resp_send_chunk(req, hdr, hlen) != ESP_OK) { esp_camera_fb_return(fb); break; }
-    if (httpd_resp_send_chunk(req, (const char*)fb->buf, (ssize_t)fb->len) != ESP_OK) { esp_camera_fb_return(fb); break; }
-
-    esp_camera_fb_return(fb);
+    bool sent = httpd_resp_send_chunk(req, hdr, hlen) == ESP_OK &&
+                httpd_resp_send_chunk(req, (const char*)f.jpeg, (ssize_t)f.len) == ESP_OK;
+    ws_stream_mjpeg_release(&f);
+    if (!sent) break;
   }
+  ws_stream_mjpeg_close();
 
   httpd_resp_send_chunk(req, NULL, 0);
   return ESP_OK;
@@ -107,14 +115,65 @@ static void make_capture_paths(const char *id, char *bin_path, int bin_max, char
   snprintf(json_path, json_max, "%s/%s.json", CAPTURES_DIR, id);
 }
 
-static void ext_from_pixformat(const char *pf, char *out, int out_max) {
+// Compressed raw captures are .rawz whatever the pixel format (it is in the header)
+static void ext_from_pixformat(const char *pf, bool compress, char *out, int out_max) {
   if (!pf) { snprintf(out, out_max, "jpg"); return; }
-  if (!strcmp(pf, "rgb565")) snprintf(out, out_max, "rgb565");
+  if (compress && (!strcmp(pf, "rgb565") || !strcmp(pf, "yuv422") || !strcmp(pf, "gray") || !strcmp(pf, "bayer")))
+    snprintf(out, out_max, "rawz");
+  else if (!strcmp(pf, "bayer")) snprintf(out, out_max, "dng");
+  else if (!strcmp(pf, "rgb565")) snprintf(out, out_max, "rgb565");
   else if (!strcmp(pf, "yuv422")) snprintf(out, out_max, "yuv");
   else if (!strcmp(pf, "gray")) snprintf(out, out_max, "gray");
   else snprintf(out, out_max, "jpg");
 }
 
+static cam_profile_t capture_profile_from(const char *pf, const char *fs, int fb_count) {
+  cam_profile_t p = {
+    .framesize = (!strcmp(fs,"svga") ? FRAMESIZE_SVGA : (!strcmp(fs,"cif") ? FRAMESIZE_CIF : FRAMESIZE_UXGA)),
+    .pixformat = (!strcmp(pf,"rgb565") ? PIXFORMAT_RGB565 :
+                 (!strcmp(pf,"yuv422") ? PIXFORMAT_YUV422 :
+                 (!strcmp(pf,"gray") ? PIXFORMAT_GRAYSCALE :
+                 (!strcmp(pf,"bayer") ? PIXFORMAT_RAW : PIXFORMAT_JPEG)))),
+    .jpeg_quality = CAPTURE_DEFAULT_JPEG_QUALITY,
+    .fb_count = fb_count
+  };
+  return p;
+}
+
+// Bayer RAW8 exists only as banded UXGA captures
+static bool profile_supported(const cam_profile_t *p) {
+  return p->pixformat != PIXFORMAT_RAW || capture_stripe_applies(p);
+}
+
+// Bayer, compressed raw and (with "stripes":true) raw UXGA frames are streamed
+// to the card in bands (capture_stripe.c); the rest go through one full frame
+// buffer
+static bool capture_frame(const char *id, const cam_profile_t *p, const char *bin_path,
+                          const char *json_path, char *meta, int meta_max) {
+  if (capture_stripe_applies(p)) return capture_stripe_run(id, p, bin_path, json_path, meta, meta_max);
+  return cam_manager_capture_to_file(bin_path, json_path, meta, meta_max);
+}
+
+// 507: rejected before the camera is touched or the slave armed
+static esp_err_t send_no_space(httpd_req_t *req, const char *why) {
+  char buf[192];
+  snprintf(buf, sizeof(buf), "{\"ok\":false,\"error\":\"%s\"}", why);
+  httpd_resp_set_status(req, "507 Insufficient Storage");
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, buf);
+}
+
+#if CONFIG_ROLE_SLAVE
+// 409: the slave is still busy with an earlier armed capture
+static esp_err_t send_busy(httpd_req_t *req, const char *why) {
+  char buf[96];
+  snprintf(buf, sizeof(buf), "{\"ok\":false,\"error\":\"%s\"}", why);
+  httpd_resp_set_status(req, "409 Conflict");
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, buf);
+}
+#endif
+
 static bool parse_hex_u8(const char *s, uint8_t *out) {
   if (!s) return false;
   long v = strtol(s, NULL, 0);
@@ -123,6 +182,12 @@ static bool parse_hex_u8(const char *s, uint8_t *out) {
   return true;
 }
 
+// Which overlay slot(s) a register write is recorded into; body field "overlay"
+static int overlay_slot_from_json(cJSON *root) {
+  cJSON *o = cJSON_GetObjectItem(root, "overlay");
+  return reg_overlay_slot_from_str(cJSON_IsString(o) ? o->valuestring : NULL);
+}
+
 // ------------------ CAPTURE APIs ------------------
 
 static esp_err_t api_capture_local(httpd_req_t *req) {
@@ -134,44 +199,54 @@ static esp_err_t api_capture_local(httpd_req_t *req) {
   cJSON *root = cJSON_Parse(body);
   if (!root) return httpd_resp_send_err(req, 400, "bad json");
 
-  const char *id = cJSON_GetObjectItem(root, "id") ? cJSON_GetObjectItem(root, "id")->valuestring : "cap_local";
+  // No id given: a fresh catalog id, so repeated local captures never overwrite each other
+  char auto_id[24];
+  cJSON *idI = cJSON_GetObjectItem(root, "id");
+  if (!cJSON_IsString(idI)) snprintf(auto_id, sizeof(auto_id), "cap_%08u", (unsigned)capture_catalog_next_id());
+  const char *id = cJSON_IsString(idI) ? idI->valuestring : auto_id;
+  // Retention only sees cataloged captures: anything else would never be removed
+  if (!capture_catalog_id_valid(id)) {
+    cJSON_Delete(root);
+    return httpd_resp_send_err(req, 400, "id must be cap_<8 digits>");
+  }
   const char *pf = cJSON_GetObjectItem(root, "pixformat") ? cJSON_GetObjectItem(root, "pixformat")->valuestring : "jpeg";
   const char *fs = cJSON_GetObjectItem(root, "framesize") ? cJSON_GetObjectItem(root, "framesize")->valuestring : "uxga";
+  bool compress = cJSON_IsTrue(cJSON_GetObjectItem(root, "compress"));
+  bool stripes = cJSON_IsTrue(cJSON_GetObjectItem(root, "stripes"));
 
-  cam_profile_t cap = {
-    .framesize = (!strcmp(fs,"svga") ? FRAMESIZE_SVGA : (!strcmp(fs,"cif") ? FRAMESIZE_CIF : FRAMESIZE_UXGA)),
-    .pixformat = (!strcmp(pf,"rgb565") ? PIXFORMAT_RGB565 :
-                 (!strcmp(pf,"yuv422") ? PIXFORMAT_YUV422 :
-                 (!strcmp(pf,"gray") ? PIXFORMAT_GRAYSCALE : PIXFORMAT_JPEG))),
-    .jpeg_quality = CAPTURE_DEFAULT_JPEG_QUALITY,
-    .fb_count = 1
-  };
+  cam_profile_t cap = capture_profile_from(pf, fs, 1);
+  cap.compress = compress;
+  cap.stripes = stripes;
+  if (!profile_supported(&cap)) {
+    cJSON_Delete(root);
+    return httpd_resp_send_err(req, 400, "bayer needs uxga");
+  }
+  char why[160];
+  if (!retention_admit(retention_estimate(&cap), why, sizeof(why))) {
+    cJSON_Delete(root);
+    return send_no_space(req, why);
+  }
   cam_manager_set_capture_profile(&cap);
 
-  char ext[8]; ext_from_pixformat(pf, ext, sizeof(ext));
+  char ext[8]; ext_from_pixformat(pf, compress, ext, sizeof(ext));
 
-  char bin_path[256], json_path[256], meta[128];
+  char bin_path[256], json_path[256], meta[384];
   make_capture_paths(id, bin_path, sizeof(bin_path), json_path, sizeof(json_path), ext);
 
-  bool ok = cam_manager_capture_to_file(bin_path, meta, sizeof(meta));
-  if (ok) {
-    FILE *jf = fopen(json_path, "wb");
-    if (jf) { fwrite(meta, 1, strlen(meta), jf); fclose(jf); }
-  }
+  bool ok = capture_frame(id, &cap, bin_path, json_path, meta, sizeof(meta));
+  if (ok) capture_catalog_add(id, ext);
+  if (ok && !strcmp(ext, "jpg")) capture_gallery_enqueue(id);
 
+  char resp[128];
+  snprintf(resp, sizeof(resp), "{\"ok\":true,\"id\":\"%s\"}", id);
   cJSON_Delete(root);
   if (!ok) return httpd_resp_send_err(req, 500, "capture failed");
-  return httpd_resp_sendstr(req, "{\"ok\":true}");
+  return httpd_resp_sendstr(req, resp);
 }
 
 #if CONFIG_ROLE_MASTER
-static uint32_t next_id_counter(void) {
-  static uint32_t c = 0;
-  return ++c;
-}
-
 static void make_shared_id(char *out, int out_max) {
-  snprintf(out, out_max, "cap_%08u", (unsigned)next_id_counter());
+  snprintf(out, out_max, "cap_%08u", (unsigned)capture_catalog_next_id());
 }
 
 static esp_err_t api_capture_sync(httpd_req_t *req) {
@@ -185,41 +260,52 @@ static esp_err_t api_capture_sync(httpd_req_t *req) {
 
   const char *pf = cJSON_GetObjectItem(root, "pixformat") ? cJSON_GetObjectItem(root, "pixformat")->valuestring : "jpeg";
   const char *fs = cJSON_GetObjectItem(root, "framesize") ? cJSON_GetObjectItem(root, "framesize")->valuestring : "uxga";
+  bool compress = cJSON_IsTrue(cJSON_GetObjectItem(root, "compress"));
+  bool stripes = cJSON_IsTrue(cJSON_GetObjectItem(root, "stripes"));
+
+  cam_profile_t est = capture_profile_from(pf, fs, 1);
+  if (!profile_supported(&est)) {
+    cJSON_Delete(root);
+    return httpd_resp_send_err(req, 400, "bayer needs uxga");
+  }
+  char why[160];
+  if (!retention_admit(retention_estimate(&est), why, sizeof(why))) {
+    cJSON_Delete(root);
+    return send_no_space(req, why);
+  }
 
   char id[64];
   make_shared_id(id, sizeof(id));
 
   char arm_json[256];
   snprintf(arm_json, sizeof(arm_json),
-    "{\"id\":\"%s\",\"pixformat\":\"%s\",\"framesize\":\"%s\"}", id, pf, fs);
+    "{\"id\":\"%s\",\"pixformat\":\"%s\",\"framesize\":\"%s\",\"compress\":%s,\"stripes\":%s}", id, pf, fs,
+    compress ? "true" : "false", stripes ? "true" : "false");
 
   if (!slave_http_post_json("/api/arm", arm_json)) {
     cJSON_Delete(root);
+    event_bus_publish(EV_SLAVE, id, 0, 0, "arm_failed");
     return httpd_resp_send_err(req, 500, "slave arm failed");
   }
+  event_bus_publish(EV_SLAVE, id, 0, 0, "armed");
+  event_bus_publish(EV_ARM, id, 0, 0, pf);
 
-  cam_profile_t cap = {
-    .framesize = (!strcmp(fs,"svga") ? FRAMESIZE_SVGA : (!strcmp(fs,"cif") ? FRAMESIZE_CIF : FRAMESIZE_UXGA)),
-    .pixformat = (!strcmp(pf,"rgb565") ? PIXFORMAT_RGB565 :
-                 (!strcmp(pf,"yuv422") ? PIXFORMAT_YUV422 :
-                 (!strcmp(pf,"gray") ? PIXFORMAT_GRAYSCALE : PIXFORMAT_JPEG))),
-    .jpeg_quality = CAPTURE_DEFAULT_JPEG_QUALITY,
-    .fb_count = 1
-  };
+  cam_profile_t cap = capture_profile_from(pf, fs, 1);
+  cap.compress = compress;
+  cap.stripes = stripes;
   cam_manager_set_capture_profile(&cap);
 
   // Trigger pulse while both are armed (slave waits on GPIO)
   trigger_master_pulse_us(30);
+  event_bus_publish(EV_TRIGGER, id, 0, 0, NULL);
 
-  char ext[8]; ext_from_pixformat(pf, ext, sizeof(ext));
-  char bin_path[256], json_path[256], meta[128];
+  char ext[8]; ext_from_pixformat(pf, compress, ext, sizeof(ext));
+  char bin_path[256], json_path[256], meta[384];
   make_capture_paths(id, bin_path, sizeof(bin_path), json_path, sizeof(json_path), ext);
 
-  bool ok = cam_manager_capture_to_file(bin_path, meta, sizeof(meta));
-  if (ok) {
-    FILE *jf = fopen(json_path, "wb");
-    if (jf) { fwrite(meta, 1, strlen(meta), jf); fclose(jf); }
-  }
+  bool ok = capture_frame(id, &cap, bin_path, json_path, meta, sizeof(meta));
+  if (ok) capture_catalog_add(id, ext);
+  if (ok && !strcmp(ext, "jpg")) capture_gallery_enqueue(id);
 
   cJSON_Delete(root);
   if (!ok) return httpd_resp_send_err(req, 500, "master capture failed");
@@ -228,6 +314,65 @@ static esp_err_t api_capture_sync(httpd_req_t *req) {
   snprintf(resp, sizeof(resp), "{\"ok\":true,\"id\":\"%s\"}", id);
   return httpd_resp_sendstr(req, resp);
 }
+
+static esp_err_t api_capture_bracket(httpd_req_t *req) {
+  char body[512];
+  int n = httpd_req_recv(req, body, sizeof(body)-1);
+  if (n <= 0) return httpd_resp_send_err(req, 400, "no body");
+  body[n]=0;
+
+  cJSON *root = cJSON_Parse(body);
+  if (!root) return httpd_resp_send_err(req, 400, "bad json");
+
+  cJSON *pfI = cJSON_GetObjectItem(root, "pixformat");
+  cJSON *fsI = cJSON_GetObjectItem(root, "framesize");
+  const char *pf = cJSON_IsString(pfI) ? pfI->valuestring : "jpeg";
+  const char *fs = cJSON_IsString(fsI) ? fsI->valuestring : "uxga";
+
+  bracket_plan_t plan;
+  if (!capture_bracket_plan_from_json(root, &plan)) { cJSON_Delete(root); return httpd_resp_send_err(req, 400, "bad steps"); }
+
+  cam_profile_t est = capture_profile_from(pf, fs, 1);
+  if (est.pixformat == PIXFORMAT_RAW) {
+    cJSON_Delete(root);
+    return httpd_resp_send_err(req, 400, "bracket does not support bayer");
+  }
+  char why[160];
+  if (!retention_admit(retention_estimate(&est) * (size_t)plan.n, why, sizeof(why))) {
+    cJSON_Delete(root);
+    return send_no_space(req, why);
+  }
+
+  char id[64];
+  make_shared_id(id, sizeof(id));
+
+  char plan_json[320], arm_json[448];
+  capture_bracket_plan_to_json(&plan, plan_json, sizeof(plan_json));
+  snprintf(arm_json, sizeof(arm_json),
+    "{\"id\":\"%s\",\"pixformat\":\"%s\",\"framesize\":\"%s\",%s}", id, pf, fs, plan_json);
+  cam_profile_t cap = capture_profile_from(pf, fs, 2);
+  cJSON_Delete(root);
+
+  if (!slave_http_post_json("/api/arm_bracket", arm_json)) {
+    event_bus_publish(EV_SLAVE, id, 0, 0, "arm_failed");
+    return httpd_resp_send_err(req, 500, "slave arm failed");
+  }
+  event_bus_publish(EV_SLAVE, id, 0, 0, "armed");
+  event_bus_publish(EV_ARM, id, plan.n, 0, "bracket");
+
+  // Both boards start their burst on the same edge
+  trigger_master_pulse_us(30);
+  event_bus_publish(EV_TRIGGER, id, 0, 0, NULL);
+
+  char meta[1024];
+  bool ok = capture_bracket_run(id, &cap, &plan, meta, sizeof(meta));
+  if (ok) capture_catalog_add(id, "brk");
+  if (!ok) return httpd_resp_send_err(req, 500, "master bracket failed");
+
+  char resp[128];
+  snprintf(resp, sizeof(resp), "{\"ok\":true,\"id\":\"%s\",\"count\":%d}", id, plan.n);
+  return httpd_resp_sendstr(req, resp);
+}
 #endif
 
 #if CONFIG_ROLE_SLAVE
@@ -240,50 +385,140 @@ static esp_err_t api_arm(httpd_req_t *req) {
   cJSON *root = cJSON_Parse(body);
   if (!root) return httpd_resp_send_err(req, 400, "bad json");
 
-  const char *id = cJSON_GetObjectItem(root, "id")->valuestring;
+  if (g_bracket_running) {
+    cJSON_Delete(root);
+    return send_busy(req, "bracket in progress");
+  }
+  cJSON *idI = cJSON_GetObjectItem(root, "id");
+  if (!cJSON_IsString(idI) || !capture_catalog_id_valid(idI->valuestring)) {
+    cJSON_Delete(root);
+    return httpd_resp_send_err(req, 400, "bad id");
+  }
+  const char *id = idI->valuestring;
   const char *pf = cJSON_GetObjectItem(root, "pixformat")->valuestring;
   const char *fs = cJSON_GetObjectItem(root, "framesize")->valuestring;
+  bool compress = cJSON_IsTrue(cJSON_GetObjectItem(root, "compress"));
+  bool stripes = cJSON_IsTrue(cJSON_GetObjectItem(root, "stripes"));
+
+  cam_profile_t est = capture_profile_from(pf, fs, 1);
+  if (!profile_supported(&est)) {
+    cJSON_Delete(root);
+    return httpd_resp_send_err(req, 400, "bayer needs uxga");
+  }
+  char why[160];
+  if (!retention_admit(retention_estimate(&est), why, sizeof(why))) {
+    cJSON_Delete(root);
+    return send_no_space(req, why);
+  }
 
   strncpy(g_armed_id, id, sizeof(g_armed_id)-1);
   strncpy(g_armed_pf, pf, sizeof(g_armed_pf)-1);
   strncpy(g_armed_fs, fs, sizeof(g_armed_fs)-1);
-  ext_from_pixformat(g_armed_pf, g_armed_ext, sizeof(g_armed_ext));
+  ext_from_pixformat(g_armed_pf, compress, g_armed_ext, sizeof(g_armed_ext));
 
   g_armed_id[sizeof(g_armed_id)-1]=0;
   g_armed_pf[sizeof(g_armed_pf)-1]=0;
   g_armed_fs[sizeof(g_armed_fs)-1]=0;
   g_armed_ext[sizeof(g_armed_ext)-1]=0;
 
-  cam_profile_t cap = {
-    .framesize = (!strcmp(fs,"svga") ? FRAMESIZE_SVGA : (!strcmp(fs,"cif") ? FRAMESIZE_CIF : FRAMESIZE_UXGA)),
-    .pixformat = (!strcmp(pf,"rgb565") ? PIXFORMAT_RGB565 :
-                 (!strcmp(pf,"yuv422") ? PIXFORMAT_YUV422 :
-                 (!strcmp(pf,"gray") ? PIXFORMAT_GRAYSCALE : PIXFORMAT_JPEG))),
-    .jpeg_quality = CAPTURE_DEFAULT_JPEG_QUALITY,
-    .fb_count = 1
-  };
+  cam_profile_t cap = capture_profile_from(pf, fs, 1);
+  cap.compress = compress;
+  cap.stripes = stripes;
   cam_manager_set_capture_profile(&cap);
+  g_armed_profile = cap;
 
   g_is_armed = true;
+  event_bus_publish(EV_ARM, g_armed_id, 0, 0, g_armed_pf);
+  cJSON_Delete(root);
+
+  return httpd_resp_sendstr(req, "{\"ok\":true}");
+}
+
+static esp_err_t api_arm_bracket(httpd_req_t *req) {
+  char body[512];
+  int n = httpd_req_recv(req, body, sizeof(body)-1);
+  if (n <= 0) return httpd_resp_send_err(req, 400, "no body");
+  body[n]=0;
+
+  cJSON *root = cJSON_Parse(body);
+  if (!root) return httpd_resp_send_err(req, 400, "bad json");
+
+  if (g_bracket_running) {
+    cJSON_Delete(root);
+    return send_busy(req, "bracket in progress");
+  }
+  cJSON *idI = cJSON_GetObjectItem(root, "id");
+  cJSON *pfI = cJSON_GetObjectItem(root, "pixformat");
+  cJSON *fsI = cJSON_GetObjectItem(root, "framesize");
+  bracket_plan_t plan;
+  if (!cJSON_IsString(idI) || !capture_catalog_id_valid(idI->valuestring) ||
+      !cJSON_IsString(pfI) || !cJSON_IsString(fsI) || !capture_bracket_plan_from_json(root, &plan)) {
+    cJSON_Delete(root);
+    return httpd_resp_send_err(req, 400, "bad bracket");
+  }
+  cam_profile_t est = capture_profile_from(pfI->valuestring, fsI->valuestring, 1);
+  if (est.pixformat == PIXFORMAT_RAW) {
+    cJSON_Delete(root);
+    return httpd_resp_send_err(req, 400, "bracket does not support bayer");
+  }
+  char why[160];
+  if (!retention_admit(retention_estimate(&est) * (size_t)plan.n, why, sizeof(why))) {
+    cJSON_Delete(root);
+    return send_no_space(req, why);
+  }
+  // Checked again with the trigger task excluded: a burst may have started meanwhile
+  cam_profile_t prof = capture_profile_from(pfI->valuestring, fsI->valuestring, 2);
+  portENTER_CRITICAL(&g_bracket_mux);
+  bool busy = g_bracket_running;
+  if (!busy) {
+    g_bracket_plan = plan;
+    strncpy(g_armed_id, idI->valuestring, sizeof(g_armed_id)-1);
+    g_armed_id[sizeof(g_armed_id)-1]=0;
+    g_bracket_profile = prof;
+    g_bracket_armed = true;
+  }
+  portEXIT_CRITICAL(&g_bracket_mux);
+  if (busy) {
+    cJSON_Delete(root);
+    return send_busy(req, "bracket in progress");
+  }
+  event_bus_publish(EV_ARM, g_armed_id, g_bracket_plan.n, 0, "bracket");
   cJSON_Delete(root);
 
   return httpd_resp_sendstr(req, "{\"ok\":true}");
 }
 
+static void slave_bracket(void) {
+  char meta[1024];
+  if (capture_bracket_run(g_armed_id, &g_bracket_profile, &g_bracket_plan, meta, sizeof(meta)))
+    capture_catalog_add(g_armed_id, "brk");
+  g_bracket_armed = false;
+}
+
 static void slave_capture_task(void *arg) {
   (void)arg;
   while (1) {
     xSemaphoreTake(g_arm_sem, portMAX_DELAY);
+    if (reg_script_run_armed()) continue;   // trigger edge started a synchronized script
+    portENTER_CRITICAL(&g_bracket_mux);
+    bool bracket = g_bracket_armed;
+    g_bracket_running = bracket;
+    portEXIT_CRITICAL(&g_bracket_mux);
+    if (bracket) {
+      event_bus_publish(EV_TRIGGER, g_armed_id, 0, 0, NULL);
+      slave_bracket();
+      g_bracket_running = false;
+      continue;
+    }
     if (!g_is_armed) continue;
+    event_bus_publish(EV_TRIGGER, g_armed_id, 0, 0, NULL);
 
-    char bin_path[256], json_path[256], meta[128];
+    char bin_path[256], json_path[256], meta[384];
     make_capture_paths(g_armed_id, bin_path, sizeof(bin_path), json_path, sizeof(json_path), g_armed_ext);
 
-    bool ok = cam_manager_capture_to_file(bin_path, meta, sizeof(meta));
-    if (ok) {
-      FILE *jf = fopen(json_path, "wb");
-      if (jf) { fwrite(meta, 1, strlen(meta), jf); fclose(jf); }
-    }
+    bool ok = capture_frame(g_armed_id, &g_armed_profile, bin_path, json_path, meta, sizeof(meta));
+    if (ok) capture_catalog_add(g_armed_id, g_armed_ext);
+    if (ok && !strcmp(g_armed_ext, "jpg")) capture_gallery_enqueue(g_armed_id);
     g_is_armed = false;
   }
 }
@@ -310,6 +545,36 @@ static esp_err_t api_reg_single_get(httpd_req_t *req) {
   return httpd_resp_sendstr(req, out);
 }
 
+// Appends ,"frame":..,"aligned":..,"parts":[[frame,written],..]: one pair per
+// frame boundary the request was split over
+static int sched_result_json(char *out, int out_max, const sccb_sched_result_t *sr) {
+  int n = snprintf(out, out_max, ",\"frame\":%u,\"first_frame\":%u,\"aligned\":%s,\"parts\":[",
+                   (unsigned)sr->frame, (unsigned)sr->first_frame, sr->aligned ? "true" : "false");
+  for (int i = 0; i < sr->parts && n < out_max; i++)
+    n += snprintf(out + n, out_max - n, "%s[%u,%d]", i ? "," : "", (unsigned)sr->part[i].frame, sr->part[i].written);
+  if (n < out_max) n += snprintf(out + n, out_max - n, "]");
+  return n < out_max ? n : out_max - 1;
+}
+
+// Reports when a scheduled register batch took effect
+static esp_err_t send_sched_result(httpd_req_t *req, const sccb_sched_result_t *sr) {
+  char out[448];
+  int n = snprintf(out, sizeof(out), "{\"ok\":true");
+  n += sched_result_json(out + n, sizeof(out) - n, sr);
+  snprintf(out + n, sizeof(out) - n, ",\"wait_us\":%lld}", (long long)sr->wait_us);
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, out);
+}
+
+static bool range_ops_from_json(cJSON *values, int bank, uint8_t start, int count, ov2640_reg_op_t *ops) {
+  for (int i=0;i<count;i++) {
+    cJSON *it = cJSON_GetArrayItem(values, i);
+    if (!cJSON_IsNumber(it)) return false;
+    ops[i] = (ov2640_reg_op_t){ (uint8_t)bank, (uint8_t)(start+i), 0xFF, (uint8_t)it->valueint };
+  }
+  return true;
+}
+
 static esp_err_t api_reg_single_post(httpd_req_t *req) {
   char body[256];
   int n = httpd_req_recv(req, body, sizeof(body)-1);
@@ -324,17 +589,70 @@ static esp_err_t api_reg_single_post(httpd_req_t *req) {
   int value = (int)strtol(cJSON_GetObjectItem(root, "value")->valuestring, NULL, 0);
 
   cJSON *maskI = cJSON_GetObjectItem(root, "mask");
-  bool ok;
-  if (maskI) {
-    int mask = (int)strtol(maskI->valuestring, NULL, 0);
-    ok = ov2640_modify_reg((ov2640_bank_t)bank, (uint8_t)addr, (uint8_t)mask, (uint8_t)value);
-  } else {
-    ok = ov2640_write_reg((ov2640_bank_t)bank, (uint8_t)addr, (uint8_t)value);
+  int mask = maskI ? (int)strtol(maskI->valuestring, NULL, 0) : 0xFF;
+  ov2640_reg_op_t op = { (uint8_t)bank, (uint8_t)addr, (uint8_t)mask, (uint8_t)value };
+  sccb_sched_result_t sr;
+  bool ok = sccb_sched_apply(&op, 1, pdMS_TO_TICKS(500), &sr);
+  if (ok) {
+    reg_overlay_record(overlay_slot_from_json(root), (ov2640_bank_t)bank, (uint8_t)addr, (uint8_t)mask, (uint8_t)value);
+    reg_overlay_save_later();
   }
 
   cJSON_Delete(root);
   if (!ok) return httpd_resp_send_err(req, 500, "write failed");
-  return httpd_resp_sendstr(req, "{\"ok\":true}");
+  return send_sched_result(req, &sr);
+}
+
+// Register reads are staged in a stack array, then streamed; no cJSON tree/heap string.
+typedef struct {
+  int64_t t0;
+  int64_t read_us;
+  size_t heap0;
+} reg_read_stats_t;
+
+static void reg_stats_begin(reg_read_stats_t *st) {
+  st->t0 = esp_timer_get_time();
+  st->read_us = 0;
+  st->heap0 = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+}
+
+static int reg_stats_heap_delta(const reg_read_stats_t *st) {
+  return (int)st->heap0 - (int)heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+}
+
+static bool query_wants_bin(const char *q) {
+  char fmt[8];
+  return q && httpd_query_key_value(q, "format", fmt, sizeof(fmt)) == ESP_OK && !strcmp(fmt, "bin");
+}
+
+// application/octet-stream: raw register bytes, stats in headers
+static esp_err_t send_reg_bin(httpd_req_t *req, const uint8_t *vals, int count, reg_read_stats_t *st) {
+  char read_us[16], heap[16];
+  snprintf(read_us, sizeof(read_us), "%lld", (long long)st->read_us);
+  snprintf(heap, sizeof(heap), "%d", reg_stats_heap_delta(st));
+  httpd_resp_set_type(req, "application/octet-stream");
+  httpd_resp_set_hdr(req, "X-Read-Us", read_us);
+  httpd_resp_set_hdr(req, "X-Heap-Delta", heap);
+  esp_err_t r = httpd_resp_send(req, (const char*)vals, count);
+  ESP_LOGD(TAG, "reg bin %d B: read %lld us, total %lld us", count,
+           (long long)st->read_us, (long long)(esp_timer_get_time() - st->t0));
+  return r;
+}
+
+static void cw_u8_array(chunk_writer_t *w, const uint8_t *vals, int count) {
+  cw_puts(w, "[");
+  for (int i = 0; i < count; i++) {
+    if (i) cw_write(w, ",", 1);
+    cw_uint(w, vals[i]);
+  }
+  cw_puts(w, "]");
+}
+
+// Closes the top-level object with a "handler" stats member
+static esp_err_t cw_finish_with_stats(chunk_writer_t *w, reg_read_stats_t *st) {
+  cw_printf(w, ",\"handler\":{\"read_us\":%lld,\"us\":%lld,\"heap_delta\":%d}}",
+            (long long)st->read_us, (long long)(esp_timer_get_time() - st->t0), reg_stats_heap_delta(st));
+  return cw_finish(w);
 }
 
 static esp_err_t api_reg_range_get(httpd_req_t *req) {
@@ -349,27 +667,25 @@ static esp_err_t api_reg_range_get(httpd_req_t *req) {
   if (!parse_hex_u8(start_s, &start) || !parse_hex_u8(end_s, &end) || end < start)
     return httpd_resp_send_err(req, 400, "bad range");
 
-  cJSON *root = cJSON_CreateObject();
-  cJSON_AddNumberToObject(root, "bank", bank);
-  cJSON_AddStringToObject(root, "start", start_s);
-  cJSON_AddStringToObject(root, "end", end_s);
-  cJSON *vals = cJSON_AddArrayToObject(root, "values");
-
-  for (int a = start; a <= end; a++) {
-    uint8_t v=0;
-    if (!ov2640_read_reg((ov2640_bank_t)bank, (uint8_t)a, &v)) {
-      cJSON_Delete(root);
+  reg_read_stats_t st;
+  reg_stats_begin(&st);
+
+  uint8_t vals[256];
+  int count = (int)end - (int)start + 1;
+  for (int i = 0; i < count; i++) {
+    if (!ov2640_read_reg((ov2640_bank_t)bank, (uint8_t)(start + i), &vals[i]))
       return httpd_resp_send_err(req, 500, "read failed");
-    }
-    cJSON_AddItemToArray(vals, cJSON_CreateNumber(v));
   }
+  st.read_us = esp_timer_get_time() - st.t0;
 
-  char *out = cJSON_PrintUnformatted(root);
+  if (query_wants_bin(q)) return send_reg_bin(req, vals, count, &st);
+
+  chunk_writer_t w;
+  cw_init(&w, req);
   httpd_resp_set_type(req, "application/json");
-  esp_err_t r = httpd_resp_sendstr(req, out);
-  free(out);
-  cJSON_Delete(root);
-  return r;
+  cw_printf(&w, "{\"bank\":%d,\"start\":\"%s\",\"end\":\"%s\",\"values\":", bank, start_s, end_s);
+  cw_u8_array(&w, vals, count);
+  return cw_finish_with_stats(&w, &st);
 }
 
 static esp_err_t api_reg_range_post(httpd_req_t *req) {
@@ -393,41 +709,47 @@ static esp_err_t api_reg_range_post(httpd_req_t *req) {
   if (count < 1 || count > 256) { cJSON_Delete(root); return httpd_resp_send_err(req, 400, "bad count"); }
   if ((int)start + count > 256) { cJSON_Delete(root); return httpd_resp_send_err(req, 400, "range overflow"); }
 
-  for (int i=0;i<count;i++) {
-    cJSON *it = cJSON_GetArrayItem(values, i);
-    if (!cJSON_IsNumber(it)) { cJSON_Delete(root); return httpd_resp_send_err(req, 400, "values must be numbers"); }
-    if (!ov2640_write_reg((ov2640_bank_t)bank, (uint8_t)(start+i), (uint8_t)it->valueint)) {
-      cJSON_Delete(root);
-      return httpd_resp_send_err(req, 500, "write failed");
-    }
-  }
+  ov2640_reg_op_t ops[256];
+  if (!range_ops_from_json(values, bank, start, count, ops)) { cJSON_Delete(root); return httpd_resp_send_err(req, 400, "values must be numbers"); }
+
+  sccb_sched_result_t sr;
+  bool ok = sccb_sched_apply(ops, count, pdMS_TO_TICKS(1000), &sr);
+  int ovl = overlay_slot_from_json(root);
+  for (int i=0;i<sr.written;i++) reg_overlay_record(ovl, (ov2640_bank_t)bank, ops[i].addr, 0xFF, ops[i].val);
+  reg_overlay_save_later();
 
   cJSON_Delete(root);
-  return httpd_resp_sendstr(req, "{\"ok\":true}");
+  if (!ok) return httpd_resp_send_err(req, 500, "write failed");
+  return send_sched_result(req, &sr);
 }
 
 static esp_err_t api_reg_dump_get(httpd_req_t *req) {
-  cJSON *root = cJSON_CreateObject();
-  cJSON *dsp = cJSON_AddArrayToObject(root, "dsp");
-  cJSON *sen = cJSON_AddArrayToObject(root, "sensor");
+  char q[64];
+  bool bin = httpd_req_get_url_query_str(req, q, sizeof(q)) == ESP_OK && query_wants_bin(q);
+
+  reg_read_stats_t st;
+  reg_stats_begin(&st);
 
+  // [0..255] = DSP bank, [256..511] = SENSOR bank
+  uint8_t vals[512];
   for (int a=0;a<256;a++) {
-    uint8_t v=0;
-    if (!ov2640_read_reg(REG_BANK_DSP, (uint8_t)a, &v)) { cJSON_Delete(root); return httpd_resp_send_err(req, 500, "dsp read fail"); }
-    cJSON_AddItemToArray(dsp, cJSON_CreateNumber(v));
+    if (!ov2640_read_reg(REG_BANK_DSP, (uint8_t)a, &vals[a])) return httpd_resp_send_err(req, 500, "dsp read fail");
   }
   for (int a=0;a<256;a++) {
-    uint8_t v=0;
-    if (!ov2640_read_reg(REG_BANK_SENSOR, (uint8_t)a, &v)) { cJSON_Delete(root); return httpd_resp_send_err(req, 500, "sensor read fail"); }
-    cJSON_AddItemToArray(sen, cJSON_CreateNumber(v));
+    if (!ov2640_read_reg(REG_BANK_SENSOR, (uint8_t)a, &vals[256 + a])) return httpd_resp_send_err(req, 500, "sensor read fail");
   }
+  st.read_us = esp_timer_get_time() - st.t0;
 
-  char *out = cJSON_PrintUnformatted(root);
+  if (bin) return send_reg_bin(req, vals, sizeof(vals), &st);
+
+  chunk_writer_t w;
+  cw_init(&w, req);
   httpd_resp_set_type(req, "application/json");
-  esp_err_t r = httpd_resp_sendstr(req, out);
-  free(out);
-  cJSON_Delete(root);
-  return r;
+  cw_puts(&w, "{\"dsp\":");
+  cw_u8_array(&w, vals, 256);
+  cw_puts(&w, ",\"sensor\":");
+  cw_u8_array(&w, vals + 256, 256);
+  return cw_finish_with_stats(&w, &st);
 }
 
 // Preset endpoints
@@ -463,27 +785,91 @@ static esp_err_t api_preset_load(httpd_req_t *req) {
   cJSON *root = cJSON_Parse(body);
   if (!root) return httpd_resp_send_err(req, 400, "bad json");
   const char *name = cJSON_GetObjectItem(root, "name")->valuestring;
-  bool ok = presets_load_and_apply(name);
+  bool ok = presets_load_and_apply(name, NULL);
   cJSON_Delete(root);
 
   if (!ok) return httpd_resp_send_err(req, 500, "load failed");
   return httpd_resp_sendstr(req, "{\"ok\":true}");
 }
 
+// Replicated register log
+static esp_err_t api_reglog_status(httpd_req_t *req) {
+  char out[512];
+  reg_log_status_json(out, sizeof(out));
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, out);
+}
+
+// Frame-aligned write scheduler
+static esp_err_t api_sched_get(httpd_req_t *req) {
+  char out[256];
+  sccb_sched_stats_json(out, sizeof(out));
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, out);
+}
+
+// Overlay endpoints
+static esp_err_t api_overlay_get(httpd_req_t *req) {
+  static const char *names[REG_OVL_SLOTS] = { "stream", "capture" };
+  cJSON *root = cJSON_CreateObject();
+  for (int i = 0; i < REG_OVL_SLOTS; i++) {
+    reg_ovl_stats_t st;
+    reg_overlay_get_stats((reg_ovl_slot_t)i, &st);
+    cJSON *o = cJSON_AddObjectToObject(root, names[i]);
+    cJSON_AddNumberToObject(o, "entries", st.entries);
+    cJSON_AddNumberToObject(o, "last_written", st.last_written);
+    cJSON_AddNumberToObject(o, "last_read", st.last_read);
+    cJSON_AddNumberToObject(o, "last_us", (double)st.last_us);
+  }
+  char *out = cJSON_PrintUnformatted(root);
+  httpd_resp_set_type(req, "application/json");
+  esp_err_t r = httpd_resp_sendstr(req, out);
+  free(out);
+  cJSON_Delete(root);
+  return r;
+}
+
+static esp_err_t api_overlay_clear(httpd_req_t *req) {
+  char body[128];
+  int slot = REG_OVL_ALL;
+  int n = httpd_req_recv(req, body, sizeof(body)-1);
+  if (n > 0) {
+    body[n]=0;
+    cJSON *root = cJSON_Parse(body);
+    if (root) {
+      cJSON *sl = cJSON_GetObjectItem(root, "slot");
+      slot = reg_overlay_slot_from_str(cJSON_IsString(sl) ? sl->valuestring : NULL);
+      cJSON_Delete(root);
+    }
+  }
+  if (slot == REG_OVL_NONE) return httpd_resp_send_err(req, 400, "bad slot");
+  reg_overlay_clear(slot);
+  if (!reg_overlay_save()) return httpd_resp_send_err(req, 500, "save failed");
+  return httpd_resp_sendstr(req, "{\"ok\":true}");
+}
+
 #if CONFIG_ROLE_MASTER
+// Applies locally and appends each write to the replicated register log; the
+// replicator streams it to the slave. Waits (bounded) for the slave's ack.
+static esp_err_t send_mirror_result(httpd_req_t *req, uint32_t seq, const sccb_sched_result_t *sr, TickType_t wait) {
+  int64_t lat = 0;
+  reg_log_kick();
+  bool mirrored = seq == 0 || reg_log_wait_acked(seq, wait, &lat);
+  char out[512];
+  int n = snprintf(out, sizeof(out), "{\"ok\":true,\"seq\":%u,\"mirrored\":%s,\"mirror_us\":%lld",
+                   (unsigned)seq, mirrored ? "true" : "false", (long long)lat);
+  if (sr) n += sched_result_json(out + n, sizeof(out) - n, sr);
+  snprintf(out + n, sizeof(out) - n, "}");
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, out);
+}
+
 static esp_err_t api_apply_range(httpd_req_t *req) {
   char body[1024];
   int n = httpd_req_recv(req, body, sizeof(body)-1);
   if (n<=0) return httpd_resp_send_err(req, 400, "no body");
   body[n]=0;
 
-  if (!slave_http_post_json("/api/registers/range", body)) {
-    return httpd_resp_send_err(req, 500, "slave range failed");
-  }
-
-  // Apply local too
-  httpd_req_t *fake = req; (void)fake;
-  // Re-parse and write locally
   cJSON *root = cJSON_Parse(body);
   if (!root) return httpd_resp_send_err(req, 400, "bad json");
   int bank = cJSON_GetObjectItem(root, "bank")->valueint;
@@ -493,17 +879,27 @@ static esp_err_t api_apply_range(httpd_req_t *req) {
   uint8_t start;
   if (!parse_hex_u8(start_s, &start) || !cJSON_IsArray(values)) { cJSON_Delete(root); return httpd_resp_send_err(req, 400, "bad"); }
   int count = cJSON_GetArraySize(values);
-
-  for (int i=0;i<count;i++) {
-    cJSON *it = cJSON_GetArrayItem(values, i);
-    if (!cJSON_IsNumber(it)) { cJSON_Delete(root); return httpd_resp_send_err(req, 400, "values bad"); }
-    if (!ov2640_write_reg((ov2640_bank_t)bank, (uint8_t)(start+i), (uint8_t)it->valueint)) {
-      cJSON_Delete(root);
-      return httpd_resp_send_err(req, 500, "local write failed");
-    }
+  if (count < 1 || (int)start + count > 256) { cJSON_Delete(root); return httpd_resp_send_err(req, 400, "bad count"); }
+
+  ov2640_reg_op_t ops[256];
+  if (!range_ops_from_json(values, bank, start, count, ops)) { cJSON_Delete(root); return httpd_resp_send_err(req, 400, "values bad"); }
+
+  sccb_sched_result_t sr;
+  bool ok = sccb_sched_apply(ops, count, pdMS_TO_TICKS(1000), &sr);
+  // writes already applied stay logged, so the slave converges to the same state
+  int ovl = overlay_slot_from_json(root);
+  uint32_t seq = 0;
+  for (int i=0;i<sr.written;i++) {
+    reg_overlay_record(ovl, (ov2640_bank_t)bank, ops[i].addr, 0xFF, ops[i].val);
+    seq = reg_log_append((ov2640_bank_t)bank, ops[i].addr, 0xFF, ops[i].val);
   }
+  reg_overlay_save_later();
   cJSON_Delete(root);
-  return httpd_resp_sendstr(req, "{\"ok\":true}");
+  if (!ok) {
+    reg_log_kick();
+    return httpd_resp_send_err(req, 500, "local write failed");
+  }
+  return send_mirror_result(req, seq, &sr, pdMS_TO_TICKS(2000));
 }
 
 static esp_err_t api_apply_preset(httpd_req_t *req) {
@@ -514,16 +910,17 @@ static esp_err_t api_apply_preset(httpd_req_t *req) {
 
   cJSON *root = cJSON_Parse(body);
   if (!root) return httpd_resp_send_err(req, 400, "bad json");
-  const char *name = cJSON_GetObjectItem(root, "name")->valuestring;
+  char name[64];
+  snprintf(name, sizeof(name), "%s", cJSON_GetObjectItem(root, "name")->valuestring);
   cJSON_Delete(root);
 
-  if (!slave_http_post_json("/api/registers/preset/load", body)) {
-    return httpd_resp_send_err(req, 500, "slave preset load failed");
-  }
-  if (!presets_load_and_apply(name)) {
+  // The slave receives the master's preset values through the log, not its own SD copy
+  uint32_t seq = 0;
+  if (!presets_load_and_apply(name, &seq)) {
+    reg_log_kick();
     return httpd_resp_send_err(req, 500, "local preset load failed");
   }
-  return httpd_resp_sendstr(req, "{\"ok\":true}");
+  return send_mirror_result(req, seq, NULL, pdMS_TO_TICKS(5000));
 }
 #endif
 
@@ -531,6 +928,11 @@ bool web_server_start(void) {
   httpd_config_t cfg = HTTPD_DEFAULT_CONFIG();
   cfg.stack_size = 8192;
   cfg.max_uri_handlers = 48;
+  // Room for the long-lived clients (stream, ws, events, watch, downloads,
+  // export, script polls) plus ordinary requests; idle keep-alive sockets are
+  // recycled when it runs out
+  cfg.max_open_sockets = HTTPD_MAX_SOCKETS;
+  cfg.lru_purge_enable = true;
   cfg.uri_match_fn = httpd_uri_match_wildcard;
 
   if (httpd_start(&g_http, &cfg) != ESP_OK) return false;
@@ -539,13 +941,37 @@ bool web_server_start(void) {
   httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/registers", .method=HTTP_GET, .handler=h_registers_page });
   httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/www/*", .method=HTTP_GET, .handler=h_www_any });
   httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/stream", .method=HTTP_GET, .handler=h_stream });
-
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/ws/stream", .method=HTTP_GET, .handler=ws_stream_handler, .is_websocket=true });
+
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/metrics", .method=HTTP_GET, .handler=metrics_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/events", .method=HTTP_GET, .handler=event_bus_sse_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/www/reload", .method=HTTP_POST, .handler=api_www_reload });
+  // Before /captures/*: handlers match in registration order
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/captures/export", .method=HTTP_GET, .handler=capture_export_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/captures/*", .method=HTTP_GET, .handler=capture_http_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/captures/*", .method=HTTP_HEAD, .handler=capture_http_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/captures", .method=HTTP_GET, .handler=capture_gallery_list_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/captures/thumb", .method=HTTP_GET, .handler=capture_gallery_thumb_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/captures/info", .method=HTTP_GET, .handler=capture_catalog_info_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/captures/reindex", .method=HTTP_POST, .handler=capture_catalog_reindex_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/sd/bench", .method=HTTP_GET, .handler=sd_bench_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/sd/reprobe", .method=HTTP_POST, .handler=sd_reprobe_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/retention", .method=HTTP_GET, .handler=retention_get_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/retention", .method=HTTP_POST, .handler=retention_set_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/mem", .method=HTTP_GET, .handler=capture_mem_get_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/mem", .method=HTTP_POST, .handler=capture_mem_set_handler });
+#if CONFIG_CAPTURE_STORE_SEGMENTS
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/store", .method=HTTP_GET, .handler=capture_store_info_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/store/export", .method=HTTP_POST, .handler=capture_store_export_handler });
+#endif
   httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/capture_local", .method=HTTP_POST, .handler=api_capture_local });
 #if CONFIG_ROLE_MASTER
   httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/capture_sync", .method=HTTP_POST, .handler=api_capture_sync });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/capture_bracket", .method=HTTP_POST, .handler=api_capture_bracket });
 #endif
 #if CONFIG_ROLE_SLAVE
   httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/arm", .method=HTTP_POST, .handler=api_arm });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/arm_bracket", .method=HTTP_POST, .handler=api_arm_bracket });
 #endif
 
   httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/registers/single", .method=HTTP_GET, .handler=api_reg_single_get });
@@ -553,6 +979,12 @@ bool web_server_start(void) {
   httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/registers/range", .method=HTTP_GET, .handler=api_reg_range_get });
   httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/registers/range", .method=HTTP_POST, .handler=api_reg_range_post });
   httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/registers/dump", .method=HTTP_GET, .handler=api_reg_dump_get });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/registers/watch", .method=HTTP_GET, .handler=reg_watch_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/registers/sched", .method=HTTP_GET, .handler=api_sched_get });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/registers/script", .method=HTTP_POST, .handler=reg_script_handler });
+
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/registers/overlay", .method=HTTP_GET, .handler=api_overlay_get });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/registers/overlay/clear", .method=HTTP_POST, .handler=api_overlay_clear });
 
   httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/registers/preset", .method=HTTP_GET, .handler=api_preset_list });
   httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/registers/preset/save", .method=HTTP_POST, .handler=api_preset_save });
@@ -562,6 +994,11 @@ bool web_server_start(void) {
   httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/registers/apply_range", .method=HTTP_POST, .handler=api_apply_range });
   httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/registers/apply_preset", .method=HTTP_POST, .handler=api_apply_preset });
 #endif
+#if CONFIG_ROLE_SLAVE
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/reglog/apply", .method=HTTP_POST, .handler=reg_log_apply_handler });
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/registers/script/result", .method=HTTP_POST, .handler=reg_script_result_handler });
+#endif
+  httpd_register_uri_handler(g_http, &(httpd_uri_t){ .uri="/api/reglog/status", .method=HTTP_GET, .handler=api_reglog_status });
 
 #if CONFIG_ROLE_SLAVE
   g_arm_sem = xSemaphoreCreateBinary();
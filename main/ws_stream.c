@@ -0,0 +1,363 @@
+#include "ws_stream.h"
+#include "app_state.h"
+#include "cam_manager.h"
+#include "frame_sync.h"
+#include "wait_queue.h"
+#include "esp_camera.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "cJSON.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "WS";
+
+typedef struct {
+  bool active;
+  bool busy;            // a send is queued or in flight
+  bool paused;
+  httpd_handle_t hd;
+  int fd;
+  int64_t interval_us;
+  int64_t next_due;
+} ws_client_t;
+
+// One copy of a frame shared by all clients it was queued to
+typedef struct {
+  int refs;
+  size_t len;
+  uint8_t data[];
+} ws_buf_t;
+
+static ws_client_t s_cl[WS_STREAM_MAX_CLIENTS];
+static ws_stream_stats_t s_st;
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t s_task = NULL;
+static uint32_t s_seq = 0;
+static wait_queue_t s_wq;               // multipart clients waiting for s_latest
+static int s_mjpeg = 0;               // multipart /stream clients, under s_mux
+static ws_buf_t *s_latest = NULL;     // newest frame for them (holds one ref), under s_mux
+static uint32_t s_latest_seq = 0;
+static int s_quality_req = -1;        // queued by a client, applied by the producer; under s_mux
+
+static void drop_locked(ws_client_t *c) {
+  if (c->active) s_st.clients--;
+  c->active = false;
+  c->busy = false;    // a late send_done only releases its buffer
+}
+
+static void buf_release(ws_buf_t *b) {
+  portENTER_CRITICAL(&s_mux);
+  bool last = --b->refs == 0;
+  portEXIT_CRITICAL(&s_mux);
+  if (last) heap_caps_free(b);
+}
+
+// Runs in the httpd task once the message is on the socket (or failed)
+static void send_done(esp_err_t err, int fd, void *arg) {
+  ws_buf_t *b = (ws_buf_t*)arg;
+  portENTER_CRITICAL(&s_mux);
+  for (int i = 0; i < WS_STREAM_MAX_CLIENTS; i++) {
+    ws_client_t *c = &s_cl[i];
+    if (!c->active || c->fd != fd) continue;
+    c->busy = false;
+    if (err != ESP_OK) {
+      s_st.send_errors++;
+      drop_locked(c);
+    } else {
+      s_st.sent++;
+      s_st.bytes += b->len;
+    }
+  }
+  portEXIT_CRITICAL(&s_mux);
+  buf_release(b);
+}
+
+// Clients due for a frame at `now`; 0 if nobody is connected and unpaused
+static int due_mask(int64_t now, int64_t *next_due) {
+  int mask = 0;
+  *next_due = INT64_MAX;
+  portENTER_CRITICAL(&s_mux);
+  for (int i = 0; i < WS_STREAM_MAX_CLIENTS; i++) {
+    ws_client_t *c = &s_cl[i];
+    if (!c->active || c->paused) continue;
+    if (now >= c->next_due) mask |= 1 << i;
+    else if (c->next_due < *next_due) *next_due = c->next_due;
+  }
+  portEXIT_CRITICAL(&s_mux);
+  return mask;
+}
+
+// Marks the due clients busy and copies them to `targets`. Still draining the
+// previous frame: that client skips this one.
+static int pick_targets(int mask, int64_t now, ws_client_t *targets) {
+  int n = 0;
+  portENTER_CRITICAL(&s_mux);
+  for (int i = 0; i < WS_STREAM_MAX_CLIENTS; i++) {
+    ws_client_t *c = &s_cl[i];
+    if (!(mask & (1 << i)) || !c->active) continue;
+    if (c->busy) {
+      s_st.skipped++;
+      continue;
+    }
+    c->busy = true;
+    c->next_due = now + c->interval_us;
+    targets[n++] = *c;
+  }
+  portEXIT_CRITICAL(&s_mux);
+  return n;
+}
+
+static void unbusy(const ws_client_t *targets, int n) {
+  portENTER_CRITICAL(&s_mux);
+  for (int i = 0; i < WS_STREAM_MAX_CLIENTS; i++)
+    for (int k = 0; k < n; k++)
+      if (s_cl[i].active && s_cl[i].fd == targets[k].fd) s_cl[i].busy = false;
+  portEXIT_CRITICAL(&s_mux);
+}
+
+// One PSRAM copy of the frame (header + JPEG) with `refs` references
+static ws_buf_t *make_buf(camera_fb_t *fb, int refs) {
+  ws_buf_t *b = (ws_buf_t*)heap_caps_malloc(sizeof(ws_buf_t) + sizeof(ws_frame_hdr_t) + fb->len, MALLOC_CAP_SPIRAM);
+  if (!b) {
+    ESP_LOGW(TAG, "no PSRAM for a %u byte frame", (unsigned)fb->len);
+    return NULL;
+  }
+  ws_frame_hdr_t h = {
+    .magic = { 'W', 'F' },
+    .version = 1,
+    .quality = (uint8_t)cam_manager_get_stream_quality(),
+    .seq = s_seq,
+    .t_us = (uint64_t)fb->timestamp.tv_sec * 1000000ULL + (uint64_t)fb->timestamp.tv_usec,
+    .width = (uint16_t)fb->width,
+    .height = (uint16_t)fb->height,
+    .len = (uint32_t)fb->len,
+  };
+  b->refs = refs;
+  b->len = sizeof(h) + fb->len;
+  memcpy(b->data, &h, sizeof(h));
+  memcpy(b->data + sizeof(h), fb->buf, fb->len);
+  return b;
+}
+
+static void fan_out(ws_buf_t *b, const ws_client_t *targets, int n) {
+  for (int k = 0; k < n; k++) {
+    httpd_ws_frame_t f = { .final = true, .type = HTTPD_WS_TYPE_BINARY, .payload = b->data, .len = b->len };
+    bool open = httpd_ws_get_fd_info(targets[k].hd, targets[k].fd) == HTTPD_WS_CLIENT_WEBSOCKET;
+    if (open && httpd_ws_send_data_async(targets[k].hd, targets[k].fd, &f, send_done, b) == ESP_OK) continue;
+    // Not queued: send_done will not run for this client
+    portENTER_CRITICAL(&s_mux);
+    for (int i = 0; i < WS_STREAM_MAX_CLIENTS; i++) {
+      if (!s_cl[i].active || s_cl[i].fd != targets[k].fd) continue;
+      if (open) s_st.send_errors++;
+      drop_locked(&s_cl[i]);
+    }
+    portEXIT_CRITICAL(&s_mux);
+    buf_release(b);
+  }
+}
+
+// Hands the frame to the multipart clients and wakes them
+static void publish(ws_buf_t *b) {
+  portENTER_CRITICAL(&s_mux);
+  ws_buf_t *old = s_latest, *drop = NULL;
+  if (s_mjpeg > 0) {
+    s_latest = b;
+    s_latest_seq = s_seq;
+  } else {
+    drop = b;    // the last client left meanwhile
+    s_latest = NULL;
+  }
+  portEXIT_CRITICAL(&s_mux);
+  if (old) buf_release(old);
+  if (drop) buf_release(drop);
+  wait_queue_wake_all(&s_wq);
+}
+
+static void ws_task(void *arg) {
+  ws_client_t targets[WS_STREAM_MAX_CLIENTS];
+  for (;;) {
+    portENTER_CRITICAL(&s_mux);
+    int quality = s_quality_req;
+    s_quality_req = -1;
+    bool mjpeg = s_mjpeg > 0;
+    portEXIT_CRITICAL(&s_mux);
+    // Waits for cam_mutex, so it is applied here rather than in the httpd task
+    if (quality >= 0 && !cam_manager_set_stream_quality(quality))
+      ESP_LOGW(TAG, "quality %d rejected", quality);
+
+    int64_t now = esp_timer_get_time(), next_due;
+    int mask = due_mask(now, &next_due);
+    if (!mask && !mjpeg) {
+      // Idle until a client connects/resumes, or its next frame is due
+      TickType_t wait = next_due == INT64_MAX ? portMAX_DELAY
+                      : pdMS_TO_TICKS((next_due - now) / 1000) + 1;
+      ulTaskNotifyTake(pdTRUE, wait);
+      continue;
+    }
+    if (!g_app.stream_enabled) {
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+
+    xSemaphoreTake(g_app.cam_mutex, portMAX_DELAY);
+    camera_fb_t *fb = cam_manager_fb_get();
+    xSemaphoreGive(g_app.cam_mutex);
+    if (!fb) {
+      vTaskDelay(pdMS_TO_TICKS(10));
+      continue;
+    }
+    frame_sync_frame_done();
+    s_seq++;
+    if (fb->format == PIXFORMAT_JPEG) {
+      int n = pick_targets(mask, now, targets);
+      ws_buf_t *b = n || mjpeg ? make_buf(fb, n + (mjpeg ? 1 : 0)) : NULL;
+      if (b) {
+        if (mjpeg) publish(b);
+        fan_out(b, targets, n);
+      } else {
+        unbusy(targets, n);
+      }
+    }
+    esp_camera_fb_return(fb);
+  }
+}
+
+void ws_stream_mjpeg_open(void) {
+  portENTER_CRITICAL(&s_mux);
+  s_mjpeg++;
+  portEXIT_CRITICAL(&s_mux);
+  xTaskNotifyGive(s_task);
+}
+
+void ws_stream_mjpeg_close(void) {
+  portENTER_CRITICAL(&s_mux);
+  ws_buf_t *old = --s_mjpeg == 0 ? s_latest : NULL;
+  if (old) s_latest = NULL;
+  portEXIT_CRITICAL(&s_mux);
+  if (old) buf_release(old);
+}
+
+bool ws_stream_mjpeg_next(uint32_t *seq, TickType_t timeout, ws_frame_ref_t *out) {
+  TickType_t start = xTaskGetTickCount();
+  // Registered before the first look, so a publish in between is not missed
+  int slot = wait_queue_enter(&s_wq);
+  for (;;) {
+    portENTER_CRITICAL(&s_mux);
+    ws_buf_t *b = s_latest && s_latest_seq != *seq ? s_latest : NULL;
+    if (b) {
+      b->refs++;
+      *seq = s_latest_seq;
+    }
+    portEXIT_CRITICAL(&s_mux);
+    if (b) {
+      out->jpeg = b->data + sizeof(ws_frame_hdr_t);
+      out->len = b->len - sizeof(ws_frame_hdr_t);
+      out->buf = b;
+      wait_queue_leave(&s_wq, slot);
+      return true;
+    }
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= timeout) break;
+    wait_queue_wait(&s_wq, slot, timeout - waited);
+  }
+  wait_queue_leave(&s_wq, slot);
+  return false;
+}
+
+void ws_stream_mjpeg_release(ws_frame_ref_t *f) {
+  if (f->buf) buf_release((ws_buf_t*)f->buf);
+  f->buf = NULL;
+}
+
+void ws_stream_init(void) {
+  if (s_task) return;
+  wait_queue_init(&s_wq);
+  xTaskCreatePinnedToCore(ws_task, "ws_stream", 4096, NULL, 5, &s_task, 0);
+}
+
+static void handle_control(int fd, const char *msg) {
+  cJSON *root = cJSON_Parse(msg);
+  if (!root) return;
+  cJSON *pause = cJSON_GetObjectItem(root, "pause");
+  cJSON *fps = cJSON_GetObjectItem(root, "fps");
+  cJSON *quality = cJSON_GetObjectItem(root, "quality");
+
+  portENTER_CRITICAL(&s_mux);
+  for (int i = 0; i < WS_STREAM_MAX_CLIENTS; i++) {
+    ws_client_t *c = &s_cl[i];
+    if (!c->active || c->fd != fd) continue;
+    if (cJSON_IsBool(pause)) c->paused = cJSON_IsTrue(pause);
+    if (cJSON_IsNumber(fps) && fps->valueint >= 1 && fps->valueint <= WS_STREAM_MAX_FPS) {
+      c->interval_us = 1000000 / fps->valueint;
+      c->next_due = 0;
+    }
+  }
+  bool bad_quality = cJSON_IsNumber(quality) && (quality->valueint < 0 || quality->valueint > 63);
+  if (cJSON_IsNumber(quality) && !bad_quality) s_quality_req = quality->valueint;
+  portEXIT_CRITICAL(&s_mux);
+
+  if (bad_quality) ESP_LOGW(TAG, "quality %d rejected", quality->valueint);
+  cJSON_Delete(root);
+  xTaskNotifyGive(s_task);
+}
+
+esp_err_t ws_stream_handler(httpd_req_t *req) {
+  int fd = httpd_req_to_sockfd(req);
+  if (req->method == HTTP_GET) {
+    // Free slots of clients that went away without the producer noticing (e.g. paused)
+    for (int i = 0; i < WS_STREAM_MAX_CLIENTS; i++) {
+      ws_client_t c = s_cl[i];
+      if (!c.active || c.fd == fd || httpd_ws_get_fd_info(c.hd, c.fd) == HTTPD_WS_CLIENT_WEBSOCKET) continue;
+      portENTER_CRITICAL(&s_mux);
+      if (s_cl[i].active && s_cl[i].fd == c.fd) drop_locked(&s_cl[i]);
+      portEXIT_CRITICAL(&s_mux);
+    }
+
+    // Handshake done: take a slot
+    int slot = -1;
+    portENTER_CRITICAL(&s_mux);
+    for (int i = 0; i < WS_STREAM_MAX_CLIENTS && slot < 0; i++) {
+      if (s_cl[i].active && s_cl[i].fd == fd) slot = i;
+    }
+    for (int i = 0; i < WS_STREAM_MAX_CLIENTS && slot < 0; i++) {
+      if (!s_cl[i].active) slot = i;
+    }
+    if (slot >= 0) {
+      if (!s_cl[slot].active) s_st.clients++;
+      s_cl[slot] = (ws_client_t){
+        .active = true, .hd = req->handle, .fd = fd,
+        .interval_us = 1000000 / WS_STREAM_DEFAULT_FPS,
+      };
+    }
+    portEXIT_CRITICAL(&s_mux);
+    if (slot < 0) {
+      ESP_LOGW(TAG, "fd %d refused: %d clients already", fd, WS_STREAM_MAX_CLIENTS);
+      return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "client fd %d in slot %d", fd, slot);
+    xTaskNotifyGive(s_task);
+    return ESP_OK;
+  }
+
+  httpd_ws_frame_t f = { 0 };
+  if (httpd_ws_recv_frame(req, &f, 0) != ESP_OK) return ESP_FAIL;
+  if (f.type != HTTPD_WS_TYPE_TEXT || f.len == 0) return ESP_OK;
+  if (f.len > 127) return ESP_FAIL;
+
+  char msg[128];
+  f.payload = (uint8_t*)msg;
+  if (httpd_ws_recv_frame(req, &f, f.len) != ESP_OK) return ESP_FAIL;
+  msg[f.len] = 0;
+  handle_control(fd, msg);
+  return ESP_OK;
+}
+
+void ws_stream_get_stats(ws_stream_stats_t *out) {
+  portENTER_CRITICAL(&s_mux);
+  *out = s_st;
+  portEXIT_CRITICAL(&s_mux);
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_http_server.h"
+
+// WebSocket preview at /ws/stream: one binary message per JPEG frame, prefixed
+// by ws_frame_hdr_t (little-endian). Clients steer their own feed with text
+// messages on the same socket, e.g. {"pause":true}, {"fps":5}, {"quality":20}
+// (quality is stream-wide: the sensor encodes once for everyone).
+// A frame is skipped for a client whose previous send is still in flight,
+// so a slow client never stalls the producer or the other clients.
+//
+// The producer task is the only preview reader of the driver: the multipart
+// /stream handler takes its frames from here too (ws_stream_mjpeg_*), so the
+// two feeds share every frame instead of splitting them.
+#define WS_STREAM_MAX_CLIENTS  3
+#define WS_STREAM_DEFAULT_FPS  15
+#define WS_STREAM_MAX_FPS      30
+
+typedef struct __attribute__((packed)) {
+  uint8_t magic[2];     // "WF"
+  uint8_t version;      // 1
+  uint8_t quality;      // JPEG quality the frame was encoded with
+  uint32_t seq;         // producer frame counter; gaps = skipped frames
+  uint64_t t_us;        // driver capture timestamp
+  uint16_t width, height;
+  uint32_t len;         // JPEG bytes that follow
+} ws_frame_hdr_t;
+
+typedef struct {
+  uint32_t clients;
+  uint32_t sent, skipped, send_errors;
+  uint64_t bytes;
+} ws_stream_stats_t;
+
+// A held frame for a multipart client: JPEG bytes, valid until released
+typedef struct {
+  const uint8_t *jpeg;
+  size_t len;
+  void *buf;
+} ws_frame_ref_t;
+
+void ws_stream_init(void);
+// The producer runs every frame while at least one multipart client is open
+void ws_stream_mjpeg_open(void);
+void ws_stream_mjpeg_close(void);
+// Waits for a frame newer than *seq (0 = any) and updates it; false on timeout
+bool ws_stream_mjpeg_next(uint32_t *seq, TickType_t timeout, ws_frame_ref_t *out);
+void ws_stream_mjpeg_release(ws_frame_ref_t *f);
+esp_err_t ws_stream_handler(httpd_req_t *req);
+void ws_stream_get_stats(ws_stream_stats_t *out);
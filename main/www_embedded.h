@@ -0,0 +1,14 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Web UI files gzip'd into the firmware at build time (see main/CMakeLists.txt).
+// The table is generated from sdcard/www; data lives in flash (mmap'd rodata).
+typedef struct {
+  const char *name;         // relative to WWW_DIR, e.g. "index.html"
+  const uint8_t *gz_start;
+  const uint8_t *gz_end;
+} www_embedded_t;
+
+extern const www_embedded_t g_www_embedded[];
+extern const int g_www_embedded_count;
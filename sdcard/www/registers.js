@@ -53,3 +53,26 @@ async function writeRangeBoth(){
   });
   out(await r.text());
 }
+
+let watchSrc = null;
+function watchStop(){ if (watchSrc) { watchSrc.close(); watchSrc = null; } }
+function watchStart(){
+  watchStop();
+  const regs = document.getElementById("watchRegs").value.trim();
+  const hz = document.getElementById("watchHz").value.trim() || "10";
+  let names = [], vals = [], stats = "";
+  const render = () => out(names.map((n,i)=>`${n} = 0x${vals[i].toString(16).padStart(2,"0")}`).join("\n") + "\n\n" + stats);
+  watchSrc = new EventSource(`/api/registers/watch?regs=${encodeURIComponent(regs)}&hz=${hz}`);
+  watchSrc.addEventListener("snapshot", e => {
+    const m = JSON.parse(e.data);
+    names = m.regs.map(([b,a]) => `${b}:0x${a.toString(16)}`);
+    vals = m.v;
+    render();
+  });
+  watchSrc.addEventListener("delta", e => {
+    const d = JSON.parse(e.data).d;
+    for (let i = 0; i < d.length; i += 2) vals[d[i]] += d[i+1];
+    render();
+  });
+  watchSrc.addEventListener("stats", e => { stats = e.data; render(); });
+}
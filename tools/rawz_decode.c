@@ -0,0 +1,97 @@
+// Decodes a .rawz capture back to the raw bytes the camera produced, or to a
+// PPM/PGM image for rgb565 and gray captures.
+//
+//   cc -O2 -I main -o rawz_decode tools/rawz_decode.c main/rawz_core.c
+//   ./rawz_decode cap_00000042.rawz cap_00000042.rgb565
+//   ./rawz_decode -p cap_00000042.rawz cap_00000042.ppm
+#include "rawz_core.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *k_names[] = { "rgb565", "yuv422", "gray", "bayer8" };
+
+static int fail(const char *msg, const char *path) {
+  fprintf(stderr, "rawz_decode: %s%s%s\n", msg, path ? ": " : "", path ? path : "");
+  return 1;
+}
+
+static uint32_t rd32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int write_image(FILE *out, const rawz_hdr_t *h, const uint8_t *px) {
+  if (h->format == RAWZ_FMT_GRAY) {
+    fprintf(out, "P5\n%u %u\n255\n", h->width, h->height);
+    return fwrite(px, 1, h->raw_len, out) == h->raw_len ? 0 : -1;
+  }
+  fprintf(out, "P6\n%u %u\n255\n", h->width, h->height);
+  for (uint32_t i = 0; i < h->raw_len; i += 2) {
+    uint16_t v = (uint16_t)(px[i] << 8 | px[i + 1]);   // sensor order: big endian
+    uint8_t rgb[3] = {
+      (uint8_t)((v >> 11) * 255 / 31),
+      (uint8_t)(((v >> 5) & 0x3F) * 255 / 63),
+      (uint8_t)((v & 0x1F) * 255 / 31),
+    };
+    if (fwrite(rgb, 1, 3, out) != 3) return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int image = argc > 1 && !strcmp(argv[1], "-p");
+  if (argc != 3 + image) {
+    fprintf(stderr, "usage: rawz_decode [-p] in.rawz out\n"
+                    "  -p  write PPM (rgb565) or PGM (gray) instead of raw bytes\n");
+    return 2;
+  }
+  const char *in_path = argv[1 + image], *out_path = argv[2 + image];
+
+  FILE *in = fopen(in_path, "rb");
+  if (!in) return fail("cannot open", in_path);
+  fseek(in, 0, SEEK_END);
+  long size = ftell(in);
+  fseek(in, 0, SEEK_SET);
+  uint8_t *buf = malloc(size > 0 ? (size_t)size : 1);
+  if (!buf || fread(buf, 1, (size_t)size, in) != (size_t)size) return fail("read failed", in_path);
+  fclose(in);
+
+  rawz_hdr_t h;
+  if ((size_t)size < sizeof(h)) return fail("truncated header", in_path);
+  memcpy(&h, buf, sizeof(h));
+  if (memcmp(h.magic, RAWZ_MAGIC, 4) || h.version != RAWZ_VERSION) return fail("not a rawz v1 file", in_path);
+  if (image && (h.format == RAWZ_FMT_YUV422 || h.format == RAWZ_FMT_BAYER8))
+    return fail("-p supports rgb565 and gray only", NULL);
+
+  static rawz_state_t st;
+  if (!rawz_init(&st, h.format, h.width) || !h.block_rows ||
+      h.raw_len != (uint32_t)st.row_bytes * h.height) return fail("bad geometry", in_path);
+  uint8_t *px = malloc(h.raw_len);
+  if (!px) return fail("out of memory", NULL);
+
+  size_t off = sizeof(h);
+  for (uint32_t b = 0; b < h.blocks; b++) {
+    uint32_t y = b * h.block_rows;
+    int rows = y + h.block_rows <= h.height ? h.block_rows : (int)(h.height - y);
+    if (rows <= 0 || off + 4 > (size_t)size) return fail("truncated block table", in_path);
+    uint32_t len = rd32(buf + off);
+    off += 4;
+    if (len > (size_t)size - off) return fail("truncated block", in_path);
+    if (!rawz_decode(&st, buf + off, len, px + (size_t)y * st.row_bytes, rows)) {
+      fprintf(stderr, "rawz_decode: block %u (rows %u..) is corrupt\n", (unsigned)b, (unsigned)y);
+      return 1;
+    }
+    off += len;
+  }
+
+  FILE *out = fopen(out_path, "wb");
+  if (!out) return fail("cannot create", out_path);
+  int err = image ? write_image(out, &h, px) : (fwrite(px, 1, h.raw_len, out) == h.raw_len ? 0 : -1);
+  if (fclose(out) != 0 || err) return fail("write failed", out_path);
+
+  fprintf(stderr, "%s: %ux%u %s, %ld -> %u bytes (%.2fx)\n", in_path, h.width, h.height,
+          h.format < 4 ? k_names[h.format] : "?", size, (unsigned)h.raw_len, (double)h.raw_len / (double)size);
+  free(px);
+  free(buf);
+  return 0;
+}
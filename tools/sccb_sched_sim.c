@@ -0,0 +1,208 @@
+// Host test for the frame-aligned register scheduler (main/sccb_sched_core.c),
+// driven by a simulated frame clock instead of the camera.
+//
+//   cc -O2 -I main -o sccb_sched_sim tools/sccb_sched_sim.c main/sccb_sched_core.c
+//   ./sccb_sched_sim
+//
+// The simulated sensor stamps every register write with the frame it landed
+// in; a request within the budget is correct when all of its writes carry the
+// same stamp and the reported frame is the one after that boundary, a larger
+// one when each part's writes carry that part's reported frame.
+#include "sccb_sched_core.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BUDGET 32
+
+typedef struct {
+  uint32_t frame;           // frames completed so far
+  int fail_at;              // absolute write index that fails, -1 = none
+  int writes;
+  uint32_t stamp[2][256];   // frame + 1 in which each register was written, 0 = never
+  uint8_t regs[2][256];
+} sim_t;
+
+static int s_checks, s_failed;
+
+static void check(int cond, const char *what) {
+  s_checks++;
+  if (cond) return;
+  s_failed++;
+  fprintf(stderr, "FAIL: %s\n", what);
+}
+
+static int sim_write(const ov2640_reg_op_t *ops, int n, void *ctx) {
+  sim_t *s = (sim_t*)ctx;
+  for (int i = 0; i < n; i++, s->writes++) {
+    if (s->writes == s->fail_at) return i;
+    s->regs[ops[i].bank][ops[i].addr] = ops[i].val;
+    s->stamp[ops[i].bank][ops[i].addr] = s->frame + 1;
+  }
+  return n;
+}
+
+// One frame ends: the boundary where queued requests are committed
+static int sim_frame(sccb_sched_core_t *c, sim_t *s) {
+  s->frame++;
+  return sccb_core_commit(c, s->frame, sim_write, s);
+}
+
+static int make_ops(ov2640_reg_op_t *ops, int n, uint8_t val) {
+  for (int i = 0; i < n; i++) ops[i] = (ov2640_reg_op_t){ (uint8_t)(i / 256), (uint8_t)(i % 256), 0xFF, val };
+  return n;
+}
+
+static void sim_reset(sccb_sched_core_t *c, sim_t *s) {
+  sccb_core_init(c, BUDGET);
+  memset(s, 0, sizeof(*s));
+  s->fail_at = -1;
+}
+
+// Checks every write of ops[0..n) landed in the frame reported for its part
+static int parts_stamped(const sim_t *s, const sccb_result_t *r, int n) {
+  int ok = r->parts == (n + BUDGET - 1) / BUDGET;
+  for (int i = 0; i < n; i++) ok &= s->stamp[i / 256][i % 256] == r->part[i / BUDGET].frame;
+  return ok;
+}
+
+// A full 512-register preset is split over consecutive boundaries, one part each
+static void test_preset(void) {
+  sccb_sched_core_t c;
+  sim_t s;
+  sim_reset(&c, &s);
+  static ov2640_reg_op_t ops[SCCB_SCHED_MAX_REQ];
+  int n = make_ops(ops, SCCB_SCHED_MAX_REQ, 0x5A);
+  sim_frame(&c, &s);
+  uint32_t id = sccb_core_submit(&c, ops, n);
+  check(id != 0, "preset: submit");
+  check(sccb_core_pending(&c) == SCCB_SCHED_QUEUE, "preset: uses every queue part");
+  sccb_result_t r;
+  int budget_ok = 1;
+  for (int k = 0; k < SCCB_SCHED_MAX_PARTS; k++) {
+    check(!sccb_core_result(&c, id, NULL), "preset: not done before its last part");
+    int w0 = s.writes;
+    budget_ok &= sim_frame(&c, &s) == 1 && s.writes - w0 <= BUDGET;
+  }
+  check(budget_ok, "preset: one part, within the budget, per boundary");
+  check(sccb_core_pending(&c) == 0, "preset: queue drained");
+  check(sccb_core_result(&c, id, &r) && r.ok && r.written == n, "preset: all written");
+  check(r.part[0].frame == 3 && r.frame == 2 + SCCB_SCHED_MAX_PARTS, "preset: first and last frame");
+  int consecutive = 1;
+  for (int k = 1; k < r.parts; k++) consecutive &= r.part[k].frame == r.part[k - 1].frame + 1 && r.part[k].written == BUDGET;
+  check(consecutive, "preset: parts at consecutive frames");
+  check(parts_stamped(&s, &r, n), "preset: every register landed in its part's blanking interval");
+}
+
+// Requests with more parts than the queue holds are refused
+static void test_oversize(void) {
+  sccb_sched_core_t c;
+  sim_t s;
+  sim_reset(&c, &s);
+  static ov2640_reg_op_t ops[SCCB_SCHED_MAX_REQ + 1];
+  make_ops(ops, SCCB_SCHED_MAX_REQ + 1, 1);
+  check(sccb_core_submit(&c, ops, SCCB_SCHED_MAX_REQ + 1) == 0, "oversize: refused");
+  check(sccb_core_pending(&c) == 0, "oversize: nothing queued");
+  check(sccb_core_submit(&c, ops, 0) == 0, "oversize: empty refused");
+}
+
+// A request that needs more parts than are free waits; it never goes in partially
+static void test_queue_full(void) {
+  sccb_sched_core_t c;
+  sim_t s;
+  sim_reset(&c, &s);
+  static ov2640_reg_op_t ops[SCCB_SCHED_MAX_REQ];
+  make_ops(ops, SCCB_SCHED_MAX_REQ, 2);
+  int free_parts = 2;
+  uint32_t a = sccb_core_submit(&c, ops, BUDGET * (SCCB_SCHED_QUEUE - free_parts) - 1);
+  check(a != 0, "full: first request");
+  check(sccb_core_submit(&c, ops, BUDGET * free_parts + 1) == 0, "full: three parts do not fit in two");
+  check(sccb_core_pending(&c) == SCCB_SCHED_QUEUE - free_parts, "full: queue untouched by the refused request");
+  uint32_t b = sccb_core_submit(&c, ops, BUDGET + 1);
+  check(b != 0, "full: two parts fit");
+  // The last part of a (31 ops) leaves no room for b's first (32)
+  while (!sccb_core_result(&c, a, NULL)) sim_frame(&c, &s);
+  sccb_result_t ra, rb;
+  sccb_core_result(&c, a, &ra);
+  check(!sccb_core_result(&c, b, NULL), "full: b not started with a's last part");
+  sim_frame(&c, &s);
+  sim_frame(&c, &s);
+  check(sccb_core_result(&c, b, &rb) && rb.part[0].frame == ra.frame + 1 && rb.frame == ra.frame + 2,
+        "full: submission order kept");
+  check(parts_stamped(&s, &rb, BUDGET + 1), "full: b's parts stamped");
+}
+
+// Small requests share a boundary up to the budget
+static void test_budget(void) {
+  sccb_sched_core_t c;
+  sim_t s;
+  sim_reset(&c, &s);
+  ov2640_reg_op_t ops[20];
+  make_ops(ops, 20, 3);
+  uint32_t ids[3];
+  ids[0] = sccb_core_submit(&c, ops, 10);
+  ids[1] = sccb_core_submit(&c, ops, 20);
+  ids[2] = sccb_core_submit(&c, ops, 20);
+  check(sim_frame(&c, &s) == 2, "budget: 10 + 20 ops in one boundary");
+  check(sim_frame(&c, &s) == 1, "budget: third request at the next one");
+  sccb_result_t r[3];
+  for (int i = 0; i < 3; i++) sccb_core_result(&c, ids[i], &r[i]);
+  check(r[0].frame == 2 && r[1].frame == 2 && r[2].frame == 3, "budget: frames reported");
+  check(sim_frame(&c, &s) == 0, "budget: idle boundary commits nothing");
+  check(c.boundaries == 2, "budget: idle boundaries not counted");
+}
+
+// A failed write stops its request (written = leading ops) and the next one still goes
+static void test_failure(void) {
+  sccb_sched_core_t c;
+  sim_t s;
+  sim_reset(&c, &s);
+  static ov2640_reg_op_t ops[300];
+  make_ops(ops, 300, 4);
+  uint32_t a = sccb_core_submit(&c, ops, 300);
+  uint32_t b = sccb_core_submit(&c, ops, 5);
+  s.fail_at = 40;   // inside the second part of a
+  sim_frame(&c, &s);
+  check(!sccb_core_result(&c, a, NULL), "failure: not done while parts are queued");
+  sim_frame(&c, &s);
+  sccb_result_t r;
+  check(sccb_core_pending(&c) == 1, "failure: remaining parts dropped at the failing boundary");
+  s.fail_at = -1;
+  sim_frame(&c, &s);
+  check(sccb_core_result(&c, a, &r) && !r.ok && r.written == 40, "failure: written stops at the failed op");
+  check(r.part[1].written == 8, "failure: part reports its count");
+  check(s.writes == 40 + 5, "failure: rest of the request dropped, next one written");
+  check(s.stamp[1][44] == 0, "failure: later parts never written");
+  check(sccb_core_result(&c, b, &r) && r.ok && r.written == 5 && r.frame == 4, "failure: next request unaffected");
+  check(c.failed == 1 && c.committed == 1, "failure: counters");
+}
+
+// Requests keep arriving while the clock runs: each part lands at one boundary
+static void test_stream(void) {
+  sccb_sched_core_t c;
+  sim_t s;
+  sim_reset(&c, &s);
+  static ov2640_reg_op_t ops[256];
+  int sizes[] = { 1, 256, 7, 129, 33, 2, 200, 64 };
+  int ok = 1;
+  for (int k = 0; k < 8; k++) {
+    int n = make_ops(ops, sizes[k], (uint8_t)(0x10 + k));
+    uint32_t id;
+    while (!(id = sccb_core_submit(&c, ops, n))) sim_frame(&c, &s);
+    sccb_result_t r;
+    while (!sccb_core_result(&c, id, &r)) sim_frame(&c, &s);
+    for (int i = 0; i < n; i++) ok &= s.regs[i / 256][i % 256] == 0x10 + k;
+    ok &= r.ok && r.written == n && r.frame == s.frame + 1 && parts_stamped(&s, &r, n);
+  }
+  check(ok, "stream: every part landed whole at one boundary");
+}
+
+int main(void) {
+  test_preset();
+  test_oversize();
+  test_queue_full();
+  test_budget();
+  test_failure();
+  test_stream();
+  printf("%d/%d checks passed\n", s_checks - s_failed, s_checks);
+  return s_failed ? 1 : 0;
+}